@@ -0,0 +1,387 @@
+/**
+ * @file raytracer_bench.cpp
+ * @brief Microbenchmarks of the hot paths of the raytracer, and end-to-end renders of fixed scenes.
+ *
+ * Run with `--benchmark_format=json` (or `--benchmark_out=<file> --benchmark_out_format=json`) for machine-readable
+ * results. The end-to-end renders report the rays traced per second, in millions, as `Mrays/s` and the samples taken
+ * per pixel per second as `spp/s`. Every random choice comes from a fixed seed, so each iteration does the same work.
+ */
+
+#include "camera.hpp"
+#include "color.hpp"
+#include "integrator.hpp"
+#include "isa.hpp"
+#include "material.hpp"
+#include "math.hpp"
+#include "png.hpp"
+#include "random.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "scheduler.hpp"
+#include "shape.hpp"
+#include "simd.hpp"
+#include "world.hpp"
+
+#include <benchmark/benchmark.h>
+#include <fmt/format.h>
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace
+{
+    constexpr std::uint32_t seed = 1;
+
+    /// The precision policies that the end-to-end renders are compared in. Both trace in ::real, since the world is
+    /// built in it, and differ only in the precision that pixels are summed in.
+    using float_sums  = rt::precision_policy<real, float>;
+    using double_sums = rt::precision_policy<real, double>;
+
+    /// A fixed set of camera rays through the default scene, so every benchmark of a single hit sees the same mix of
+    /// hits and misses.
+    std::vector<rt::ray> make_camera_rays(const rt::scene &scene, std::uint32_t width, std::uint32_t height)
+    {
+        rt::camera::create_parameters parameters = scene.camera();
+        parameters.aspect_ratio = static_cast<real>(width) / static_cast<real>(height);
+        const rt::thin_lens_camera camera(parameters);
+
+        const std::unique_ptr<rt::sampler> sampler = rt::make_sampler(rt::sampler_type::random, seed);
+
+        std::vector<rt::ray> rays;
+        rays.reserve(static_cast<std::size_t>(width) * height);
+        for (std::uint32_t y = 0; y < height; ++y)
+        {
+            for (std::uint32_t x = 0; x < width; ++x)
+            {
+                const rt::sample_id id = { .x = x, .y = y, .index = 0, .count = 1 };
+                const real u = (static_cast<real>(x) + real(0.5)) / static_cast<real>(width);
+                const real v = (static_cast<real>(y) + real(0.5)) / static_cast<real>(height);
+                rays.push_back(camera.shoot_ray_at(u, v, sampler->sample(id, rt::dimension::lens)));
+            }
+        }
+
+        return rays;
+    }
+
+    const rt::scene &default_scene()
+    {
+        static const rt::scene scene(rt::default_scene());
+        return scene;
+    }
+
+    void bm_sphere_hit(benchmark::State &state)
+    {
+        const rt::sphere sphere(vec3(real(0.0), real(0.0), real(1.0)), real(0.5), 0);
+        const std::vector<rt::ray> rays = make_camera_rays(default_scene(), 64, 64);
+
+        std::size_t i = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(sphere.hit(rays[i], t_min, std::numeric_limits<real>::infinity()));
+            i = i + 1 == rays.size() ? 0 : i + 1;
+        }
+
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(bm_sphere_hit);
+
+    void bm_world_hit(benchmark::State &state)
+    {
+        const rt::world &world = default_scene().world();
+        const std::vector<rt::ray> rays = make_camera_rays(default_scene(), 64, 64);
+
+        std::size_t i = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(world.hit(rays[i], t_min, std::numeric_limits<real>::infinity()));
+            i = i + 1 == rays.size() ? 0 : i + 1;
+        }
+
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(bm_world_hit);
+
+    void bm_world_occluded(benchmark::State &state)
+    {
+        const rt::world &world = default_scene().world();
+        const std::vector<rt::ray> rays = make_camera_rays(default_scene(), 64, 64);
+
+        std::size_t i = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(world.occluded(rays[i], t_min, std::numeric_limits<real>::infinity()));
+            i = i + 1 == rays.size() ? 0 : i + 1;
+        }
+
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(bm_world_occluded);
+
+    template <typename Material>
+    Material make_material();
+
+    template <>
+    rt::lambertian make_material()
+    {
+        return rt::lambertian(vec3(real(0.5)));
+    }
+
+    template <>
+    rt::metal make_material()
+    {
+        return rt::metal(vec3(real(0.8), real(0.6), real(0.2)));
+    }
+
+    template <>
+    rt::dielectric make_material()
+    {
+        return rt::dielectric(real(1.52));
+    }
+
+    template <>
+    rt::emissive make_material()
+    {
+        return rt::emissive(vec3(real(4.0)));
+    }
+
+    template <typename Material>
+    void bm_scatter(benchmark::State &state)
+    {
+        const Material material = make_material<Material>();
+
+        // Rays from the camera of the default scene that hit its middle sphere, with the hits they make.
+        const rt::sphere sphere(vec3(real(0.0), real(0.0), real(1.0)), real(0.5), 0);
+        std::vector<rt::ray> rays;
+        std::vector<rt::hit> hits;
+        for (const rt::ray &ray : make_camera_rays(default_scene(), 64, 64))
+        {
+            if (const std::optional<rt::hit> hit = sphere.hit(ray, t_min, std::numeric_limits<real>::infinity()))
+            {
+                rays.push_back(ray);
+                hits.push_back(*hit);
+            }
+        }
+
+        if (hits.empty())
+        {
+            state.SkipWithError("no camera ray hits the sphere");
+            return;
+        }
+
+        const std::unique_ptr<rt::sampler> sampler = rt::make_sampler(rt::sampler_type::random, seed);
+        std::vector<rt::scatter_sample> samples;
+        samples.reserve(hits.size());
+        for (std::uint32_t index = 0; index < hits.size(); ++index)
+        {
+            const rt::sample_id id = { .x = 0, .y = 0, .index = index, .count = static_cast<std::uint32_t>(hits.size()) };
+            samples.push_back({
+                .direction = sampler->sample(id, rt::dimension::bounce),
+                .choice    = sampler->sample(id, rt::dimension::bounce + 1).x,
+            });
+        }
+
+        std::size_t i = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(material.scatter(rays[i], hits[i], samples[i]));
+            i = i + 1 == hits.size() ? 0 : i + 1;
+        }
+
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK_TEMPLATE(bm_scatter, rt::lambertian);
+    BENCHMARK_TEMPLATE(bm_scatter, rt::metal);
+    BENCHMARK_TEMPLATE(bm_scatter, rt::dielectric);
+    BENCHMARK_TEMPLATE(bm_scatter, rt::emissive);
+
+    void bm_random_unit_vector(benchmark::State &state)
+    {
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(random_unit_vector());
+        }
+
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(bm_random_unit_vector);
+
+    void bm_to_rgba(benchmark::State &state)
+    {
+        // A spread of colors, some outside [0, 1], so the clamps are not predicted perfectly.
+        std::array<vec3, 256> colors;
+        for (vec3 &color : colors)
+        {
+            color = random_vec3(real(-0.25), real(1.25));
+        }
+
+        std::size_t i = 0;
+        for (auto _ : state)
+        {
+            benchmark::DoNotOptimize(to_rgba(colors[i]));
+            i = (i + 1) % colors.size();
+        }
+
+        state.SetItemsProcessed(state.iterations());
+    }
+    BENCHMARK(bm_to_rgba);
+
+    /**
+     * @brief Encodes a noisy gradient, which compresses about as well as a rendered image.
+     * @param state The first argument is the side of the square image in pixels, and the second is the number of
+     *              threads that compress it, where 0 compresses it on the calling thread. The time is wall-clock time,
+     *              because the calling thread mostly waits on the pool.
+     */
+    void bm_png_write(benchmark::State &state)
+    {
+        const auto side = static_cast<std::uint32_t>(state.range(0));
+        const auto thread_count = static_cast<std::uint32_t>(state.range(1));
+
+        std::vector<std::uint8_t> raw_bytes;
+        raw_bytes.reserve(png::image::uncompressed_size(side, side));
+        for (std::uint32_t y = 0; y < side; ++y)
+        {
+            for (std::uint32_t x = 0; x < side; ++x)
+            {
+                const vec3 gradient(static_cast<real>(x) / static_cast<real>(side), static_cast<real>(y) / static_cast<real>(side), real(0.5));
+                const std::array rgba = to_rgba(gradient + random_vec3(real(-0.05), real(0.05)));
+                raw_bytes.insert(raw_bytes.end(), rgba.begin(), rgba.end());
+            }
+        }
+
+        const png::image image = {
+            .raw_bytes = raw_bytes,
+            .width     = side,
+            .height    = side,
+        };
+
+        std::optional<rt::thread_pool> pool;
+        if (thread_count > 0)
+        {
+            pool.emplace(thread_count);
+        }
+
+        for (auto _ : state)
+        {
+            std::ostringstream output;
+            image.write_to(output, pool ? &*pool : nullptr);
+            benchmark::DoNotOptimize(output.view().data());
+        }
+
+        state.SetBytesProcessed(state.iterations() * static_cast<std::int64_t>(raw_bytes.size()));
+    }
+    BENCHMARK(bm_png_write)->Args({ 512, 0 })->Args({ 512, 4 })->Unit(benchmark::kMillisecond)->UseRealTime();
+
+    /**
+     * @brief Renders a whole scene on the calling thread, with the integrator and sampler the program uses.
+     * @tparam Precision The rt::precision_policy of the integrator.
+     * @param state The first argument is the side of the square image in pixels, and the second is the number of
+     *              samples per pixel.
+     */
+    template <typename Precision>
+    void render(benchmark::State &state, const rt::scene &scene)
+    {
+        const auto side = static_cast<std::uint32_t>(state.range(0));
+        const auto sample_count = static_cast<std::uint32_t>(state.range(1));
+        const std::size_t pixel_count = static_cast<std::size_t>(side) * side;
+
+        rt::camera::create_parameters camera_parameters = scene.camera();
+        camera_parameters.aspect_ratio = real(1.0);
+        const rt::thin_lens_camera camera(camera_parameters);
+
+        const std::unique_ptr<rt::sampler> sampler = rt::make_sampler(rt::sampler_type::sobol, seed);
+        std::vector<typename Precision::accumulate_vec3> color_sums(pixel_count);
+
+        std::uint64_t ray_count = 0;
+        for (auto _ : state)
+        {
+            rt::basic_wavefront_integrator<Precision> integrator(scene.world(), scene.materials(), scene.lights(), *sampler, color_sums, {
+                .max_depth      = 50,
+                .roulette_depth = 3,
+                .tracing        = rt::trace_method::packet,
+            });
+
+            const real delta = real(1.0) / static_cast<real>(side);
+            for (std::uint32_t y = 0; y < side; ++y)
+            {
+                for (std::uint32_t x = 0; x < side; ++x)
+                {
+                    for (std::uint32_t index = 0; index < sample_count; ++index)
+                    {
+                        const rt::sample_id id = { .x = x, .y = y, .index = index, .count = sample_count };
+                        const vec2 offset = sampler->sample(id, rt::dimension::pixel);
+                        const real u = (static_cast<real>(x) + offset.x) * delta;
+                        const real v = (static_cast<real>(y) + offset.y) * delta;
+
+                        const rt::ray ray = camera.shoot_ray_at(u, v, sampler->sample(id, rt::dimension::lens));
+                        integrator.add(ray, y * side + x, real(1.0), id);
+                    }
+                }
+            }
+
+            integrator.flush();
+            ray_count += integrator.ray_count();
+        }
+
+        benchmark::DoNotOptimize(color_sums.data());
+
+        const auto iterations = static_cast<double>(state.iterations());
+        state.counters["Mrays/s"] = benchmark::Counter(static_cast<double>(ray_count) * 1.0e-6, benchmark::Counter::kIsRate);
+        state.counters["spp/s"] = benchmark::Counter(iterations * sample_count, benchmark::Counter::kIsRate);
+    }
+
+    template <typename Precision>
+    void bm_render_three_spheres(benchmark::State &state)
+    {
+        render<Precision>(state, default_scene());
+    }
+    BENCHMARK_TEMPLATE(bm_render_three_spheres, float_sums)->Args({ 64, 16 })->Unit(benchmark::kMillisecond);
+    BENCHMARK_TEMPLATE(bm_render_three_spheres, double_sums)->Args({ 64, 16 })->Unit(benchmark::kMillisecond);
+
+    template <typename Precision>
+    void bm_render_lamplit_spheres(benchmark::State &state)
+    {
+        static const rt::scene scene = rt::scene::load(RAYTRACER_SCENE_DIRECTORY "/lamplit_spheres.scene");
+        render<Precision>(state, scene);
+    }
+    BENCHMARK_TEMPLATE(bm_render_lamplit_spheres, float_sums)->Args({ 64, 16 })->Unit(benchmark::kMillisecond);
+    BENCHMARK_TEMPLATE(bm_render_lamplit_spheres, double_sums)->Args({ 64, 16 })->Unit(benchmark::kMillisecond);
+
+    template <typename Precision>
+    void bm_render_icosahedron_ring(benchmark::State &state)
+    {
+        static const rt::scene scene = rt::scene::load(RAYTRACER_SCENE_DIRECTORY "/icosahedron_ring.scene");
+        render<Precision>(state, scene);
+    }
+    BENCHMARK_TEMPLATE(bm_render_icosahedron_ring, float_sums)->Args({ 64, 16 })->Unit(benchmark::kMillisecond);
+    BENCHMARK_TEMPLATE(bm_render_icosahedron_ring, double_sums)->Args({ 64, 16 })->Unit(benchmark::kMillisecond);
+}
+
+int main(int argc, char **argv)
+{
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+    {
+        return 1;
+    }
+
+    // Loops marked RAYTRACER_DISPATCH run in the instruction set named here, and the intersection kernels in lanes
+    // of the width named here, so results are only comparable between builds and machines that report the same.
+    benchmark::AddCustomContext("isa", std::string(rt::isa_name(rt::dispatched_isa())));
+    benchmark::AddCustomContext("simd_lanes", std::to_string(rt::simd::lane_count));
+    benchmark::AddCustomContext(
+        "precision",
+        fmt::format("{}-bit tracing, {}-bit accumulation", sizeof(real) * 8, sizeof(accumulate_real) * 8)
+    );
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -0,0 +1,113 @@
+/**
+ * @file aabb.hpp
+ * @brief Axis-aligned bounding boxes.
+ */
+
+#ifndef RAYTRACER_AABB_HPP
+#define RAYTRACER_AABB_HPP
+
+#include "camera.hpp"
+#include "math.hpp"
+
+#include <glm/glm.hpp>
+
+#include <limits>
+
+namespace rt
+{
+    /**
+     * @brief An axis-aligned bounding box.
+     * @note A default-constructed box is empty: it contains no points, and merging anything into it yields that thing.
+     */
+    struct aabb
+    {
+        vec3 min = vec3(std::numeric_limits<real>::infinity());
+        vec3 max = vec3(-std::numeric_limits<real>::infinity());
+
+        /// Whether the box contains no points.
+        bool empty() const
+        {
+            return min.x > max.x || min.y > max.y || min.z > max.z;
+        }
+
+        vec3 extent() const
+        {
+            return max - min;
+        }
+
+        vec3 centroid() const
+        {
+            return real(0.5) * (min + max);
+        }
+
+        /// The surface area of the box, or 0 if the box is empty.
+        real surface_area() const
+        {
+            if (empty())
+            {
+                return real(0.0);
+            }
+
+            const vec3 e = extent();
+            return real(2.0) * (e.x * e.y + e.y * e.z + e.z * e.x);
+        }
+
+        /// The index of the axis along which the box is longest.
+        int longest_axis() const
+        {
+            const vec3 e = extent();
+            if (e.x > e.y && e.x > e.z)
+            {
+                return 0;
+            }
+
+            return e.y > e.z ? 1 : 2;
+        }
+
+        /// Grows the box to contain `point`.
+        void expand(vec3 point)
+        {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+
+        /// Grows the box to contain `other`.
+        void expand(const aabb &other)
+        {
+            min = glm::min(min, other.min);
+            max = glm::max(max, other.max);
+        }
+
+        /**
+         * @brief Tests a ray against the box using the slab method.
+         * @param[in] origin The origin of the ray.
+         * @param[in] inverse_direction The component-wise reciprocal of the ray's direction.
+         * @param[in] t_min The lower bound of the interval of interest.
+         * @param[in] t_max The upper bound of the interval of interest.
+         * @return Whether the ray overlaps the box anywhere in `[t_min, t_max]`.
+         */
+        [[nodiscard]]
+        bool hit(vec3 origin, vec3 inverse_direction, real t_min, real t_max) const
+        {
+            const vec3 t0 = (min - origin) * inverse_direction;
+            const vec3 t1 = (max - origin) * inverse_direction;
+
+            const vec3 t_near = glm::min(t0, t1);
+            const vec3 t_far = glm::max(t0, t1);
+
+            t_min = glm::max(t_min, glm::max(t_near.x, glm::max(t_near.y, t_near.z)));
+            t_max = glm::min(t_max, glm::min(t_far.x, glm::min(t_far.y, t_far.z)));
+
+            return t_min <= t_max;
+        }
+    };
+
+    /// Returns the smallest box containing both `a` and `b`.
+    inline rt::aabb merge(rt::aabb a, const rt::aabb &b)
+    {
+        a.expand(b);
+        return a;
+    }
+}
+
+#endif // !RAYTRACER_AABB_HPP
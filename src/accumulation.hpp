@@ -0,0 +1,421 @@
+/**
+ * @file accumulation.hpp
+ * @brief Accumulating samples across rendering passes, and saving them to resume later.
+ */
+
+#ifndef RAYTRACER_ACCUMULATION_HPP
+#define RAYTRACER_ACCUMULATION_HPP
+
+#include "math.hpp"
+#include "sampler.hpp"
+
+#include <fmt/format.h>
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <numeric>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief The settings that decide which samples each pixel takes, which a checkpoint must have been rendered with
+     *        for the render to be resumed from it.
+     *
+     * Samplers stratify over the number of samples a pixel takes in total, and draw every sample from the seed, so
+     * sums taken with other settings belong to a different sequence of samples. Merging them would either repeat
+     * samples already taken or mix sequences that are not stratified together, and both bias the result.
+     */
+    struct sample_settings
+    {
+        std::uint32_t    seed;
+        rt::sampler_type sampler;
+        std::uint32_t    sample_count;
+    };
+
+    /**
+     * @brief Per-pixel sums of every sample taken so far, from which the image can be estimated at any time.
+     *
+     * Alongside the sum of each pixel's radiance, it keeps the sum of the squares of its luminance, for estimating
+     * variance, and the number of samples taken. Both sums are kept in the accumulation precision of rt::precision.
+     *
+     * It can also keep auxiliary outputs (AOVs) of the first surface each sample hits: the sum of its albedo and of
+     * its normal, and the nearest distance to it. Denoisers use them to tell noise apart from detail.
+     */
+    class accumulation_buffer
+    {
+    public:
+        /**
+         * @param[in] has_aovs Whether to keep the auxiliary outputs as well as the color.
+         */
+        explicit accumulation_buffer(std::uint32_t width, std::uint32_t height, bool has_aovs = false)
+            : width_(width)
+            , height_(height)
+            , color_sums_(static_cast<std::size_t>(width) * height, accumulate_vec3(accumulate_real(0.0)))
+            , luminance_squares_(static_cast<std::size_t>(width) * height, accumulate_real(0.0))
+            , sample_counts_(static_cast<std::size_t>(width) * height, 0)
+        {
+            if (has_aovs)
+            {
+                albedo_sums_.assign(sample_counts_.size(), vec3(real(0.0)));
+                normal_sums_.assign(sample_counts_.size(), vec3(real(0.0)));
+                depths_.assign(sample_counts_.size(), std::numeric_limits<real>::infinity());
+            }
+        }
+
+        /**
+         * @brief Reads a buffer previously written by rt::accumulation_buffer::save.
+         * @param[in] settings The settings of the render that is to continue from the checkpoint.
+         * @throws std::runtime_error Thrown if the file cannot be read, is not a valid checkpoint, or was rendered
+         *                            with other settings.
+         */
+        static accumulation_buffer load(const std::string &filepath, const rt::sample_settings &settings)
+        {
+            std::ifstream input(filepath, std::ios::binary);
+            if (!input)
+            {
+                throw std::runtime_error(fmt::format("could not open checkpoint '{}'", filepath));
+            }
+
+            file_header header = { };
+            input.read(reinterpret_cast<char *>(&header), sizeof(header));
+            if (!input || header.magic != magic || header.version != version)
+            {
+                throw std::runtime_error(fmt::format("'{}' is not a checkpoint written by this version", filepath));
+            }
+
+            if (header.seed != settings.seed
+                || header.sampler != static_cast<std::uint32_t>(settings.sampler)
+                || header.sample_count != settings.sample_count)
+            {
+                throw std::runtime_error(fmt::format(
+                    "checkpoint '{}' was rendered with seed {}, the {} sampler and {} samples per pixel, but this render "
+                    "uses seed {}, the {} sampler and {} samples per pixel",
+                    filepath,
+                    header.seed,
+                    rt::sampler_name(static_cast<rt::sampler_type>(header.sampler)),
+                    header.sample_count,
+                    settings.seed,
+                    rt::sampler_name(settings.sampler),
+                    settings.sample_count
+                ));
+            }
+
+            // The header is checked against the size of the file before its dimensions are allocated for, so that a
+            // corrupt one fails here rather than exhausting memory.
+            const bool has_aovs = (header.flags & has_aovs_flag) != 0;
+            const std::uint64_t pixel_size = 4 * ((header.flags & double_sums_flag) != 0 ? sizeof(double) : sizeof(float))
+                + sizeof(std::uint32_t)
+                + (has_aovs ? 7 * sizeof(float) : 0);
+            const std::uint64_t header_pixel_count = std::uint64_t(header.width) * header.height;
+            std::error_code error;
+            const std::uintmax_t file_size = std::filesystem::file_size(filepath, error);
+            if (error
+                || header_pixel_count > (file_size - sizeof(header)) / pixel_size
+                || file_size != sizeof(header) + header_pixel_count * pixel_size)
+            {
+                throw std::runtime_error(fmt::format("checkpoint '{}' is truncated", filepath));
+            }
+
+            accumulation_buffer buffer(header.width, header.height, has_aovs);
+            const std::size_t pixel_count = buffer.sample_counts_.size();
+
+            if ((header.flags & double_sums_flag) != 0)
+            {
+                buffer.read_sums<double>(input);
+            }
+            else
+            {
+                buffer.read_sums<float>(input);
+            }
+
+            input.read(
+                reinterpret_cast<char *>(buffer.sample_counts_.data()),
+                static_cast<std::streamsize>(pixel_count * sizeof(std::uint32_t))
+            );
+
+            std::vector<float> aovs(buffer.has_aovs() ? pixel_count * 7 : 0);
+            input.read(reinterpret_cast<char *>(aovs.data()), static_cast<std::streamsize>(aovs.size() * sizeof(float)));
+            if (!input)
+            {
+                throw std::runtime_error(fmt::format("checkpoint '{}' is truncated", filepath));
+            }
+
+            const bool has_valid_counts = std::ranges::all_of(buffer.sample_counts_, [&](std::uint32_t count)
+            {
+                return count <= header.sample_count;
+            });
+            if (!has_valid_counts || buffer.samples_done() != header.samples_done)
+            {
+                throw std::runtime_error(fmt::format("checkpoint '{}' is corrupt", filepath));
+            }
+
+            for (std::size_t i = 0; i < aovs.size() / 7; ++i)
+            {
+                buffer.albedo_sums_[i] = vec3(aovs[i * 7 + 0], aovs[i * 7 + 1], aovs[i * 7 + 2]);
+                buffer.normal_sums_[i] = vec3(aovs[i * 7 + 3], aovs[i * 7 + 4], aovs[i * 7 + 5]);
+                buffer.depths_[i] = aovs[i * 7 + 6];
+            }
+
+            return buffer;
+        }
+
+        /**
+         * @brief Writes the buffer to a checkpoint file, replacing it atomically so that an interrupted write never
+         *        destroys the previous checkpoint.
+         * @param[in] settings The settings the samples were taken with, which a render must share to resume.
+         * @throws std::runtime_error Thrown if the file cannot be written.
+         */
+        void save(const std::string &filepath, const rt::sample_settings &settings) const
+        {
+            const std::size_t pixel_count = sample_counts_.size();
+
+            std::vector<float> aovs(has_aovs() ? pixel_count * 7 : 0);
+            for (std::size_t i = 0; i < aovs.size() / 7; ++i)
+            {
+                aovs[i * 7 + 0] = static_cast<float>(albedo_sums_[i].x);
+                aovs[i * 7 + 1] = static_cast<float>(albedo_sums_[i].y);
+                aovs[i * 7 + 2] = static_cast<float>(albedo_sums_[i].z);
+                aovs[i * 7 + 3] = static_cast<float>(normal_sums_[i].x);
+                aovs[i * 7 + 4] = static_cast<float>(normal_sums_[i].y);
+                aovs[i * 7 + 5] = static_cast<float>(normal_sums_[i].z);
+                aovs[i * 7 + 6] = static_cast<float>(depths_[i]);
+            }
+
+            std::uint32_t flags = has_aovs() ? has_aovs_flag : 0;
+            if constexpr (std::is_same_v<accumulate_real, double>)
+            {
+                flags |= double_sums_flag;
+            }
+
+            const file_header header = {
+                .magic        = magic,
+                .version      = version,
+                .width        = width_,
+                .height       = height_,
+                .flags        = flags,
+                .seed         = settings.seed,
+                .sampler      = static_cast<std::uint32_t>(settings.sampler),
+                .sample_count = settings.sample_count,
+                .samples_done = samples_done(),
+            };
+
+            const std::string temporary_filepath = filepath + ".tmp";
+            {
+                std::ofstream output(temporary_filepath, std::ios::binary | std::ios::trunc);
+                output.write(reinterpret_cast<const char *>(&header), sizeof(header));
+                write_sums<accumulate_real>(output);
+                output.write(
+                    reinterpret_cast<const char *>(sample_counts_.data()),
+                    static_cast<std::streamsize>(pixel_count * sizeof(std::uint32_t))
+                );
+                output.write(reinterpret_cast<const char *>(aovs.data()), static_cast<std::streamsize>(aovs.size() * sizeof(float)));
+                if (!output.flush())
+                {
+                    throw std::runtime_error(fmt::format("could not write checkpoint '{}'", temporary_filepath));
+                }
+            }
+
+            std::filesystem::rename(temporary_filepath, filepath);
+        }
+
+        std::uint32_t width() const
+        {
+            return width_;
+        }
+
+        std::uint32_t height() const
+        {
+            return height_;
+        }
+
+        /// Whether the buffer keeps the auxiliary outputs.
+        bool has_aovs() const
+        {
+            return !depths_.empty();
+        }
+
+        /// The sum of the radiance of every sample of each pixel, in row-major order.
+        std::span<accumulate_vec3> color_sums()
+        {
+            return color_sums_;
+        }
+
+        std::span<const accumulate_vec3> color_sums() const
+        {
+            return color_sums_;
+        }
+
+        /// The sum of the squared luminance of every sample of each pixel, in row-major order.
+        std::span<accumulate_real> luminance_squares()
+        {
+            return luminance_squares_;
+        }
+
+        std::span<const accumulate_real> luminance_squares() const
+        {
+            return luminance_squares_;
+        }
+
+        /// The number of samples taken in each pixel, in row-major order.
+        std::span<std::uint32_t> sample_counts()
+        {
+            return sample_counts_;
+        }
+
+        std::span<const std::uint32_t> sample_counts() const
+        {
+            return sample_counts_;
+        }
+
+        /// The sum of the albedo of the first surface hit by every sample of each pixel, in row-major order. Empty
+        /// unless the buffer keeps the auxiliary outputs.
+        std::span<vec3> albedo_sums()
+        {
+            return albedo_sums_;
+        }
+
+        /// The sum of the world-space normal of the first surface hit by every sample of each pixel, in row-major
+        /// order. Empty unless the buffer keeps the auxiliary outputs.
+        std::span<vec3> normal_sums()
+        {
+            return normal_sums_;
+        }
+
+        /// The distance from the camera to the nearest surface hit by any sample of each pixel, or infinity if none
+        /// hit anything, in row-major order. Empty unless the buffer keeps the auxiliary outputs.
+        std::span<real> depths()
+        {
+            return depths_;
+        }
+
+        std::span<const real> depths() const
+        {
+            return depths_;
+        }
+
+        /// The number of samples taken across every pixel.
+        std::uint64_t samples_done() const
+        {
+            return std::accumulate(sample_counts_.begin(), sample_counts_.end(), std::uint64_t(0));
+        }
+
+        /// The current estimate of a pixel's color.
+        vec3 mean(std::size_t pixel) const
+        {
+            if (sample_counts_[pixel] == 0)
+            {
+                return vec3(real(0.0));
+            }
+
+            return vec3(color_sums_[pixel] / static_cast<accumulate_real>(sample_counts_[pixel]));
+        }
+
+        /// The current estimate of the albedo of a pixel. The buffer must keep the auxiliary outputs.
+        vec3 mean_albedo(std::size_t pixel) const
+        {
+            if (sample_counts_[pixel] == 0)
+            {
+                return vec3(real(0.0));
+            }
+
+            return albedo_sums_[pixel] / static_cast<real>(sample_counts_[pixel]);
+        }
+
+        /// The average normal of a pixel, normalized, or zero if it has none. The buffer must keep the auxiliary
+        /// outputs.
+        vec3 mean_normal(std::size_t pixel) const
+        {
+            const vec3 sum = normal_sums_[pixel];
+            const real length = glm::length(sum);
+            return length > real(0.0) ? sum / length : vec3(real(0.0));
+        }
+
+    private:
+        /// Reads the color and luminance square sums of every pixel, stored as `Stored`.
+        template <typename Stored>
+        void read_sums(std::istream &input)
+        {
+            std::vector<Stored> values(sample_counts_.size() * 4);
+            input.read(reinterpret_cast<char *>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(Stored)));
+
+            for (std::size_t i = 0; i < sample_counts_.size(); ++i)
+            {
+                color_sums_[i] = accumulate_vec3(
+                    static_cast<accumulate_real>(values[i * 4 + 0]),
+                    static_cast<accumulate_real>(values[i * 4 + 1]),
+                    static_cast<accumulate_real>(values[i * 4 + 2])
+                );
+                luminance_squares_[i] = static_cast<accumulate_real>(values[i * 4 + 3]);
+            }
+        }
+
+        /// Writes the color and luminance square sums of every pixel as `Stored`.
+        template <typename Stored>
+        void write_sums(std::ostream &output) const
+        {
+            std::vector<Stored> values(sample_counts_.size() * 4);
+            for (std::size_t i = 0; i < sample_counts_.size(); ++i)
+            {
+                values[i * 4 + 0] = static_cast<Stored>(color_sums_[i].x);
+                values[i * 4 + 1] = static_cast<Stored>(color_sums_[i].y);
+                values[i * 4 + 2] = static_cast<Stored>(color_sums_[i].z);
+                values[i * 4 + 3] = static_cast<Stored>(luminance_squares_[i]);
+            }
+
+            output.write(reinterpret_cast<const char *>(values.data()), static_cast<std::streamsize>(values.size() * sizeof(Stored)));
+        }
+
+        /// The fixed-size start of a checkpoint file. Its pixel data follows, as 4 values (the color sum, then the
+        /// luminance square sum) per pixel, which are doubles if the double sums flag is set and floats otherwise,
+        /// then one 32-bit sample count per pixel, then, if the auxiliary outputs are kept, 7 floats (the albedo sum,
+        /// the normal sum, then the depth) per pixel, all in native byte order. Sums are stored in the accumulation
+        /// precision, so that resuming a long render loses nothing that continuing it would have kept.
+        struct file_header
+        {
+            std::array<char, 4> magic;
+            std::uint32_t       version;
+            std::uint32_t       width;
+            std::uint32_t       height;
+            std::uint32_t       flags;
+            /// The rt::sample_settings of the render.
+            std::uint32_t       seed;
+            std::uint32_t       sampler;
+            std::uint32_t       sample_count;
+            /// The sum of the sample counts of every pixel, which the counts that follow must agree with.
+            std::uint64_t       samples_done;
+        };
+
+        static_assert(sizeof(file_header) == 40, "the header must have no padding, so that every byte written is set");
+
+        static constexpr std::array<char, 4> magic = { 'R', 'T', 'C', 'K' };
+        /// Checkpoints before version 4 do not record their sample settings, so they cannot be resumed safely.
+        static constexpr std::uint32_t version = 4;
+        static constexpr std::uint32_t has_aovs_flag = 1;
+        static constexpr std::uint32_t double_sums_flag = 2;
+
+        std::uint32_t                width_;
+        std::uint32_t                height_;
+        std::vector<accumulate_vec3> color_sums_;
+        std::vector<accumulate_real> luminance_squares_;
+        std::vector<std::uint32_t>   sample_counts_;
+        std::vector<vec3>            albedo_sums_;
+        std::vector<vec3>            normal_sums_;
+        std::vector<real>            depths_;
+    };
+}
+
+#endif // !RAYTRACER_ACCUMULATION_HPP
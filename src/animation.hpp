@@ -0,0 +1,95 @@
+/**
+ * @file animation.hpp
+ * @brief Moving the camera along a path through keyframes, for rendering animations.
+ */
+
+#ifndef RAYTRACER_ANIMATION_HPP
+#define RAYTRACER_ANIMATION_HPP
+
+#include "camera.hpp"
+#include "math.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <type_traits>
+
+namespace rt
+{
+    /// The camera at one frame of an animation.
+    struct camera_keyframe
+    {
+        /// The frame that the camera is at, which need not be whole.
+        real                          frame;
+        /// The camera, apart from its aspect ratio, which is set by the image being rendered.
+        rt::camera::create_parameters camera;
+    };
+
+    static_assert(std::is_trivially_copyable_v<rt::camera_keyframe>);
+
+    /**
+     * @brief Finds the camera at any frame of an animation.
+     *
+     * Every setting moves along a Catmull-Rom spline through its values at the keyframes, so the camera passes through
+     * each keyframe without stopping, and a handful of keyframes around an object give a smooth orbit of it. Before
+     * the first keyframe and after the last, the camera holds still.
+     *
+     * @param[in] keyframes The keyframes, in order of increasing frame. There must be at least one.
+     */
+    [[nodiscard]]
+    inline rt::camera::create_parameters camera_at(std::span<const rt::camera_keyframe> keyframes, real frame)
+    {
+        const auto next = std::ranges::upper_bound(keyframes, frame, { }, &rt::camera_keyframe::frame);
+        if (next == keyframes.begin())
+        {
+            return keyframes.front().camera;
+        }
+
+        if (next == keyframes.end())
+        {
+            return keyframes.back().camera;
+        }
+
+        const auto i = static_cast<std::size_t>(next - keyframes.begin()) - 1;
+        const real t0 = keyframes[i].frame;
+        const real t1 = keyframes[i + 1].frame;
+        const real h = t1 - t0;
+        const real s = (frame - t0) / h;
+
+        // Cubic Hermite interpolation, with the slope at each keyframe running from the keyframe before it to the one
+        // after, or to its one neighbour at either end of the path. Slopes are per frame, so keyframes may be spaced
+        // unevenly.
+        const real h00 = (real(2.0) * s - real(3.0)) * s * s + real(1.0);
+        const real h10 = ((s - real(2.0)) * s + real(1.0)) * s;
+        const real h01 = (real(3.0) - real(2.0) * s) * s * s;
+        const real h11 = (s - real(1.0)) * s * s;
+
+        const auto interpolate = [&](auto rt::camera::create_parameters::*setting)
+        {
+            const auto slope_at = [&](std::size_t k)
+            {
+                const std::size_t before = k == 0 ? k : k - 1;
+                const std::size_t after = k + 1 == keyframes.size() ? k : k + 1;
+                const real span = keyframes[after].frame - keyframes[before].frame;
+                return (keyframes[after].camera.*setting - keyframes[before].camera.*setting) / span;
+            };
+
+            return h00 * keyframes[i].camera.*setting
+                + h10 * h * slope_at(i)
+                + h01 * keyframes[i + 1].camera.*setting
+                + h11 * h * slope_at(i + 1);
+        };
+
+        return {
+            .origin       = interpolate(&rt::camera::create_parameters::origin),
+            .target       = interpolate(&rt::camera::create_parameters::target),
+            .up           = interpolate(&rt::camera::create_parameters::up),
+            .vertical_fov = interpolate(&rt::camera::create_parameters::vertical_fov),
+            .aspect_ratio = keyframes[i].camera.aspect_ratio,
+            .aperture     = glm::max(interpolate(&rt::camera::create_parameters::aperture), real(0.0)),
+            .focal_length = interpolate(&rt::camera::create_parameters::focal_length),
+        };
+    }
+}
+
+#endif // !RAYTRACER_ANIMATION_HPP
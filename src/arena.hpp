@@ -0,0 +1,124 @@
+/**
+ * @file arena.hpp
+ * @brief Arenas that hand out memory by bumping a pointer and give it all back at once.
+ */
+
+#ifndef RAYTRACER_ARENA_HPP
+#define RAYTRACER_ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+
+namespace rt
+{
+    /**
+     * @brief A monotonic arena for memory that is used for a short while and then dropped all at once, such as the
+     *        path state of the tile being rendered.
+     *
+     * Allocations are bumped out of a single block, and deallocating does nothing. reset() drops every allocation.
+     * If they outgrew the block since the last reset, the block grows to fit them, so once a thread has rendered a
+     * few tiles, its scratch memory never touches the heap again.
+     *
+     * An arena is not thread-safe, so each thread keeps its own.
+     */
+    class scratch_arena
+    {
+    public:
+        /// The size of the block that an arena starts with.
+        static constexpr std::size_t default_size = std::size_t(1) << 20;
+
+        explicit scratch_arena(std::size_t initial_size = default_size)
+            : block_size_(initial_size)
+            , block_(std::make_unique_for_overwrite<std::byte[]>(initial_size))
+        {
+            resource_.emplace(block_.get(), block_size_, &overflow_);
+        }
+
+        // The resource points into the arena's own block.
+        scratch_arena(const scratch_arena &) = delete;
+        scratch_arena &operator=(const scratch_arena &) = delete;
+
+        /// The memory resource to allocate from, which is valid until the arena is destroyed.
+        [[nodiscard]]
+        std::pmr::memory_resource *resource()
+        {
+            return &*resource_;
+        }
+
+        /**
+         * @brief Drops every allocation made since the last reset.
+         * @note Nothing allocated from the arena may be used afterwards.
+         */
+        void reset()
+        {
+            if (overflow_.allocated() == 0)
+            {
+                resource_->release();
+                return;
+            }
+
+            // The block will be freed, so the resource that borrows it must go first.
+            block_size_ += overflow_.allocated();
+            resource_.reset();
+            overflow_.clear();
+            block_ = std::make_unique_for_overwrite<std::byte[]>(block_size_);
+            resource_.emplace(block_.get(), block_size_, &overflow_);
+        }
+
+        /// The size of the current block in bytes.
+        [[nodiscard]]
+        std::size_t capacity() const
+        {
+            return block_size_;
+        }
+
+    private:
+        /// The heap, for the allocations that do not fit in the block, counting how many bytes they took.
+        class overflow_resource : public std::pmr::memory_resource
+        {
+        public:
+            [[nodiscard]]
+            std::size_t allocated() const
+            {
+                return allocated_;
+            }
+
+            void clear()
+            {
+                allocated_ = 0;
+            }
+
+        private:
+            void *do_allocate(std::size_t bytes, std::size_t alignment) override
+            {
+                void *memory = std::pmr::new_delete_resource()->allocate(bytes, alignment);
+                allocated_ += bytes;
+                return memory;
+            }
+
+            void do_deallocate(void *memory, std::size_t bytes, std::size_t alignment) override
+            {
+                std::pmr::new_delete_resource()->deallocate(memory, bytes, alignment);
+            }
+
+            [[nodiscard]]
+            bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+            {
+                return this == &other;
+            }
+
+        private:
+            std::size_t allocated_ = 0;
+        };
+
+    private:
+        std::size_t                                        block_size_;
+        std::unique_ptr<std::byte[]>                       block_;
+        overflow_resource                                  overflow_;
+        std::optional<std::pmr::monotonic_buffer_resource> resource_;
+    };
+}
+
+#endif // !RAYTRACER_ARENA_HPP
@@ -0,0 +1,525 @@
+/**
+ * @file bvh.hpp
+ * @brief Building and traversing bounding volume hierarchies.
+ */
+
+#ifndef RAYTRACER_BVH_HPP
+#define RAYTRACER_BVH_HPP
+
+#include "aabb.hpp"
+#include "camera.hpp"
+#include "math.hpp"
+#include "packet.hpp"
+#include "shape.hpp"
+#include "simd.hpp"
+#include "stats.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief A node of a flattened rt::bvh.
+     *
+     * Nodes are stored in depth-first order, so the first child of an interior node always immediately follows it.
+     */
+    struct bvh_node
+    {
+        /// The bounds of every object below the node.
+        rt::aabb      bounds;
+        /// For a leaf, the index of its first object. For an interior node, the index of its second child.
+        std::uint32_t index;
+        /// The number of objects in a leaf, or 0 for an interior node.
+        std::uint16_t count;
+        /// The axis that an interior node was split along.
+        std::uint16_t axis;
+
+        bool is_leaf() const
+        {
+            return count != 0;
+        }
+    };
+
+    /**
+     * @brief Builds flattened bounding volume hierarchies with binned SAH (surface area heuristic) splits.
+     */
+    class bvh_builder
+    {
+    public:
+        /// The largest number of primitives in a single leaf.
+        static constexpr std::size_t max_leaf_size = 4;
+        /// The number of bins along each axis when evaluating split candidates.
+        static constexpr std::size_t bin_count = 16;
+        /// The cost of visiting an interior node, relative to the cost of testing one primitive.
+        static constexpr real traversal_cost = real(1.0);
+        /// The deepest tree that can be built, and traversed.
+        static constexpr std::size_t max_depth = 64;
+
+        struct result
+        {
+            /// The nodes of the hierarchy, root first.
+            std::vector<rt::bvh_node>  nodes;
+            /// The index of the primitive at each position that the leaves refer to. Primitives should be reordered
+            /// to match, so that every leaf covers a contiguous range.
+            std::vector<std::uint32_t> order;
+        };
+
+        /**
+         * @brief Builds a hierarchy over primitives with the given bounds.
+         * @return The hierarchy, which has no nodes if there are no primitives.
+         */
+        static result build(std::span<const rt::aabb> bounds)
+        {
+            result built;
+            if (bounds.empty())
+            {
+                return built;
+            }
+
+            std::vector<build_entry> entries;
+            entries.reserve(bounds.size());
+            for (std::uint32_t i = 0; i < bounds.size(); ++i)
+            {
+                entries.push_back({ .bounds = bounds[i], .centroid = bounds[i].centroid(), .index = i });
+            }
+
+            built.nodes.reserve(2 * bounds.size() - 1);
+            build(built.nodes, entries, 0, 0);
+
+            built.order.reserve(entries.size());
+            for (const build_entry &entry : entries)
+            {
+                built.order.push_back(entry.index);
+            }
+
+            return built;
+        }
+
+    private:
+        struct build_entry
+        {
+            rt::aabb      bounds;
+            vec3          centroid;
+            std::uint32_t index;
+        };
+
+        struct bin
+        {
+            rt::aabb    bounds;
+            std::size_t count = 0;
+        };
+
+        struct split
+        {
+            int         axis;
+            std::size_t bin;
+            real        cost;
+        };
+
+        static void build(std::vector<rt::bvh_node> &nodes, std::span<build_entry> entries, std::size_t first, std::size_t depth)
+        {
+            rt::aabb bounds;
+            rt::aabb centroid_bounds;
+            for (const build_entry &entry : entries)
+            {
+                bounds.expand(entry.bounds);
+                centroid_bounds.expand(entry.centroid);
+            }
+
+            const std::size_t node_index = nodes.size();
+            nodes.push_back({ .bounds = bounds, .index = 0, .count = 0, .axis = 0 });
+
+            if (entries.size() <= max_leaf_size)
+            {
+                nodes[node_index].index = static_cast<std::uint32_t>(first);
+                nodes[node_index].count = static_cast<std::uint16_t>(entries.size());
+                return;
+            }
+
+            // Past half the stack depth, only median splits are used, which bounds the depth of what remains.
+            const std::optional best = depth < max_depth / 2 ? find_split(entries, bounds, centroid_bounds) : std::nullopt;
+            const real leaf_cost = static_cast<real>(entries.size());
+
+            std::size_t middle = 0;
+            int axis = centroid_bounds.longest_axis();
+            if (best && best->cost < leaf_cost)
+            {
+                axis = best->axis;
+                const real axis_min = centroid_bounds.min[axis];
+                const real scale = static_cast<real>(bin_count) / centroid_bounds.extent()[axis];
+                const auto is_left = [&](const build_entry &entry)
+                {
+                    return bin_index(entry.centroid[axis], axis_min, scale) <= best->bin;
+                };
+                middle = static_cast<std::size_t>(std::ranges::partition(entries, is_left).begin() - entries.begin());
+            }
+
+            // Fall back to an object median split when SAH cannot separate the primitives, so that leaves stay small.
+            if (middle == 0 || middle == entries.size())
+            {
+                middle = entries.size() / 2;
+                std::ranges::nth_element(entries, entries.begin() + static_cast<std::ptrdiff_t>(middle), { }, [axis](const build_entry &entry)
+                {
+                    return entry.centroid[axis];
+                });
+            }
+
+            nodes[node_index].axis = static_cast<std::uint16_t>(axis);
+            build(nodes, entries.first(middle), first, depth + 1);
+            nodes[node_index].index = static_cast<std::uint32_t>(nodes.size());
+            build(nodes, entries.subspan(middle), first + middle, depth + 1);
+        }
+
+        static std::optional<split> find_split(std::span<const build_entry> entries, const rt::aabb &bounds, const rt::aabb &centroid_bounds)
+        {
+            std::optional<split> best;
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                const real extent = centroid_bounds.extent()[axis];
+                if (extent <= real(0.0))
+                {
+                    continue;
+                }
+
+                const real axis_min = centroid_bounds.min[axis];
+                const real scale = static_cast<real>(bin_count) / extent;
+
+                std::array<bin, bin_count> bins;
+                for (const build_entry &entry : entries)
+                {
+                    bin &b = bins[bin_index(entry.centroid[axis], axis_min, scale)];
+                    b.bounds.expand(entry.bounds);
+                    ++b.count;
+                }
+
+                // Sweep from the right to find the cost of everything after each boundary.
+                std::array<real, bin_count - 1> right_cost;
+                rt::aabb right_bounds;
+                std::size_t right_count = 0;
+                for (std::size_t i = bin_count - 1; i > 0; --i)
+                {
+                    right_bounds.expand(bins[i].bounds);
+                    right_count += bins[i].count;
+                    right_cost[i - 1] = right_bounds.surface_area() * static_cast<real>(right_count);
+                }
+
+                rt::aabb left_bounds;
+                std::size_t left_count = 0;
+                for (std::size_t i = 0; i < bin_count - 1; ++i)
+                {
+                    left_bounds.expand(bins[i].bounds);
+                    left_count += bins[i].count;
+                    if (left_count == 0 || left_count == entries.size())
+                    {
+                        continue;
+                    }
+
+                    const real cost = traversal_cost
+                        + (left_bounds.surface_area() * static_cast<real>(left_count) + right_cost[i]) / bounds.surface_area();
+                    if (!best || cost < best->cost)
+                    {
+                        best = split { .axis = axis, .bin = i, .cost = cost };
+                    }
+                }
+            }
+
+            return best;
+        }
+
+        static std::size_t bin_index(real centroid, real axis_min, real scale)
+        {
+            const auto index = static_cast<std::size_t>((centroid - axis_min) * scale);
+            return std::min(index, bin_count - 1);
+        }
+    };
+
+    /**
+     * @brief Visits every leaf of a flattened hierarchy whose bounds a ray enters, nearer children first.
+     * @param[in] nodes The hierarchy, no deeper than rt::bvh_builder::max_depth.
+     * @param[in,out] t_max The upper bound of the interval of interest. Leaves beyond it are skipped, so lowering it
+     *                      whenever a nearer hit is found prunes the rest of the traversal.
+     * @param[in] visit_leaf Called with the first index and the number of primitives of each leaf, and `t_max`. If it
+     *                       returns a bool, returning true ends the traversal at once, as when any hit will do.
+     */
+    template<typename Visitor>
+    void traverse_bvh(std::span<const rt::bvh_node> nodes, const rt::ray &ray, real t_min, real &t_max, Visitor &&visit_leaf)
+    {
+        if (nodes.empty())
+        {
+            return;
+        }
+
+        const vec3 origin = ray.origin();
+        const vec3 inverse_direction = real(1.0) / ray.direction();
+        const std::array<bool, 3> is_negative = {
+            inverse_direction.x < real(0.0),
+            inverse_direction.y < real(0.0),
+            inverse_direction.z < real(0.0),
+        };
+
+        std::array<std::uint32_t, rt::bvh_builder::max_depth> stack;
+        std::size_t stack_size = 0;
+        std::uint32_t current = 0;
+        while (true)
+        {
+            const rt::bvh_node &node = nodes[current];
+            rt::stats::add(&rt::stats::counters::node_tests);
+            if (node.bounds.hit(origin, inverse_direction, t_min, t_max))
+            {
+                if (node.is_leaf())
+                {
+                    rt::stats::add(&rt::stats::counters::primitive_tests, node.count);
+                    if constexpr (std::is_void_v<std::invoke_result_t<Visitor &, std::uint32_t, std::uint32_t, real &>>)
+                    {
+                        visit_leaf(node.index, node.count, t_max);
+                    }
+                    else if (visit_leaf(node.index, node.count, t_max))
+                    {
+                        return;
+                    }
+                }
+                else
+                {
+                    // Visit the child nearer to the ray origin first so that t_max shrinks as early as possible.
+                    const std::uint32_t first = current + 1;
+                    const std::uint32_t second = node.index;
+                    if (is_negative[node.axis])
+                    {
+                        stack[stack_size++] = first;
+                        current = second;
+                    }
+                    else
+                    {
+                        stack[stack_size++] = second;
+                        current = first;
+                    }
+
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                break;
+            }
+
+            current = stack[--stack_size];
+        }
+    }
+
+    /**
+     * @brief Visits every leaf of a flattened hierarchy whose bounds any ray of a packet enters.
+     * @param[in] nodes The hierarchy, no deeper than rt::bvh_builder::max_depth.
+     * @param[in] hits The nearest hits found so far. Leaves beyond the `t_max` of every ray are skipped.
+     * @param[in] visit_leaf Called with the first index and the number of primitives of each leaf.
+     */
+    template<typename Visitor>
+    void traverse_bvh_packet(
+        std::span<const rt::bvh_node> nodes,
+        const rt::ray_packet &packet,
+        real t_min,
+        const rt::packet_hits &hits,
+        Visitor &&visit_leaf
+    )
+    {
+        if (nodes.empty() || packet.count == 0)
+        {
+            return;
+        }
+
+        std::array<real, rt::packet_size> inverse_x;
+        std::array<real, rt::packet_size> inverse_y;
+        std::array<real, rt::packet_size> inverse_z;
+        for (std::size_t i = 0; i < rt::packet_size; ++i)
+        {
+            inverse_x[i] = real(1.0) / packet.direction_x[i];
+            inverse_y[i] = real(1.0) / packet.direction_y[i];
+            inverse_z[i] = real(1.0) / packet.direction_z[i];
+        }
+
+        // The rays of a packet are coherent, so the first ray decides the traversal order for all of them.
+        const std::array<bool, 3> is_negative = {
+            inverse_x[0] < real(0.0),
+            inverse_y[0] < real(0.0),
+            inverse_z[0] < real(0.0),
+        };
+
+        const auto any_ray_hits = [&](const rt::aabb &bounds)
+        {
+            using simd::real_lanes;
+            using std::max;
+            using std::min;
+
+            for (std::size_t first = 0; first < rt::packet_size; first += simd::lane_count)
+            {
+                const real_lanes x0 = (real_lanes(bounds.min.x) - simd::load(&packet.origin_x[first])) * simd::load(&inverse_x[first]);
+                const real_lanes x1 = (real_lanes(bounds.max.x) - simd::load(&packet.origin_x[first])) * simd::load(&inverse_x[first]);
+                const real_lanes y0 = (real_lanes(bounds.min.y) - simd::load(&packet.origin_y[first])) * simd::load(&inverse_y[first]);
+                const real_lanes y1 = (real_lanes(bounds.max.y) - simd::load(&packet.origin_y[first])) * simd::load(&inverse_y[first]);
+                const real_lanes z0 = (real_lanes(bounds.min.z) - simd::load(&packet.origin_z[first])) * simd::load(&inverse_z[first]);
+                const real_lanes z1 = (real_lanes(bounds.max.z) - simd::load(&packet.origin_z[first])) * simd::load(&inverse_z[first]);
+
+                const real_lanes enter = max(max(real_lanes(t_min), min(x0, x1)), max(min(y0, y1), min(z0, z1)));
+                const real_lanes exit = min(min(simd::load(&hits.t_max[first]), max(x0, x1)), min(max(y0, y1), max(z0, z1)));
+                if (simd::any_of(enter <= exit))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        };
+
+        std::array<std::uint32_t, rt::bvh_builder::max_depth> stack;
+        std::size_t stack_size = 0;
+        std::uint32_t current = 0;
+        while (true)
+        {
+            const rt::bvh_node &node = nodes[current];
+            rt::stats::add(&rt::stats::counters::node_tests);
+            if (any_ray_hits(node.bounds))
+            {
+                if (node.is_leaf())
+                {
+                    rt::stats::add(&rt::stats::counters::primitive_tests, std::uint64_t(node.count) * packet.count);
+                    visit_leaf(node.index, node.count);
+                }
+                else
+                {
+                    const std::uint32_t first = current + 1;
+                    const std::uint32_t second = node.index;
+                    if (is_negative[node.axis])
+                    {
+                        stack[stack_size++] = first;
+                        current = second;
+                    }
+                    else
+                    {
+                        stack[stack_size++] = second;
+                        current = first;
+                    }
+
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                break;
+            }
+
+            current = stack[--stack_size];
+        }
+    }
+
+    /**
+     * @brief A bounding volume hierarchy over arbitrary hittable objects.
+     */
+    class bvh : public hittable
+    {
+    public:
+        /**
+         * @param[in] objects The objects to build the hierarchy over.
+         * @param[in] memory The memory that the hierarchy is allocated from, which must outlive it.
+         */
+        explicit bvh(
+            std::vector<std::unique_ptr<hittable>> objects,
+            std::pmr::memory_resource *memory = std::pmr::get_default_resource()
+        )
+            : nodes_(memory)
+        {
+            std::vector<rt::aabb> bounds;
+            bounds.reserve(objects.size());
+            for (const std::unique_ptr<hittable> &object : objects)
+            {
+                bounds.push_back(object->bounding_box());
+            }
+
+            const rt::bvh_builder::result built = rt::bvh_builder::build(bounds);
+            nodes_.assign(built.nodes.begin(), built.nodes.end());
+
+            objects_.reserve(objects.size());
+            for (const std::uint32_t index : built.order)
+            {
+                objects_.push_back(std::move(objects[index]));
+            }
+        }
+
+        [[nodiscard]]
+        std::optional<rt::hit_record> intersect(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            std::optional<rt::hit_record> nearest;
+            rt::traverse_bvh(nodes_, ray, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, real &t_nearest)
+            {
+                for (std::uint32_t i = first; i < first + count; ++i)
+                {
+                    if (const std::optional record = objects_[i]->intersect(ray, t_min, t_nearest))
+                    {
+                        nearest = record;
+                        t_nearest = record->t;
+                    }
+                }
+            });
+
+            return nearest;
+        }
+
+        void intersect_packet(const rt::ray_packet &packet, real t_min, rt::packet_hits &hits) const override
+        {
+            rt::traverse_bvh_packet(nodes_, packet, t_min, hits, [&](std::uint32_t first, std::uint32_t count)
+            {
+                for (std::uint32_t i = first; i < first + count; ++i)
+                {
+                    objects_[i]->intersect_packet(packet, t_min, hits);
+                }
+            });
+        }
+
+        [[nodiscard]]
+        bool occluded(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            bool is_occluded = false;
+            rt::traverse_bvh(nodes_, ray, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, real &t_nearest)
+            {
+                for (std::uint32_t i = first; i < first + count && !is_occluded; ++i)
+                {
+                    is_occluded = objects_[i]->occluded(ray, t_min, t_nearest);
+                }
+
+                return is_occluded;
+            });
+
+            return is_occluded;
+        }
+
+        [[nodiscard]]
+        rt::aabb bounding_box() const override
+        {
+            return nodes_.empty() ? rt::aabb() : nodes_.front().bounds;
+        }
+
+        /// The flattened nodes of the hierarchy, root first.
+        std::span<const rt::bvh_node> nodes() const
+        {
+            return nodes_;
+        }
+
+    private:
+        std::vector<std::unique_ptr<hittable>> objects_;
+        std::pmr::vector<rt::bvh_node>         nodes_;
+    };
+}
+
+#endif // !RAYTRACER_BVH_HPP
@@ -2,7 +2,7 @@
 #define RAYTRACER_CAMERA_HPP
 
 #include "math.hpp"
-#include "random.hpp"
+#include "sampler.hpp"
 
 #include <glm/glm.hpp>
 
@@ -49,10 +49,17 @@ namespace rt
             real aspect_ratio;
             real aperture;
             real focal_length;
+
+            bool operator==(const create_parameters &) const = default;
         };
 
+        /**
+         * @param[in] u The horizontal position on the viewport, from 0 at the left edge to 1 at the right.
+         * @param[in] v The vertical position on the viewport, from 0 at the top edge to 1 at the bottom.
+         * @param[in] lens_sample A point in @f$[0, 1)^2@f$ selecting where on the lens the ray starts.
+         */
         [[nodiscard]]
-        virtual rt::ray shoot_ray_at(real u, real v) const = 0;
+        virtual rt::ray shoot_ray_at(real u, real v, vec2 lens_sample) const = 0;
         virtual ~camera() = default;
     };
 
@@ -76,7 +83,7 @@ namespace rt
         }
 
         [[nodiscard]]
-        rt::ray shoot_ray_at(real u, real v) const override
+        rt::ray shoot_ray_at(real u, real v, [[maybe_unused]] vec2 lens_sample) const override
         {
             const vec3 target = top_left_ + u * horizontal_ + v * vertical_;
             const vec3 direction = target - origin_;
@@ -112,11 +119,11 @@ namespace rt
         }
 
         [[nodiscard]]
-        rt::ray shoot_ray_at(real u, real v) const override
+        rt::ray shoot_ray_at(real u, real v, vec2 lens_sample) const override
         {
             const vec3 target = top_left_ + u * horizontal_ + v * vertical_;
 
-            const vec3 lens_point = lens_radius_ * random_in_unit_disk();
+            const vec3 lens_point = lens_radius_ * sample_disk(lens_sample);
             const vec3 offset = u_ * lens_point.x + v_ * lens_point.y;
 
             const vec3 origin = origin_ + offset;
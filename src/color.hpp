@@ -6,6 +6,8 @@
 #ifndef RAYTRACER_COLOR_HPP
 #define RAYTRACER_COLOR_HPP
 
+#include "math.hpp"
+
 #include <glm/glm.hpp>
 
 #include <array>
@@ -14,6 +16,12 @@
 
 constexpr real color_max = real(256.0) - std::numeric_limits<real>::epsilon() * real(128.0);
 
+/// The relative luminance of a linear color, using the Rec. 709 primaries.
+inline real luminance(vec3 color)
+{
+    return glm::dot(color, vec3(real(0.2126), real(0.7152), real(0.0722)));
+}
+
 inline std::array<std::uint8_t, 4> to_rgba(vec3 color)
 {
     const real r_real = glm::clamp(color.x, real(0.0), real(1.0));
@@ -0,0 +1,276 @@
+/**
+ * @file denoise.hpp
+ * @brief Removing the noise of a render with a filter guided by its auxiliary outputs.
+ */
+
+#ifndef RAYTRACER_DENOISE_HPP
+#define RAYTRACER_DENOISE_HPP
+
+#include "accumulation.hpp"
+#include "framebuffer.hpp"
+#include "math.hpp"
+#include "scheduler.hpp"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief How strongly rt::denoise smooths, and which differences between pixels it treats as edges to keep.
+     */
+    struct denoise_parameters
+    {
+        /// The number of passes of the filter. Each reaches twice as far as the last, so 3 passes blend pixels up to
+        /// 14 pixels apart. More passes smooth low-frequency noise further, at the cost of blurring soft shadows.
+        std::uint32_t passes = 3;
+        /// The number of standard deviations of their noise by which two pixels may differ in luminance and still be
+        /// blended, so that noise is smoothed but edges in lighting that noise cannot explain are kept.
+        float         luminance_sigma = 4.0F;
+        /// The exponent of the cosine between the normals of two pixels, which keeps creases and silhouettes sharp.
+        float         normal_power = 128.0F;
+        /// The difference in albedo over which the weight of a pixel falls by a factor of e.
+        float         albedo_sigma = 0.1F;
+        /// The difference in depth, as a multiple of the change in depth expected across that distance on the
+        /// surface, over which the weight of a pixel falls by a factor of e.
+        float         depth_sigma = 1.0F;
+    };
+
+    namespace detail
+    {
+        /// The weights of the B3 spline, which every pass of the filter spreads over a grid of 5x5 pixels.
+        inline constexpr std::array<float, 5> atrous_kernel = { 1.0F / 16.0F, 1.0F / 4.0F, 3.0F / 8.0F, 1.0F / 4.0F, 1.0F / 16.0F };
+
+        inline float luminance(glm::vec3 color)
+        {
+            return glm::dot(color, glm::vec3(0.2126F, 0.7152F, 0.0722F));
+        }
+    }
+
+    /**
+     * @brief Removes noise from an image with an edge-avoiding à-trous wavelet filter, in the manner of
+     *        spatiotemporal variance-guided filtering without the temporal part.
+     *
+     * The color is divided by the albedo first, so that only the lighting is filtered and textures stay sharp, then
+     * multiplied back. Each pass blends every pixel with a 5x5 grid of others, spaced twice as far apart as in the
+     * pass before, weighted by how alike their normals, depths, albedos and luminances are. Luminances are compared
+     * against the noise that each pixel is estimated to have from the spread of its samples, so that converged pixels
+     * are left nearly alone and noisy ones are smoothed the most.
+     *
+     * @param[in,out] image The image to denoise, which must have the auxiliary outputs.
+     * @param[in] accumulation The samples that the image was resolved from, for the noise of each pixel.
+     * @param[in] pool The pool that filters rows in parallel. If null, the image is filtered on the calling thread.
+     * @throws std::runtime_error Thrown if the image has no auxiliary outputs, or does not match the accumulation
+     *                            buffer.
+     */
+    inline void denoise(
+        rt::framebuffer &image,
+        const rt::accumulation_buffer &accumulation,
+        const rt::denoise_parameters &parameters = { },
+        rt::thread_pool *pool = nullptr
+    )
+    {
+        if (!image.has_aovs())
+        {
+            throw std::runtime_error("denoising needs the albedo, normal and depth outputs");
+        }
+
+        if (image.width() != accumulation.width() || image.height() != accumulation.height())
+        {
+            throw std::runtime_error("the image to denoise does not match its samples");
+        }
+
+        const std::uint32_t width = image.width();
+        const std::uint32_t height = image.height();
+        const std::size_t pixel_count = std::size_t(width) * height;
+        const std::span<const glm::vec3> albedos = image.albedo();
+        const std::span<const glm::vec3> normals = image.normal();
+        const std::span<const float> depths = image.depth();
+
+        const auto for_each_row = [&](const rt::thread_pool::task_type &row)
+        {
+            if (pool != nullptr)
+            {
+                pool->run(height, row);
+                return;
+            }
+
+            for (std::size_t y = 0; y < height; ++y)
+            {
+                row(y);
+            }
+        };
+
+        // Dividing by an albedo near zero would make the lighting of black surfaces arbitrary, so it is bounded.
+        constexpr float min_albedo = 1.0e-3F;
+        const auto demodulator = [&](std::size_t pixel)
+        {
+            return glm::max(albedos[pixel], glm::vec3(min_albedo));
+        };
+
+        std::vector<glm::vec3> irradiance(pixel_count);
+        std::vector<float> variance(pixel_count);
+        std::vector<glm::vec2> depth_gradients(pixel_count);
+        const std::span<const accumulate_vec3> color_sums = accumulation.color_sums();
+        const std::span<const std::uint32_t> sample_counts = accumulation.sample_counts();
+        const std::span<const accumulate_real> luminance_squares = accumulation.luminance_squares();
+        for_each_row([&](std::size_t y)
+        {
+            for (std::size_t x = 0; x < width; ++x)
+            {
+                const std::size_t pixel = y * width + x;
+                const glm::vec3 albedo = demodulator(pixel);
+                irradiance[pixel] = glm::vec3(image.color()[pixel]) / albedo;
+
+                // The variance of the mean, from the spread of the samples. A single sample says nothing of its noise,
+                // so it is taken to be as large as the sample itself.
+                const std::uint32_t count = sample_counts[pixel];
+                const float albedo_luminance = glm::max(detail::luminance(albedo), min_albedo);
+                if (count < 2)
+                {
+                    const float value = detail::luminance(irradiance[pixel]);
+                    variance[pixel] = value * value;
+                }
+                else
+                {
+                    using T = accumulate_real;
+                    const T n = static_cast<T>(count);
+                    const T mean = detail::luminance(glm::vec3(color_sums[pixel])) / n;
+                    const T sample_variance = glm::max(luminance_squares[pixel] / n - mean * mean, T(0.0)) * n / (n - T(1.0));
+                    variance[pixel] = static_cast<float>(sample_variance / n) / (albedo_luminance * albedo_luminance);
+                }
+
+                // How quickly depth changes across the surface, from the neighbours that saw a surface too.
+                const auto slope = [&](std::size_t before, std::size_t after, float spacing)
+                {
+                    const float change = depths[after] - depths[before];
+                    return std::isfinite(change) ? glm::abs(change) / spacing : 0.0F;
+                };
+
+                const std::size_t left = x > 0 ? pixel - 1 : pixel;
+                const std::size_t right = x + 1 < width ? pixel + 1 : pixel;
+                const std::size_t up = y > 0 ? pixel - width : pixel;
+                const std::size_t down = y + 1 < height ? pixel + width : pixel;
+                depth_gradients[pixel] = glm::vec2(
+                    right != left ? slope(left, right, static_cast<float>(right - left)) : 0.0F,
+                    down != up ? slope(up, down, static_cast<float>((down - up) / width)) : 0.0F
+                );
+            }
+        });
+
+        std::vector<glm::vec3> filtered(pixel_count);
+        std::vector<float> filtered_variance(pixel_count);
+        std::vector<float> guide_variance(pixel_count);
+        for (std::uint32_t pass = 0; pass < parameters.passes; ++pass)
+        {
+            const int step = 1 << pass;
+
+            // The noise that luminances are compared against is itself noisy, so it is blurred first.
+            for_each_row([&](std::size_t y)
+            {
+                for (std::size_t x = 0; x < width; ++x)
+                {
+                    constexpr std::array<float, 3> gaussian = { 0.25F, 0.5F, 0.25F };
+                    float sum = 0.0F;
+                    float weight_sum = 0.0F;
+                    for (int dy = -1; dy <= 1; ++dy)
+                    {
+                        for (int dx = -1; dx <= 1; ++dx)
+                        {
+                            const auto qx = static_cast<std::ptrdiff_t>(x) + dx;
+                            const auto qy = static_cast<std::ptrdiff_t>(y) + dy;
+                            if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                            {
+                                continue;
+                            }
+
+                            const float weight = gaussian[dx + 1] * gaussian[dy + 1];
+                            sum += weight * variance[static_cast<std::size_t>(qy * width + qx)];
+                            weight_sum += weight;
+                        }
+                    }
+
+                    guide_variance[y * width + x] = sum / weight_sum;
+                }
+            });
+
+            for_each_row([&](std::size_t y)
+            {
+                for (std::size_t x = 0; x < width; ++x)
+                {
+                    const std::size_t p = y * width + x;
+                    const glm::vec3 normal_p = normals[p];
+                    const bool has_surface_p = std::isfinite(depths[p]);
+                    const float luminance_p = detail::luminance(irradiance[p]);
+                    const float luminance_scale = parameters.luminance_sigma * glm::sqrt(guide_variance[p]) + 1.0e-6F;
+
+                    glm::vec3 sum(0.0F);
+                    float variance_sum = 0.0F;
+                    float weight_sum = 0.0F;
+                    for (int ky = -2; ky <= 2; ++ky)
+                    {
+                        for (int kx = -2; kx <= 2; ++kx)
+                        {
+                            const auto qx = static_cast<std::ptrdiff_t>(x) + kx * step;
+                            const auto qy = static_cast<std::ptrdiff_t>(y) + ky * step;
+                            if (qx < 0 || qy < 0 || qx >= width || qy >= height)
+                            {
+                                continue;
+                            }
+
+                            const auto q = static_cast<std::size_t>(qy * width + qx);
+                            float weight = detail::atrous_kernel[kx + 2] * detail::atrous_kernel[ky + 2];
+                            if (q != p)
+                            {
+                                // Pixels that saw nothing are only alike each other.
+                                if (has_surface_p != std::isfinite(depths[q]))
+                                {
+                                    continue;
+                                }
+
+                                if (has_surface_p)
+                                {
+                                    const float cosine = glm::max(glm::dot(normal_p, normals[q]), 0.0F);
+                                    const float expected_change = parameters.depth_sigma
+                                        * glm::dot(depth_gradients[p], glm::abs(glm::vec2(float(kx * step), float(ky * step))));
+                                    weight *= glm::pow(cosine, parameters.normal_power);
+                                    weight *= glm::exp(-glm::abs(depths[p] - depths[q]) / (expected_change + 1.0e-3F * depths[p]));
+                                }
+
+                                weight *= glm::exp(-glm::distance(albedos[p], albedos[q]) / parameters.albedo_sigma);
+                                weight *= glm::exp(-glm::abs(luminance_p - detail::luminance(irradiance[q])) / luminance_scale);
+                            }
+
+                            sum += weight * irradiance[q];
+                            variance_sum += weight * weight * variance[q];
+                            weight_sum += weight;
+                        }
+                    }
+
+                    // The center always has a weight, so the sum of weights is never zero.
+                    filtered[p] = sum / weight_sum;
+                    filtered_variance[p] = variance_sum / (weight_sum * weight_sum);
+                }
+            });
+
+            std::swap(irradiance, filtered);
+            std::swap(variance, filtered_variance);
+        }
+
+        for (std::size_t pixel = 0; pixel < pixel_count; ++pixel)
+        {
+            const float alpha = image.color()[pixel].w;
+            image.color()[pixel] = glm::vec4(irradiance[pixel] * demodulator(pixel), alpha);
+        }
+    }
+}
+
+#endif // !RAYTRACER_DENOISE_HPP
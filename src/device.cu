@@ -0,0 +1,477 @@
+/**
+ * @file device.cu
+ * @brief The CUDA backend, which traces the paths of each pixel of a pass in its own device thread.
+ */
+
+#include "device.hpp"
+
+#include <cuda_runtime.h>
+
+#include <cfloat>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace
+{
+    /// Throws if a CUDA call failed, naming what was being done.
+    void check(cudaError_t error, const char *what)
+    {
+        if (error != cudaSuccess)
+        {
+            throw std::runtime_error(std::string("CUDA could not ") + what + ": " + cudaGetErrorString(error));
+        }
+    }
+
+    /// An array in device memory, freed with its owner.
+    template <typename T>
+    class device_array
+    {
+    public:
+        device_array() = default;
+
+        explicit device_array(std::size_t count)
+            : count_(count)
+        {
+            if (count != 0)
+            {
+                check(cudaMalloc(reinterpret_cast<void **>(&data_), count * sizeof(T)), "allocate device memory");
+            }
+        }
+
+        explicit device_array(const std::vector<T> &values)
+            : device_array(values.size())
+        {
+            upload(values);
+        }
+
+        ~device_array()
+        {
+            cudaFree(data_);
+        }
+
+        device_array(const device_array &) = delete;
+        device_array &operator=(const device_array &) = delete;
+
+        template <typename Range>
+        void upload(const Range &values)
+        {
+            if (count_ != 0)
+            {
+                check(cudaMemcpy(data_, values.data(), count_ * sizeof(T), cudaMemcpyHostToDevice), "copy to the device");
+            }
+        }
+
+        void download(std::span<T> values) const
+        {
+            if (count_ != 0)
+            {
+                check(cudaMemcpy(values.data(), data_, count_ * sizeof(T), cudaMemcpyDeviceToHost), "copy from the device");
+            }
+        }
+
+        T *data() const
+        {
+            return data_;
+        }
+
+        std::size_t size() const
+        {
+            return count_;
+        }
+
+    private:
+        T          *data_ = nullptr;
+        std::size_t count_ = 0;
+    };
+
+    __device__ float3 operator+(float3 a, float3 b) { return make_float3(a.x + b.x, a.y + b.y, a.z + b.z); }
+    __device__ float3 operator-(float3 a, float3 b) { return make_float3(a.x - b.x, a.y - b.y, a.z - b.z); }
+    __device__ float3 operator-(float3 a) { return make_float3(-a.x, -a.y, -a.z); }
+    __device__ float3 operator*(float3 a, float3 b) { return make_float3(a.x * b.x, a.y * b.y, a.z * b.z); }
+    __device__ float3 operator*(float s, float3 a) { return make_float3(s * a.x, s * a.y, s * a.z); }
+    __device__ float3 operator/(float3 a, float s) { return make_float3(a.x / s, a.y / s, a.z / s); }
+
+    __device__ float dot(float3 a, float3 b)
+    {
+        return a.x * b.x + a.y * b.y + a.z * b.z;
+    }
+
+    __device__ float3 normalize(float3 a)
+    {
+        return rsqrtf(dot(a, a)) * a;
+    }
+
+    __device__ float3 reflect(float3 direction, float3 normal)
+    {
+        return direction - 2.0F * dot(normal, direction) * normal;
+    }
+
+    /// The same as glm::refract, which gives no direction at all past the critical angle.
+    __device__ float3 refract(float3 direction, float3 normal, float eta)
+    {
+        const float cosine = dot(normal, direction);
+        const float k = 1.0F - eta * eta * (1.0F - cosine * cosine);
+        return k < 0.0F ? make_float3(0.0F, 0.0F, 0.0F) : eta * direction - (eta * cosine + sqrtf(k)) * normal;
+    }
+
+    __device__ float3 load(rt::device::float3_value value)
+    {
+        return make_float3(value.x, value.y, value.z);
+    }
+
+    __device__ float luminance(float3 color)
+    {
+        return dot(color, make_float3(0.2126F, 0.7152F, 0.0722F));
+    }
+
+    /// The PCG hash, which scrambles every bit of its input into every bit of its output.
+    __device__ std::uint32_t hash(std::uint32_t value)
+    {
+        const std::uint32_t state = value * 747796405U + 2891336453U;
+        const std::uint32_t word = ((state >> ((state >> 28U) + 4U)) ^ state) * 277803737U;
+        return (word >> 22U) ^ word;
+    }
+
+    /// A stream of uniform reals in [0, 1) for a single sample.
+    class random_stream
+    {
+    public:
+        __device__ explicit random_stream(std::uint32_t seed, std::uint32_t pixel, std::uint32_t sample)
+            : state_(hash(seed ^ hash(pixel ^ hash(sample))))
+        {
+        }
+
+        __device__ float next()
+        {
+            state_ = hash(state_);
+            return static_cast<float>(state_ >> 8U) * (1.0F / 16777216.0F);
+        }
+
+    private:
+        std::uint32_t state_;
+    };
+
+    /// The same as rt::sample_disk.
+    __device__ float2 sample_disk(float u, float v)
+    {
+        const float x = 2.0F * u - 1.0F;
+        const float y = 2.0F * v - 1.0F;
+        if (x == 0.0F && y == 0.0F)
+        {
+            return make_float2(0.0F, 0.0F);
+        }
+
+        constexpr float quarter_pi = 0.785398163F;
+        const bool is_horizontal = fabsf(x) > fabsf(y);
+        const float radius = is_horizontal ? x : y;
+        const float theta = is_horizontal ? quarter_pi * (y / x) : 2.0F * quarter_pi - quarter_pi * (x / y);
+        return make_float2(radius * cosf(theta), radius * sinf(theta));
+    }
+
+    /// The same as rt::sample_sphere.
+    __device__ float3 sample_sphere(float u, float v)
+    {
+        const float z = 1.0F - 2.0F * u;
+        const float r = sqrtf(fmaxf(0.0F, 1.0F - z * z));
+        const float phi = 6.28318531F * v;
+        return make_float3(r * cosf(phi), r * sinf(phi), z);
+    }
+
+    /// The same as rt::background.
+    __device__ float3 background(float3 direction)
+    {
+        const float t = 0.5F * (normalize(direction).y + 1.0F);
+        return (1.0F - t) * make_float3(0.5F, 0.7F, 1.0F) + t * make_float3(1.0F, 1.0F, 1.0F);
+    }
+
+    struct scene_view
+    {
+        const rt::device::sphere   *spheres;
+        const rt::device::node     *nodes;
+        std::uint32_t               node_count;
+        const rt::device::material *materials;
+    };
+
+    /// The nearest sphere along a ray, found by the same traversal as rt::traverse_bvh.
+    __device__ bool intersect(const scene_view &scene, float3 origin, float3 direction, float t_min, float &t_max, std::uint32_t &nearest)
+    {
+        if (scene.node_count == 0)
+        {
+            return false;
+        }
+
+        const float3 inverse_direction = make_float3(1.0F / direction.x, 1.0F / direction.y, 1.0F / direction.z);
+        const bool is_negative[3] = { inverse_direction.x < 0.0F, inverse_direction.y < 0.0F, inverse_direction.z < 0.0F };
+        const float a = dot(direction, direction);
+
+        // The deepest hierarchy that rt::bvh_builder builds.
+        std::uint32_t stack[64];
+        std::uint32_t stack_size = 0;
+        std::uint32_t current = 0;
+        bool has_hit = false;
+        while (true)
+        {
+            const rt::device::node &node = scene.nodes[current];
+            const float3 t0 = (load(node.min) - origin) * inverse_direction;
+            const float3 t1 = (load(node.max) - origin) * inverse_direction;
+            const float t_near = fmaxf(t_min, fmaxf(fminf(t0.x, t1.x), fmaxf(fminf(t0.y, t1.y), fminf(t0.z, t1.z))));
+            const float t_far = fminf(t_max, fminf(fmaxf(t0.x, t1.x), fminf(fmaxf(t0.y, t1.y), fmaxf(t0.z, t1.z))));
+            if (t_near <= t_far)
+            {
+                if (node.count != 0)
+                {
+                    for (std::uint32_t i = node.index; i < node.index + node.count; ++i)
+                    {
+                        const rt::device::sphere &sphere = scene.spheres[i];
+                        const float3 oc = origin - load(sphere.center);
+                        const float half_b = dot(oc, direction);
+                        const float c = dot(oc, oc) - sphere.radius * sphere.radius;
+                        const float discriminant = half_b * half_b - a * c;
+                        if (discriminant <= 0.0F)
+                        {
+                            continue;
+                        }
+
+                        const float sqrt_discriminant = sqrtf(discriminant);
+                        const float near_root = (-half_b - sqrt_discriminant) / a;
+                        const float root = near_root >= t_min ? near_root : (-half_b + sqrt_discriminant) / a;
+                        if (root >= t_min && root < t_max)
+                        {
+                            t_max = root;
+                            nearest = i;
+                            has_hit = true;
+                        }
+                    }
+                }
+                else
+                {
+                    // Visit the child nearer to the ray origin first so that t_max shrinks as early as possible.
+                    const std::uint32_t first = current + 1;
+                    const std::uint32_t second = node.index;
+                    stack[stack_size++] = is_negative[node.axis] ? first : second;
+                    current = is_negative[node.axis] ? second : first;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+            {
+                break;
+            }
+
+            current = stack[--stack_size];
+        }
+
+        return has_hit;
+    }
+
+    /// Traces every sample that one pixel takes in a pass.
+    __global__ void render_pixels(
+        scene_view scene,
+        rt::device::pass_parameters parameters,
+        const std::uint32_t *sample_counts,
+        float *color_sums,
+        float *luminance_squares,
+        unsigned long long *ray_count
+    )
+    {
+        const std::uint32_t x = blockIdx.x * blockDim.x + threadIdx.x;
+        const std::uint32_t y = blockIdx.y * blockDim.y + threadIdx.y;
+        if (x >= parameters.width || y >= parameters.height)
+        {
+            return;
+        }
+
+        const std::uint32_t pixel = y * parameters.width + x;
+        const std::uint32_t first_sample = sample_counts[pixel];
+        const std::uint32_t count = first_sample < parameters.total_samples
+            ? min(parameters.pass_samples, parameters.total_samples - first_sample)
+            : 0;
+
+        const rt::device::camera &camera = parameters.camera;
+        float3 color_sum = make_float3(0.0F, 0.0F, 0.0F);
+        float luminance_square_sum = 0.0F;
+        unsigned long long rays = 0;
+        for (std::uint32_t sample = first_sample; sample < first_sample + count; ++sample)
+        {
+            random_stream random(parameters.seed, pixel, sample);
+
+            const float u = (static_cast<float>(x) + random.next()) / static_cast<float>(parameters.width);
+            const float v = (static_cast<float>(y) + random.next()) / static_cast<float>(parameters.height);
+            const float lens_u = random.next();
+            const float2 lens_point = sample_disk(lens_u, random.next());
+            const float3 offset = camera.lens_radius * (lens_point.x * load(camera.u) + lens_point.y * load(camera.v));
+
+            const float3 target = load(camera.top_left) + u * load(camera.horizontal) + v * load(camera.vertical);
+            float3 origin = load(camera.origin) + offset;
+            float3 direction = target - origin;
+
+            float3 throughput = make_float3(1.0F, 1.0F, 1.0F);
+            float3 radiance = make_float3(0.0F, 0.0F, 0.0F);
+            for (std::uint32_t depth = 0; depth < parameters.max_depth; ++depth)
+            {
+                float t = INFINITY;
+                std::uint32_t nearest = 0;
+                ++rays;
+                if (!intersect(scene, origin, direction, parameters.t_min, t, nearest))
+                {
+                    radiance = radiance + throughput * background(direction);
+                    break;
+                }
+
+                const rt::device::sphere &sphere = scene.spheres[nearest];
+                const rt::device::material &material = scene.materials[sphere.material];
+                const float3 point = origin + t * direction;
+                const float3 outward_normal = (point - load(sphere.center)) / sphere.radius;
+                const bool front_face = dot(direction, outward_normal) < 0.0F;
+                const float3 normal = front_face ? outward_normal : -outward_normal;
+
+                const float direction_u = random.next();
+                const float direction_v = random.next();
+                const float choice = random.next();
+                const float roulette = random.next();
+
+                float3 scattered;
+                if (material.type == rt::device::material_type::lambertian)
+                {
+                    scattered = normal + sample_sphere(direction_u, direction_v);
+                    if (fabsf(scattered.x) < FLT_EPSILON && fabsf(scattered.y) < FLT_EPSILON && fabsf(scattered.z) < FLT_EPSILON)
+                    {
+                        scattered = normal;
+                    }
+
+                    throughput = throughput * load(material.albedo);
+                }
+                else if (material.type == rt::device::material_type::metal)
+                {
+                    scattered = reflect(normalize(direction), normal);
+                    if (dot(scattered, normal) < 0.0F)
+                    {
+                        break;
+                    }
+
+                    throughput = throughput * load(material.albedo);
+                }
+                else
+                {
+                    const float eta = front_face ? 1.0F / material.refractive_index : material.refractive_index;
+                    const float3 unit_direction = normalize(direction);
+                    const float cos_theta = fminf(dot(-unit_direction, normal), 1.0F);
+                    const float sin_theta = sqrtf(1.0F - cos_theta * cos_theta);
+
+                    const float sqrt_r0 = (1.0F - eta) / (1.0F + eta);
+                    const float r0 = sqrt_r0 * sqrt_r0;
+                    const float reflectance = r0 + (1.0F - r0) * powf(1.0F - cos_theta, 5.0F);
+                    scattered = eta * sin_theta > 1.0F || reflectance > choice
+                        ? reflect(unit_direction, normal)
+                        : refract(unit_direction, normal, eta);
+                }
+
+                origin = point;
+                direction = scattered;
+
+                if (depth + 1 >= parameters.roulette_depth)
+                {
+                    const float survival = fminf(fmaxf(throughput.x, fmaxf(throughput.y, throughput.z)), 1.0F);
+                    if (survival <= 0.0F || (survival < 1.0F && roulette >= survival))
+                    {
+                        break;
+                    }
+
+                    throughput = throughput / survival;
+                }
+            }
+
+            color_sum = color_sum + radiance;
+            const float y_luminance = luminance(radiance);
+            luminance_square_sum += y_luminance * y_luminance;
+        }
+
+        color_sums[3 * pixel + 0] = color_sum.x;
+        color_sums[3 * pixel + 1] = color_sum.y;
+        color_sums[3 * pixel + 2] = color_sum.z;
+        luminance_squares[pixel] = luminance_square_sum;
+        atomicAdd(ray_count, rays);
+    }
+}
+
+namespace rt::device
+{
+    struct renderer::allocations
+    {
+        device_array<rt::device::sphere>   spheres;
+        device_array<rt::device::node>     nodes;
+        device_array<rt::device::material> materials;
+        device_array<std::uint32_t>        sample_counts;
+        device_array<float>                color_sums;
+        device_array<float>                luminance_squares;
+        device_array<unsigned long long>   ray_count;
+
+        allocations(const rt::device::scene_buffers &scene, std::uint32_t pixel_count)
+            : spheres(scene.spheres)
+            , nodes(scene.nodes)
+            , materials(scene.materials)
+            , sample_counts(pixel_count)
+            , color_sums(std::size_t(3) * pixel_count)
+            , luminance_squares(pixel_count)
+            , ray_count(1)
+        {
+        }
+    };
+
+    renderer::renderer(const rt::device::scene_buffers &scene, std::uint32_t pixel_count)
+    {
+        int device_count = 0;
+        if (cudaGetDeviceCount(&device_count) != cudaSuccess || device_count == 0)
+        {
+            throw std::runtime_error("there is no CUDA device to render on");
+        }
+
+        allocations_ = std::make_unique<allocations>(scene, pixel_count);
+    }
+
+    renderer::~renderer() = default;
+
+    std::uint64_t renderer::render_pass(
+        const rt::device::pass_parameters &parameters,
+        std::span<const std::uint32_t> sample_counts,
+        std::span<float> color_sums,
+        std::span<float> luminance_squares
+    )
+    {
+        allocations_->sample_counts.upload(sample_counts);
+        check(cudaMemset(allocations_->ray_count.data(), 0, sizeof(unsigned long long)), "clear the ray count");
+
+        const scene_view scene = {
+            .spheres    = allocations_->spheres.data(),
+            .nodes      = allocations_->nodes.data(),
+            .node_count = static_cast<std::uint32_t>(allocations_->nodes.size()),
+            .materials  = allocations_->materials.data(),
+        };
+
+        const dim3 block(16, 8);
+        const dim3 grid((parameters.width + block.x - 1) / block.x, (parameters.height + block.y - 1) / block.y);
+        render_pixels<<<grid, block>>>(
+            scene,
+            parameters,
+            allocations_->sample_counts.data(),
+            allocations_->color_sums.data(),
+            allocations_->luminance_squares.data(),
+            allocations_->ray_count.data()
+        );
+        check(cudaGetLastError(), "launch the render kernel");
+        check(cudaDeviceSynchronize(), "render a pass");
+
+        allocations_->color_sums.download(color_sums);
+        allocations_->luminance_squares.download(luminance_squares);
+
+        unsigned long long rays = 0;
+        allocations_->ray_count.download(std::span(&rays, 1));
+        return rays;
+    }
+}
@@ -0,0 +1,165 @@
+/**
+ * @file device.hpp
+ * @brief The interface of the optional CUDA backend, in plain types that both the host compiler and nvcc can read.
+ *
+ * The host flattens a scene into the buffers declared here (see device_scene.hpp), and the backend, which is only
+ * built with the RAYTRACER_ENABLE_CUDA CMake option, uploads them once and renders passes of samples from them.
+ */
+
+#ifndef RAYTRACER_DEVICE_HPP
+#define RAYTRACER_DEVICE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+namespace rt::device
+{
+    /// Whether the program is built with the CUDA backend. Without it, rt::device::renderer is declared but has no
+    /// definition, so it may only be used where this is checked with `if constexpr`.
+#ifdef RAYTRACER_ENABLE_CUDA
+    inline constexpr bool enabled = true;
+#else
+    inline constexpr bool enabled = false;
+#endif
+
+    /// Three floats, which device code reads without glm. The device always traces in single precision.
+    struct float3_value
+    {
+        float x;
+        float y;
+        float z;
+    };
+
+    /// An rt::packed_sphere.
+    struct sphere
+    {
+        rt::device::float3_value center;
+        /// A negative radius flips the surface normal.
+        float                    radius;
+        std::uint32_t            material;
+    };
+
+    /// An rt::bvh_node, in the same depth-first order.
+    struct node
+    {
+        rt::device::float3_value min;
+        rt::device::float3_value max;
+        /// For a leaf, the index of its first sphere. For an interior node, the index of its second child.
+        std::uint32_t            index;
+        /// The number of spheres in a leaf, or 0 for an interior node.
+        std::uint16_t            count;
+        std::uint16_t            axis;
+    };
+
+    /// The materials that the device can scatter from, which share their values with rt::material_type.
+    enum class material_type : std::uint32_t
+    {
+        lambertian = 0,
+        metal      = 1,
+        dielectric = 2,
+    };
+
+    /// An rt::material_description.
+    struct material
+    {
+        rt::device::material_type type;
+        rt::device::float3_value  albedo;
+        float                     refractive_index;
+    };
+
+    /// The vectors of an rt::thin_lens_camera.
+    struct camera
+    {
+        rt::device::float3_value origin;
+        rt::device::float3_value top_left;
+        rt::device::float3_value horizontal;
+        rt::device::float3_value vertical;
+        rt::device::float3_value u;
+        rt::device::float3_value v;
+        float                    lens_radius;
+    };
+
+    static_assert(std::is_trivially_copyable_v<rt::device::sphere>);
+    static_assert(std::is_trivially_copyable_v<rt::device::node>);
+    static_assert(std::is_trivially_copyable_v<rt::device::material>);
+    static_assert(std::is_trivially_copyable_v<rt::device::camera>);
+
+    /// A scene flattened into arrays that are copied to the device as they are.
+    struct scene_buffers
+    {
+        /// The spheres, in the order that the leaves of `nodes` refer to them.
+        std::vector<rt::device::sphere>   spheres;
+        /// The hierarchy over the spheres, root first, no deeper than rt::bvh_builder::max_depth.
+        std::vector<rt::device::node>     nodes;
+        std::vector<rt::device::material> materials;
+    };
+
+    /// The settings of one pass over every pixel of the image.
+    struct pass_parameters
+    {
+        rt::device::camera camera;
+        std::uint32_t      width;
+        std::uint32_t      height;
+        /// The most samples each pixel takes in the pass.
+        std::uint32_t      pass_samples;
+        /// The number of samples each pixel takes in the whole render.
+        std::uint32_t      total_samples;
+        std::uint32_t      max_depth;
+        std::uint32_t      roulette_depth;
+        /// Selects the sample points, which the device draws from a hash of the seed, the pixel and the sample.
+        std::uint32_t      seed;
+        /// The distance a ray travels before it can hit anything.
+        float              t_min;
+    };
+
+    /**
+     * @brief The scene uploaded to a CUDA device, which renders passes of samples into host arrays.
+     *
+     * Each pass runs one thread per pixel that traces its samples to completion in turn, with the same camera,
+     * scattering and Russian roulette as rt::basic_wavefront_integrator. Only the sample points differ, so a render
+     * on the device converges to the same image as one on the host, with different noise.
+     */
+    class renderer
+    {
+    public:
+        /**
+         * @brief Picks the current CUDA device and copies the scene to it.
+         * @param[in] scene The flattened scene.
+         * @param[in] pixel_count The number of pixels of the images that will be rendered.
+         * @throws std::runtime_error Thrown if there is no CUDA device, or it runs out of memory.
+         */
+        explicit renderer(const rt::device::scene_buffers &scene, std::uint32_t pixel_count);
+        ~renderer();
+
+        renderer(const renderer &) = delete;
+        renderer &operator=(const renderer &) = delete;
+
+        /**
+         * @brief Renders a pass, waiting for the device to finish it.
+         * @param[in] parameters The settings of the pass.
+         * @param[in] sample_counts The samples each pixel has already taken. Pixels continue from there, and take no
+         *                          more than the total.
+         * @param[out] color_sums The sums of the colors of the samples each pixel took in the pass, three floats per
+         *                        pixel.
+         * @param[out] luminance_squares The sums of the squares of their luminances.
+         * @return The number of rays traced.
+         * @throws std::runtime_error Thrown if the device fails.
+         */
+        std::uint64_t render_pass(
+            const rt::device::pass_parameters &parameters,
+            std::span<const std::uint32_t> sample_counts,
+            std::span<float> color_sums,
+            std::span<float> luminance_squares
+        );
+
+    private:
+        struct allocations;
+
+        std::unique_ptr<allocations> allocations_;
+    };
+}
+
+#endif // !RAYTRACER_DEVICE_HPP
@@ -0,0 +1,117 @@
+/**
+ * @file device_scene.hpp
+ * @brief Flattening a scene and its camera into the buffers that the CUDA backend uploads.
+ */
+
+#ifndef RAYTRACER_DEVICE_SCENE_HPP
+#define RAYTRACER_DEVICE_SCENE_HPP
+
+#include "camera.hpp"
+#include "device.hpp"
+#include "math.hpp"
+#include "scene.hpp"
+#include "sphere_bvh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <span>
+#include <stdexcept>
+
+namespace rt
+{
+    inline rt::device::float3_value to_device(vec3 value)
+    {
+        return {
+            .x = static_cast<float>(value.x),
+            .y = static_cast<float>(value.y),
+            .z = static_cast<float>(value.z),
+        };
+    }
+
+    /**
+     * @brief Copies the spheres, hierarchy and materials of a scene into flat single-precision arrays.
+     * @throws std::runtime_error Thrown if the scene has anything that the device cannot render: meshes, instances,
+     *                            point lights or emissive materials.
+     */
+    inline rt::device::scene_buffers flatten_for_device(const rt::scene &scene)
+    {
+        if (scene.has_meshes())
+        {
+            throw std::runtime_error("the CUDA backend cannot render meshes or instances yet");
+        }
+
+        if (!scene.point_lights().empty())
+        {
+            throw std::runtime_error("the CUDA backend cannot render point lights yet");
+        }
+
+        rt::device::scene_buffers buffers;
+        for (const rt::material_description &material : scene.material_descriptions())
+        {
+            if (material.type == rt::material_type::emissive)
+            {
+                throw std::runtime_error("the CUDA backend cannot render emissive materials yet");
+            }
+
+            buffers.materials.push_back({
+                .type             = static_cast<rt::device::material_type>(material.type),
+                .albedo           = to_device(material.albedo),
+                .refractive_index = static_cast<float>(material.refractive_index),
+            });
+        }
+
+        const std::span<const rt::packed_sphere> spheres = scene.spheres().spheres();
+        buffers.spheres.reserve(spheres.size());
+        for (const rt::packed_sphere &sphere : spheres)
+        {
+            buffers.spheres.push_back({
+                .center   = to_device(sphere.center),
+                .radius   = static_cast<float>(sphere.radius),
+                .material = sphere.material,
+            });
+        }
+
+        const std::span<const rt::bvh_node> nodes = scene.spheres().nodes();
+        buffers.nodes.reserve(nodes.size());
+        for (const rt::bvh_node &node : nodes)
+        {
+            buffers.nodes.push_back({
+                .min   = to_device(node.bounds.min),
+                .max   = to_device(node.bounds.max),
+                .index = node.index,
+                .count = node.count,
+                .axis  = node.axis,
+            });
+        }
+
+        return buffers;
+    }
+
+    /// The vectors that an rt::thin_lens_camera with the same parameters shoots its rays along.
+    inline rt::device::camera flatten_for_device(const rt::camera::create_parameters &parameters)
+    {
+        const real optical_power = glm::tan(parameters.vertical_fov / real(2.0));
+        const real viewport_height = real(1.0) * optical_power;
+        const real viewport_width = parameters.aspect_ratio * viewport_height;
+
+        const vec3 w = glm::normalize(parameters.target - parameters.origin);
+        const vec3 u = glm::normalize(glm::cross(w, parameters.up));
+        const vec3 v = glm::cross(w, u);
+
+        const vec3 vertical = parameters.focal_length * viewport_height * v;
+        const vec3 horizontal = parameters.focal_length * viewport_width * u;
+        const vec3 top_left = parameters.origin + (parameters.focal_length * w) - (real(0.5) * horizontal) - (real(0.5) * vertical);
+
+        return {
+            .origin      = to_device(parameters.origin),
+            .top_left    = to_device(top_left),
+            .horizontal  = to_device(horizontal),
+            .vertical    = to_device(vertical),
+            .u           = to_device(u),
+            .v           = to_device(v),
+            .lens_radius = static_cast<float>(real(0.5) * parameters.aperture),
+        };
+    }
+}
+
+#endif // !RAYTRACER_DEVICE_SCENE_HPP
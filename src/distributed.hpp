@@ -0,0 +1,538 @@
+/**
+ * @file distributed.hpp
+ * @brief The protocol between a coordinator that splits a render into leases and the workers that render them.
+ *
+ * A worker connects to the coordinator and says hello. The coordinator replies with the job: the render settings
+ * and the bytes of the scene. From then on, the worker repeatedly requests leases, renders every lease it is given
+ * on all of its threads, and returns the sums of the samples it took for each as a result. Once every lease has a
+ * result, the coordinator tells each worker to finish.
+ *
+ * A lease is one tile of the image to take one run of consecutive samples for. Every sample point is a pure function
+ * of the seed, the pixel and the sample index, so any worker renders a lease the same way. A lease that is not
+ * returned in time, or whose worker disconnects, is simply leased again, and whichever result arrives first is kept.
+ *
+ * Every message is a header, giving its type and the size of its payload, followed by the payload. Values are in the
+ * native byte order, so every machine in a render must share one, and builds must share a precision.
+ */
+
+#ifndef RAYTRACER_DISTRIBUTED_HPP
+#define RAYTRACER_DISTRIBUTED_HPP
+
+#include "math.hpp"
+#include "sampler.hpp"
+#include "socket.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace rt::distributed
+{
+    /// The version of the protocol, which the coordinator and every worker must share.
+    constexpr std::uint32_t protocol_version = 1;
+
+    /// The largest payload accepted, which stops a corrupt header from exhausting memory.
+    constexpr std::uint64_t max_payload_size = std::uint64_t(1) << 32;
+
+    enum class message_type : std::uint32_t
+    {
+        /// Worker to coordinator: a protocol_version, then the number of threads the worker renders on.
+        hello   = 0,
+        /// Coordinator to worker: an rt::distributed::job.
+        job     = 1,
+        /// Worker to coordinator: the number of leases the worker is ready to render.
+        request = 2,
+        /// Coordinator to worker: a count, then that many rt::distributed::lease%s.
+        leases  = 3,
+        /// Worker to coordinator: the lease, the number of rays traced for it, then its results.
+        result  = 4,
+        /// Coordinator to worker: every lease is done, so the worker can disconnect.
+        finish  = 5,
+    };
+
+    struct message_header
+    {
+        message_type  type;
+        std::uint32_t reserved;
+        std::uint64_t size;
+    };
+
+    static_assert(std::is_trivially_copyable_v<message_header>);
+
+    /**
+     * @brief Builds the payload of a message out of values.
+     */
+    class message_writer
+    {
+    public:
+        template <typename T>
+        message_writer &write(const T &value)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            return write_bytes(std::as_bytes(std::span(&value, 1)));
+        }
+
+        template <typename T>
+        message_writer &write_span(std::span<const T> values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            return write_bytes(std::as_bytes(values));
+        }
+
+        /// Writes the size of `string`, then its characters.
+        message_writer &write_string(std::string_view string)
+        {
+            write(static_cast<std::uint64_t>(string.size()));
+            return write_bytes(std::as_bytes(std::span(string)));
+        }
+
+        message_writer &write_bytes(std::span<const std::byte> bytes)
+        {
+            payload_.insert(payload_.end(), bytes.begin(), bytes.end());
+            return *this;
+        }
+
+        /**
+         * @brief Sends the payload as a message of the given type.
+         * @throws std::runtime_error Thrown if the connection fails.
+         */
+        void send(const rt::socket &socket, message_type type) const
+        {
+            const message_header header = { .type = type, .reserved = 0, .size = payload_.size() };
+            socket.send(std::as_bytes(std::span(&header, 1)));
+            socket.send(payload_);
+        }
+
+    private:
+        std::vector<std::byte> payload_;
+    };
+
+    /**
+     * @brief Reads values back out of the payload of a message.
+     * @note Every read throws std::runtime_error if the payload is too short.
+     */
+    class message_reader
+    {
+    public:
+        explicit message_reader(std::span<const std::byte> payload)
+            : payload_(payload)
+        {
+        }
+
+        template <typename T>
+        T read()
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            T value;
+            std::memcpy(&value, take(sizeof(T)).data(), sizeof(T));
+            return value;
+        }
+
+        template <typename T>
+        void read_span(std::span<T> values)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const std::span<const std::byte> bytes = take(values.size_bytes());
+            std::memcpy(values.data(), bytes.data(), bytes.size());
+        }
+
+        std::string read_string()
+        {
+            const auto size = read<std::uint64_t>();
+            const std::span<const std::byte> bytes = take(size);
+            return std::string(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+        }
+
+        std::span<const std::byte> read_bytes(std::size_t size)
+        {
+            return take(size);
+        }
+
+    private:
+        std::span<const std::byte> take(std::uint64_t size)
+        {
+            if (size > payload_.size())
+            {
+                throw std::runtime_error("a message is truncated");
+            }
+
+            const std::span<const std::byte> bytes = payload_.first(static_cast<std::size_t>(size));
+            payload_ = payload_.subspan(static_cast<std::size_t>(size));
+            return bytes;
+        }
+
+    private:
+        std::span<const std::byte> payload_;
+    };
+
+    /// A whole message, as received.
+    struct message
+    {
+        message_type           type;
+        std::vector<std::byte> payload;
+
+        [[nodiscard]]
+        message_reader reader() const
+        {
+            return message_reader(payload);
+        }
+    };
+
+    /**
+     * @brief Receives a whole message, blocking until it has arrived.
+     * @throws std::runtime_error Thrown if the connection fails or is closed, or the message is invalid.
+     */
+    inline message receive_message(const rt::socket &socket)
+    {
+        message_header header;
+        socket.receive(std::as_writable_bytes(std::span(&header, 1)));
+        if (header.size > max_payload_size)
+        {
+            throw std::runtime_error("a message is too large");
+        }
+
+        message received = { .type = header.type, .payload = std::vector<std::byte>(static_cast<std::size_t>(header.size)) };
+        socket.receive(received.payload);
+        return received;
+    }
+
+    /**
+     * @brief Gathers the messages arriving on a connection from whatever bytes are received at a time, so that a
+     *        coordinator can wait on many connections at once without blocking on any one.
+     */
+    class message_buffer
+    {
+    public:
+        /**
+         * @brief Receives the bytes that have arrived, blocking until at least one has.
+         * @return Whether the connection is still open.
+         * @throws std::runtime_error Thrown if the connection fails.
+         */
+        bool receive(const rt::socket &socket)
+        {
+            constexpr std::size_t chunk_size = std::size_t(1) << 16;
+            const std::size_t size = bytes_.size();
+            bytes_.resize(size + chunk_size);
+            const std::size_t received = socket.receive_some(std::span(bytes_).subspan(size));
+            bytes_.resize(size + received);
+            return received > 0;
+        }
+
+        /**
+         * @brief Takes the next whole message that has arrived, if any.
+         * @throws std::runtime_error Thrown if the message is too large.
+         */
+        std::optional<message> next()
+        {
+            message_header header;
+            if (bytes_.size() < sizeof(header))
+            {
+                return std::nullopt;
+            }
+
+            std::memcpy(&header, bytes_.data(), sizeof(header));
+            if (header.size > max_payload_size)
+            {
+                throw std::runtime_error("a message is too large");
+            }
+
+            const std::size_t end = sizeof(header) + static_cast<std::size_t>(header.size);
+            if (bytes_.size() < end)
+            {
+                return std::nullopt;
+            }
+
+            message received = {
+                .type    = header.type,
+                .payload = std::vector<std::byte>(bytes_.begin() + sizeof(header), bytes_.begin() + static_cast<std::ptrdiff_t>(end)),
+            };
+            bytes_.erase(bytes_.begin(), bytes_.begin() + static_cast<std::ptrdiff_t>(end));
+            return received;
+        }
+
+    private:
+        std::vector<std::byte> bytes_;
+    };
+
+    /**
+     * @brief Everything a worker needs to render leases of a render exactly as the coordinator would.
+     */
+    struct job
+    {
+        std::uint32_t          width = 0;
+        std::uint32_t          height = 0;
+        /// The number of samples that each pixel takes in total, which the sampler stratifies over.
+        std::uint32_t          sample_count = 0;
+        std::uint32_t          max_depth = 0;
+        std::uint32_t          roulette_depth = 0;
+        rt::sampler_type       sampler = rt::sampler_type::stratified;
+        std::uint32_t          seed = 0;
+        /// The size of the tiles that leases refer to by index, in the order of rt::make_tiles.
+        std::uint32_t          tile_size = 0;
+        bool                   aovs = false;
+        /// The path of the scene on the coordinator, which relative paths in a scene description are resolved
+        /// against. If empty, the built-in scene is rendered.
+        std::string            scene_filepath;
+        /// The contents of the scene file.
+        std::vector<std::byte> scene;
+
+        void send(const rt::socket &socket) const
+        {
+            message_writer writer;
+            writer.write(protocol_version)
+                .write(static_cast<std::uint32_t>(sizeof(real)))
+                .write(static_cast<std::uint32_t>(sizeof(accumulate_real)))
+                .write(width)
+                .write(height)
+                .write(sample_count)
+                .write(max_depth)
+                .write(roulette_depth)
+                .write(sampler)
+                .write(seed)
+                .write(tile_size)
+                .write(static_cast<std::uint8_t>(aovs))
+                .write_string(scene_filepath)
+                .write(static_cast<std::uint64_t>(scene.size()))
+                .write_bytes(scene);
+            writer.send(socket, message_type::job);
+        }
+
+        /**
+         * @throws std::runtime_error Thrown if the job is invalid, or was sent by an incompatible build.
+         */
+        static job read(message_reader reader)
+        {
+            if (reader.read<std::uint32_t>() != protocol_version)
+            {
+                throw std::runtime_error("the coordinator speaks a different version of the protocol");
+            }
+
+            if (reader.read<std::uint32_t>() != sizeof(real) || reader.read<std::uint32_t>() != sizeof(accumulate_real))
+            {
+                throw std::runtime_error("the coordinator was built with a different RAYTRACER_PRECISION");
+            }
+
+            job received;
+            received.width = reader.read<std::uint32_t>();
+            received.height = reader.read<std::uint32_t>();
+            received.sample_count = reader.read<std::uint32_t>();
+            received.max_depth = reader.read<std::uint32_t>();
+            received.roulette_depth = reader.read<std::uint32_t>();
+            received.sampler = reader.read<rt::sampler_type>();
+            received.seed = reader.read<std::uint32_t>();
+            received.tile_size = reader.read<std::uint32_t>();
+            received.aovs = reader.read<std::uint8_t>() != 0;
+            received.scene_filepath = reader.read_string();
+
+            const std::span<const std::byte> scene = reader.read_bytes(static_cast<std::size_t>(reader.read<std::uint64_t>()));
+            received.scene.assign(scene.begin(), scene.end());
+
+            if (received.width == 0 || received.height == 0 || received.sample_count == 0 || received.tile_size == 0)
+            {
+                throw std::runtime_error("the coordinator sent an empty job");
+            }
+
+            return received;
+        }
+    };
+
+    /**
+     * @brief One tile of the image, to take a run of consecutive samples of every pixel for.
+     */
+    struct lease
+    {
+        /// Identifies the lease among every lease of the render.
+        std::uint32_t id;
+        /// The index of the tile, in the order of rt::make_tiles.
+        std::uint32_t tile;
+        /// The index of the first sample of each pixel to take.
+        std::uint32_t first_sample;
+        /// The number of samples of each pixel to take.
+        std::uint32_t sample_count;
+    };
+
+    static_assert(std::is_trivially_copyable_v<lease>);
+
+    /**
+     * @brief The leases of a render, and which of them are free to lease, leased until some deadline, or done.
+     *
+     * Leases run tile by tile within each pass, so that the whole image refines evenly, as it does when rendering
+     * locally.
+     */
+    class lease_table
+    {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        /**
+         * @param[in] tile_count The number of tiles of the image.
+         * @param[in] sample_count The number of samples each pixel takes in total.
+         * @param[in] pass_samples The number of samples each pixel takes per lease.
+         */
+        lease_table(std::size_t tile_count, std::uint32_t sample_count, std::uint32_t pass_samples)
+        {
+            for (std::uint32_t first = 0; first < sample_count; first += pass_samples)
+            {
+                for (std::size_t tile = 0; tile < tile_count; ++tile)
+                {
+                    leases_.push_back({
+                        .id           = static_cast<std::uint32_t>(leases_.size()),
+                        .tile         = static_cast<std::uint32_t>(tile),
+                        .first_sample = first,
+                        .sample_count = std::min(pass_samples, sample_count - first),
+                    });
+                }
+            }
+
+            states_.resize(leases_.size());
+            for (const rt::distributed::lease &lease : leases_)
+            {
+                free_.push_back(lease.id);
+            }
+        }
+
+        /// The number of leases in the render.
+        [[nodiscard]]
+        std::size_t size() const
+        {
+            return leases_.size();
+        }
+
+        /// Whether every lease is done.
+        [[nodiscard]]
+        bool is_done() const
+        {
+            return done_count_ == leases_.size();
+        }
+
+        [[nodiscard]]
+        const rt::distributed::lease &operator[](std::uint32_t id) const
+        {
+            return leases_[id];
+        }
+
+        /**
+         * @brief Takes the next free lease, if any.
+         * @param[in] holder Identifies whoever holds the lease, for release().
+         * @param[in] deadline When the lease becomes free again if it is not done.
+         */
+        std::optional<rt::distributed::lease> take(std::uint64_t holder, clock::time_point deadline)
+        {
+            while (!free_.empty())
+            {
+                const std::uint32_t id = free_.front();
+                free_.pop_front();
+                if (states_[id].is_done)
+                {
+                    continue;
+                }
+
+                states_[id].is_leased = true;
+                states_[id].holder = holder;
+                states_[id].deadline = deadline;
+                return leases_[id];
+            }
+
+            return std::nullopt;
+        }
+
+        /**
+         * @brief Marks a lease as done.
+         * @return Whether it was the first result for the lease, which should be kept.
+         */
+        bool complete(std::uint32_t id)
+        {
+            if (id >= states_.size() || states_[id].is_done)
+            {
+                return false;
+            }
+
+            states_[id].is_done = true;
+            states_[id].is_leased = false;
+            ++done_count_;
+            return true;
+        }
+
+        /**
+         * @brief Frees every lease held by a holder that is gone, so that the next take() hands them out first.
+         * @return The number of leases freed.
+         */
+        std::size_t release(std::uint64_t holder)
+        {
+            return free_where([&](const state &state) { return state.holder == holder; });
+        }
+
+        /**
+         * @brief Frees every lease whose deadline has passed.
+         * @return The number of leases freed.
+         */
+        std::size_t expire(clock::time_point now)
+        {
+            return free_where([&](const state &state) { return state.deadline <= now; });
+        }
+
+        /// The earliest deadline of any leased lease, if any lease is out.
+        [[nodiscard]]
+        std::optional<clock::time_point> next_deadline() const
+        {
+            std::optional<clock::time_point> earliest;
+            for (const state &state : states_)
+            {
+                if (state.is_leased && (!earliest || state.deadline < *earliest))
+                {
+                    earliest = state.deadline;
+                }
+            }
+
+            return earliest;
+        }
+
+    private:
+        struct state
+        {
+            bool              is_leased = false;
+            bool              is_done = false;
+            std::uint64_t     holder = 0;
+            clock::time_point deadline;
+        };
+
+        template <typename Predicate>
+        std::size_t free_where(Predicate predicate)
+        {
+            // Freed leases go to the front, in their original order, since the image has been waiting longest for
+            // them.
+            std::vector<std::uint32_t> freed;
+            for (std::uint32_t id = 0; id < states_.size(); ++id)
+            {
+                if (states_[id].is_leased && predicate(states_[id]))
+                {
+                    states_[id].is_leased = false;
+                    freed.push_back(id);
+                }
+            }
+
+            free_.insert(free_.begin(), freed.begin(), freed.end());
+            return freed.size();
+        }
+
+    private:
+        std::vector<rt::distributed::lease> leases_;
+        std::vector<state>                  states_;
+        std::deque<std::uint32_t>           free_;
+        std::size_t                         done_count_ = 0;
+    };
+}
+
+#endif // !RAYTRACER_DISTRIBUTED_HPP
@@ -0,0 +1,338 @@
+/**
+ * @file exr.hpp
+ * @brief Writing multi-channel, high dynamic range OpenEXR files.
+ */
+
+#ifndef RAYTRACER_EXR_HPP
+#define RAYTRACER_EXR_HPP
+
+#include "scheduler.hpp"
+
+#include <zlib.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace exr
+{
+    /// The type that a channel's samples are stored as, as defined by
+    /// [the OpenEXR file layout](https://openexr.com/en/latest/OpenEXRFileLayout.html).
+    enum class pixel_type : std::int32_t
+    {
+        half    = 1,
+        float32 = 2,
+    };
+
+    /**
+     * @brief One channel of an image, read from every `stride`-th float of an interleaved buffer.
+     */
+    struct channel
+    {
+        /// The name of the channel, such as `R` or `albedo.R`.
+        std::string        name;
+        /// The channel's value for the top-left pixel. The value for pixel `i`, in row-major order, is at
+        /// `values[i * stride]`.
+        const float       *values;
+        /// The number of floats between the values of consecutive pixels.
+        std::size_t        stride;
+    };
+
+    namespace detail
+    {
+        /// The number of scanlines that ZIP compression packs into each block.
+        constexpr std::size_t lines_per_block = 16;
+
+        /// Converts a float to the nearest IEEE 754 half-precision float, rounding ties to even.
+        constexpr std::uint16_t to_half(float value)
+        {
+            const auto bits = std::bit_cast<std::uint32_t>(value);
+            const auto sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000U);
+            const std::uint32_t magnitude = bits & 0x7FFFFFFFU;
+
+            // Infinity and NaN, keeping NaNs quiet.
+            if (magnitude >= 0x7F800000U)
+            {
+                return static_cast<std::uint16_t>(sign | 0x7C00U | (magnitude > 0x7F800000U ? 0x0200U : 0));
+            }
+
+            // Too large for a half, so round to infinity.
+            if (magnitude >= 0x477FF000U)
+            {
+                return static_cast<std::uint16_t>(sign | 0x7C00U);
+            }
+
+            // Normal halves.
+            if (magnitude >= 0x38800000U)
+            {
+                const std::uint32_t rounded = magnitude + 0x0FFFU + ((magnitude >> 13) & 1);
+                return static_cast<std::uint16_t>(sign | ((rounded - 0x38000000U) >> 13));
+            }
+
+            // Subnormal halves, or zero.
+            if (magnitude < 0x33000000U)
+            {
+                return sign;
+            }
+
+            const std::uint32_t exponent = magnitude >> 23;
+            const std::uint32_t mantissa = (magnitude & 0x007FFFFFU) | 0x00800000U;
+            const std::uint32_t shift = 126 - exponent;
+            const std::uint32_t half_mantissa = mantissa >> shift;
+            const std::uint32_t remainder = mantissa & ((1U << shift) - 1);
+            const std::uint32_t halfway = 1U << (shift - 1);
+            const bool round_up = remainder > halfway || (remainder == halfway && (half_mantissa & 1) != 0);
+            return static_cast<std::uint16_t>(sign | (half_mantissa + (round_up ? 1 : 0)));
+        }
+
+        /// Appends integers in little-endian byte order, as OpenEXR requires.
+        template<typename T>
+        void append(std::vector<std::uint8_t> &bytes, T value)
+        {
+            const auto unsigned_value = std::bit_cast<std::make_unsigned_t<T>>(value);
+            for (std::size_t i = 0; i < sizeof(T); ++i)
+            {
+                bytes.push_back(static_cast<std::uint8_t>(unsigned_value >> (8 * i)));
+            }
+        }
+
+        inline void append(std::vector<std::uint8_t> &bytes, float value)
+        {
+            append(bytes, std::bit_cast<std::uint32_t>(value));
+        }
+
+        inline void append(std::vector<std::uint8_t> &bytes, const std::string &string)
+        {
+            bytes.insert(bytes.end(), string.begin(), string.end());
+            bytes.push_back(0);
+        }
+
+        inline void append_attribute(
+            std::vector<std::uint8_t> &bytes,
+            const std::string &name,
+            const std::string &type,
+            const std::vector<std::uint8_t> &value
+        )
+        {
+            append(bytes, name);
+            append(bytes, type);
+            append(bytes, static_cast<std::int32_t>(value.size()));
+            bytes.insert(bytes.end(), value.begin(), value.end());
+        }
+
+        /**
+         * @brief Applies OpenEXR's ZIP compression to the uncompressed bytes of a block.
+         *
+         * The bytes are split into two halves of alternating bytes, so that the high and low bytes of each sample are
+         * grouped, and then delta-encoded, before being deflated. A block that would not shrink is stored as is.
+         *
+         * @throws std::runtime_error Thrown if the compression process fails.
+         */
+        inline std::vector<std::uint8_t> compress_block(std::span<const std::uint8_t> raw)
+        {
+            std::vector<std::uint8_t> reordered(raw.size());
+            const std::size_t half = (raw.size() + 1) / 2;
+            for (std::size_t i = 0; i < raw.size(); ++i)
+            {
+                reordered[(i % 2 == 0 ? 0 : half) + i / 2] = raw[i];
+            }
+
+            for (std::size_t i = reordered.size(); i-- > 1;)
+            {
+                reordered[i] = static_cast<std::uint8_t>(reordered[i] - reordered[i - 1] + 128);
+            }
+
+            uLongf compressed_size = compressBound(static_cast<uLong>(reordered.size()));
+            std::vector<std::uint8_t> compressed(compressed_size);
+            if (const int status = compress2(compressed.data(), &compressed_size, reordered.data(), static_cast<uLong>(reordered.size()), Z_DEFAULT_COMPRESSION);
+                status != Z_OK)
+            {
+                throw std::runtime_error(fmt::format("failed on compress2() with error: {}", status));
+            }
+
+            if (compressed_size >= raw.size())
+            {
+                return std::vector<std::uint8_t>(raw.begin(), raw.end());
+            }
+
+            compressed.resize(compressed_size);
+            return compressed;
+        }
+    }
+
+    /**
+     * @brief A scanline OpenEXR image with ZIP compression, written from interleaved float channels.
+     */
+    struct image
+    {
+        /// The channels of the image. They are written in alphabetical order, as OpenEXR requires.
+        std::vector<exr::channel> channels;
+        /// The width of the image.
+        std::uint32_t             width;
+        /// The height of the image.
+        std::uint32_t             height;
+        /// The type every channel is stored as.
+        exr::pixel_type           type = exr::pixel_type::half;
+
+        /**
+         * @brief Encodes the image and writes it to a stream.
+         * @param[in] os The output stream.
+         * @param[in] pool If not null, the pool that compresses the blocks of the image in parallel.
+         * @throws std::runtime_error Thrown if the compression process fails.
+         */
+        void write_to(std::ostream &os, rt::thread_pool *pool = nullptr) const
+        {
+            std::vector<exr::channel> sorted = channels;
+            std::ranges::sort(sorted, { }, &exr::channel::name);
+
+            const std::vector<std::uint8_t> header = make_header(sorted);
+
+            const std::size_t block_count = (height + detail::lines_per_block - 1) / detail::lines_per_block;
+            std::vector<std::vector<std::uint8_t>> blocks(block_count);
+            std::vector<std::exception_ptr> errors(block_count);
+
+            const auto compress = [&](std::size_t index)
+            {
+                try
+                {
+                    blocks[index] = detail::compress_block(pack_block(sorted, index));
+                }
+                catch (...)
+                {
+                    errors[index] = std::current_exception();
+                }
+            };
+
+            if (pool == nullptr)
+            {
+                for (std::size_t index = 0; index < block_count; ++index)
+                {
+                    compress(index);
+                }
+            }
+            else
+            {
+                pool->run(block_count, compress);
+            }
+
+            for (const std::exception_ptr &error : errors)
+            {
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+            }
+
+            // The offset table holds the position of each block from the start of the file, and follows the header.
+            std::vector<std::uint8_t> offsets;
+            std::uint64_t offset = header.size() + block_count * sizeof(std::uint64_t);
+            for (const std::vector<std::uint8_t> &block : blocks)
+            {
+                detail::append(offsets, offset);
+                offset += 2 * sizeof(std::int32_t) + block.size();
+            }
+
+            os.write(reinterpret_cast<const char *>(header.data()), static_cast<std::streamsize>(header.size()));
+            os.write(reinterpret_cast<const char *>(offsets.data()), static_cast<std::streamsize>(offsets.size()));
+            for (std::size_t index = 0; index < block_count; ++index)
+            {
+                std::vector<std::uint8_t> prefix;
+                detail::append(prefix, static_cast<std::int32_t>(index * detail::lines_per_block));
+                detail::append(prefix, static_cast<std::int32_t>(blocks[index].size()));
+                os.write(reinterpret_cast<const char *>(prefix.data()), static_cast<std::streamsize>(prefix.size()));
+                os.write(reinterpret_cast<const char *>(blocks[index].data()), static_cast<std::streamsize>(blocks[index].size()));
+            }
+        }
+
+    private:
+        std::vector<std::uint8_t> make_header(std::span<const exr::channel> sorted) const
+        {
+            std::vector<std::uint8_t> bytes;
+
+            // The magic number, then version 2 with no flags set: a single-part scanline image.
+            detail::append(bytes, std::int32_t(20000630));
+            detail::append(bytes, std::int32_t(2));
+
+            std::vector<std::uint8_t> channel_list;
+            for (const exr::channel &channel : sorted)
+            {
+                detail::append(channel_list, channel.name);
+                detail::append(channel_list, static_cast<std::int32_t>(type));
+                // pLinear and three reserved bytes, then the x and y sampling rates.
+                detail::append(channel_list, std::uint32_t(0));
+                detail::append(channel_list, std::int32_t(1));
+                detail::append(channel_list, std::int32_t(1));
+            }
+            channel_list.push_back(0);
+
+            std::vector<std::uint8_t> window;
+            detail::append(window, std::int32_t(0));
+            detail::append(window, std::int32_t(0));
+            detail::append(window, static_cast<std::int32_t>(width) - 1);
+            detail::append(window, static_cast<std::int32_t>(height) - 1);
+
+            std::vector<std::uint8_t> one;
+            detail::append(one, 1.0F);
+
+            std::vector<std::uint8_t> origin;
+            detail::append(origin, 0.0F);
+            detail::append(origin, 0.0F);
+
+            constexpr std::uint8_t zip_compression = 3;
+            constexpr std::uint8_t increasing_y = 0;
+
+            detail::append_attribute(bytes, "channels", "chlist", channel_list);
+            detail::append_attribute(bytes, "compression", "compression", { zip_compression });
+            detail::append_attribute(bytes, "dataWindow", "box2i", window);
+            detail::append_attribute(bytes, "displayWindow", "box2i", window);
+            detail::append_attribute(bytes, "lineOrder", "lineOrder", { increasing_y });
+            detail::append_attribute(bytes, "pixelAspectRatio", "float", one);
+            detail::append_attribute(bytes, "screenWindowCenter", "v2f", origin);
+            detail::append_attribute(bytes, "screenWindowWidth", "float", one);
+            bytes.push_back(0);
+
+            return bytes;
+        }
+
+        /// Lays out the samples of a block scanline by scanline, and within each scanline channel by channel.
+        std::vector<std::uint8_t> pack_block(std::span<const exr::channel> sorted, std::size_t index) const
+        {
+            const std::size_t first_line = index * detail::lines_per_block;
+            const std::size_t line_count = std::min<std::size_t>(detail::lines_per_block, height - first_line);
+            const std::size_t sample_size = type == exr::pixel_type::half ? sizeof(std::uint16_t) : sizeof(float);
+
+            std::vector<std::uint8_t> bytes;
+            bytes.reserve(line_count * sorted.size() * width * sample_size);
+            for (std::size_t line = first_line; line < first_line + line_count; ++line)
+            {
+                for (const exr::channel &channel : sorted)
+                {
+                    for (std::size_t x = 0; x < width; ++x)
+                    {
+                        const float value = channel.values[(line * width + x) * channel.stride];
+                        if (type == exr::pixel_type::half)
+                        {
+                            detail::append(bytes, detail::to_half(value));
+                        }
+                        else
+                        {
+                            detail::append(bytes, value);
+                        }
+                    }
+                }
+            }
+
+            return bytes;
+        }
+    };
+}
+
+#endif // !RAYTRACER_EXR_HPP
@@ -0,0 +1,142 @@
+/**
+ * @file framebuffer.hpp
+ * @brief Resolving accumulated samples into a high dynamic range image.
+ */
+
+#ifndef RAYTRACER_FRAMEBUFFER_HPP
+#define RAYTRACER_FRAMEBUFFER_HPP
+
+#include "accumulation.hpp"
+#include "math.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <span>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief A linear, high dynamic range image in single-precision float RGBA, with optional auxiliary outputs.
+     *
+     * Values are stored as computed, without clamping, tonemapping or gamma, so they can be written to HDR formats
+     * or post-processed. Use rt::tonemap to get an 8-bit image.
+     */
+    class framebuffer
+    {
+    public:
+        /**
+         * @param[in] has_aovs Whether to store the albedo, normal and depth outputs.
+         */
+        explicit framebuffer(std::uint32_t width, std::uint32_t height, bool has_aovs = false)
+            : width_(width)
+            , height_(height)
+            , color_(static_cast<std::size_t>(width) * height, glm::vec4(0.0F, 0.0F, 0.0F, 1.0F))
+        {
+            if (has_aovs)
+            {
+                albedo_.assign(color_.size(), glm::vec3(0.0F));
+                normal_.assign(color_.size(), glm::vec3(0.0F));
+                depth_.assign(color_.size(), std::numeric_limits<float>::infinity());
+            }
+        }
+
+        /// Estimates every pixel, and every auxiliary output that the buffer keeps, from the samples taken so far.
+        static framebuffer resolve(const rt::accumulation_buffer &accumulation)
+        {
+            framebuffer image(accumulation.width(), accumulation.height(), accumulation.has_aovs());
+            for (std::size_t pixel = 0; pixel < image.color_.size(); ++pixel)
+            {
+                image.color_[pixel] = glm::vec4(glm::vec3(accumulation.mean(pixel)), 1.0F);
+            }
+
+            if (image.has_aovs())
+            {
+                const std::span<const real> depths = accumulation.depths();
+                for (std::size_t pixel = 0; pixel < image.color_.size(); ++pixel)
+                {
+                    image.albedo_[pixel] = glm::vec3(accumulation.mean_albedo(pixel));
+                    image.normal_[pixel] = glm::vec3(accumulation.mean_normal(pixel));
+                    image.depth_[pixel] = static_cast<float>(depths[pixel]);
+                }
+            }
+
+            return image;
+        }
+
+        std::uint32_t width() const
+        {
+            return width_;
+        }
+
+        std::uint32_t height() const
+        {
+            return height_;
+        }
+
+        /// Whether the image has the albedo, normal and depth outputs.
+        bool has_aovs() const
+        {
+            return !depth_.empty();
+        }
+
+        /// The linear color and alpha of each pixel, in row-major order from the top-left.
+        std::span<glm::vec4> color()
+        {
+            return color_;
+        }
+
+        std::span<const glm::vec4> color() const
+        {
+            return color_;
+        }
+
+        /// The albedo of each pixel, or empty if the image has no auxiliary outputs.
+        std::span<glm::vec3> albedo()
+        {
+            return albedo_;
+        }
+
+        std::span<const glm::vec3> albedo() const
+        {
+            return albedo_;
+        }
+
+        /// The unit world-space normal of each pixel, zero where nothing was hit, or empty if the image has no
+        /// auxiliary outputs.
+        std::span<glm::vec3> normal()
+        {
+            return normal_;
+        }
+
+        std::span<const glm::vec3> normal() const
+        {
+            return normal_;
+        }
+
+        /// The distance to the nearest surface in each pixel, infinite where nothing was hit, or empty if the image
+        /// has no auxiliary outputs.
+        std::span<float> depth()
+        {
+            return depth_;
+        }
+
+        std::span<const float> depth() const
+        {
+            return depth_;
+        }
+
+    private:
+        std::uint32_t          width_;
+        std::uint32_t          height_;
+        std::vector<glm::vec4> color_;
+        std::vector<glm::vec3> albedo_;
+        std::vector<glm::vec3> normal_;
+        std::vector<float>     depth_;
+    };
+}
+
+#endif // !RAYTRACER_FRAMEBUFFER_HPP
@@ -0,0 +1,162 @@
+/**
+ * @file instance.hpp
+ * @brief Placing shared copies of an object in a scene with their own transforms.
+ */
+
+#ifndef RAYTRACER_INSTANCE_HPP
+#define RAYTRACER_INSTANCE_HPP
+
+#include "aabb.hpp"
+#include "camera.hpp"
+#include "math.hpp"
+#include "packet.hpp"
+#include "shape.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace rt
+{
+    /// An affine transform: a 3x3 linear part in the first three columns, followed by a translation.
+    using affine_transform = glm::mat<4, 3, real, glm::defaultp>;
+
+    /**
+     * @brief A copy of a shared object, such as a triangle mesh with its own hierarchy, placed by an affine transform.
+     *
+     * Rays are moved into the object's space rather than the object into the world, so every copy shares one set of
+     * geometry and one bottom-level hierarchy, and costs only its transforms. The scene's rt::world then builds its
+     * top-level hierarchy over the bounds of the instances. Directions are transformed without normalizing them,
+     * which keeps the distance along the ray the same in both spaces.
+     *
+     * Hits found through an instance are resolved by it, so an instance cannot be placed inside another.
+     */
+    class instance : public hittable
+    {
+    public:
+        /**
+         * @param[in] object The object to place, which may be shared with other instances.
+         * @param[in] object_to_world The transform from the object's space into the world. It must be invertible.
+         * @param[in] material If given, the index of the material of the whole copy, replacing the object's own.
+         */
+        explicit instance(
+            std::shared_ptr<const rt::hittable> object,
+            const mat4 &object_to_world,
+            std::optional<std::uint32_t> material = std::nullopt
+        )
+            : object_(std::move(object))
+            , object_to_world_(object_to_world)
+            , world_to_object_(glm::inverse(object_to_world))
+            , material_(material)
+        {
+            const rt::aabb object_bounds = object_->bounding_box();
+            if (object_bounds.empty())
+            {
+                return;
+            }
+
+            for (std::size_t corner = 0; corner < 8; ++corner)
+            {
+                const vec3 point(
+                    (corner & 1) != 0 ? object_bounds.max.x : object_bounds.min.x,
+                    (corner & 2) != 0 ? object_bounds.max.y : object_bounds.min.y,
+                    (corner & 4) != 0 ? object_bounds.max.z : object_bounds.min.z
+                );
+                bounds_.expand(object_to_world_ * glm::vec<4, real, glm::defaultp>(point, real(1.0)));
+            }
+        }
+
+        [[nodiscard]]
+        std::optional<rt::hit_record> intersect(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            std::optional record = object_->intersect(to_object(ray), t_min, t_max);
+            if (record)
+            {
+                record->instance = this;
+            }
+
+            return record;
+        }
+
+        void intersect_packet(const rt::ray_packet &packet, real t_min, rt::packet_hits &hits) const override
+        {
+            rt::ray_packet object_packet;
+            for (std::size_t ray = 0; ray < packet.count; ++ray)
+            {
+                object_packet.push_back(to_object(packet[ray]));
+            }
+
+            // Distances are the same in both spaces, so the intervals carry over and only new hits need marking.
+            rt::packet_hits object_hits(object_packet, real(0.0));
+            object_hits.t_max = hits.t_max;
+            object_->intersect_packet(object_packet, t_min, object_hits);
+            for (std::size_t ray = 0; ray < packet.count; ++ray)
+            {
+                if (object_hits.hits[ray])
+                {
+                    hits.t_max[ray] = object_hits.t_max[ray];
+                    hits.hits[ray] = object_hits.hits[ray];
+                    hits.hits[ray]->instance = this;
+                }
+            }
+        }
+
+        [[nodiscard]]
+        bool occluded(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            return object_->occluded(to_object(ray), t_min, t_max);
+        }
+
+        /**
+         * @copydoc rt::hittable::resolve
+         * @note The object resolves the hit in its own space, and the result is moved back into the world.
+         */
+        [[nodiscard]]
+        rt::hit resolve(const rt::ray &ray, const rt::hit_record &record) const override
+        {
+            const rt::hit object_hit = record.object->resolve(to_object(ray), record);
+
+            // Normals transform by the inverse transpose of the linear part, which keeps them perpendicular to the
+            // surface under non-uniform scaling.
+            const glm::mat<3, 3, real, glm::defaultp> normal_matrix = glm::transpose(glm::mat<3, 3, real, glm::defaultp>(world_to_object_));
+            const vec3 outward_normal = object_hit.front_face() ? object_hit.normal() : -object_hit.normal();
+
+            return rt::hit(
+                ray.at(record.t),
+                glm::normalize(normal_matrix * outward_normal),
+                material_.value_or(object_hit.material()),
+                ray,
+                record.t
+            );
+        }
+
+        [[nodiscard]]
+        rt::aabb bounding_box() const override
+        {
+            return bounds_;
+        }
+
+    private:
+        rt::ray to_object(const rt::ray &ray) const
+        {
+            using vec4 = glm::vec<4, real, glm::defaultp>;
+            return rt::ray(
+                world_to_object_ * vec4(ray.origin(), real(1.0)),
+                world_to_object_ * vec4(ray.direction(), real(0.0))
+            );
+        }
+
+    private:
+        std::shared_ptr<const rt::hittable> object_;
+        rt::affine_transform                object_to_world_;
+        rt::affine_transform                world_to_object_;
+        std::optional<std::uint32_t>        material_;
+        rt::aabb                            bounds_;
+    };
+}
+
+#endif // !RAYTRACER_INSTANCE_HPP
@@ -0,0 +1,660 @@
+/**
+ * @file integrator.hpp
+ * @brief Estimating the light arriving along camera rays.
+ */
+
+#ifndef RAYTRACER_INTEGRATOR_HPP
+#define RAYTRACER_INTEGRATOR_HPP
+
+#include "camera.hpp"
+#include "color.hpp"
+#include "light.hpp"
+#include "material.hpp"
+#include "math.hpp"
+#include "packet.hpp"
+#include "sampler.hpp"
+#include "shape.hpp"
+#include "stats.hpp"
+#include "world.hpp"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace rt
+{
+    enum class trace_method
+    {
+        single = 0,
+        packet = 1,
+    };
+
+    /// The color of the sky seen along a ray that escapes the scene.
+    inline vec3 background(const rt::ray &ray)
+    {
+        const vec3 direction = glm::normalize(ray.direction());
+
+        const real t = real(0.5) * (direction.y + real(1.0));
+
+        constexpr vec3 blue (real(0.5), real(0.7), real(1.0));
+        constexpr vec3 white(real(1.0), real(1.0), real(1.0));
+
+        return lerp(blue, white, t);
+    }
+
+    /**
+     * @brief The per-pixel sums of the auxiliary outputs of the first surface each path hits. Empty spans record
+     *        nothing.
+     * @see rt::accumulation_buffer
+     */
+    struct aov_accumulator
+    {
+        /// The weighted albedo of the surface, or of the sky for paths that escape at once.
+        std::span<vec3> albedo_sums;
+        /// The weighted world-space normal of the surface, facing the camera.
+        std::span<vec3> normal_sums;
+        /// The nearest distance from the camera to the surface.
+        std::span<real> depths;
+    };
+
+    /**
+     * @brief An iterative path tracer that advances a whole batch of paths one bounce at a time.
+     *
+     * Camera rays are queued with add() and traced when the batch is full or flush() is called. Each bounce runs as a
+     * sequence of tight loops over flat arrays of path state: intersect every live path, accumulate the paths that
+     * escaped, sort the rest by material, scatter each run of paths on the same material with a single dispatch,
+     * trace the shadow rays that scattering queued, and finally compact away the paths that were absorbed.
+     *
+     * At every surface that is not perfectly specular, a path also samples one of the scene's lights directly (next
+     * event estimation) and queues a shadow ray towards it. Light that a scattered ray then finds by chance on an
+     * emissive surface could have been found by either strategy, so both are weighted by the power heuristic
+     * (multiple importance sampling), which keeps small and large lights alike from becoming noisy.
+     *
+     * Once a path is deep enough, it is randomly terminated with a probability that grows as its throughput falls
+     * (Russian roulette), and survivors are reweighted to keep the estimate unbiased. This stops long chains of
+     * bounces that carry almost no light from costing as much as the paths that matter.
+     *
+     * Every random decision along a path, from scattering to roulette, draws on the path's own dimensions of the
+     * rt::sampler, so a well-stratified sampler reduces noise at every bounce and not only on the image plane.
+     *
+     * @tparam Precision The rt::precision_policy that paths are traced and pixels are summed with. Paths are traced
+     *                   in ::real, which the shapes of the world share, but pixels can be summed in a wider type, so
+     *                   variants that differ only in accumulation can be built side by side.
+     */
+    template <typename Precision = rt::precision>
+    class basic_wavefront_integrator
+    {
+        static_assert(
+            std::is_same_v<typename Precision::trace_real, real>,
+            "paths must be traced in the precision that the world was built in"
+        );
+
+    public:
+        using accumulate_real = typename Precision::accumulate_real;
+        using accumulate_vec3 = typename Precision::accumulate_vec3;
+
+        struct create_parameters
+        {
+            /// The largest number of intersection tests along a single path.
+            std::uint32_t    max_depth = 64;
+            /// The number of bounces after which paths become subject to Russian roulette.
+            std::uint32_t    roulette_depth = 4;
+            /// Whether camera rays are intersected in rt::ray_packet%s or one at a time. Bounced rays are always
+            /// traced one at a time, as they are rarely coherent.
+            rt::trace_method tracing = rt::trace_method::packet;
+            /// The number of paths traced together.
+            std::size_t      batch_size = std::size_t(1) << 14;
+            /// The memory that path state and scratch space are allocated from, which must outlive the integrator.
+            /// An rt::scratch_arena that is reset after each tile saves allocating it all again for the next.
+            std::pmr::memory_resource *memory = std::pmr::get_default_resource();
+        };
+
+        /**
+         * @param[in] world The scene to trace.
+         * @param[in] materials The material table that the surfaces of the world index into.
+         * @param[in] lights The lights that paths sample directly, which the emissive materials refer to.
+         * @param[in] sampler The source of the sample points for every random decision along a path.
+         * @param[out] accumulator The per-pixel sums that the weighted radiance of each path is added to.
+         * @param[in] parameters How paths are traced.
+         * @param[out] luminance_squares If not empty, the per-pixel sums that the square of the luminance of each
+         *                               path's weighted radiance is added to, for estimating variance.
+         * @param[out] aovs The per-pixel auxiliary outputs to record the first hit of each path into.
+         */
+        explicit basic_wavefront_integrator(
+            const rt::world &world,
+            std::span<const rt::material> materials,
+            const rt::light_set &lights,
+            const rt::sampler &sampler,
+            std::span<accumulate_vec3> accumulator,
+            const create_parameters &parameters,
+            std::span<accumulate_real> luminance_squares = { },
+            const rt::aov_accumulator &aovs = { }
+        )
+            : world_(&world)
+            , materials_(materials)
+            , lights_(&lights)
+            , sampler_(&sampler)
+            , accumulator_(accumulator)
+            , luminance_squares_(luminance_squares)
+            , aovs_(aovs)
+            , max_depth_(parameters.max_depth)
+            , roulette_depth_(parameters.roulette_depth)
+            , tracing_(parameters.tracing)
+            , batch_size_(std::max<std::size_t>(parameters.batch_size, 1))
+            , rays_(parameters.memory)
+            , throughputs_(parameters.memory)
+            , radiances_(parameters.memory)
+            , scatter_pdfs_(parameters.memory)
+            , weights_(parameters.memory)
+            , pixels_(parameters.memory)
+            , samples_(parameters.memory)
+            , hits_(parameters.memory)
+            , active_(parameters.memory)
+            , material_counts_(parameters.memory)
+            , sorted_(parameters.memory)
+            , active_samples_(parameters.memory)
+            , direction_samples_(parameters.memory)
+            , choice_samples_(parameters.memory)
+            , light_samples_(parameters.memory)
+            , roulette_samples_(parameters.memory)
+            , shadow_rays_(parameters.memory)
+        {
+            rays_.reserve(batch_size_);
+            throughputs_.reserve(batch_size_);
+            radiances_.reserve(batch_size_);
+            scatter_pdfs_.reserve(batch_size_);
+            weights_.reserve(batch_size_);
+            pixels_.reserve(batch_size_);
+            samples_.reserve(batch_size_);
+            hits_.reserve(batch_size_);
+            active_.reserve(batch_size_);
+        }
+
+        /**
+         * @brief Queues a camera ray, tracing the current batch first if it is full.
+         * @param[in] ray The camera ray.
+         * @param[in] pixel The index into the accumulator that the path's radiance is added to.
+         * @param[in] weight The factor that the path's radiance is scaled by.
+         * @param[in] sample The sample that the camera ray was generated for, which the rest of the path continues.
+         */
+        void add(const rt::ray &ray, std::uint32_t pixel, real weight, const rt::sample_id &sample)
+        {
+            if (rays_.size() == batch_size_)
+            {
+                flush();
+            }
+
+            rays_.push_back(ray);
+            throughputs_.push_back(vec3(real(1.0)));
+            radiances_.push_back(vec3(real(0.0)));
+            scatter_pdfs_.push_back(real(0.0));
+            weights_.push_back(weight);
+            pixels_.push_back(pixel);
+            samples_.push_back(sample);
+        }
+
+        /// Traces every queued path to completion and adds its radiance to the accumulator.
+        void flush()
+        {
+            hits_.assign(rays_.size(), std::nullopt);
+
+            active_.resize(rays_.size());
+            for (std::uint32_t i = 0; i < active_.size(); ++i)
+            {
+                active_[i] = i;
+            }
+
+            for (std::uint32_t depth = 0; depth < max_depth_ && !active_.empty(); ++depth)
+            {
+                rt::stats::add(depth == 0 ? &rt::stats::counters::primary_rays : &rt::stats::counters::secondary_rays, active_.size());
+                rt::stats::add_paths_at_depth(depth, active_.size());
+
+                const bool use_packets = depth == 0 && tracing_ == rt::trace_method::packet;
+                if (use_packets)
+                {
+                    intersect_packets();
+                }
+                else
+                {
+                    intersect();
+                }
+
+                if (depth == 0)
+                {
+                    record_aovs();
+                }
+
+                accumulate_escaped();
+                sort_by_material();
+                scatter(depth);
+                trace_shadow_rays();
+
+                if (depth + 1 >= roulette_depth_)
+                {
+                    play_roulette();
+                }
+            }
+
+            // Every path has now escaped, been absorbed or run out of bounces, so its light can go to its pixel.
+            for (std::uint32_t path = 0; path < rays_.size(); ++path)
+            {
+                const vec3 radiance = weights_[path] * radiances_[path];
+                accumulator_[pixels_[path]] += accumulate_vec3(radiance);
+                if (!luminance_squares_.empty())
+                {
+                    // The second moment of the weighted estimate, so the weight is squared along with the radiance.
+                    const real y = luminance(radiance);
+                    luminance_squares_[pixels_[path]] += accumulate_real(y * y);
+                }
+            }
+
+            rays_.clear();
+            throughputs_.clear();
+            radiances_.clear();
+            scatter_pdfs_.clear();
+            weights_.clear();
+            pixels_.clear();
+            samples_.clear();
+            hits_.clear();
+            active_.clear();
+        }
+
+        /// The number of rays traced so far, counting every bounce and shadow ray, for reporting throughput.
+        [[nodiscard]]
+        std::uint64_t ray_count() const
+        {
+            return ray_count_;
+        }
+
+    private:
+        void intersect()
+        {
+            constexpr real t_max = std::numeric_limits<real>::infinity();
+            ray_count_ += active_.size();
+            for (const std::uint32_t path : active_)
+            {
+                hits_[path] = world_->hit(rays_[path], t_min, t_max);
+            }
+        }
+
+        void intersect_packets()
+        {
+            ray_count_ += active_.size();
+
+            rt::ray_packet packet;
+            for (std::size_t first = 0; first < active_.size(); first += rt::packet_size)
+            {
+                const std::size_t count = std::min(rt::packet_size, active_.size() - first);
+
+                packet.count = 0;
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    packet.push_back(rays_[active_[first + i]]);
+                }
+
+                rt::packet_hits hits(packet, std::numeric_limits<real>::infinity());
+                world_->intersect_packet(packet, t_min, hits);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    const std::uint32_t path = active_[first + i];
+                    if (hits.hits[i])
+                    {
+                        hits_[path] = world_->resolve(rays_[path], *hits.hits[i]);
+                    }
+                    else
+                    {
+                        hits_[path].reset();
+                    }
+                }
+            }
+        }
+
+        /// Adds the first surface hit by every path to the auxiliary outputs.
+        void record_aovs()
+        {
+            for (const std::uint32_t path : active_)
+            {
+                const std::uint32_t pixel = pixels_[path];
+                const real weight = weights_[path];
+                const std::optional<rt::hit> &hit = hits_[path];
+
+                if (!aovs_.albedo_sums.empty())
+                {
+                    aovs_.albedo_sums[pixel] += weight * (hit ? rt::albedo(materials_[hit->material()]) : rt::background(rays_[path]));
+                }
+
+                if (!hit)
+                {
+                    continue;
+                }
+
+                if (!aovs_.normal_sums.empty())
+                {
+                    aovs_.normal_sums[pixel] += weight * hit->normal();
+                }
+
+                if (!aovs_.depths.empty())
+                {
+                    aovs_.depths[pixel] = glm::min(aovs_.depths[pixel], glm::distance(hit->point(), rays_[path].origin()));
+                }
+            }
+        }
+
+        /// Adds the sky's contribution for every path that escaped, and removes those paths from the active set.
+        void accumulate_escaped()
+        {
+            for (const std::uint32_t path : active_)
+            {
+                if (!hits_[path])
+                {
+                    radiances_[path] += throughputs_[path] * rt::background(rays_[path]);
+                }
+            }
+
+            std::erase_if(active_, [&](std::uint32_t path) { return !hits_[path]; });
+        }
+
+        /**
+         * @brief Groups the active paths by the index of the material they hit.
+         *
+         * Material indices are dense, so a counting sort over the table is far cheaper than a comparison sort. Tables
+         * larger than the batch fall back to a comparison sort, since clearing the counts would dominate.
+         */
+        void sort_by_material()
+        {
+            if (materials_.size() > active_.size())
+            {
+                std::ranges::sort(active_, { }, [&](std::uint32_t path) { return hits_[path]->material(); });
+                return;
+            }
+
+            material_counts_.assign(materials_.size(), 0);
+            for (const std::uint32_t path : active_)
+            {
+                ++material_counts_[hits_[path]->material()];
+            }
+
+            std::uint32_t offset = 0;
+            for (std::uint32_t &count : material_counts_)
+            {
+                offset += std::exchange(count, offset);
+            }
+
+            sorted_.resize(active_.size());
+            for (const std::uint32_t path : active_)
+            {
+                sorted_[material_counts_[hits_[path]->material()]++] = path;
+            }
+
+            std::swap(active_, sorted_);
+        }
+
+        /// Bounces every active path off the surface it hit, and removes the paths that were absorbed.
+        void scatter(std::uint32_t depth)
+        {
+            // Generate the bounce's sample points for every path up front, so the sampler can batch its work.
+            active_samples_.clear();
+            for (const std::uint32_t path : active_)
+            {
+                active_samples_.push_back(samples_[path]);
+            }
+
+            direction_samples_.resize(active_.size());
+            choice_samples_.resize(active_.size());
+            sampler_->sample_batch(active_samples_, direction_dimension(depth), direction_samples_);
+            sampler_->sample_batch(active_samples_, choice_dimension(depth), choice_samples_);
+            light_samples_.resize(lights_->empty() ? 0 : active_.size());
+            if (!lights_->empty())
+            {
+                sampler_->sample_batch(active_samples_, light_dimension(depth), light_samples_);
+            }
+
+            roulette_samples_.resize(rays_.size());
+
+            // The paths are sorted by material, so each run of equal indices is dispatched once and then scattered by
+            // a loop that calls the concrete material directly.
+            for (std::size_t first = 0; first < active_.size();)
+            {
+                const std::uint32_t material = hits_[active_[first]]->material();
+                std::size_t last = first + 1;
+                while (last < active_.size() && hits_[active_[last]]->material() == material)
+                {
+                    ++last;
+                }
+
+                std::visit([&](const auto &alternative)
+                {
+                    for (std::size_t i = first; i < last; ++i)
+                    {
+                        scatter_path(alternative, i);
+                    }
+                }, materials_[material]);
+
+                if constexpr (rt::stats::enabled)
+                {
+                    const auto absorbed = static_cast<std::uint64_t>(
+                        std::count_if(active_.begin() + first, active_.begin() + last, [&](std::uint32_t path) { return !hits_[path]; })
+                    );
+                    rt::stats::add_scatter(materials_[material].index(), last - first - absorbed, absorbed);
+                }
+
+                first = last;
+            }
+
+            std::erase_if(active_, [&](std::uint32_t path) { return !hits_[path]; });
+        }
+
+        /// Bounces the `i`th active path off its surface, whose material is `material`, or marks it as absorbed.
+        template <typename Material>
+        void scatter_path(const Material &material, std::size_t i)
+        {
+            const std::uint32_t path = active_[i];
+            const rt::scatter_sample sample = {
+                .direction = direction_samples_[i],
+                .choice    = choice_samples_[i].x,
+            };
+            roulette_samples_[path] = choice_samples_[i].y;
+
+            const rt::hit &hit = *hits_[path];
+            if constexpr (std::is_same_v<Material, rt::emissive>)
+            {
+                add_emitted(material, path, hit);
+            }
+
+            if constexpr (rt::evaluable_material<Material>)
+            {
+                if (!lights_->empty())
+                {
+                    sample_light(material, path, hit, light_samples_[i]);
+                }
+            }
+
+            if (const std::optional maybe_scattered = material.scatter(rays_[path], hit, sample))
+            {
+                if constexpr (rt::evaluable_material<Material>)
+                {
+                    scatter_pdfs_[path] = material.pdf(hit, maybe_scattered->ray.direction());
+                }
+                else
+                {
+                    // Light sampling can never pick a specular direction, so light found along it is not weighted.
+                    scatter_pdfs_[path] = real(0.0);
+                }
+
+                rays_[path] = maybe_scattered->ray;
+                throughputs_[path] *= maybe_scattered->color;
+            }
+            else
+            {
+                hits_[path] = std::nullopt;
+            }
+        }
+
+        /// Adds the light that a path found on an emissive surface, weighted against sampling the same light directly.
+        void add_emitted(const rt::emissive &material, std::uint32_t path, const rt::hit &hit)
+        {
+            real weight = real(1.0);
+            if (const std::optional light = material.light(); light && scatter_pdfs_[path] > real(0.0))
+            {
+                const rt::ray &ray = rays_[path];
+                const real light_pdf = lights_->pdf(*light, ray.origin(), glm::normalize(ray.direction()));
+                weight = rt::power_heuristic(scatter_pdfs_[path], light_pdf);
+            }
+
+            radiances_[path] += weight * throughputs_[path] * material.emitted(hit);
+        }
+
+        /// Queues a shadow ray towards a light sampled from the surface that a path hit.
+        template <rt::evaluable_material Material>
+        void sample_light(const Material &material, std::uint32_t path, const rt::hit &hit, vec2 u)
+        {
+            const std::optional light_sample = lights_->sample(hit.point(), u);
+            if (!light_sample || light_sample->pdf <= real(0.0))
+            {
+                return;
+            }
+
+            const vec3 reflected = material.evaluate(hit, light_sample->direction);
+            if (reflected == vec3(real(0.0)))
+            {
+                return;
+            }
+
+            const real weight = light_sample->is_delta
+                ? real(1.0)
+                : rt::power_heuristic(light_sample->pdf, material.pdf(hit, light_sample->direction));
+
+            shadow_rays_.push_back({
+                .ray      = rt::ray(hit.point(), light_sample->direction),
+                .t_max    = light_sample->distance - t_min,
+                .radiance = (weight / light_sample->pdf) * throughputs_[path] * reflected * light_sample->radiance,
+                .path     = path,
+            });
+        }
+
+        /// Traces every queued shadow ray, and adds the light of those that reach their light unblocked.
+        void trace_shadow_rays()
+        {
+            ray_count_ += shadow_rays_.size();
+            rt::stats::add(&rt::stats::counters::shadow_rays, shadow_rays_.size());
+            for (const shadow_ray &shadow : shadow_rays_)
+            {
+                if (!world_->occluded(shadow.ray, t_min, shadow.t_max))
+                {
+                    radiances_[shadow.path] += shadow.radiance;
+                }
+            }
+
+            shadow_rays_.clear();
+        }
+
+        /**
+         * @brief Randomly terminates active paths in proportion to how little light they can still carry.
+         *
+         * A path survives with probability equal to its largest throughput component, capped at 1, and survivors are
+         * divided by that probability. Paths whose throughput has reached zero are always terminated. The test uses the
+         * sample point that scatter() generated for the same bounce.
+         */
+        void play_roulette()
+        {
+            for (const std::uint32_t path : active_)
+            {
+                const vec3 &throughput = throughputs_[path];
+                const real survival = glm::min(glm::max(throughput.x, glm::max(throughput.y, throughput.z)), real(1.0));
+                if (survival <= real(0.0) || (survival < real(1.0) && roulette_samples_[path] >= survival))
+                {
+                    hits_[path] = std::nullopt;
+                }
+                else
+                {
+                    throughputs_[path] /= survival;
+                }
+            }
+
+            std::erase_if(active_, [&](std::uint32_t path) { return !hits_[path]; });
+        }
+
+        /// The sample dimension of the direction scattered at the given bounce.
+        static std::uint32_t direction_dimension(std::uint32_t depth)
+        {
+            return rt::dimension::bounce + rt::dimension::per_bounce * depth;
+        }
+
+        /// The sample dimension whose halves drive the discrete scatter choice and the roulette at the given bounce.
+        static std::uint32_t choice_dimension(std::uint32_t depth)
+        {
+            return rt::dimension::bounce + rt::dimension::per_bounce * depth + 1;
+        }
+
+        /// The sample dimension that picks a light, and a point on it, at the given bounce.
+        static std::uint32_t light_dimension(std::uint32_t depth)
+        {
+            return rt::dimension::bounce + rt::dimension::per_bounce * depth + 2;
+        }
+
+    private:
+        /// A ray towards a sampled light, and the light its path gains if nothing blocks it.
+        struct shadow_ray
+        {
+            rt::ray       ray;
+            real          t_max;
+            vec3          radiance;
+            std::uint32_t path;
+        };
+
+    private:
+        const rt::world              *world_;
+        std::span<const rt::material> materials_;
+        const rt::light_set          *lights_;
+        const rt::sampler            *sampler_;
+        std::span<accumulate_vec3>    accumulator_;
+        std::span<accumulate_real>    luminance_squares_;
+        rt::aov_accumulator           aovs_;
+        std::uint32_t                 max_depth_;
+        std::uint32_t                 roulette_depth_;
+        rt::trace_method              tracing_;
+        std::size_t                   batch_size_;
+        std::uint64_t                 ray_count_ = 0;
+
+        std::pmr::vector<rt::ray>                rays_;
+        std::pmr::vector<vec3>                   throughputs_;
+        /// The light gathered along each path so far, which is added to the accumulator once the path ends.
+        std::pmr::vector<vec3>                   radiances_;
+        /// The density with which the last bounce of each path picked its direction, or 0 if it was specular.
+        std::pmr::vector<real>                   scatter_pdfs_;
+        std::pmr::vector<real>                   weights_;
+        std::pmr::vector<std::uint32_t>          pixels_;
+        std::pmr::vector<rt::sample_id>          samples_;
+        std::pmr::vector<std::optional<rt::hit>> hits_;
+        std::pmr::vector<std::uint32_t>          active_;
+
+        // Scratch space for sort_by_material().
+        std::pmr::vector<std::uint32_t> material_counts_;
+        std::pmr::vector<std::uint32_t> sorted_;
+
+        // Scratch space for scatter(), and the roulette samples it leaves for play_roulette().
+        std::pmr::vector<rt::sample_id> active_samples_;
+        std::pmr::vector<vec2>          direction_samples_;
+        std::pmr::vector<vec2>          choice_samples_;
+        std::pmr::vector<vec2>          light_samples_;
+        std::pmr::vector<real>          roulette_samples_;
+
+        // The shadow rays that scatter() queues for trace_shadow_rays().
+        std::pmr::vector<shadow_ray>    shadow_rays_;
+    };
+
+    /// The path tracer in the precision that the program is built with.
+    using wavefront_integrator = rt::basic_wavefront_integrator<rt::precision>;
+}
+
+#endif // !RAYTRACER_INTEGRATOR_HPP
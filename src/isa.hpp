@@ -0,0 +1,111 @@
+/**
+ * @file isa.hpp
+ * @brief Detecting the SIMD instruction sets of the running CPU, and compiling kernels for each of them.
+ */
+
+#ifndef RAYTRACER_ISA_HPP
+#define RAYTRACER_ISA_HPP
+
+#include <string_view>
+
+/**
+ * @def RAYTRACER_DISPATCH
+ * @brief Marks a free function to be compiled once for each of AVX-512, AVX2, SSE4.2 and the baseline instruction
+ *        set, with the best version for the running CPU picked when the program loads.
+ *
+ * Only plain loops over arrays benefit, since the compiler vectorizes each version to its own width. It marks the PNG
+ * row filters and the random sampler's batch. The intersection kernels are not dispatched: their rt::simd::real_lanes
+ * are as wide as the registers of the build's baseline, which RAYTRACER_NATIVE_ARCH widens to those of the build
+ * machine.
+ *
+ * The build turns off floating-point contraction wherever it enables this, so that no version fuses multiplies and
+ * adds, not even the AVX-512 one whose target implies FMA, and results do not depend on the CPU a render runs on.
+ *
+ * It expands to nothing unless the build enables RAYTRACER_ISA_DISPATCH, and on compilers and targets that lack
+ * function multiversioning, which includes every target but x86-64 ELF. Virtual functions cannot be multiversioned,
+ * so kernels behind a virtual call are written as free functions that it calls.
+ */
+#if defined(RAYTRACER_ISA_DISPATCH) && defined(__GNUC__) && defined(__x86_64__) && defined(__ELF__)
+    #define RAYTRACER_DISPATCH [[gnu::target_clones("avx512f", "avx2", "sse4.2", "default")]]
+    #define RAYTRACER_HAS_DISPATCH
+#else
+    #define RAYTRACER_DISPATCH
+#endif
+
+namespace rt
+{
+    /// The SIMD instruction sets that kernels are specialized for.
+    enum class isa
+    {
+        /// The baseline of the target, such as SSE2 on x86-64.
+        generic = 0,
+        sse4    = 1,
+        avx2    = 2,
+        avx512  = 3,
+        /// Advanced SIMD, which every AArch64 CPU has.
+        neon    = 4,
+    };
+
+    /// The best instruction set that the running CPU supports.
+    [[nodiscard]]
+    inline rt::isa detect_isa()
+    {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return rt::isa::avx512;
+        }
+
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return rt::isa::avx2;
+        }
+
+        if (__builtin_cpu_supports("sse4.2"))
+        {
+            return rt::isa::sse4;
+        }
+
+        return rt::isa::generic;
+#elif defined(__aarch64__) || defined(_M_ARM64)
+        return rt::isa::neon;
+#else
+        return rt::isa::generic;
+#endif
+    }
+
+    /// The instruction set that functions marked RAYTRACER_DISPATCH run in, which is the baseline of the build
+    /// unless it compiles them for several.
+    [[nodiscard]]
+    inline rt::isa dispatched_isa()
+    {
+#ifdef RAYTRACER_HAS_DISPATCH
+        return rt::detect_isa();
+#else
+        return rt::isa::generic;
+#endif
+    }
+
+    /// The name of an instruction set, for reports.
+    [[nodiscard]]
+    constexpr std::string_view isa_name(rt::isa isa)
+    {
+        switch (isa)
+        {
+        case rt::isa::sse4:
+            return "SSE4.2";
+        case rt::isa::avx2:
+            return "AVX2";
+        case rt::isa::avx512:
+            return "AVX-512";
+        case rt::isa::neon:
+            return "NEON";
+        case rt::isa::generic:
+            break;
+        }
+
+        return "generic";
+    }
+}
+
+#endif // !RAYTRACER_ISA_HPP
@@ -0,0 +1,239 @@
+/**
+ * @file light.hpp
+ * @brief Lights that can be sampled directly from a point on a surface.
+ */
+
+#ifndef RAYTRACER_LIGHT_HPP
+#define RAYTRACER_LIGHT_HPP
+
+#include "math.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief The light arriving at a point from a direction chosen towards a light.
+     */
+    struct light_sample
+    {
+        /// The unit direction from the point towards the light.
+        vec3 direction;
+        /// The distance along `direction` to the light, which a shadow ray must reach unblocked.
+        real distance;
+        /// The radiance arriving from the light, or for a point light, the irradiance it casts.
+        vec3 radiance;
+        /// The probability density of choosing the light and then `direction`, per unit solid angle.
+        real pdf;
+        /// Whether only light sampling can find the light, so the sample needs no multiple importance weight.
+        bool is_delta;
+    };
+
+    /**
+     * @brief A light that emits equally in every direction from a single point.
+     */
+    struct point_light
+    {
+        vec3 position;
+        /// The radiant intensity, which falls off with the square of the distance.
+        vec3 intensity;
+
+        [[nodiscard]]
+        std::optional<rt::light_sample> sample(vec3 point, [[maybe_unused]] vec2 u) const
+        {
+            const vec3 offset = position - point;
+            const real distance_squared = glm::length2(offset);
+            if (distance_squared <= real(0.0))
+            {
+                return std::nullopt;
+            }
+
+            const real distance = glm::sqrt(distance_squared);
+            return rt::light_sample {
+                .direction = offset / distance,
+                .distance  = distance,
+                .radiance  = intensity / distance_squared,
+                .pdf       = real(1.0),
+                .is_delta  = true,
+            };
+        }
+
+        /// Directions found by other means never reach a point, so their density is always 0.
+        [[nodiscard]]
+        real pdf([[maybe_unused]] vec3 point, [[maybe_unused]] vec3 direction) const
+        {
+            return real(0.0);
+        }
+    };
+
+    /**
+     * @brief The outside of an emissive sphere, sampled uniformly over the cone of directions that it subtends.
+     *
+     * Sampling the cone rather than the surface wastes no samples on the far side of the sphere, and its density is
+     * the same for every direction inside it, so the weight of a sample found by scattering is cheap to work out.
+     */
+    struct sphere_light
+    {
+        vec3 center;
+        real radius;
+        /// The radiance leaving every point of the surface.
+        vec3 radiance;
+
+        [[nodiscard]]
+        std::optional<rt::light_sample> sample(vec3 point, vec2 u) const
+        {
+            const vec3 offset = center - point;
+            const real distance_squared = glm::length2(offset);
+            const std::optional<real> one_minus_cos_max = cone(distance_squared);
+            if (!one_minus_cos_max)
+            {
+                return std::nullopt;
+            }
+
+            // Pick a direction uniformly within the cone around the axis towards the center.
+            const real center_distance = glm::sqrt(distance_squared);
+            const vec3 axis = offset / center_distance;
+            const real cos_theta = real(1.0) - u.x * *one_minus_cos_max;
+            const real sin_theta = glm::sqrt(glm::max(real(0.0), real(1.0) - cos_theta * cos_theta));
+            const real phi = glm::two_pi<real>() * u.y;
+
+            const vec3 helper = glm::abs(axis.x) > real(0.9) ? vec3(real(0.0), real(1.0), real(0.0)) : vec3(real(1.0), real(0.0), real(0.0));
+            const vec3 tangent = glm::normalize(glm::cross(helper, axis));
+            const vec3 bitangent = glm::cross(axis, tangent);
+            const vec3 direction = glm::normalize(
+                sin_theta * glm::cos(phi) * tangent + sin_theta * glm::sin(phi) * bitangent + cos_theta * axis
+            );
+
+            // The nearer root of the ray-sphere equation. Directions at the very edge of the cone graze the sphere,
+            // where rounding can leave no root at all, so the discriminant is clamped to the tangent point.
+            const real half_b = glm::dot(direction, offset);
+            const real discriminant = glm::max(real(0.0), half_b * half_b - (distance_squared - radius * radius));
+            return rt::light_sample {
+                .direction = direction,
+                .distance  = half_b - glm::sqrt(discriminant),
+                .radiance  = radiance,
+                .pdf       = real(1.0) / (glm::two_pi<real>() * *one_minus_cos_max),
+                .is_delta  = false,
+            };
+        }
+
+        /// The density with which sample() picks `direction` from `point`, assuming it points at the sphere.
+        [[nodiscard]]
+        real pdf(vec3 point, [[maybe_unused]] vec3 direction) const
+        {
+            const std::optional<real> one_minus_cos_max = cone(glm::length2(center - point));
+            return one_minus_cos_max ? real(1.0) / (glm::two_pi<real>() * *one_minus_cos_max) : real(0.0);
+        }
+
+    private:
+        /**
+         * @brief The cone that the sphere subtends from a point at a squared distance from its center.
+         * @return One minus the cosine of the cone's half-angle, or nothing if the point is inside the sphere.
+         */
+        std::optional<real> cone(real distance_squared) const
+        {
+            const real sin_squared = radius * radius / distance_squared;
+            if (!(sin_squared < real(1.0)))
+            {
+                return std::nullopt;
+            }
+
+            // For small, distant spheres, 1 - sqrt(1 - x) loses every digit to cancellation, unlike its expansion.
+            if (sin_squared < real(1.0e-3))
+            {
+                return sin_squared * (real(0.5) + real(0.125) * sin_squared);
+            }
+
+            return real(1.0) - glm::sqrt(real(1.0) - sin_squared);
+        }
+    };
+
+    /// Any of the lights, stored by value in the same way as rt::material.
+    using light = std::variant<rt::point_light, rt::sphere_light>;
+
+    /**
+     * @brief The lights of a scene, one of which is picked uniformly at random for each sample.
+     */
+    class light_set
+    {
+    public:
+        light_set() = default;
+
+        explicit light_set(std::vector<rt::light> lights)
+            : lights_(std::move(lights))
+        {
+        }
+
+        [[nodiscard]]
+        bool empty() const
+        {
+            return lights_.empty();
+        }
+
+        [[nodiscard]]
+        std::span<const rt::light> lights() const
+        {
+            return lights_;
+        }
+
+        /**
+         * @brief Picks a light, then a direction towards it from `point`.
+         * @param[in] u A uniform point in @f$[0, 1)^2@f$. Its first coordinate picks the light and is then stretched
+         *              back over @f$[0, 1)@f$, so one 2D sample serves both choices without losing its stratification.
+         * @return The sample, whose density includes the probability of picking the light, or nothing if the light
+         *         cannot be seen from the point at all.
+         */
+        [[nodiscard]]
+        std::optional<rt::light_sample> sample(vec3 point, vec2 u) const
+        {
+            if (lights_.empty())
+            {
+                return std::nullopt;
+            }
+
+            const auto count = static_cast<real>(lights_.size());
+            const std::size_t index = glm::min(static_cast<std::size_t>(u.x * count), lights_.size() - 1);
+            const vec2 remapped(glm::min(u.x * count - static_cast<real>(index), real(1.0) - glm::epsilon<real>()), u.y);
+
+            std::optional sample = std::visit([&](const auto &light) { return light.sample(point, remapped); }, lights_[index]);
+            if (sample)
+            {
+                sample->pdf /= count;
+            }
+
+            return sample;
+        }
+
+        /// The density with which sample() picks `direction` from `point` towards the light at `index`.
+        [[nodiscard]]
+        real pdf(std::uint32_t index, vec3 point, vec3 direction) const
+        {
+            const real pdf = std::visit([&](const auto &light) { return light.pdf(point, direction); }, lights_[index]);
+            return pdf / static_cast<real>(lights_.size());
+        }
+
+    private:
+        std::vector<rt::light> lights_;
+    };
+
+    /// The weight that the power heuristic gives a sample drawn with density `pdf` against one other strategy.
+    [[nodiscard]]
+    inline real power_heuristic(real pdf, real other_pdf)
+    {
+        const real squared = pdf * pdf;
+        const real other_squared = other_pdf * other_pdf;
+        return squared > real(0.0) ? squared / (squared + other_squared) : real(0.0);
+    }
+}
+
+#endif // !RAYTRACER_LIGHT_HPP
@@ -0,0 +1,213 @@
+/**
+ * @file mapped_file.hpp
+ * @brief Mapping files into memory to read them in place.
+ */
+
+#ifndef RAYTRACER_MAPPED_FILE_HPP
+#define RAYTRACER_MAPPED_FILE_HPP
+
+#include <fmt/format.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#ifdef _WIN32
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace rt
+{
+    /**
+     * @brief A read-only view of a whole file, mapped into memory.
+     *
+     * Pages are only read from disk when first touched, and are shared with every other process mapping the same
+     * file, so opening even a very large file is nearly free. The mapping starts on a page boundary, so it is suitably
+     * aligned for any type.
+     */
+    class mapped_file
+    {
+    public:
+        /**
+         * @throws std::runtime_error Thrown if the file cannot be opened or mapped.
+         */
+        explicit mapped_file(const std::string &filepath)
+        {
+#ifdef _WIN32
+            const HANDLE file = CreateFileA(
+                filepath.c_str(),
+                GENERIC_READ,
+                FILE_SHARE_READ,
+                nullptr,
+                OPEN_EXISTING,
+                FILE_ATTRIBUTE_NORMAL,
+                nullptr
+            );
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                throw std::runtime_error(fmt::format("could not open '{}'", filepath));
+            }
+
+            LARGE_INTEGER size = { };
+            if (!GetFileSizeEx(file, &size))
+            {
+                CloseHandle(file);
+                throw std::runtime_error(fmt::format("could not get the size of '{}'", filepath));
+            }
+
+            size_ = static_cast<std::size_t>(size.QuadPart);
+            if (size_ > 0)
+            {
+                const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping != nullptr)
+                {
+                    data_ = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+                    CloseHandle(mapping);
+                }
+            }
+            CloseHandle(file);
+#else
+            const int file = ::open(filepath.c_str(), O_RDONLY);
+            if (file < 0)
+            {
+                throw std::runtime_error(fmt::format("could not open '{}'", filepath));
+            }
+
+            struct stat status = { };
+            if (::fstat(file, &status) != 0)
+            {
+                ::close(file);
+                throw std::runtime_error(fmt::format("could not get the size of '{}'", filepath));
+            }
+
+            size_ = static_cast<std::size_t>(status.st_size);
+            if (size_ > 0)
+            {
+                void *data = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file, 0);
+                data_ = data == MAP_FAILED ? nullptr : data;
+            }
+            ::close(file);
+#endif
+
+            if (size_ > 0 && data_ == nullptr)
+            {
+                throw std::runtime_error(fmt::format("could not map '{}' into memory", filepath));
+            }
+        }
+
+        /**
+         * @brief Maps fresh memory, not backed by any file, and copies `bytes` into it, for reading data that arrived
+         *        some other way in place.
+         * @throws std::runtime_error Thrown if the memory cannot be mapped.
+         */
+        [[nodiscard]]
+        static mapped_file copy_of(std::span<const std::byte> bytes)
+        {
+            mapped_file copy;
+            copy.size_ = bytes.size();
+            if (copy.size_ == 0)
+            {
+                return copy;
+            }
+
+#ifdef _WIN32
+            const auto size = static_cast<std::uint64_t>(copy.size_);
+            const HANDLE mapping = CreateFileMappingA(
+                INVALID_HANDLE_VALUE,
+                nullptr,
+                PAGE_READWRITE,
+                static_cast<DWORD>(size >> 32),
+                static_cast<DWORD>(size),
+                nullptr
+            );
+            if (mapping != nullptr)
+            {
+                copy.data_ = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, 0);
+                CloseHandle(mapping);
+            }
+#else
+            void *data = ::mmap(nullptr, copy.size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            copy.data_ = data == MAP_FAILED ? nullptr : data;
+#endif
+
+            if (copy.data_ == nullptr)
+            {
+                throw std::runtime_error(fmt::format("could not map {} bytes into memory", copy.size_));
+            }
+
+            std::memcpy(copy.data_, bytes.data(), bytes.size());
+            return copy;
+        }
+
+        mapped_file(const mapped_file &) = delete;
+        mapped_file &operator=(const mapped_file &) = delete;
+
+        mapped_file(mapped_file &&other) noexcept
+            : data_(std::exchange(other.data_, nullptr))
+            , size_(std::exchange(other.size_, 0))
+        {
+        }
+
+        mapped_file &operator=(mapped_file &&other) noexcept
+        {
+            if (this != &other)
+            {
+                unmap();
+                data_ = std::exchange(other.data_, nullptr);
+                size_ = std::exchange(other.size_, 0);
+            }
+
+            return *this;
+        }
+
+        ~mapped_file()
+        {
+            unmap();
+        }
+
+        /// The contents of the file.
+        std::span<const std::byte> bytes() const
+        {
+            return { static_cast<const std::byte *>(data_), size_ };
+        }
+
+    private:
+        mapped_file() = default;
+
+        void unmap()
+        {
+            if (data_ == nullptr)
+            {
+                return;
+            }
+
+#ifdef _WIN32
+            UnmapViewOfFile(data_);
+#else
+            ::munmap(data_, size_);
+#endif
+            data_ = nullptr;
+        }
+
+    private:
+        void        *data_ = nullptr;
+        std::size_t  size_ = 0;
+    };
+}
+
+#endif // !RAYTRACER_MAPPED_FILE_HPP
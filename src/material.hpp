@@ -2,29 +2,38 @@
 #define RAYTRACER_MATERIAL_HPP
 
 #include "camera.hpp"
-#include "random.hpp"
+#include "sampler.hpp"
 #include "shape.hpp"
+#include "stats.hpp"
 
 #include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
 
+#include <concepts>
+#include <cstdint>
 #include <optional>
+#include <variant>
 
 namespace rt
 {
-    struct scatter
+    /**
+     * @brief The uniform random numbers in @f$[0, 1)@f$ that drive a single scattering event.
+     */
+    struct scatter_sample
     {
-        rt::ray ray;
-        vec3    color;
+        /// Selects the scattered direction among the continuous choices.
+        vec2 direction;
+        /// Selects between discrete choices, such as reflecting or refracting.
+        real choice;
     };
 
-    struct material
+    struct scatter
     {
-        [[nodiscard]]
-        virtual std::optional<rt::scatter> scatter(const rt::ray &ray, const rt::hit &hit) const = 0;
-        virtual ~material() = default;
+        rt::ray ray;
+        vec3    color;
     };
 
-    class lambertian : public material
+    class lambertian
     {
     public:
         constexpr explicit lambertian(vec3 albedo)
@@ -33,9 +42,9 @@ namespace rt
         }
 
         [[nodiscard]]
-        std::optional<rt::scatter> scatter(const rt::ray &ray, const rt::hit &hit) const override
+        std::optional<rt::scatter> scatter([[maybe_unused]] const rt::ray &ray, const rt::hit &hit, const rt::scatter_sample &sample) const
         {
-            vec3 direction = hit.normal() + random_unit_vector();
+            vec3 direction = hit.normal() + sample_sphere(sample.direction);
             if (glm::all(glm::epsilonEqual(direction, vec3(real(0.0)), glm::epsilon<real>())))
             {
                 direction = hit.normal();
@@ -50,11 +59,31 @@ namespace rt
             };
         }
 
+        /// The reflectance times the cosine of the angle to the normal, for light arriving from `direction`.
+        [[nodiscard]]
+        vec3 evaluate(const rt::hit &hit, vec3 direction) const
+        {
+            return albedo_ * pdf(hit, direction);
+        }
+
+        /// The density with which scatter() picks `direction`. Scattered directions follow the cosine to the normal.
+        [[nodiscard]]
+        real pdf(const rt::hit &hit, vec3 direction) const
+        {
+            return glm::max(glm::dot(hit.normal(), glm::normalize(direction)), real(0.0)) * glm::one_over_pi<real>();
+        }
+
+        [[nodiscard]]
+        vec3 albedo() const
+        {
+            return albedo_;
+        }
+
     private:
         vec3 albedo_;
     };
 
-    class metal : public material
+    class metal
     {
     public:
         constexpr explicit metal(vec3 albedo)
@@ -63,7 +92,7 @@ namespace rt
         }
 
         [[nodiscard]]
-        std::optional<rt::scatter> scatter(const rt::ray &ray, const rt::hit &hit) const override
+        std::optional<rt::scatter> scatter(const rt::ray &ray, const rt::hit &hit, [[maybe_unused]] const rt::scatter_sample &sample) const
         {
             const vec3 reflected_direction = glm::reflect(glm::normalize(ray.direction()), hit.normal());
             const rt::ray scattered_ray(hit.point(), reflected_direction);
@@ -79,11 +108,18 @@ namespace rt
                 .color = attenuation,
             };
         }
+
+        [[nodiscard]]
+        vec3 albedo() const
+        {
+            return albedo_;
+        }
+
     private:
         vec3 albedo_;
     };
 
-    class dielectric : public material
+    class dielectric
     {
     public:
         constexpr explicit dielectric(real refractive_index)
@@ -92,7 +128,7 @@ namespace rt
         }
 
         [[nodiscard]]
-        std::optional<rt::scatter> scatter(const rt::ray &ray, const rt::hit &hit) const override
+        std::optional<rt::scatter> scatter(const rt::ray &ray, const rt::hit &hit, const rt::scatter_sample &sample) const
         {
             const vec3 attenuation = vec3(real(1.0));
             const real eta = hit.front_face() ? (real(1.0) / refractive_index_) : refractive_index_;
@@ -104,7 +140,7 @@ namespace rt
             const bool must_reflect = eta * sin_theta > real(1.0);
             const vec3 scattered_direction = [&]
             {
-                if (must_reflect || reflectance(cos_theta, eta) > random_real())
+                if (must_reflect || reflectance(cos_theta, eta) > sample.choice)
                 {
                     return glm::reflect(unit_direction, hit.normal());
                 }
@@ -120,6 +156,12 @@ namespace rt
             };
         }
 
+        [[nodiscard]]
+        vec3 albedo() const
+        {
+            return vec3(real(1.0));
+        }
+
     private:
         static real reflectance(real cosine, real eta)
         {
@@ -133,6 +175,90 @@ namespace rt
     private:
         real refractive_index_;
     };
+
+    /**
+     * @brief A surface that emits light from its front face and reflects none.
+     */
+    class emissive
+    {
+    public:
+        /**
+         * @param[in] radiance The radiance leaving every point of the surface.
+         * @param[in] light The index of the light in the scene's rt::light_set that samples this surface, if any.
+         */
+        constexpr explicit emissive(vec3 radiance, std::optional<std::uint32_t> light = std::nullopt)
+            : radiance_(radiance)
+            , light_(light)
+        {
+        }
+
+        [[nodiscard]]
+        std::optional<rt::scatter> scatter(
+            [[maybe_unused]] const rt::ray &ray,
+            [[maybe_unused]] const rt::hit &hit,
+            [[maybe_unused]] const rt::scatter_sample &sample
+        ) const
+        {
+            return std::nullopt;
+        }
+
+        [[nodiscard]]
+        vec3 emitted(const rt::hit &hit) const
+        {
+            return hit.front_face() ? radiance_ : vec3(real(0.0));
+        }
+
+        [[nodiscard]]
+        vec3 radiance() const
+        {
+            return radiance_;
+        }
+
+        [[nodiscard]]
+        std::optional<std::uint32_t> light() const
+        {
+            return light_;
+        }
+
+        /// The emitted color, capped at 1, which is what denoisers expect of the albedo of a light.
+        [[nodiscard]]
+        vec3 albedo() const
+        {
+            return glm::min(radiance_, vec3(real(1.0)));
+        }
+
+    private:
+        vec3                         radiance_;
+        std::optional<std::uint32_t> light_;
+    };
+
+    /**
+     * @brief Materials that scatter over a continuum of directions, so light sampling can evaluate them for any
+     *        direction. Perfectly specular materials pick a single direction and never qualify.
+     */
+    template <typename Material>
+    concept evaluable_material = requires(const Material &material, const rt::hit &hit, vec3 direction)
+    {
+        { material.evaluate(hit, direction) } -> std::same_as<vec3>;
+        { material.pdf(hit, direction) } -> std::same_as<real>;
+    };
+
+    /**
+     * @brief Any of the materials, stored by value.
+     *
+     * The set of materials is closed, so a scene keeps every material in one contiguous array and surfaces refer to
+     * them by index. Calls dispatch through std::visit, which the compiler lowers to a jump on the alternative, and
+     * the integrator visits once per run of hits on the same material rather than once per hit.
+     */
+    using material = std::variant<rt::lambertian, rt::metal, rt::dielectric, rt::emissive>;
+    static_assert(std::variant_size_v<rt::material> == rt::stats::material_names.size());
+
+    /// The fraction of light the surface reflects, regardless of direction, for the albedo output.
+    [[nodiscard]]
+    inline vec3 albedo(const rt::material &material)
+    {
+        return std::visit([](const auto &alternative) { return alternative.albedo(); }, material);
+    }
 }
 
 #endif
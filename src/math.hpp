@@ -3,16 +3,55 @@
 
 #include <glm/glm.hpp>
 
-#define RAYTRACER_USE_FLOAT
-#ifdef RAYTRACER_USE_FLOAT
-using real = float;
-constexpr real t_min = real(0.5e-2);
+#include <concepts>
+#include <type_traits>
+
+namespace rt
+{
+    /**
+     * @brief The floating-point types that a render computes with.
+     * @tparam Trace The type of everything geometric: rays, shapes, intersections and shading.
+     * @tparam Accumulate The type that the samples of each pixel are summed in. Sums of many samples lose the low
+     *                    bits of every new sample once they grow large, so long renders benefit from a wider type
+     *                    here long before tracing does.
+     */
+    template <std::floating_point Trace, std::floating_point Accumulate>
+    struct precision_policy
+    {
+        using trace_real      = Trace;
+        using accumulate_real = Accumulate;
+        using accumulate_vec3 = glm::vec<3, Accumulate, glm::defaultp>;
+
+        /// The distance a ray travels before it can hit anything, which keeps it from hitting the surface it left.
+        static constexpr Trace t_min = std::is_same_v<Trace, float> ? Trace(0.5e-2) : Trace(1.0e-6);
+    };
+
+    /// Single precision throughout, the smallest and fastest.
+    using float_precision  = rt::precision_policy<float, float>;
+    /// Single-precision tracing, with pixels summed in double precision.
+    using mixed_precision  = rt::precision_policy<float, double>;
+    /// Double precision throughout.
+    using double_precision = rt::precision_policy<double, double>;
+
+    /// The policy that the program is built with, chosen by the RAYTRACER_PRECISION CMake option.
+#if defined(RAYTRACER_PRECISION_DOUBLE)
+    using precision = rt::double_precision;
+#elif defined(RAYTRACER_PRECISION_MIXED)
+    using precision = rt::mixed_precision;
 #else
-using real = double;
-constexpr real t_min = real(1.0e-6);
+    using precision = rt::float_precision;
 #endif
+}
 
+using real = rt::precision::trace_real;
+constexpr real t_min = rt::precision::t_min;
+
+using vec2 = glm::vec<2, real, glm::defaultp>;
 using vec3 = glm::vec<3, real, glm::defaultp>;
+using mat4 = glm::mat<4, 4, real, glm::defaultp>;
+
+using accumulate_real = rt::precision::accumulate_real;
+using accumulate_vec3 = rt::precision::accumulate_vec3;
 
 inline vec3 lerp(vec3 from, vec3 to, real t)
 {
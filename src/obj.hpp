@@ -0,0 +1,366 @@
+/**
+ * @file obj.hpp
+ * @brief Reading triangle meshes from Wavefront OBJ files.
+ */
+
+#ifndef RAYTRACER_OBJ_HPP
+#define RAYTRACER_OBJ_HPP
+
+#include "math.hpp"
+#include "scheduler.hpp"
+#include "triangle_mesh.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace obj
+{
+    namespace detail
+    {
+        /// The number of chunks that each thread parses, so that uneven chunks still balance out.
+        constexpr std::size_t chunks_per_thread = 4;
+
+        /**
+         * @brief Marks vertex indices that are relative to the first vertex of their chunk.
+         *
+         * Positive OBJ indices count from the start of the file and are known at once. Negative ones count back from
+         * the vertices read so far, so they are kept relative to the first vertex of the chunk, offset by this bias,
+         * until the number of vertices in every earlier chunk is known. Every biased index is negative, and every
+         * known index is not.
+         */
+        constexpr std::int64_t relative_bias = std::int64_t(1) << 62;
+        /// Marks a face corner without a normal.
+        constexpr std::int64_t no_index = std::numeric_limits<std::int64_t>::min();
+
+        /// The vertex indices of one corner of a face, resolved as far as a chunk on its own can.
+        struct corner
+        {
+            std::int64_t position;
+            std::int64_t normal;
+        };
+
+        /// Everything read from one chunk of lines.
+        struct chunk
+        {
+            std::vector<vec3>                                  positions;
+            std::vector<vec3>                                  normals;
+            /// Three corners for every triangle.
+            std::vector<detail::corner>                        corners;
+            std::size_t                                        line_count = 0;
+            /// The line within the chunk, and the description, of the first error in it.
+            std::optional<std::pair<std::size_t, std::string>> error;
+        };
+
+        class line_parser
+        {
+        public:
+            explicit line_parser(std::string_view line)
+                : rest_(line)
+            {
+            }
+
+            std::string_view next()
+            {
+                // Scanning by hand is much faster than find_first_of(), and OBJ files are mostly whitespace and words.
+                const auto is_space = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+
+                std::size_t begin = 0;
+                while (begin < rest_.size() && is_space(rest_[begin]))
+                {
+                    ++begin;
+                }
+
+                std::size_t end = begin;
+                while (end < rest_.size() && !is_space(rest_[end]))
+                {
+                    ++end;
+                }
+
+                const std::string_view word = rest_.substr(begin, end - begin);
+                rest_.remove_prefix(end);
+                return word;
+            }
+
+            vec3 next_vec3()
+            {
+                vec3 result;
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    const std::string_view word = next();
+                    const auto [end, status] = std::from_chars(word.data(), word.data() + word.size(), result[axis]);
+                    if (word.empty() || status != std::errc() || end != word.data() + word.size())
+                    {
+                        throw std::runtime_error(fmt::format("expected a number, but found '{}'", word));
+                    }
+                }
+
+                return result;
+            }
+
+        private:
+            std::string_view rest_;
+        };
+
+        /// Parses one index of a face corner, given how many vertices of its kind the chunk has read so far.
+        inline std::int64_t parse_index(std::string_view word, std::size_t count)
+        {
+            std::int64_t value = 0;
+            const auto [end, status] = std::from_chars(word.data(), word.data() + word.size(), value);
+            if (word.empty() || status != std::errc() || end != word.data() + word.size() || value == 0)
+            {
+                throw std::runtime_error(fmt::format("invalid vertex index '{}'", word));
+            }
+
+            if (value > 0)
+            {
+                return value - 1;
+            }
+
+            return static_cast<std::int64_t>(count) + value - relative_bias;
+        }
+
+        /// Parses a face corner of the form `v`, `v/vt`, `v//vn` or `v/vt/vn`. Texture coordinates are ignored.
+        inline detail::corner parse_corner(std::string_view word, const detail::chunk &chunk)
+        {
+            const std::size_t first_slash = word.find('/');
+            detail::corner corner = {
+                .position = parse_index(word.substr(0, first_slash), chunk.positions.size()),
+                .normal   = no_index,
+            };
+
+            if (first_slash != std::string_view::npos)
+            {
+                const std::size_t second_slash = word.find('/', first_slash + 1);
+                if (second_slash != std::string_view::npos)
+                {
+                    corner.normal = parse_index(word.substr(second_slash + 1), chunk.normals.size());
+                }
+            }
+
+            return corner;
+        }
+
+        /// Parses whole lines of an OBJ file, stopping at the first error.
+        inline void parse_chunk(std::string_view text, detail::chunk &chunk)
+        {
+            std::vector<detail::corner> face;
+            while (!text.empty())
+            {
+                ++chunk.line_count;
+                const std::size_t line_end = std::min(text.find('\n'), text.size());
+                std::string_view line = text.substr(0, line_end);
+                line = line.substr(0, std::min(line.find('#'), line.size()));
+                text.remove_prefix(std::min(line_end + 1, text.size()));
+
+                try
+                {
+                    detail::line_parser words(line);
+                    const std::string_view statement = words.next();
+                    if (statement == "v")
+                    {
+                        chunk.positions.push_back(words.next_vec3());
+                    }
+                    else if (statement == "vn")
+                    {
+                        chunk.normals.push_back(words.next_vec3());
+                    }
+                    else if (statement == "f")
+                    {
+                        face.clear();
+                        for (std::string_view word = words.next(); !word.empty(); word = words.next())
+                        {
+                            face.push_back(parse_corner(word, chunk));
+                        }
+
+                        if (face.size() < 3)
+                        {
+                            throw std::runtime_error("a face needs at least 3 vertices");
+                        }
+
+                        // Polygons are split into a fan of triangles around their first vertex.
+                        for (std::size_t i = 2; i < face.size(); ++i)
+                        {
+                            chunk.corners.push_back(face[0]);
+                            chunk.corners.push_back(face[i - 1]);
+                            chunk.corners.push_back(face[i]);
+                        }
+                    }
+                }
+                catch (const std::runtime_error &e)
+                {
+                    chunk.error.emplace(chunk.line_count, e.what());
+                    return;
+                }
+            }
+        }
+
+        /// Splits text into about `count` pieces that each end at the end of a line.
+        inline std::vector<std::string_view> split_lines(std::string_view text, std::size_t count)
+        {
+            std::vector<std::string_view> pieces;
+            const std::size_t target_size = text.size() / std::max<std::size_t>(count, 1) + 1;
+            while (!text.empty())
+            {
+                std::size_t end = std::min(target_size, text.size());
+                end = std::min(text.find('\n', end - 1), text.size() - 1) + 1;
+                pieces.push_back(text.substr(0, end));
+                text.remove_prefix(end);
+            }
+
+            return pieces;
+        }
+
+        inline std::uint32_t resolve(std::int64_t index, std::size_t base, std::size_t total, const char *what)
+        {
+            const std::int64_t value = index < 0 ? static_cast<std::int64_t>(base) + index + relative_bias : index;
+            if (value < 0 || value >= static_cast<std::int64_t>(total))
+            {
+                throw std::runtime_error(fmt::format("a face refers to {} {}, but there are only {}", what, value + 1, total));
+            }
+
+            return static_cast<std::uint32_t>(value);
+        }
+    }
+
+    /**
+     * @brief Reads the triangles of an OBJ file, and their shading normals if every face has them.
+     *
+     * Only vertex positions, normals and faces are read; every other statement is ignored. Polygons are split into
+     * triangles.
+     *
+     * @param[in] text The contents of the file.
+     * @param[in] filepath The name of the file, for error messages.
+     * @param[in] pool If not null, the pool that parses pieces of the file in parallel.
+     * @throws std::runtime_error Thrown if the file is invalid.
+     */
+    inline rt::mesh_data load(std::string_view text, std::string_view filepath, rt::thread_pool *pool = nullptr)
+    {
+        const std::size_t piece_count = pool == nullptr ? 1 : pool->thread_count() * detail::chunks_per_thread;
+        const std::vector<std::string_view> pieces = detail::split_lines(text, piece_count);
+
+        std::vector<detail::chunk> chunks(pieces.size());
+        std::vector<std::exception_ptr> errors(pieces.size());
+        const auto parse = [&](std::size_t index)
+        {
+            try
+            {
+                detail::parse_chunk(pieces[index], chunks[index]);
+            }
+            catch (...)
+            {
+                errors[index] = std::current_exception();
+            }
+        };
+
+        if (pool == nullptr)
+        {
+            for (std::size_t index = 0; index < pieces.size(); ++index)
+            {
+                parse(index);
+            }
+        }
+        else
+        {
+            pool->run(pieces.size(), parse);
+        }
+
+        std::size_t position_count = 0;
+        std::size_t normal_count = 0;
+        std::size_t corner_count = 0;
+        std::size_t line_count = 0;
+        bool has_normals = true;
+        for (std::size_t index = 0; index < chunks.size(); ++index)
+        {
+            if (errors[index])
+            {
+                std::rethrow_exception(errors[index]);
+            }
+
+            const detail::chunk &chunk = chunks[index];
+            if (chunk.error)
+            {
+                throw std::runtime_error(fmt::format("{}:{}: {}", filepath, line_count + chunk.error->first, chunk.error->second));
+            }
+
+            position_count += chunk.positions.size();
+            normal_count += chunk.normals.size();
+            corner_count += chunk.corners.size();
+            line_count += chunk.line_count;
+            has_normals = has_normals && std::ranges::all_of(chunk.corners, [](const detail::corner &corner)
+            {
+                return corner.normal != detail::no_index;
+            });
+        }
+
+        if (position_count > std::numeric_limits<std::uint32_t>::max())
+        {
+            throw std::runtime_error(fmt::format("{}: too many vertices", filepath));
+        }
+
+        rt::mesh_data mesh;
+        mesh.positions.reserve(position_count);
+        mesh.normals.reserve(has_normals ? normal_count : 0);
+        mesh.triangles.reserve(corner_count / 3);
+        mesh.normal_triangles.reserve(has_normals ? corner_count / 3 : 0);
+
+        std::size_t position_base = 0;
+        std::size_t normal_base = 0;
+        try
+        {
+            for (const detail::chunk &chunk : chunks)
+            {
+                mesh.positions.insert(mesh.positions.end(), chunk.positions.begin(), chunk.positions.end());
+                if (has_normals)
+                {
+                    mesh.normals.insert(mesh.normals.end(), chunk.normals.begin(), chunk.normals.end());
+                }
+
+                for (std::size_t i = 0; i < chunk.corners.size(); i += 3)
+                {
+                    rt::triangle_indices triangle;
+                    rt::triangle_indices normal_triangle;
+                    for (std::size_t corner = 0; corner < 3; ++corner)
+                    {
+                        const detail::corner &c = chunk.corners[i + corner];
+                        triangle[corner] = detail::resolve(c.position, position_base, position_count, "vertex");
+                        if (has_normals)
+                        {
+                            normal_triangle[corner] = detail::resolve(c.normal, normal_base, normal_count, "normal");
+                        }
+                    }
+
+                    mesh.triangles.push_back(triangle);
+                    if (has_normals)
+                    {
+                        mesh.normal_triangles.push_back(normal_triangle);
+                    }
+                }
+
+                position_base += chunk.positions.size();
+                normal_base += chunk.normals.size();
+            }
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(fmt::format("{}: {}", filepath, e.what()));
+        }
+
+        return mesh;
+    }
+}
+
+#endif // !RAYTRACER_OBJ_HPP
@@ -0,0 +1,744 @@
+/**
+ * @file options.hpp
+ * @brief Parsing the command-line options of the raytracer program.
+ */
+
+#ifndef RAYTRACER_OPTIONS_HPP
+#define RAYTRACER_OPTIONS_HPP
+
+#include "math.hpp"
+#include "device.hpp"
+#include "exr.hpp"
+#include "progress.hpp"
+#include "sampler.hpp"
+#include "stats.hpp"
+#include "tonemap.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace rt
+{
+    /// The file formats that the rendered image can be written in.
+    enum class image_format
+    {
+        /// 8-bit RGBA, tonemapped.
+        png = 0,
+        /// ZIP-compressed OpenEXR, with every auxiliary output as extra channels.
+        exr = 1,
+        /// Uncompressed 32-bit float PFM, with every auxiliary output as a separate file.
+        pfm = 2,
+    };
+
+    /// The processors that an image can be rendered on.
+    enum class render_device
+    {
+        /// The thread pool, with the wavefront integrator.
+        cpu  = 0,
+        /// The CUDA backend, which only builds with RAYTRACER_ENABLE_CUDA can use.
+        cuda = 1,
+    };
+
+    /**
+     * @brief The settings of a single render that can be chosen at runtime.
+     */
+    struct options
+    {
+        /// The width of the image in pixels.
+        std::uint32_t          width = 1280;
+        /// The height of the image in pixels.
+        std::uint32_t          height = 720;
+        /// The number of samples each pixel takes, unless adaptive sampling stops it sooner.
+        std::uint32_t          sample_count = 400;
+        /// The largest number of intersection tests along a single path.
+        std::uint32_t          max_depth = 64;
+        /// The number of bounces after which paths become subject to Russian roulette.
+        std::uint32_t          roulette_depth = 4;
+        /// The relative error, at 95% confidence, below which a pixel stops being sampled. If 0, every pixel takes
+        /// the full sample count.
+        real                   adaptive_threshold = real(0.0);
+        /// The number of samples every pixel takes before adaptive sampling may stop it.
+        std::uint32_t          adaptive_min_samples = 64;
+        /// Where to write an image of the number of samples taken in each pixel. If empty, none is written.
+        std::string            heatmap_filepath;
+        /// How the sample points of each pixel are placed.
+        rt::sampler_type       sampler = rt::sampler_type::stratified;
+        /// Selects the sample points. Renders with different seeds have independent noise.
+        std::uint32_t          seed = 0;
+        /// The number of threads that render. If 0, one thread is used per hardware thread.
+        std::uint32_t          thread_count = 0;
+        /// What renders the image. A CUDA device renders scenes of spheres lit by the sky, with sample points of its
+        /// own whatever the sampler.
+        rt::render_device      device = rt::render_device::cpu;
+        /// How the progress of the render is reported.
+        rt::progress_format    progress = rt::progress_format::text;
+        /// The file descriptor that progress is reported to.
+        int                    progress_fd = 1;
+        /// The number of seconds between progress reports.
+        real                   progress_interval = real(0.5);
+        /// Where to write a trace of the time each tile took, in the Chrome trace event format. If empty, none is
+        /// written. Only builds with statistics enabled can write one.
+        std::string            trace_filepath;
+        /// The width and height of the square tiles that the image is split into for rendering.
+        std::uint32_t          tile_size = 32;
+        /// The number of samples each pixel takes per pass. The preview is updated, and adaptive sampling tests for
+        /// convergence, after every pass.
+        std::uint32_t          pass_samples = 16;
+        /// Where to periodically save the accumulated samples, so that the render can be resumed. If empty, no
+        /// checkpoints are written.
+        std::string            checkpoint_filepath;
+        /// The least number of seconds between checkpoints.
+        std::uint32_t          checkpoint_interval = 300;
+        /// A checkpoint to continue rendering from, which must have been rendered with the same seed, sampler and
+        /// sample count. If empty, the render starts from scratch.
+        std::string            resume_filepath;
+        /// Where to write the rendered image.
+        std::string            output_filepath = "output.png";
+        /// The format of the rendered image. Unless given, it is chosen by the extension of the output file.
+        rt::image_format       output_format = rt::image_format::png;
+        /// Whether to also output the albedo, normal and depth of the first surface seen in each pixel. They are
+        /// only written by the HDR formats.
+        bool                   aovs = false;
+        /// Whether to remove the noise of the image with a filter guided by the albedo, normal and depth outputs,
+        /// which are then gathered even if they are not written.
+        bool                   denoise = false;
+        /// The type that the channels of OpenEXR images are stored as.
+        exr::pixel_type        exr_type = exr::pixel_type::half;
+        /// How the linear render is mapped to the colors of 8-bit images.
+        rt::tonemap_parameters tonemap;
+        /// The scene description or compiled scene to render. If empty, a built-in scene is rendered.
+        std::string            scene_filepath;
+        /// Where to write the scene as a compiled scene file. If not empty, the scene is compiled instead of rendered.
+        std::string            compiled_scene_filepath;
+        /// The number of frames of an animation along the scene's camera path to render, each written to the output
+        /// path with its frame number added, such that `output.png` becomes `output.0000.png`, `output.0001.png` and
+        /// so on. If 0, a single image is rendered from the scene's camera.
+        std::uint32_t          frame_count = 0;
+        /// Whether to render an interactive preview instead, which refines the output image from coarse to full
+        /// resolution and starts over whenever a line of camera settings arrives on standard input.
+        bool                   preview = false;
+        /// The port to listen for workers on, leasing the render out to them instead of rendering it here. If 0, the
+        /// render is not distributed.
+        std::uint32_t          listen_port = 0;
+        /// The host of a coordinator to render leases for, with every other setting coming from the coordinator. If
+        /// empty, the program renders on its own.
+        std::string            coordinator_host;
+        /// The port of the coordinator to render leases for.
+        std::uint32_t          coordinator_port = 0;
+        /// The number of seconds a worker has to return a lease before it is leased to another.
+        std::uint32_t          lease_timeout = 120;
+        /// Whether to print the usage of the program instead of rendering.
+        bool                   show_help = false;
+    };
+
+    namespace detail
+    {
+        inline std::uint32_t parse_unsigned(std::string_view name, std::string_view value)
+        {
+            std::uint32_t result = 0;
+            const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+            if (error != std::errc() || end != value.data() + value.size())
+            {
+                throw std::runtime_error(
+                    fmt::format("invalid value '{}' for option {}: expected a non-negative integer", value, name)
+                );
+            }
+
+            return result;
+        }
+
+        inline std::uint32_t parse_positive(std::string_view name, std::string_view value)
+        {
+            const std::uint32_t result = parse_unsigned(name, value);
+            if (result == 0)
+            {
+                throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected at least 1", value, name));
+            }
+
+            return result;
+        }
+
+        inline real parse_real(std::string_view name, std::string_view value)
+        {
+            real result = real(0.0);
+            const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+            if (error != std::errc() || end != value.data() + value.size() || !std::isfinite(result) || result < real(0.0))
+            {
+                throw std::runtime_error(
+                    fmt::format("invalid value '{}' for option {}: expected a finite non-negative number", value, name)
+                );
+            }
+
+            return result;
+        }
+
+        inline real parse_signed_real(std::string_view name, std::string_view value)
+        {
+            real result = real(0.0);
+            const auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+            if (error != std::errc() || end != value.data() + value.size() || !std::isfinite(result))
+            {
+                throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected a finite number", value, name));
+            }
+
+            return result;
+        }
+
+        inline std::uint32_t parse_port(std::string_view name, std::string_view value)
+        {
+            const std::uint32_t port = parse_unsigned(name, value);
+            if (port == 0 || port > 65535)
+            {
+                throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected a port from 1 to 65535", value, name));
+            }
+
+            return port;
+        }
+
+        inline bool parse_switch(std::string_view name, std::string_view value)
+        {
+            if (value == "on")  return true;
+            if (value == "off") return false;
+
+            throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected on or off", value, name));
+        }
+
+        inline rt::sampler_type parse_sampler(std::string_view name, std::string_view value)
+        {
+            if (value == "random")     return rt::sampler_type::random;
+            if (value == "stratified") return rt::sampler_type::stratified;
+            if (value == "halton")     return rt::sampler_type::halton;
+            if (value == "sobol")      return rt::sampler_type::sobol;
+            if (value == "lattice")    return rt::sampler_type::lattice;
+
+            throw std::runtime_error(
+                fmt::format(
+                    "invalid value '{}' for option {}: expected one of random, stratified, halton, sobol, lattice",
+                    value,
+                    name
+                )
+            );
+        }
+
+        inline rt::render_device parse_device(std::string_view name, std::string_view value)
+        {
+            if (value == "cpu") return rt::render_device::cpu;
+            if (value == "cuda")
+            {
+                if constexpr (!rt::device::enabled)
+                {
+                    throw std::runtime_error(fmt::format("option {} cuda needs a build with RAYTRACER_ENABLE_CUDA", name));
+                }
+
+                return rt::render_device::cuda;
+            }
+
+            throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected cpu or cuda", value, name));
+        }
+
+        inline rt::image_format parse_image_format(std::string_view name, std::string_view value)
+        {
+            if (value == "png") return rt::image_format::png;
+            if (value == "exr") return rt::image_format::exr;
+            if (value == "pfm") return rt::image_format::pfm;
+
+            throw std::runtime_error(
+                fmt::format("invalid value '{}' for option {}: expected one of png, exr, pfm", value, name)
+            );
+        }
+
+        /// The format of an image file with the given path, going by its extension.
+        inline std::optional<rt::image_format> image_format_of(std::string_view filepath)
+        {
+            const std::string extension = std::filesystem::path(filepath).extension().string();
+            if (extension == ".png") return rt::image_format::png;
+            if (extension == ".exr") return rt::image_format::exr;
+            if (extension == ".pfm") return rt::image_format::pfm;
+
+            return std::nullopt;
+        }
+
+        inline exr::pixel_type parse_exr_type(std::string_view name, std::string_view value)
+        {
+            if (value == "half")  return exr::pixel_type::half;
+            if (value == "float") return exr::pixel_type::float32;
+
+            throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected half or float", value, name));
+        }
+
+        inline rt::progress_format parse_progress_format(std::string_view name, std::string_view value)
+        {
+            if (value == "text") return rt::progress_format::text;
+            if (value == "json") return rt::progress_format::json;
+            if (value == "off")  return rt::progress_format::none;
+
+            throw std::runtime_error(
+                fmt::format("invalid value '{}' for option {}: expected one of text, json, off", value, name)
+            );
+        }
+
+        inline rt::tonemap_operator parse_tonemap(std::string_view name, std::string_view value)
+        {
+            if (value == "clamp")    return rt::tonemap_operator::clamp;
+            if (value == "reinhard") return rt::tonemap_operator::reinhard;
+            if (value == "aces")     return rt::tonemap_operator::aces;
+
+            throw std::runtime_error(
+                fmt::format("invalid value '{}' for option {}: expected one of clamp, reinhard, aces", value, name)
+            );
+        }
+    }
+
+    namespace detail
+    {
+        /**
+         * @brief Accumulates options from the command line and from configuration files.
+         */
+        class option_parser
+        {
+        public:
+            /**
+             * @brief Sets the option `name`, including its leading dashes, to `value`.
+             * @throws std::runtime_error Thrown if the option is unrecognized or the value is invalid.
+             */
+            void apply(std::string_view name, std::string_view value)
+            {
+                if (name == "--width")
+                {
+                    options_.width = parse_positive(name, value);
+                }
+                else if (name == "--height")
+                {
+                    options_.height = parse_positive(name, value);
+                }
+                else if (name == "--samples")
+                {
+                    options_.sample_count = parse_positive(name, value);
+                }
+                else if (name == "--max-depth")
+                {
+                    options_.max_depth = parse_unsigned(name, value);
+                }
+                else if (name == "--roulette-depth")
+                {
+                    options_.roulette_depth = parse_unsigned(name, value);
+                }
+                else if (name == "--adaptive-threshold")
+                {
+                    options_.adaptive_threshold = parse_real(name, value);
+                }
+                else if (name == "--adaptive-min-samples")
+                {
+                    options_.adaptive_min_samples = parse_unsigned(name, value);
+                }
+                else if (name == "--heatmap")
+                {
+                    options_.heatmap_filepath = value;
+                }
+                else if (name == "--sampler")
+                {
+                    options_.sampler = parse_sampler(name, value);
+                }
+                else if (name == "--seed")
+                {
+                    options_.seed = parse_unsigned(name, value);
+                }
+                else if (name == "--threads")
+                {
+                    options_.thread_count = parse_unsigned(name, value);
+                }
+                else if (name == "--device")
+                {
+                    options_.device = parse_device(name, value);
+                }
+                else if (name == "--progress")
+                {
+                    options_.progress = parse_progress_format(name, value);
+                }
+                else if (name == "--progress-fd")
+                {
+                    options_.progress_fd = static_cast<int>(parse_unsigned(name, value));
+                }
+                else if (name == "--progress-interval")
+                {
+                    options_.progress_interval = parse_real(name, value);
+                    // Reports are timed in whole milliseconds, so shorter intervals would round down to none at all.
+                    if (options_.progress_interval < real(0.001) || options_.progress_interval > real(86400.0))
+                    {
+                        throw std::runtime_error(
+                            fmt::format("invalid value '{}' for option {}: expected from 0.001 to 86400 seconds", value, name)
+                        );
+                    }
+                }
+                else if (name == "--trace")
+                {
+                    if constexpr (!rt::stats::enabled)
+                    {
+                        throw std::runtime_error(fmt::format("option {} needs a build with RAYTRACER_ENABLE_STATS", name));
+                    }
+
+                    options_.trace_filepath = value;
+                }
+                else if (name == "--tile-size")
+                {
+                    options_.tile_size = parse_positive(name, value);
+                }
+                else if (name == "--pass-samples")
+                {
+                    options_.pass_samples = parse_positive(name, value);
+                }
+                else if (name == "--checkpoint")
+                {
+                    options_.checkpoint_filepath = value;
+                }
+                else if (name == "--checkpoint-interval")
+                {
+                    options_.checkpoint_interval = parse_unsigned(name, value);
+                }
+                else if (name == "--resume")
+                {
+                    options_.resume_filepath = value;
+                }
+                else if (name == "--output")
+                {
+                    options_.output_filepath = value;
+                }
+                else if (name == "--format")
+                {
+                    output_format_ = parse_image_format(name, value);
+                }
+                else if (name == "--aovs")
+                {
+                    options_.aovs = parse_switch(name, value);
+                }
+                else if (name == "--denoise")
+                {
+                    options_.denoise = parse_switch(name, value);
+                }
+                else if (name == "--exr-type")
+                {
+                    options_.exr_type = parse_exr_type(name, value);
+                }
+                else if (name == "--tonemap")
+                {
+                    options_.tonemap.op = parse_tonemap(name, value);
+                }
+                else if (name == "--exposure")
+                {
+                    options_.tonemap.exposure = parse_signed_real(name, value);
+                }
+                else if (name == "--gamma")
+                {
+                    options_.tonemap.gamma = parse_real(name, value);
+                    if (options_.tonemap.gamma == real(0.0))
+                    {
+                        throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected a positive number", value, name));
+                    }
+                }
+                else if (name == "--config")
+                {
+                    apply_file(std::string(value));
+                }
+                else if (name == "--scene")
+                {
+                    options_.scene_filepath = value;
+                }
+                else if (name == "--compile-scene")
+                {
+                    options_.compiled_scene_filepath = value;
+                }
+                else if (name == "--frames")
+                {
+                    options_.frame_count = parse_positive(name, value);
+                }
+                else if (name == "--preview")
+                {
+                    options_.preview = parse_switch(name, value);
+                }
+                else if (name == "--coordinate")
+                {
+                    options_.listen_port = parse_port(name, value);
+                }
+                else if (name == "--worker")
+                {
+                    const std::size_t colon = value.rfind(':');
+                    if (colon == std::string_view::npos || colon == 0)
+                    {
+                        throw std::runtime_error(fmt::format("invalid value '{}' for option {}: expected HOST:PORT", value, name));
+                    }
+
+                    options_.coordinator_host = value.substr(0, colon);
+                    options_.coordinator_port = parse_port(name, value.substr(colon + 1));
+                }
+                else if (name == "--lease-timeout")
+                {
+                    options_.lease_timeout = parse_positive(name, value);
+                }
+                else
+                {
+                    throw std::runtime_error(fmt::format("unrecognized option {}", name));
+                }
+            }
+
+            /**
+             * @brief Applies every option in a configuration file.
+             *
+             * Each line holds the name of an option, without its leading dashes, then its value, separated by
+             * whitespace. Blank lines and everything after a `#` are ignored.
+             *
+             * @throws std::runtime_error Thrown if the file cannot be read or holds an invalid option.
+             */
+            void apply_file(const std::string &filepath)
+            {
+                if (std::ranges::find(open_files_, filepath) != open_files_.end())
+                {
+                    throw std::runtime_error(fmt::format("configuration file '{}' includes itself", filepath));
+                }
+
+                std::ifstream input(filepath);
+                if (!input)
+                {
+                    throw std::runtime_error(fmt::format("could not open configuration file '{}'", filepath));
+                }
+
+                open_files_.push_back(filepath);
+                std::string line;
+                for (std::size_t line_number = 1; std::getline(input, line); ++line_number)
+                {
+                    std::string_view rest(line);
+                    rest = rest.substr(0, std::min(rest.find('#'), rest.size()));
+
+                    constexpr std::string_view whitespace = " \t\r";
+                    const std::size_t name_begin = std::min(rest.find_first_not_of(whitespace), rest.size());
+                    const std::size_t name_end = std::min(rest.find_first_of(whitespace, name_begin), rest.size());
+                    const std::size_t value_begin = std::min(rest.find_first_not_of(whitespace, name_end), rest.size());
+                    const std::size_t value_end = rest.find_last_not_of(whitespace) + 1;
+                    if (name_begin == rest.size())
+                    {
+                        continue;
+                    }
+
+                    if (value_begin == rest.size())
+                    {
+                        throw std::runtime_error(fmt::format("{}:{}: missing value", filepath, line_number));
+                    }
+
+                    const std::string name = fmt::format("--{}", rest.substr(name_begin, name_end - name_begin));
+                    const std::string_view value = rest.substr(value_begin, value_end - value_begin);
+                    try
+                    {
+                        apply(name, value);
+                    }
+                    catch (const std::runtime_error &e)
+                    {
+                        throw std::runtime_error(fmt::format("{}:{}: {}", filepath, line_number, e.what()));
+                    }
+                }
+                open_files_.pop_back();
+            }
+
+            void show_help()
+            {
+                options_.show_help = true;
+            }
+
+            /**
+             * @brief Resolves the options that depend on others.
+             * @throws std::runtime_error Thrown if no output format was given and the output file's is unknown, or if
+             *                            options that cannot be combined were.
+             */
+            rt::options finish()
+            {
+                if (options_.listen_port != 0)
+                {
+                    if (!options_.coordinator_host.empty())
+                    {
+                        throw std::runtime_error("options --coordinate and --worker cannot be combined");
+                    }
+
+                    // Both leave pixels with different numbers of samples to take, which leases cannot express yet.
+                    if (options_.adaptive_threshold > real(0.0) || !options_.resume_filepath.empty())
+                    {
+                        throw std::runtime_error("options --adaptive-threshold and --resume cannot be combined with --coordinate yet");
+                    }
+                }
+
+                // A preview renders one image over and over, and never finishes it for good.
+                if (options_.preview)
+                {
+                    const bool has_conflict = options_.frame_count != 0
+                        || options_.listen_port != 0
+                        || !options_.coordinator_host.empty()
+                        || !options_.checkpoint_filepath.empty()
+                        || !options_.resume_filepath.empty()
+                        || options_.adaptive_threshold > real(0.0);
+                    if (has_conflict)
+                    {
+                        throw std::runtime_error(
+                            "option --preview cannot be combined with --frames, --coordinate, --worker, --checkpoint, "
+                            "--resume or --adaptive-threshold"
+                        );
+                    }
+                }
+
+                // The device renders a single image with every pixel taking the full sample count, and gathers no
+                // auxiliary outputs.
+                if (options_.device == rt::render_device::cuda)
+                {
+                    const bool has_conflict = options_.preview
+                        || options_.frame_count != 0
+                        || options_.listen_port != 0
+                        || !options_.coordinator_host.empty()
+                        || options_.adaptive_threshold > real(0.0)
+                        || options_.aovs
+                        || options_.denoise;
+                    if (has_conflict)
+                    {
+                        throw std::runtime_error(
+                            "option --device cuda cannot be combined with --preview, --frames, --coordinate, --worker, "
+                            "--adaptive-threshold, --aovs or --denoise yet"
+                        );
+                    }
+                }
+
+                // A single checkpoint cannot hold a render of many frames.
+                if (options_.frame_count != 0)
+                {
+                    if (!options_.checkpoint_filepath.empty() || !options_.resume_filepath.empty())
+                    {
+                        throw std::runtime_error("options --checkpoint and --resume cannot be combined with --frames");
+                    }
+
+                    if (options_.listen_port != 0 || !options_.coordinator_host.empty())
+                    {
+                        throw std::runtime_error("options --coordinate and --worker cannot be combined with --frames yet");
+                    }
+                }
+
+                if (!output_format_)
+                {
+                    output_format_ = image_format_of(options_.output_filepath);
+                    if (!output_format_)
+                    {
+                        throw std::runtime_error(fmt::format(
+                            "cannot tell the format of output '{}' from its extension: use a .png, .exr or .pfm file, or give --format",
+                            options_.output_filepath
+                        ));
+                    }
+                }
+
+                options_.output_format = *output_format_;
+                return options_;
+            }
+
+        private:
+            rt::options                     options_;
+            std::optional<rt::image_format> output_format_;
+            std::vector<std::string>        open_files_;
+        };
+    }
+
+    /// The text printed by `--help`.
+    inline constexpr std::string_view usage = R"(usage: raytracer [--option value]...
+
+Image:
+  --width N                  the width of the image in pixels (1280)
+  --height N                 the height of the image in pixels (720)
+  --samples N                the number of samples per pixel (400)
+  --output PATH              where to write the image (output.png)
+  --format png|exr|pfm       the format of the image (from the extension of --output)
+  --aovs on|off              also write albedo, normal and depth to EXR and PFM output (off)
+  --denoise on|off           remove noise with a filter guided by the albedo, normal and depth (off)
+  --exr-type half|float      the precision of EXR channels (half)
+  --tonemap clamp|reinhard|aces
+                             how PNG output maps high dynamic range colors (clamp)
+  --exposure STOPS           the exposure adjustment of PNG output (0)
+  --gamma G                  the gamma that PNG output is encoded with (1)
+  --heatmap PATH             also write an image of the samples taken per pixel
+
+Scene:
+  --scene PATH               the scene description or compiled scene to render (built-in scene)
+  --compile-scene PATH       write the scene as a compiled scene file instead of rendering it
+  --frames N                 render N frames along the scene's camera path, numbering the output files
+  --preview on|off           refine the output from coarse to full resolution, starting over whenever a line of
+                             camera settings such as "origin 0 -2 -4 fov 40" arrives on standard input (off)
+
+Sampling:
+  --max-depth N              the largest number of bounces along a path (64)
+  --roulette-depth N         the number of bounces before Russian roulette applies (4)
+  --sampler random|stratified|halton|sobol|lattice
+                             how sample points are placed (stratified)
+  --seed N                   selects the sample points (0)
+  --adaptive-threshold E     stop sampling pixels whose relative error falls below E (0, never)
+  --adaptive-min-samples N   the samples every pixel takes before it can stop (64)
+
+Performance:
+  --threads N                the number of render threads (0, one per hardware thread)
+  --device cpu|cuda          render on the CPU, or on a CUDA device for scenes of spheres lit by the sky (cpu)
+  --tile-size N              the size of the square tiles the image is split into (32)
+  --pass-samples N           the samples each pixel takes per pass (16)
+  --trace PATH               write a Chrome trace of the tile timings (needs RAYTRACER_ENABLE_STATS)
+
+Progress:
+  --progress text|json|off   report a status line, one JSON object per line, or nothing (text)
+  --progress-fd N            the file descriptor that progress is written to (1, standard output)
+  --progress-interval S      the seconds between progress reports (0.5)
+
+Checkpoints:
+  --checkpoint PATH          where to periodically save the render so it can be resumed
+  --checkpoint-interval S    the least number of seconds between checkpoints (300)
+  --resume PATH              a checkpoint to continue rendering from, with the same seed, sampler and samples
+
+Distributed rendering:
+  --coordinate PORT          lease the render out to the workers that connect on PORT, instead of rendering it here
+  --worker HOST:PORT         render leases for the coordinator at HOST:PORT, taking every other setting from it
+  --lease-timeout S          the seconds a worker has to return a lease before it is leased again (120)
+
+  --config PATH              read options from a file of "name value" lines
+  --help                     print this message
+)";
+
+    /**
+     * @brief Parses the command-line arguments of the program, not including the program name.
+     * @param[in] arguments The arguments, each of the form `--name value`, or `--help`.
+     * @return The options, with defaults for every option that was not given.
+     * @throws std::runtime_error Thrown if an argument is unrecognized or has an invalid value.
+     */
+    inline rt::options parse_options(std::span<const char *const> arguments)
+    {
+        detail::option_parser parser;
+        for (std::size_t i = 0; i < arguments.size(); ++i)
+        {
+            const std::string_view name = arguments[i];
+            if (name == "--help")
+            {
+                parser.show_help();
+                continue;
+            }
+
+            if (i + 1 == arguments.size())
+            {
+                throw std::runtime_error(fmt::format("missing value for option {}", name));
+            }
+
+            parser.apply(name, arguments[++i]);
+        }
+
+        return parser.finish();
+    }
+}
+
+#endif // !RAYTRACER_OPTIONS_HPP
@@ -0,0 +1,65 @@
+/**
+ * @file packet.hpp
+ * @brief Groups of coherent rays that are traced together.
+ */
+
+#ifndef RAYTRACER_PACKET_HPP
+#define RAYTRACER_PACKET_HPP
+
+#include "camera.hpp"
+#include "math.hpp"
+#include "simd.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+namespace rt
+{
+    /// The number of rays in an rt::ray_packet. Always a whole number of SIMD vectors.
+    constexpr std::size_t packet_size = std::max<std::size_t>(8, simd::lane_count);
+
+    /**
+     * @brief A packet of rays stored as structure-of-arrays, so that each component can be loaded as SIMD lanes.
+     * @note Only the first `count` rays are meaningful. The remaining slots hold zero-length rays, which never hit
+     *       anything.
+     */
+    struct ray_packet
+    {
+        std::array<real, packet_size> origin_x = { };
+        std::array<real, packet_size> origin_y = { };
+        std::array<real, packet_size> origin_z = { };
+        std::array<real, packet_size> direction_x = { };
+        std::array<real, packet_size> direction_y = { };
+        std::array<real, packet_size> direction_z = { };
+        std::size_t                   count = 0;
+
+        /// Whether every slot in the packet holds a ray.
+        bool full() const
+        {
+            return count == packet_size;
+        }
+
+        /// Appends a ray to the packet.
+        void push_back(const rt::ray &ray)
+        {
+            origin_x[count] = ray.origin().x;
+            origin_y[count] = ray.origin().y;
+            origin_z[count] = ray.origin().z;
+            direction_x[count] = ray.direction().x;
+            direction_y[count] = ray.direction().y;
+            direction_z[count] = ray.direction().z;
+            ++count;
+        }
+
+        rt::ray operator[](std::size_t index) const
+        {
+            return rt::ray(
+                vec3(origin_x[index], origin_y[index], origin_z[index]),
+                vec3(direction_x[index], direction_y[index], direction_z[index])
+            );
+        }
+    };
+}
+
+#endif // !RAYTRACER_PACKET_HPP
@@ -0,0 +1,64 @@
+/**
+ * @file pfm.hpp
+ * @brief Writing uncompressed Portable Float Map images.
+ */
+
+#ifndef RAYTRACER_PFM_HPP
+#define RAYTRACER_PFM_HPP
+
+#include <fmt/format.h>
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace pfm
+{
+    /**
+     * @brief An uncompressed, 32-bit float PFM image with one or three channels, read from an interleaved buffer.
+     */
+    struct image
+    {
+        /// The first channel of the top-left pixel. The channels of pixel `i`, in row-major order, start at
+        /// `values[i * stride]`.
+        const float  *values;
+        /// The number of floats between consecutive pixels.
+        std::size_t   stride;
+        /// The number of channels written for each pixel: 3 for color, or 1 for greyscale.
+        std::uint32_t channels;
+        /// The width of the image.
+        std::uint32_t width;
+        /// The height of the image.
+        std::uint32_t height;
+
+        /// Writes the image to a stream.
+        void write_to(std::ostream &os) const
+        {
+            // A negative scale marks the data as little-endian.
+            const char *scale = std::endian::native == std::endian::little ? "-1.0" : "1.0";
+            const std::string header = fmt::format("{}\n{} {}\n{}\n", channels == 1 ? "Pf" : "PF", width, height, scale);
+            os.write(header.data(), static_cast<std::streamsize>(header.size()));
+
+            // Rows are stored from the bottom of the image to the top.
+            std::vector<float> row(static_cast<std::size_t>(width) * channels);
+            for (std::size_t y = height; y-- > 0;)
+            {
+                for (std::size_t x = 0; x < width; ++x)
+                {
+                    const float *pixel = values + (y * width + x) * stride;
+                    for (std::size_t c = 0; c < channels; ++c)
+                    {
+                        row[x * channels + c] = pixel[c];
+                    }
+                }
+
+                os.write(reinterpret_cast<const char *>(row.data()), static_cast<std::streamsize>(row.size() * sizeof(float)));
+            }
+        }
+    };
+}
+
+#endif // !RAYTRACER_PFM_HPP
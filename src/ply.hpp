@@ -0,0 +1,682 @@
+/**
+ * @file ply.hpp
+ * @brief Reading triangle meshes from Stanford PLY files.
+ */
+
+#ifndef RAYTRACER_PLY_HPP
+#define RAYTRACER_PLY_HPP
+
+#include "math.hpp"
+#include "scheduler.hpp"
+#include "triangle_mesh.hpp"
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace ply
+{
+    enum class format
+    {
+        ascii                = 0,
+        binary_little_endian = 1,
+        binary_big_endian    = 2,
+    };
+
+    enum class scalar_type
+    {
+        int8    = 0,
+        uint8   = 1,
+        int16   = 2,
+        uint16  = 3,
+        int32   = 4,
+        uint32  = 5,
+        float32 = 6,
+        float64 = 7,
+    };
+
+    struct property
+    {
+        std::string                     name;
+        ply::scalar_type                type;
+        /// For a list property, the type of the count that precedes its items, which are of type `type`.
+        std::optional<ply::scalar_type> count_type;
+    };
+
+    struct element
+    {
+        std::string                name;
+        std::size_t                count;
+        std::vector<ply::property> properties;
+    };
+
+    namespace detail
+    {
+        /// The number of vertices that each task of a parallel binary read decodes.
+        constexpr std::size_t vertices_per_task = std::size_t(1) << 16;
+
+        inline std::size_t size_of(ply::scalar_type type)
+        {
+            switch (type)
+            {
+            case ply::scalar_type::int8:
+            case ply::scalar_type::uint8:
+                return 1;
+            case ply::scalar_type::int16:
+            case ply::scalar_type::uint16:
+                return 2;
+            case ply::scalar_type::int32:
+            case ply::scalar_type::uint32:
+            case ply::scalar_type::float32:
+                return 4;
+            case ply::scalar_type::float64:
+                return 8;
+            }
+
+            return 0;
+        }
+
+        inline std::optional<ply::scalar_type> parse_scalar_type(std::string_view name)
+        {
+            if (name == "char"   || name == "int8")    return ply::scalar_type::int8;
+            if (name == "uchar"  || name == "uint8")   return ply::scalar_type::uint8;
+            if (name == "short"  || name == "int16")   return ply::scalar_type::int16;
+            if (name == "ushort" || name == "uint16")  return ply::scalar_type::uint16;
+            if (name == "int"    || name == "int32")   return ply::scalar_type::int32;
+            if (name == "uint"   || name == "uint32")  return ply::scalar_type::uint32;
+            if (name == "float"  || name == "float32") return ply::scalar_type::float32;
+            if (name == "double" || name == "float64") return ply::scalar_type::float64;
+
+            return std::nullopt;
+        }
+
+        template<typename T>
+        T load(const std::byte *data, bool swap_bytes)
+        {
+            std::array<std::byte, sizeof(T)> bytes;
+            std::memcpy(bytes.data(), data, sizeof(T));
+            if (swap_bytes)
+            {
+                std::ranges::reverse(bytes);
+            }
+
+            return std::bit_cast<T>(bytes);
+        }
+
+        /// Decodes one binary scalar as a double, which holds every type exactly.
+        inline double load_scalar(const std::byte *data, ply::scalar_type type, bool swap_bytes)
+        {
+            switch (type)
+            {
+            case ply::scalar_type::int8:    return static_cast<double>(load<std::int8_t>(data, swap_bytes));
+            case ply::scalar_type::uint8:   return static_cast<double>(load<std::uint8_t>(data, swap_bytes));
+            case ply::scalar_type::int16:   return static_cast<double>(load<std::int16_t>(data, swap_bytes));
+            case ply::scalar_type::uint16:  return static_cast<double>(load<std::uint16_t>(data, swap_bytes));
+            case ply::scalar_type::int32:   return static_cast<double>(load<std::int32_t>(data, swap_bytes));
+            case ply::scalar_type::uint32:  return static_cast<double>(load<std::uint32_t>(data, swap_bytes));
+            case ply::scalar_type::float32: return static_cast<double>(load<float>(data, swap_bytes));
+            case ply::scalar_type::float64: return load<double>(data, swap_bytes);
+            }
+
+            return 0.0;
+        }
+
+        /// Reads the scalars of the body of a file one at a time, whatever its format.
+        class reader
+        {
+        public:
+            explicit reader(std::span<const std::byte> body, ply::format format)
+                : body_(body)
+                , format_(format)
+                , swap_bytes_((format == ply::format::binary_little_endian) != (std::endian::native == std::endian::little))
+            {
+            }
+
+            double next(ply::scalar_type type)
+            {
+                if (format_ == ply::format::ascii)
+                {
+                    const std::string_view word = next_word();
+                    double value = 0.0;
+                    const auto [end, status] = std::from_chars(word.data(), word.data() + word.size(), value);
+                    if (word.empty() || status != std::errc() || end != word.data() + word.size())
+                    {
+                        throw std::runtime_error(fmt::format("expected a number, but found '{}'", word));
+                    }
+
+                    return value;
+                }
+
+                const std::size_t size = size_of(type);
+                if (position_ + size > body_.size())
+                {
+                    throw std::runtime_error("the file ends before all of its elements");
+                }
+
+                const double value = load_scalar(body_.data() + position_, type, swap_bytes_);
+                position_ += size;
+                return value;
+            }
+
+            /// Reads the length of a list, which must be a whole number of items that the rest of the file could hold.
+            std::size_t next_count(ply::scalar_type type)
+            {
+                const double value = next(type);
+                if (!is_whole(value) || value > static_cast<double>(body_.size() - position_))
+                {
+                    throw std::runtime_error(fmt::format("invalid list length {}", value));
+                }
+
+                return static_cast<std::size_t>(value);
+            }
+
+            /**
+             * @brief Tests that the rest of the file could hold `count` elements that are each at least `size` bytes
+             *        long, before anything is allocated for them.
+             */
+            void expect(std::size_t count, std::size_t size) const
+            {
+                if (count > (body_.size() - position_) / std::max<std::size_t>(size, 1))
+                {
+                    throw std::runtime_error("the file ends before all of its elements");
+                }
+            }
+
+            /// Skips the binary data of `count` elements that are each `size` bytes long.
+            void skip(std::size_t count, std::size_t size)
+            {
+                expect(count, size);
+                position_ += count * size;
+            }
+
+            std::span<const std::byte> remaining() const
+            {
+                return body_.subspan(position_);
+            }
+
+            bool swap_bytes() const
+            {
+                return swap_bytes_;
+            }
+
+            /// The smallest number of bytes that an element could take up: one per scalar in either format.
+            std::size_t min_size(const ply::element &element) const
+            {
+                if (format_ == ply::format::ascii)
+                {
+                    return element.properties.size();
+                }
+
+                std::size_t size = 0;
+                for (const ply::property &property : element.properties)
+                {
+                    size += property.count_type ? size_of(*property.count_type) : size_of(property.type);
+                }
+
+                return size;
+            }
+
+            /// Whether a value read from the file is a whole number that is not negative.
+            static bool is_whole(double value)
+            {
+                return value >= 0.0 && std::trunc(value) == value;
+            }
+
+        private:
+            std::string_view next_word()
+            {
+                while (position_ < body_.size() && is_space(body_[position_]))
+                {
+                    ++position_;
+                }
+
+                const std::size_t begin = position_;
+                while (position_ < body_.size() && !is_space(body_[position_]))
+                {
+                    ++position_;
+                }
+
+                return std::string_view(reinterpret_cast<const char *>(body_.data()) + begin, position_ - begin);
+            }
+
+            static bool is_space(std::byte byte)
+            {
+                const char c = static_cast<char>(byte);
+                return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+            }
+
+        private:
+            std::span<const std::byte> body_;
+            ply::format                format_;
+            bool                       swap_bytes_;
+            std::size_t                position_ = 0;
+        };
+
+        struct header
+        {
+            ply::format               format;
+            std::vector<ply::element> elements;
+            /// The number of bytes before the first element.
+            std::size_t               size;
+        };
+
+        inline detail::header parse_header(std::string_view text)
+        {
+            detail::header header = { .format = ply::format::ascii, .elements = { }, .size = 0 };
+            bool has_format = false;
+
+            std::string_view rest = text;
+            for (std::size_t line_number = 1; ; ++line_number)
+            {
+                const std::size_t line_end = rest.find('\n');
+                if (line_end == std::string_view::npos)
+                {
+                    throw std::runtime_error("the header has no end_header line");
+                }
+
+                std::string_view line = rest.substr(0, line_end);
+                rest.remove_prefix(line_end + 1);
+                if (!line.empty() && line.back() == '\r')
+                {
+                    line.remove_suffix(1);
+                }
+
+                std::vector<std::string_view> words;
+                for (std::size_t begin = 0; begin < line.size();)
+                {
+                    const std::size_t end = std::min(line.find(' ', begin), line.size());
+                    if (end > begin)
+                    {
+                        words.push_back(line.substr(begin, end - begin));
+                    }
+
+                    begin = end + 1;
+                }
+
+                const auto error = [&](std::string_view message)
+                {
+                    return std::runtime_error(fmt::format("header line {}: {}", line_number, message));
+                };
+
+                if (line_number == 1)
+                {
+                    if (line != "ply")
+                    {
+                        throw error("not a PLY file");
+                    }
+
+                    continue;
+                }
+
+                if (words.empty() || words[0] == "comment" || words[0] == "obj_info")
+                {
+                    continue;
+                }
+
+                if (words[0] == "end_header")
+                {
+                    break;
+                }
+
+                if (words[0] == "format" && words.size() == 3)
+                {
+                    if (words[1] == "ascii")                     header.format = ply::format::ascii;
+                    else if (words[1] == "binary_little_endian") header.format = ply::format::binary_little_endian;
+                    else if (words[1] == "binary_big_endian")    header.format = ply::format::binary_big_endian;
+                    else throw error(fmt::format("unknown format '{}'", words[1]));
+                    has_format = true;
+                }
+                else if (words[0] == "element" && words.size() == 3)
+                {
+                    std::size_t count = 0;
+                    const auto [end, status] = std::from_chars(words[2].data(), words[2].data() + words[2].size(), count);
+                    if (status != std::errc() || end != words[2].data() + words[2].size())
+                    {
+                        throw error(fmt::format("invalid element count '{}'", words[2]));
+                    }
+
+                    header.elements.push_back({ .name = std::string(words[1]), .count = count, .properties = { } });
+                }
+                else if (words[0] == "property" && !header.elements.empty())
+                {
+                    const bool is_list = words.size() == 5 && words[1] == "list";
+                    if (!is_list && words.size() != 3)
+                    {
+                        throw error("expected 'property type name' or 'property list count_type type name'");
+                    }
+
+                    const std::optional type = parse_scalar_type(words[is_list ? 3 : 1]);
+                    const std::optional count_type = is_list ? parse_scalar_type(words[2]) : std::optional<ply::scalar_type>();
+                    if (!type || (is_list && !count_type))
+                    {
+                        throw error("unknown property type");
+                    }
+
+                    header.elements.back().properties.push_back({
+                        .name       = std::string(words.back()),
+                        .type       = *type,
+                        .count_type = count_type,
+                    });
+                }
+                else
+                {
+                    throw error(fmt::format("unexpected '{}'", line));
+                }
+            }
+
+            if (!has_format)
+            {
+                throw std::runtime_error("the header has no format line");
+            }
+
+            header.size = text.size() - rest.size();
+            return header;
+        }
+
+        /// The index of the property with the given name, if the element has it.
+        inline std::optional<std::size_t> find_property(const ply::element &element, std::string_view name)
+        {
+            const auto found = std::ranges::find(element.properties, name, &ply::property::name);
+            if (found == element.properties.end())
+            {
+                return std::nullopt;
+            }
+
+            return static_cast<std::size_t>(found - element.properties.begin());
+        }
+
+        /// The size of an element in binary, or nothing if it has list properties and so varies.
+        inline std::optional<std::size_t> fixed_size(const ply::element &element)
+        {
+            std::size_t size = 0;
+            for (const ply::property &property : element.properties)
+            {
+                if (property.count_type)
+                {
+                    return std::nullopt;
+                }
+
+                size += size_of(property.type);
+            }
+
+            return size;
+        }
+
+        inline void read_vertices(
+            detail::reader &input,
+            ply::format format,
+            const ply::element &element,
+            rt::mesh_data &mesh,
+            rt::thread_pool *pool
+        )
+        {
+            const std::optional x = find_property(element, "x");
+            const std::optional y = find_property(element, "y");
+            const std::optional z = find_property(element, "z");
+            if (!x || !y || !z)
+            {
+                throw std::runtime_error("vertices have no x, y and z properties");
+            }
+
+            const std::optional nx = find_property(element, "nx");
+            const std::optional ny = find_property(element, "ny");
+            const std::optional nz = find_property(element, "nz");
+            const bool has_normals = nx && ny && nz;
+            const std::optional size = fixed_size(element);
+
+            // A corrupt count would otherwise be allocated for before the file is found to be too short.
+            input.expect(element.count, size && format != ply::format::ascii ? *size : input.min_size(element));
+            mesh.positions.resize(element.count);
+            mesh.normals.resize(has_normals ? element.count : 0);
+
+            // Binary vertices without lists sit at fixed offsets, so their ranges can be decoded in parallel.
+            if (format != ply::format::ascii && size)
+            {
+                std::vector<std::size_t> offsets;
+                for (std::size_t i = 0, offset = 0; i < element.properties.size(); ++i)
+                {
+                    offsets.push_back(offset);
+                    offset += size_of(element.properties[i].type);
+                }
+
+                const std::span<const std::byte> data = input.remaining();
+                input.skip(element.count, *size);
+
+                const bool swap_bytes = input.swap_bytes();
+                const auto read_component = [&](const std::byte *vertex, std::size_t property)
+                {
+                    return static_cast<real>(load_scalar(vertex + offsets[property], element.properties[property].type, swap_bytes));
+                };
+
+                const auto decode = [&](std::size_t task)
+                {
+                    const std::size_t begin = task * vertices_per_task;
+                    const std::size_t end = std::min(begin + vertices_per_task, element.count);
+                    for (std::size_t i = begin; i < end; ++i)
+                    {
+                        const std::byte *vertex = data.data() + i * *size;
+                        mesh.positions[i] = vec3(read_component(vertex, *x), read_component(vertex, *y), read_component(vertex, *z));
+                        if (has_normals)
+                        {
+                            mesh.normals[i] = vec3(read_component(vertex, *nx), read_component(vertex, *ny), read_component(vertex, *nz));
+                        }
+                    }
+                };
+
+                const std::size_t task_count = (element.count + vertices_per_task - 1) / vertices_per_task;
+                if (pool == nullptr)
+                {
+                    for (std::size_t task = 0; task < task_count; ++task)
+                    {
+                        decode(task);
+                    }
+                }
+                else
+                {
+                    pool->run(task_count, decode);
+                }
+
+                return;
+            }
+
+            std::vector<double> values(element.properties.size());
+            for (std::size_t i = 0; i < element.count; ++i)
+            {
+                for (std::size_t p = 0; p < element.properties.size(); ++p)
+                {
+                    const ply::property &property = element.properties[p];
+                    if (property.count_type)
+                    {
+                        const std::size_t count = input.next_count(*property.count_type);
+                        for (std::size_t item = 0; item < count; ++item)
+                        {
+                            input.next(property.type);
+                        }
+
+                        continue;
+                    }
+
+                    values[p] = input.next(property.type);
+                }
+
+                const auto component = [&](std::size_t property) { return static_cast<real>(values[property]); };
+                mesh.positions[i] = vec3(component(*x), component(*y), component(*z));
+                if (has_normals)
+                {
+                    mesh.normals[i] = vec3(component(*nx), component(*ny), component(*nz));
+                }
+            }
+        }
+
+        inline void read_faces(detail::reader &input, const ply::element &element, rt::mesh_data &mesh)
+        {
+            std::optional indices = find_property(element, "vertex_indices");
+            if (!indices)
+            {
+                indices = find_property(element, "vertex_index");
+            }
+
+            if (!indices || !element.properties[*indices].count_type)
+            {
+                throw std::runtime_error("faces have no vertex_indices list");
+            }
+
+            input.expect(element.count, input.min_size(element));
+            mesh.triangles.reserve(element.count);
+            std::vector<std::uint32_t> face;
+            for (std::size_t i = 0; i < element.count; ++i)
+            {
+                for (std::size_t p = 0; p < element.properties.size(); ++p)
+                {
+                    const ply::property &property = element.properties[p];
+                    if (!property.count_type)
+                    {
+                        input.next(property.type);
+                        continue;
+                    }
+
+                    const std::size_t count = input.next_count(*property.count_type);
+                    if (p != *indices)
+                    {
+                        for (std::size_t item = 0; item < count; ++item)
+                        {
+                            input.next(property.type);
+                        }
+
+                        continue;
+                    }
+
+                    face.clear();
+                    for (std::size_t item = 0; item < count; ++item)
+                    {
+                        const double index = input.next(property.type);
+                        if (!detail::reader::is_whole(index))
+                        {
+                            throw std::runtime_error(fmt::format("face {} refers to vertex {}, which is not an index", i, index));
+                        }
+
+                        if (index >= static_cast<double>(mesh.positions.size()))
+                        {
+                            throw std::runtime_error(fmt::format(
+                                "face {} refers to vertex {}, but there are only {}", i, index, mesh.positions.size()
+                            ));
+                        }
+
+                        face.push_back(static_cast<std::uint32_t>(index));
+                    }
+
+                    if (face.size() < 3)
+                    {
+                        throw std::runtime_error(fmt::format("face {} has fewer than 3 vertices", i));
+                    }
+
+                    // Polygons are split into a fan of triangles around their first vertex.
+                    for (std::size_t corner = 2; corner < face.size(); ++corner)
+                    {
+                        mesh.triangles.push_back({ face[0], face[corner - 1], face[corner] });
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Reads the triangles of a PLY file, and their shading normals if its vertices have them.
+     *
+     * Vertices must have `x`, `y` and `z` properties, and may have `nx`, `ny` and `nz`. Faces must have a
+     * `vertex_indices` list. Every other element and property is skipped. Polygons are split into triangles.
+     *
+     * @param[in] bytes The contents of the file.
+     * @param[in] filepath The name of the file, for error messages.
+     * @param[in] pool If not null, the pool that decodes binary vertices in parallel.
+     * @throws std::runtime_error Thrown if the file is invalid or has no vertex and face elements.
+     */
+    inline rt::mesh_data load(std::span<const std::byte> bytes, std::string_view filepath, rt::thread_pool *pool = nullptr)
+    {
+        try
+        {
+            const std::string_view text(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+            const detail::header header = detail::parse_header(text);
+
+            const auto has_element = [&](std::string_view name)
+            {
+                return std::ranges::find(header.elements, name, &ply::element::name) != header.elements.end();
+            };
+
+            if (!has_element("vertex") || !has_element("face"))
+            {
+                throw std::runtime_error("expected vertex and face elements");
+            }
+
+            rt::mesh_data mesh;
+            bool has_vertices = false;
+            detail::reader input(bytes.subspan(header.size), header.format);
+            for (const ply::element &element : header.elements)
+            {
+                if (element.name == "vertex")
+                {
+                    detail::read_vertices(input, header.format, element, mesh, pool);
+                    has_vertices = true;
+                }
+                else if (element.name == "face")
+                {
+                    if (!has_vertices)
+                    {
+                        throw std::runtime_error("faces must follow the vertices they refer to");
+                    }
+
+                    detail::read_faces(input, element, mesh);
+                    break;
+                }
+                else if (const std::optional size = detail::fixed_size(element); size && header.format != ply::format::ascii)
+                {
+                    input.skip(element.count, *size);
+                }
+                else
+                {
+                    for (std::size_t i = 0; i < element.count; ++i)
+                    {
+                        for (const ply::property &property : element.properties)
+                        {
+                            const std::size_t count = property.count_type ? input.next_count(*property.count_type) : 1;
+                            for (std::size_t item = 0; item < count; ++item)
+                            {
+                                input.next(property.type);
+                            }
+                        }
+                    }
+                }
+            }
+
+            if (mesh.normals.empty())
+            {
+                return mesh;
+            }
+
+            // Normals are stored per vertex, so every triangle indexes them as it indexes the positions.
+            mesh.normal_triangles = mesh.triangles;
+            return mesh;
+        }
+        catch (const std::runtime_error &e)
+        {
+            throw std::runtime_error(fmt::format("{}: {}", filepath, e.what()));
+        }
+    }
+}
+
+#endif // !RAYTRACER_PLY_HPP
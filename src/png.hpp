@@ -6,14 +6,23 @@
 #ifndef RAYTRACER_PNG_HPP
 #define RAYTRACER_PNG_HPP
 
+#include "isa.hpp"
+#include "scheduler.hpp"
+
 #include <zlib.h>
 #include <fmt/format.h>
 
+#include <algorithm>
 #include <array>
+#include <atomic>
 #include <bit>
+#include <cstddef>
 #include <cstdint>
+#include <exception>
+#include <limits>
 #include <ostream>
 #include <span>
+#include <stdexcept>
 #include <vector>
 
 namespace png
@@ -32,6 +41,70 @@ namespace png
         }
     }
 
+    /**
+     * @brief Collects the many small writes that make up a PNG file into large writes to an std::ostream.
+     *
+     * Writes at least as large as the buffer bypass it, so the bulk of the image data is never copied.
+     */
+    class writer
+    {
+    public:
+        /// The number of bytes collected before they are written to the stream.
+        static constexpr std::size_t buffer_size = std::size_t(1) << 16;
+
+        explicit writer(std::ostream &os)
+            : os_(&os)
+        {
+            buffer_.reserve(buffer_size);
+        }
+
+        writer(const writer &) = delete;
+        writer &operator=(const writer &) = delete;
+
+        ~writer()
+        {
+            flush();
+        }
+
+        void write(std::span<const std::uint8_t> bytes)
+        {
+            if (buffer_.size() + bytes.size() > buffer_size)
+            {
+                flush();
+            }
+
+            if (bytes.size() >= buffer_size)
+            {
+                os_->write(reinterpret_cast<const char *>(bytes.data()), static_cast<std::streamsize>(bytes.size()));
+                return;
+            }
+
+            buffer_.insert(buffer_.end(), bytes.begin(), bytes.end());
+        }
+
+        /// Writes a 32-bit integer in big-endian byte order, as PNG requires.
+        void write_big_endian(std::uint32_t value)
+        {
+            if constexpr (std::endian::native == std::endian::little)
+            {
+                value = std::byteswap(value);
+            }
+
+            write(std::span(reinterpret_cast<const std::uint8_t *>(&value), sizeof(value)));
+        }
+
+        /// Writes every collected byte to the stream.
+        void flush()
+        {
+            os_->write(reinterpret_cast<const char *>(buffer_.data()), static_cast<std::streamsize>(buffer_.size()));
+            buffer_.clear();
+        }
+
+    private:
+        std::ostream             *os_;
+        std::vector<std::uint8_t> buffer_;
+    };
+
     /// The PNG file signature, as defined by
     /// [the PNG specification](http://www.libpng.org/pub/png/spec/1.2/PNG-Rationale.html#R.PNG-file-signature).
     constexpr std::array<std::uint8_t, 8> signature = { 0x89, 0x50, 0x4E, 0x47, 0x0D, 0x0A, 0x1A, 0x0A };
@@ -72,127 +145,329 @@ namespace png
             return header::size;
         }
 
-        void write_data(std::ostream &os) const
+        /// The packed data, in the order and byte order that the PNG specification defines.
+        std::array<std::uint8_t, size> bytes() const
         {
-            std::uint32_t width = this->width;
-            if constexpr (std::endian::native == std::endian::little)
+            std::array<std::uint8_t, size> bytes = { };
+            for (std::size_t i = 0; i < 4; ++i)
             {
-                width = std::byteswap(width);
+                bytes[i] = static_cast<std::uint8_t>(width >> (24 - 8 * i));
+                bytes[4 + i] = static_cast<std::uint8_t>(height >> (24 - 8 * i));
             }
 
-            std::uint32_t height = this->height;
-            if constexpr (std::endian::native == std::endian::little)
-            {
-                height = std::byteswap(height);
-            }
+            bytes[8] = bit_depth;
+            bytes[9] = color_type;
+            bytes[10] = compression_method;
+            bytes[11] = filter_method;
+            bytes[12] = interlace_method;
+
+            return bytes;
+        }
 
-            os.write(reinterpret_cast<const char *>(&width), sizeof(width));
-            os.write(reinterpret_cast<const char *>(&height), sizeof(height));
-            os.put(static_cast<char>(bit_depth));
-            os.put(static_cast<char>(color_type));
-            os.put(static_cast<char>(compression_method));
-            os.put(static_cast<char>(filter_method));
-            os.put(static_cast<char>(interlace_method));
+        void write_data(png::writer &writer) const
+        {
+            writer.write(bytes());
         }
 
         [[nodiscard]]
         std::uint32_t hash_data(std::uint32_t crc) const
         {
-            std::uint32_t width = this->width;
-            if constexpr (std::endian::native == std::endian::little)
+            const std::array packed = bytes();
+            return crc32(crc, packed.data(), static_cast<uInt>(packed.size()));
+        }
+    };
+
+    /**
+     * @brief The filter applied to a row of pixels before compression, as defined by
+     *        [the PNG specification](http://www.libpng.org/pub/png/spec/1.2/PNG-Filters.html).
+     */
+    enum class filter_type : std::uint8_t
+    {
+        none    = 0,
+        sub     = 1,
+        up      = 2,
+        average = 3,
+        paeth   = 4,
+    };
+
+    namespace detail
+    {
+        /// The number of bytes in each pixel of a 32-bit true-color image.
+        constexpr std::size_t bytes_per_pixel = 4;
+
+        /// The size of the LZ77 window of deflate, and so the most history a compressed segment can refer back to.
+        constexpr std::size_t window_size = std::size_t(1) << 15;
+
+        /// The number of uncompressed bytes that each segment of an image aims for when compressing in parallel.
+        constexpr std::size_t segment_size = std::size_t(1) << 18;
+
+        constexpr std::uint8_t paeth_predictor(std::uint8_t a, std::uint8_t b, std::uint8_t c)
+        {
+            const int p = a + b - c;
+            const int pa = p > a ? p - a : a - p;
+            const int pb = p > b ? p - b : b - p;
+            const int pc = p > c ? p - c : c - p;
+            if (pa <= pb && pa <= pc)
             {
-                width = std::byteswap(width);
+                return a;
             }
 
-            std::uint32_t height = this->height;
-            if constexpr (std::endian::native == std::endian::little)
+            return pb <= pc ? b : c;
+        }
+
+        /**
+         * @brief Applies a filter to a row of pixels.
+         * @param[in] row The raw bytes of the row.
+         * @param[in] previous The raw bytes of the row above, or an empty span for the first row.
+         * @param[out] filtered The filtered bytes, the same size as `row`.
+         */
+        RAYTRACER_DISPATCH
+        inline void filter_row(
+            png::filter_type filter,
+            std::span<const std::uint8_t> row,
+            std::span<const std::uint8_t> previous,
+            std::span<std::uint8_t> filtered
+        )
+        {
+            // Bytes outside the image are treated as zero. Each filter gets its own loop so that it vectorizes.
+            const std::size_t size = row.size();
+            const std::size_t bpp = std::min(bytes_per_pixel, size);
+            const bool has_previous = !previous.empty();
+            switch (filter)
             {
-                height = std::byteswap(height);
+            case png::filter_type::none:
+                std::ranges::copy(row, filtered.begin());
+                break;
+            case png::filter_type::sub:
+                std::copy_n(row.begin(), bpp, filtered.begin());
+                for (std::size_t i = bpp; i < size; ++i)
+                {
+                    filtered[i] = static_cast<std::uint8_t>(row[i] - row[i - bytes_per_pixel]);
+                }
+                break;
+            case png::filter_type::up:
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    filtered[i] = static_cast<std::uint8_t>(row[i] - (has_previous ? previous[i] : 0));
+                }
+                break;
+            case png::filter_type::average:
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    const int left = i >= bytes_per_pixel ? row[i - bytes_per_pixel] : 0;
+                    const int up = has_previous ? previous[i] : 0;
+                    filtered[i] = static_cast<std::uint8_t>(row[i] - (left + up) / 2);
+                }
+                break;
+            case png::filter_type::paeth:
+                for (std::size_t i = 0; i < size; ++i)
+                {
+                    const std::uint8_t left = i >= bytes_per_pixel ? row[i - bytes_per_pixel] : 0;
+                    const std::uint8_t up = has_previous ? previous[i] : 0;
+                    const std::uint8_t up_left = has_previous && i >= bytes_per_pixel ? previous[i - bytes_per_pixel] : 0;
+                    filtered[i] = static_cast<std::uint8_t>(row[i] - paeth_predictor(left, up, up_left));
+                }
+                break;
             }
+        }
 
-            crc = crc32(crc, reinterpret_cast<const Bytef *>(&width), sizeof(width));
-            crc = crc32(crc, reinterpret_cast<const Bytef *>(&height), sizeof(height));
-            crc = crc32(crc, &bit_depth, sizeof(bit_depth));
-            crc = crc32(crc, &color_type, sizeof(color_type));
-            crc = crc32(crc, &compression_method, sizeof(compression_method));
-            crc = crc32(crc, &filter_method, sizeof(filter_method));
-            crc = crc32(crc, &interlace_method, sizeof(interlace_method));
+        /// The sum of the absolute values of filtered bytes, each treated as signed.
+        RAYTRACER_DISPATCH
+        inline std::uint64_t filter_cost(std::span<const std::uint8_t> filtered)
+        {
+            std::uint64_t cost = 0;
+            for (const std::uint8_t byte : filtered)
+            {
+                const auto value = static_cast<std::int8_t>(byte);
+                cost += static_cast<std::uint64_t>(value < 0 ? -value : value);
+            }
 
-            return crc;
+            return cost;
         }
-    };
 
-    /**
-     * @brief An [IDAT](http://www.libpng.org/pub/png/spec/1.2/PNG-Chunks.html#C.IDAT) chunk.
-     */
-    struct data
-    {
-        /// The 4-byte chunk type.
-        static constexpr std::array type = detail::to_type("IDAT");
+        /**
+         * @brief Filters a row with whichever filter leaves the smallest sum of absolute values, treating each byte
+         *        as signed. This is the heuristic recommended by the PNG specification, and it usually compresses
+         *        best.
+         * @param[out] filtered The filter type byte followed by the filtered row, one byte larger than `row`.
+         * @param scratch Working space the size of `row`.
+         */
+        inline void filter_row_adaptive(
+            std::span<const std::uint8_t> row,
+            std::span<const std::uint8_t> previous,
+            std::span<std::uint8_t> filtered,
+            std::span<std::uint8_t> scratch
+        )
+        {
+            constexpr std::array filters = {
+                png::filter_type::none,
+                png::filter_type::sub,
+                png::filter_type::up,
+                png::filter_type::average,
+                png::filter_type::paeth,
+            };
 
-        /// The compressed image data.
-        std::vector<std::uint8_t> bytes;
+            std::uint64_t best_cost = std::numeric_limits<std::uint64_t>::max();
+            for (const png::filter_type filter : filters)
+            {
+                filter_row(filter, row, previous, scratch);
+
+                const std::uint64_t cost = filter_cost(scratch);
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    filtered[0] = static_cast<std::uint8_t>(filter);
+                    std::ranges::copy(scratch, filtered.begin() + 1);
+                }
+            }
+        }
+
+        /// Filters a run of consecutive rows, each prefixed with its filter type byte.
+        inline std::vector<std::uint8_t> filter_rows(
+            std::span<const std::uint8_t> raw_bytes,
+            std::size_t stride,
+            std::size_t first_row,
+            std::size_t row_count
+        )
+        {
+            std::vector<std::uint8_t> filtered(row_count * (stride + 1));
+            std::vector<std::uint8_t> scratch(stride);
+            for (std::size_t i = 0; i < row_count; ++i)
+            {
+                const std::size_t row = first_row + i;
+                filter_row_adaptive(
+                    raw_bytes.subspan(row * stride, stride),
+                    row == 0 ? std::span<const std::uint8_t>() : raw_bytes.subspan((row - 1) * stride, stride),
+                    std::span(filtered).subspan(i * (stride + 1), stride + 1),
+                    scratch
+                );
+            }
+
+            return filtered;
+        }
 
         /**
-         * @brief Constructs a new png::data object by compressing the provided raw image bytes.
-         * @param[in] width The width of the image.
-         * @param[in] height The height of the image.
-         * @param[in] raw_bytes The raw RGBA bytes.
+         * @brief A run of rows compressed as an independent piece of the image's zlib stream.
+         */
+        struct segment
+        {
+            /// The compressed bytes, starting with the zlib header for the first segment.
+            std::vector<std::uint8_t> bytes;
+            /// The Adler-32 checksum of the segment's uncompressed bytes.
+            uLong                     adler;
+            /// The number of uncompressed bytes in the segment.
+            std::size_t               uncompressed_size;
+            /// The error thrown while compressing the segment, if any.
+            std::exception_ptr        error;
+        };
+
+        /**
+         * @brief Filters and compresses a run of rows as raw deflate data that can be concatenated with the
+         *        segments before and after it.
+         *
+         * Every segment but the last ends on a byte boundary with `Z_SYNC_FLUSH`, so segments can be compressed
+         * independently and joined in order. Each segment is primed with the last 32 KiB of the data before it, as
+         * pigz does, so that splitting costs almost nothing in compression ratio.
+         *
          * @throws std::runtime_error Thrown if the compression process fails.
          */
-        explicit data(std::size_t width, std::size_t height, std::span<const std::uint8_t> raw_bytes)
-            : bytes(compressBound(static_cast<uInt>(raw_bytes.size())))
+        inline segment compress_segment(
+            std::span<const std::uint8_t> raw_bytes,
+            std::size_t stride,
+            std::size_t first_row,
+            std::size_t row_count,
+            bool is_last
+        )
         {
-            z_stream stream = {
-                .next_out  = bytes.data(),
-                .avail_out = static_cast<uInt>(bytes.size()),
-            };
+            const std::vector<std::uint8_t> input = filter_rows(raw_bytes, stride, first_row, row_count);
 
-            if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+            z_stream stream = { };
+            constexpr int raw_deflate_window_bits = -15;
+            constexpr int default_memory_level = 8;
+            if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, raw_deflate_window_bits, default_memory_level, Z_DEFAULT_STRATEGY) != Z_OK)
             {
                 throw std::runtime_error(
-                    fmt::format("failed on deflateInit() with error: {}", stream.msg)
+                    fmt::format("failed on deflateInit2() with error: {}", stream.msg)
                 );
             }
 
-            const std::size_t stride = width * 4;
-            for (std::size_t row = 0; row < height; ++row)
+            if (first_row > 0)
             {
-                std::uint8_t filter = 0;
-                stream.next_in = &filter;
-                stream.avail_in = sizeof(filter);
-                if (deflate(&stream, Z_NO_FLUSH) != Z_OK)
+                // Filtering is deterministic, so re-filtering the preceding rows reproduces their exact bytes.
+                const std::size_t dictionary_rows = std::min(first_row, (window_size + stride) / (stride + 1));
+                const std::vector<std::uint8_t> history = filter_rows(raw_bytes, stride, first_row - dictionary_rows, dictionary_rows);
+                const std::size_t dictionary_size = std::min(history.size(), window_size);
+                deflateSetDictionary(&stream, history.data() + history.size() - dictionary_size, static_cast<uInt>(dictionary_size));
+            }
+
+            segment result = {
+                .bytes             = { },
+                .adler             = adler32(adler32(0, nullptr, 0), input.data(), static_cast<uInt>(input.size())),
+                .uncompressed_size = input.size(),
+                .error             = nullptr,
+            };
+
+            // The zlib header: deflate with a 32 KiB window at the default compression level.
+            const std::size_t header_size = first_row == 0 ? 2 : 0;
+            result.bytes.resize(header_size + deflateBound(&stream, static_cast<uLong>(input.size())) + 16);
+            if (first_row == 0)
+            {
+                result.bytes[0] = 0x78;
+                result.bytes[1] = 0x9C;
+            }
+
+            stream.next_in = const_cast<Bytef *>(input.data());
+            stream.avail_in = static_cast<uInt>(input.size());
+
+            const int flush = is_last ? Z_FINISH : Z_SYNC_FLUSH;
+            while (true)
+            {
+                stream.next_out = result.bytes.data() + header_size + stream.total_out;
+                stream.avail_out = static_cast<uInt>(result.bytes.size() - header_size - stream.total_out);
+
+                const int status = deflate(&stream, flush);
+                if (status == Z_STREAM_END || (status == Z_OK && flush == Z_SYNC_FLUSH && stream.avail_out != 0))
                 {
-                    throw std::runtime_error(
-                        fmt::format("failed on deflate(Z_NO_FLUSH) with error: {}", stream.msg)
-                    );
+                    break;
                 }
 
-                const auto bytes = raw_bytes.subspan(row * stride, stride);
-                stream.next_in = const_cast<Bytef *>(bytes.data());
-                stream.avail_in = static_cast<uInt>(bytes.size());
-                if (deflate(&stream, Z_NO_FLUSH) != Z_OK)
+                if (status != Z_OK && status != Z_BUF_ERROR)
                 {
                     throw std::runtime_error(
-                        fmt::format("failed on deflate(Z_NO_FLUSH) with error: {}", stream.msg)
+                        fmt::format("failed on deflate() with error: {}", stream.msg)
                     );
                 }
-            }
 
-            if (deflate(&stream, Z_FINISH) != Z_STREAM_END)
-            {
-                throw std::runtime_error(
-                    fmt::format("failed on deflate(Z_FINISH) with error: {}", stream.msg)
-                );
+                result.bytes.resize(result.bytes.size() * 2);
             }
 
-            if (deflateEnd(&stream) != Z_OK)
+            result.bytes.resize(header_size + stream.total_out);
+
+            // A segment that was only flushed, not finished, is reported as freed prematurely, which is expected.
+            const int end_status = deflateEnd(&stream);
+            if (end_status != Z_OK && !(end_status == Z_DATA_ERROR && !is_last))
             {
                 throw std::runtime_error(
                     fmt::format("failed on deflateEnd() with error: {}", stream.msg)
                 );
             }
+
+            return result;
         }
+    }
+
+    /**
+     * @brief An [IDAT](http://www.libpng.org/pub/png/spec/1.2/PNG-Chunks.html#C.IDAT) chunk.
+     * @note The compressed image data is a single zlib stream, which may be split across any number of consecutive
+     *       IDAT chunks.
+     */
+    struct data
+    {
+        /// The 4-byte chunk type.
+        static constexpr std::array type = detail::to_type("IDAT");
+
+        /// This chunk's piece of the compressed image data.
+        std::span<const std::uint8_t> bytes;
 
         /// The length of the compressed data.
         std::uint32_t length() const
@@ -200,9 +475,9 @@ namespace png
             return static_cast<std::uint32_t>(bytes.size());
         }
 
-        void write_data(std::ostream &os) const
+        void write_data(png::writer &writer) const
         {
-            os.write(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+            writer.write(bytes);
         }
 
         [[nodiscard]]
@@ -226,7 +501,7 @@ namespace png
             return 0;
         }
 
-        void write_data([[maybe_unused]] std::ostream &os) const
+        void write_data([[maybe_unused]] png::writer &writer) const
         {
         }
 
@@ -257,31 +532,18 @@ namespace png
     }
 
     /**
-     * @brief Writes a chunk to the provided std::ostream.
+     * @brief Writes a chunk to the provided png::writer.
      * @tparam T The chunk type. This should usually not be provided explicitly, and should instead be deduced.
      * @param[in] chunk The chunk to be written.
-     * @param[in] os The output stream.
+     * @param[in] writer The output.
      */
     template<typename T>
-    void write_chunk(const T &chunk, std::ostream &os)
+    void write_chunk(const T &chunk, png::writer &writer)
     {
-        std::uint32_t length = chunk.length();
-        if constexpr (std::endian::native == std::endian::little)
-        {
-            length = std::byteswap(length);
-        }
-
-        os.write(reinterpret_cast<const char *>(&length), sizeof(length));
-        os.write(reinterpret_cast<const char *>(T::type.data()), T::type.size());
-        chunk.write_data(os);
-
-        std::uint32_t crc = calculate_chunk_crc(chunk);
-        if constexpr (std::endian::native == std::endian::little)
-        {
-            crc = std::byteswap(crc);
-        }
-
-        os.write(reinterpret_cast<const char *>(&crc), sizeof(crc));
+        writer.write_big_endian(chunk.length());
+        writer.write(T::type);
+        chunk.write_data(writer);
+        writer.write_big_endian(calculate_chunk_crc(chunk));
     }
 
     /**
@@ -289,12 +551,12 @@ namespace png
      */
     struct image
     {
-        /// The raw RGBA bytes of the image.
-        std::vector<std::uint8_t> raw_bytes;
+        /// The raw RGBA bytes of the image, which the caller keeps alive until the image is written.
+        std::span<const std::uint8_t> raw_bytes;
         /// The width of the image.
-        std::uint32_t             width;
+        std::uint32_t                 width;
         /// The height of the image.
-        std::uint32_t             height;
+        std::uint32_t                 height;
 
         /**
          * @brief Calculates the uncompressed size in bytes of a PNG image with a given width and height.
@@ -307,7 +569,14 @@ namespace png
             return width * (32 / 8) * height;
         }
 
-        void write_to(std::ostream &os) const
+        /**
+         * @brief Encodes the image and writes it to a stream.
+         * @param[in] os The output stream.
+         * @param[in] pool If not null, the pool that compresses segments of the image in parallel. Each segment is
+         *                 written as its own IDAT chunk as soon as every segment before it is done.
+         * @throws std::runtime_error Thrown if the compression process fails.
+         */
+        void write_to(std::ostream &os, rt::thread_pool *pool = nullptr) const
         {
             const png::header header = {
                 .width              = width,
@@ -319,12 +588,99 @@ namespace png
                 .interlace_method   = 0,
             };
 
-            const png::data data(width, height, raw_bytes);
+            png::writer writer(os);
+            writer.write(png::signature);
+            write_chunk(header, writer);
+
+            const std::size_t stride = static_cast<std::size_t>(width) * detail::bytes_per_pixel;
+            const std::size_t rows_per_segment = std::max<std::size_t>(detail::segment_size / (stride + 1), 1);
+            const std::size_t segment_count = std::max<std::size_t>((height + rows_per_segment - 1) / rows_per_segment, 1);
+
+            const auto compress = [&](std::size_t index)
+            {
+                const std::size_t first_row = index * rows_per_segment;
+                const std::size_t row_count = std::min<std::size_t>(rows_per_segment, height - first_row);
+                return detail::compress_segment(raw_bytes, stride, first_row, row_count, index + 1 == segment_count);
+            };
+
+            uLong adler = adler32(0, nullptr, 0);
+            const auto write_segment = [&](detail::segment &segment, bool is_last)
+            {
+                if (segment.error)
+                {
+                    std::rethrow_exception(segment.error);
+                }
+
+                adler = adler32_combine(adler, segment.adler, static_cast<z_off_t>(segment.uncompressed_size));
+                if (is_last)
+                {
+                    // The zlib stream ends with the big-endian Adler-32 of everything it holds.
+                    for (int shift = 24; shift >= 0; shift -= 8)
+                    {
+                        segment.bytes.push_back(static_cast<std::uint8_t>(adler >> shift));
+                    }
+                }
+
+                write_chunk(png::data { .bytes = segment.bytes }, writer);
+                segment = { };
+            };
+
+            if (pool == nullptr || segment_count == 1)
+            {
+                for (std::size_t index = 0; index < segment_count; ++index)
+                {
+                    detail::segment segment = compress(index);
+                    write_segment(segment, index + 1 == segment_count);
+                }
+            }
+            else
+            {
+                std::vector<detail::segment> segments(segment_count);
+                std::vector<std::atomic<bool>> is_ready(segment_count);
+                std::size_t next_to_write = 0;
+
+                const auto compress_task = [&](std::size_t index)
+                {
+                    try
+                    {
+                        segments[index] = compress(index);
+                    }
+                    catch (...)
+                    {
+                        segments[index].error = std::current_exception();
+                    }
+
+                    is_ready[index].store(true, std::memory_order_release);
+                };
+
+                // This runs on this thread while the pool is still busy, so it must not throw until the pool is done.
+                std::exception_ptr write_error;
+                const auto write_ready = [&](std::size_t)
+                {
+                    while (!write_error && next_to_write < segment_count && is_ready[next_to_write].load(std::memory_order_acquire))
+                    {
+                        try
+                        {
+                            write_segment(segments[next_to_write], next_to_write + 1 == segment_count);
+                        }
+                        catch (...)
+                        {
+                            write_error = std::current_exception();
+                        }
+
+                        ++next_to_write;
+                    }
+                };
+
+                pool->run(segment_count, compress_task, write_ready);
+                write_ready(segment_count);
+                if (write_error)
+                {
+                    std::rethrow_exception(write_error);
+                }
+            }
 
-            os.write(reinterpret_cast<const char *>(png::signature.data()), png::signature.size());
-            write_chunk(header, os);
-            write_chunk(data, os);
-            write_chunk(end, os);
+            write_chunk(end, writer);
         }
     };
 }
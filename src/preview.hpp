@@ -0,0 +1,111 @@
+/**
+ * @file preview.hpp
+ * @brief Reading the commands that steer an interactive preview while it renders.
+ */
+
+#ifndef RAYTRACER_PREVIEW_HPP
+#define RAYTRACER_PREVIEW_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <istream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief Reads commands, one per line, on a thread of its own, so that rendering never waits for input.
+     *
+     * Render threads test for pending commands between tiles, which only loads a relaxed atomic flag, so that a
+     * preview can drop the rest of its pass as soon as the camera moves.
+     *
+     * The reading thread is detached, since it may be blocked on a terminal when the program exits, so everything it
+     * touches is shared with it rather than owned by the reader.
+     */
+    class command_reader
+    {
+    public:
+        /// Starts reading from `input`, which must outlive the program's use of it, as the standard streams do.
+        explicit command_reader(std::istream &input)
+        {
+            std::thread([state = state_, &input]
+            {
+                std::string line;
+                while (std::getline(input, line))
+                {
+                    const std::scoped_lock lock(state->mutex);
+                    state->lines.push_back(std::move(line));
+                    state->has_pending.store(true, std::memory_order_relaxed);
+                    state->changed.notify_all();
+                }
+
+                const std::scoped_lock lock(state->mutex);
+                state->is_closed = true;
+                state->changed.notify_all();
+            }).detach();
+        }
+
+        command_reader(const command_reader &) = delete;
+        command_reader &operator=(const command_reader &) = delete;
+
+        /**
+         * @brief Whether any command has arrived since the last take().
+         * @note This function is thread-safe and lock-free.
+         */
+        [[nodiscard]]
+        bool has_pending() const
+        {
+            return state_->has_pending.load(std::memory_order_relaxed);
+        }
+
+        /// Takes every command that has arrived, in order.
+        [[nodiscard]]
+        std::vector<std::string> take()
+        {
+            const std::scoped_lock lock(state_->mutex);
+            std::vector<std::string> lines(
+                std::make_move_iterator(state_->lines.begin()),
+                std::make_move_iterator(state_->lines.end())
+            );
+            state_->lines.clear();
+            state_->has_pending.store(false, std::memory_order_relaxed);
+            return lines;
+        }
+
+        /// Whether the input has ended, so that no more commands will arrive.
+        [[nodiscard]]
+        bool is_closed() const
+        {
+            const std::scoped_lock lock(state_->mutex);
+            return state_->is_closed;
+        }
+
+        /// Blocks until a command arrives or the input ends.
+        void wait() const
+        {
+            std::unique_lock lock(state_->mutex);
+            state_->changed.wait(lock, [&] { return !state_->lines.empty() || state_->is_closed; });
+        }
+
+    private:
+        struct shared_state
+        {
+            std::mutex              mutex;
+            std::condition_variable changed;
+            std::deque<std::string> lines;
+            bool                    is_closed = false;
+            std::atomic<bool>       has_pending = false;
+        };
+
+    private:
+        std::shared_ptr<shared_state> state_ = std::make_shared<shared_state>();
+    };
+}
+
+#endif // !RAYTRACER_PREVIEW_HPP
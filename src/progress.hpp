@@ -0,0 +1,268 @@
+/**
+ * @file progress.hpp
+ * @brief Reporting the progress of a render from a thread of its own.
+ */
+
+#ifndef RAYTRACER_PROGRESS_HPP
+#define RAYTRACER_PROGRESS_HPP
+
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#ifdef _WIN32
+    #include <io.h>
+#else
+    #include <unistd.h>
+#endif
+
+namespace rt
+{
+    /// How progress is reported.
+    enum class progress_format
+    {
+        /// A status line for a terminal, rewritten in place.
+        text = 0,
+        /// One JSON object per line, for programs that track the render.
+        json = 1,
+        /// Nothing at all.
+        none = 2,
+    };
+
+    /**
+     * @brief Reports the progress of a render at a fixed interval.
+     *
+     * Render threads only bump relaxed atomic counters as they finish each tile, so they never wait on a lock or make
+     * a system call for the sake of progress. A thread of the reporter's own reads the counters at every interval and
+     * writes a report straight to a file descriptor, bypassing stdio.
+     *
+     * Every JSON report has the fields `event` (`"progress"`, or `"done"` for the last), `pass`, `pass_pixels`,
+     * `pass_tiles`, `tiles`, `samples`, `total_samples`, `rays`, `elapsed`, `samples_per_second`,
+     * `mrays_per_second` and `eta`, with times in seconds.
+     */
+    class progress_reporter
+    {
+    public:
+        struct create_parameters
+        {
+            rt::progress_format       format = rt::progress_format::text;
+            /// The file descriptor that reports are written to.
+            int                       fd = 1;
+            /// The time between reports.
+            std::chrono::milliseconds interval = std::chrono::milliseconds(500);
+            /// The number of samples left to take, across every pass. With adaptive sampling, pixels may stop
+            /// sooner, so the total is lowered with set_total_samples() as they converge.
+            std::uint64_t             total_samples = 0;
+        };
+
+        /// Starts the reporting thread, unless the format is rt::progress_format::none.
+        explicit progress_reporter(const create_parameters &parameters)
+            : format_(parameters.format)
+            , fd_(parameters.fd)
+            , interval_(parameters.interval)
+            , start_(std::chrono::steady_clock::now())
+            , total_samples_(parameters.total_samples)
+        {
+            if (format_ != rt::progress_format::none)
+            {
+                reporter_ = std::thread([this] { report_periodically(); });
+            }
+        }
+
+        progress_reporter(const progress_reporter &) = delete;
+        progress_reporter &operator=(const progress_reporter &) = delete;
+
+        ~progress_reporter()
+        {
+            finish();
+        }
+
+        /**
+         * @brief Starts counting the tiles of a new pass.
+         * @note Tiles of the previous pass must no longer be completing.
+         */
+        void begin_pass(std::uint32_t pass, std::size_t tile_count, std::size_t pixel_count)
+        {
+            pass_.store(pass, std::memory_order_relaxed);
+            pass_tiles_.store(tile_count, std::memory_order_relaxed);
+            pass_pixels_.store(pixel_count, std::memory_order_relaxed);
+            tiles_.store(0, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Changes the number of samples the render takes in total, counting those already taken, such as when
+         *        adaptive sampling finds that pixels have converged.
+         * @note This function is thread-safe and lock-free.
+         */
+        void set_total_samples(std::uint64_t total_samples)
+        {
+            total_samples_.store(total_samples, std::memory_order_relaxed);
+        }
+
+        /**
+         * @brief Counts a completed tile.
+         * @param[in] samples The number of samples taken in the tile.
+         * @param[in] rays The number of rays traced for the tile.
+         * @note This function is thread-safe and lock-free.
+         */
+        void complete_tile(std::uint64_t samples, std::uint64_t rays)
+        {
+            tiles_.fetch_add(1, std::memory_order_relaxed);
+            samples_.fetch_add(samples, std::memory_order_relaxed);
+            rays_.fetch_add(rays, std::memory_order_relaxed);
+        }
+
+        /// Stops the reporting thread and writes the final report. Does nothing if it was already called.
+        void finish()
+        {
+            if (!reporter_.joinable())
+            {
+                return;
+            }
+
+            {
+                const std::scoped_lock lock(mutex_);
+                stopping_ = true;
+            }
+
+            stopped_.notify_all();
+            reporter_.join();
+            report(true);
+        }
+
+    private:
+        void report_periodically()
+        {
+            std::unique_lock lock(mutex_);
+            while (!stopped_.wait_for(lock, interval_, [&] { return stopping_; }))
+            {
+                lock.unlock();
+                report(false);
+                lock.lock();
+            }
+        }
+
+        void report(bool is_done) const
+        {
+            const std::uint32_t pass = pass_.load(std::memory_order_relaxed);
+            const std::size_t pass_tiles = pass_tiles_.load(std::memory_order_relaxed);
+            const std::size_t pass_pixels = pass_pixels_.load(std::memory_order_relaxed);
+            const std::size_t tiles = tiles_.load(std::memory_order_relaxed);
+            const std::uint64_t samples = samples_.load(std::memory_order_relaxed);
+            const std::uint64_t rays = rays_.load(std::memory_order_relaxed);
+            const std::uint64_t total_samples = total_samples_.load(std::memory_order_relaxed);
+
+            const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+            const double samples_per_second = elapsed > 0.0 ? static_cast<double>(samples) / elapsed : 0.0;
+            const double mrays_per_second = elapsed > 0.0 ? static_cast<double>(rays) * 1.0e-6 / elapsed : 0.0;
+            const std::uint64_t remaining = total_samples - std::min(samples, total_samples);
+            const double eta = is_done || remaining == 0 ? 0.0
+                : samples_per_second > 0.0 ? static_cast<double>(remaining) / samples_per_second
+                : -1.0;
+
+            std::string line;
+            if (format_ == rt::progress_format::json)
+            {
+                line = fmt::format(
+                    "{{\"event\":\"{}\",\"pass\":{},\"pass_pixels\":{},\"pass_tiles\":{},\"tiles\":{},\"samples\":{},"
+                    "\"total_samples\":{},\"rays\":{},\"elapsed\":{:.3f},\"samples_per_second\":{:.1f},"
+                    "\"mrays_per_second\":{:.3f},\"eta\":{:.3f}}}\n",
+                    is_done ? "done" : "progress",
+                    pass,
+                    pass_pixels,
+                    pass_tiles,
+                    tiles,
+                    samples,
+                    total_samples,
+                    rays,
+                    elapsed,
+                    samples_per_second,
+                    mrays_per_second,
+                    eta
+                );
+            }
+            else
+            {
+                const double percent = total_samples > 0
+                    ? 100.0 * static_cast<double>(samples) / static_cast<double>(total_samples)
+                    : 100.0;
+                line = fmt::format(
+                    "\rPass {} ({} pixels sampling): {}/{} tiles, {:.1f}%, {:.2f} Msamples/s, {:.2f} Mrays/s, {} {}  {}",
+                    pass,
+                    pass_pixels,
+                    tiles,
+                    pass_tiles,
+                    percent,
+                    samples_per_second * 1.0e-6,
+                    mrays_per_second,
+                    is_done ? "elapsed" : "ETA",
+                    format_duration(is_done ? elapsed : eta),
+                    is_done ? "\n" : ""
+                );
+            }
+
+            write(line);
+        }
+
+        /// Formats a number of seconds as hours, minutes and seconds, or as unknown if it is negative.
+        static std::string format_duration(double seconds)
+        {
+            if (seconds < 0.0)
+            {
+                return "--:--:--";
+            }
+
+            const auto total = static_cast<std::uint64_t>(seconds + 0.5);
+            return fmt::format("{}:{:02}:{:02}", total / 3600, total / 60 % 60, total % 60);
+        }
+
+        /// Writes every byte of `text`, giving up quietly if the descriptor fails, since progress is never essential.
+        void write(std::string_view text) const
+        {
+            while (!text.empty())
+            {
+#ifdef _WIN32
+                const int written = ::_write(fd_, text.data(), static_cast<unsigned int>(text.size()));
+#else
+                const ssize_t written = ::write(fd_, text.data(), text.size());
+#endif
+                if (written <= 0)
+                {
+                    return;
+                }
+
+                text.remove_prefix(static_cast<std::size_t>(written));
+            }
+        }
+
+    private:
+        rt::progress_format       format_;
+        int                       fd_;
+        std::chrono::milliseconds interval_;
+        std::chrono::steady_clock::time_point start_;
+
+        std::atomic<std::uint64_t> total_samples_;
+        std::atomic<std::uint32_t> pass_ = 0;
+        std::atomic<std::size_t>   pass_tiles_ = 0;
+        std::atomic<std::size_t>   pass_pixels_ = 0;
+        std::atomic<std::size_t>   tiles_ = 0;
+        std::atomic<std::uint64_t> samples_ = 0;
+        std::atomic<std::uint64_t> rays_ = 0;
+
+        std::mutex              mutex_;
+        std::condition_variable stopped_;
+        bool                    stopping_ = false;
+        std::thread             reporter_;
+    };
+}
+
+#endif // !RAYTRACER_PROGRESS_HPP
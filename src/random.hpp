@@ -6,14 +6,177 @@
 #ifndef RAYTRACER_RANDOM_HPP
 #define RAYTRACER_RANDOM_HPP
 
+#include "math.hpp"
+
 #include <glm/glm.hpp>
-#include <glm/gtx/norm.hpp>
+#include <glm/gtc/constants.hpp>
 
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
 #include <ctime>
 #include <functional>
-#include <random>
+#include <limits>
 #include <thread>
 
+namespace rt
+{
+    /// The largest real less than 1.
+    constexpr real one_minus_epsilon = real(1.0) - std::numeric_limits<real>::epsilon() / real(2.0);
+
+    namespace detail
+    {
+        /// A fast, well-mixing 32-bit integer hash (lowbias32, by Chris Wellons).
+        constexpr std::uint32_t hash(std::uint32_t x)
+        {
+            x ^= x >> 16;
+            x *= 0x7FEB352DU;
+            x ^= x >> 15;
+            x *= 0x846CA68BU;
+            x ^= x >> 16;
+            return x;
+        }
+
+        template<typename... Ts>
+        constexpr std::uint32_t hash(std::uint32_t seed, std::uint32_t value, Ts... values)
+        {
+            seed = hash(seed ^ (value + 0x9E3779B9U + (seed << 6) + (seed >> 2)));
+            if constexpr (sizeof...(values) == 0)
+            {
+                return seed;
+            }
+            else
+            {
+                return hash(seed, values...);
+            }
+        }
+
+        /// Maps 32 random bits to a real in @f$[0, 1)@f$.
+        constexpr real to_unit(std::uint32_t bits)
+        {
+            return glm::min(static_cast<real>(bits) * real(0x1p-32), one_minus_epsilon);
+        }
+    }
+
+    /**
+     * @brief The PCG32 random number generator: 64-bit linear congruential state with a permuted 32-bit output.
+     *
+     * Its 16 bytes of state make it cheap to give every thread or every path a generator of its own, and distinct
+     * streams are statistically independent even when seeded with the same value.
+     *
+     * @see M. E. O'Neill, "PCG: A Family of Simple Fast Space-Efficient Statistically Good Algorithms for Random
+     *      Number Generation", Harvey Mudd College Technical Report HMC-CS-2014-0905, 2014.
+     */
+    class pcg32
+    {
+    public:
+        constexpr explicit pcg32(std::uint64_t seed = 0x853C49E6748FEA9BULL, std::uint64_t stream = 0xDA3E39CB94B95BDBULL)
+            : state_(0)
+            , increment_((stream << 1) | 1)
+        {
+            next();
+            state_ += seed;
+            next();
+        }
+
+        /// Generates 32 uniformly distributed random bits.
+        constexpr std::uint32_t next()
+        {
+            const std::uint64_t state = state_;
+            state_ = state * multiplier + increment_;
+
+            const auto xorshifted = static_cast<std::uint32_t>(((state >> 18) ^ state) >> 27);
+            const auto rotation = static_cast<std::uint32_t>(state >> 59);
+            return (xorshifted >> rotation) | (xorshifted << ((~rotation + 1) & 31));
+        }
+
+        /// Generates a real in @f$[0, 1)@f$ with uniform probability.
+        constexpr real next_real()
+        {
+            return detail::to_unit(next());
+        }
+
+        /// Skips the next `delta` outputs in @f$O(\log \texttt{delta})@f$ time.
+        constexpr void advance(std::uint64_t delta)
+        {
+            std::uint64_t step_multiplier = multiplier;
+            std::uint64_t step_increment = increment_;
+            std::uint64_t total_multiplier = 1;
+            std::uint64_t total_increment = 0;
+            while (delta > 0)
+            {
+                if ((delta & 1) != 0)
+                {
+                    total_multiplier *= step_multiplier;
+                    total_increment = total_increment * step_multiplier + step_increment;
+                }
+
+                step_increment = (step_multiplier + 1) * step_increment;
+                step_multiplier *= step_multiplier;
+                delta >>= 1;
+            }
+
+            state_ = total_multiplier * state_ + total_increment;
+        }
+
+    private:
+        static constexpr std::uint64_t multiplier = 0x5851F42D4C957F2DULL;
+
+        std::uint64_t state_;
+        std::uint64_t increment_;
+    };
+
+    /**
+     * @brief Maps a point in @f$[0, 1)^2@f$ to a point on the unit disk in the xy-plane, preserving stratification.
+     * @see P. Shirley and K. Chiu, "A Low Distortion Map Between Disk and Square", 1997.
+     */
+    inline vec3 sample_disk(vec2 u)
+    {
+        const vec2 offset = real(2.0) * u - vec2(real(1.0));
+        if (offset.x == real(0.0) && offset.y == real(0.0))
+        {
+            return vec3(real(0.0));
+        }
+
+        constexpr real quarter_pi = glm::pi<real>() / real(4.0);
+        const bool is_horizontal = glm::abs(offset.x) > glm::abs(offset.y);
+        const real radius = is_horizontal ? offset.x : offset.y;
+        const real theta = is_horizontal
+            ? quarter_pi * (offset.y / offset.x)
+            : real(2.0) * quarter_pi - quarter_pi * (offset.x / offset.y);
+
+        return vec3(radius * glm::cos(theta), radius * glm::sin(theta), real(0.0));
+    }
+
+    /// Maps a point in @f$[0, 1)^2@f$ to a uniformly distributed point on the unit sphere.
+    inline vec3 sample_sphere(vec2 u)
+    {
+        const real z = real(1.0) - real(2.0) * u.x;
+        const real r = glm::sqrt(glm::max(real(0.0), real(1.0) - z * z));
+        const real phi = glm::two_pi<real>() * u.y;
+
+        return vec3(r * glm::cos(phi), r * glm::sin(phi), z);
+    }
+
+    /// Maps a point in @f$[0, 1)^3@f$ to a uniformly distributed point inside the unit sphere.
+    inline vec3 sample_ball(vec3 u)
+    {
+        return std::cbrt(u.z) * sample_sphere(vec2(u.x, u.y));
+    }
+
+    namespace detail
+    {
+        inline rt::pcg32 &thread_generator()
+        {
+            static thread_local rt::pcg32 generator(
+                static_cast<std::uint64_t>(std::clock()),
+                std::hash<std::thread::id>()(std::this_thread::get_id())
+            );
+            return generator;
+        }
+    }
+}
+
 /**
  * @brief Generates a float @f$\texttt{f} \in [\texttt{min}, \texttt{max})@f$ with uniform probability.
  * @param[in] min The lower bound of the range.
@@ -22,9 +185,7 @@
  */
 inline real random_real(real min, real max)
 {
-    static thread_local std::mt19937 generator(std::clock() + std::hash<std::thread::id>()(std::this_thread::get_id()));
-    static thread_local std::uniform_real_distribution<real> distribution;
-    return distribution(generator, decltype(distribution)::param_type(min, max));
+    return min + (max - min) * rt::detail::thread_generator().next_real();
 }
 
 /**
@@ -33,7 +194,7 @@ inline real random_real(real min, real max)
  */
 inline real random_real()
 {
-    return random_real(real(0.0), real(1.0));
+    return rt::detail::thread_generator().next_real();
 }
 
 inline vec3 random_vec3()
@@ -48,29 +209,17 @@ inline vec3 random_vec3(real min, real max)
 
 inline vec3 random_in_unit_sphere()
 {
-    while (true)
-    {
-        if (const vec3 point = random_vec3(real(-1.0), real(1.0)); glm::length2(point) < real(1.0))
-        {
-            return point;
-        }
-    }
+    return rt::sample_ball(random_vec3());
 }
 
 inline vec3 random_unit_vector()
 {
-    return glm::normalize(random_in_unit_sphere());
+    return rt::sample_sphere(vec2(random_real(), random_real()));
 }
 
 inline vec3 random_in_unit_disk()
 {
-    while (true)
-    {
-        if (const vec3 point = vec3(random_real(real(-1.0), real(1.0)), random_real(real(-1.0), real(1.0)), real(0.0)); glm::length2(point) < real(1.0))
-        {
-            return point;
-        }
-    }
+    return rt::sample_disk(vec2(random_real(), random_real()));
 }
 
 #endif // !RAYTRACER_RANDOM_HPP
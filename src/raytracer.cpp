@@ -3,58 +3,236 @@
  * @brief Set-up and execution of the raytracer program.
  */
 
+#include "accumulation.hpp"
+#include "animation.hpp"
+#include "arena.hpp"
 #include "camera.hpp"
 #include "color.hpp"
-#include "material.hpp"
+#include "denoise.hpp"
+#include "device.hpp"
+#include "device_scene.hpp"
+#include "distributed.hpp"
+#include "exr.hpp"
+#include "framebuffer.hpp"
+#include "integrator.hpp"
 #include "math.hpp"
+#include "options.hpp"
+#include "pfm.hpp"
+#include "preview.hpp"
 #include "png.hpp"
+#include "progress.hpp"
 #include "random.hpp"
-#include "shape.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "scheduler.hpp"
+#include "socket.hpp"
+#include "stats.hpp"
+#include "tonemap.hpp"
+#include "world.hpp"
 
 #include <fmt/core.h>
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <cstdio>
 #include <exception>
+#include <filesystem>
 #include <fstream>
+#include <functional>
+#include <iostream>
+#include <future>
 #include <limits>
 #include <memory>
+#include <stdexcept>
+#include <span>
+#include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 enum class sample_method
 {
-    single     = 0,
-    stratified = 1,
+    /// One sample at the top-left corner of the pixel, with the lens sampled as usual.
+    single   = 0,
+    /// Every sample at its own point within the pixel, placed by the sampler.
+    jittered = 1,
 };
 
 /**
  * @brief The real entry point of the program.
+ * @param[in] options The settings chosen on the command line.
  * @throws std::exception Thrown if a fatal error occurs.
  */
-void run();
+void run(const rt::options &options);
 
-static vec3 sample_at(
+/**
+ * @brief Renders every pixel of an accumulation buffer that still needs samples, pass by pass.
+ * @param[in] camera_parameters The camera to render from, apart from its aspect ratio.
+ * @param[in] writes_previews Whether to write the image after every pass but the last, and save checkpoints as they
+ *                            fall due.
+ */
+static void render_image(
+    const rt::options &options,
+    const rt::scene &scene,
+    rt::camera::create_parameters camera_parameters,
+    rt::accumulation_buffer &accumulation,
+    rt::thread_pool &pool,
+    bool writes_previews
+);
+
+/**
+ * @brief Renders every pixel of an accumulation buffer that still needs samples on a CUDA device, pass by pass, writing
+ *        the image after every pass but the last and saving checkpoints as they fall due.
+ * @throws std::runtime_error Thrown if the scene has anything that the device cannot render, or the device fails.
+ */
+static void render_image_on_device(
+    const rt::options &options,
+    const rt::scene &scene,
+    rt::accumulation_buffer &accumulation,
+    rt::thread_pool &pool
+);
+
+/**
+ * @brief Renders each frame of an animation along the scene's camera path, writing each while the next renders.
+ * @throws std::exception Thrown if a fatal error occurs, including writing any frame failing.
+ */
+static void run_animation(const rt::options &options, const rt::scene &scene, rt::thread_pool &pool);
+
+/**
+ * @brief Renders an interactive preview, which refines the output image from coarse to full resolution and starts over
+ *        whenever a line of camera settings arrives on standard input, until the input ends or says `quit`.
+ */
+static void run_preview(const rt::options &options, const rt::scene &scene, rt::thread_pool &pool);
+
+/**
+ * @brief Enlarges an accumulation buffer by repeating each of its pixels over a block of pixels, cropped to the given
+ *        size.
+ */
+static rt::accumulation_buffer upscale(const rt::accumulation_buffer &coarse, std::uint32_t width, std::uint32_t height);
+
+/**
+ * @brief Leases the render out to workers instead of rendering it here, and writes the outputs once every lease is
+ *        done.
+ * @param[in] options The settings chosen on the command line.
+ * @throws std::exception Thrown if a fatal error occurs.
+ */
+static void run_coordinator(const rt::options &options);
+
+/**
+ * @brief Renders leases for a coordinator until it has no more to hand out.
+ * @param[in] options The settings chosen on the command line, of which only the ones that are not part of the job
+ *                    are used.
+ * @throws std::exception Thrown if a fatal error occurs, including the connection failing.
+ */
+static void run_worker(const rt::options &options);
+
+/**
+ * @brief Prints the statistics collected while rendering, and writes the trace of the tile timings, in builds that
+ *        collect them.
+ * @param[in] elapsed The time that rendering took.
+ */
+static void report_stats(const rt::options &options, std::chrono::steady_clock::duration elapsed);
+
+/**
+ * @brief Whether a render gathers the albedo, normal and depth outputs, which are needed to write them or to denoise.
+ */
+static bool keeps_aovs(const rt::options &options);
+
+/**
+ * @brief The settings that decide which samples a render takes, which its checkpoints record so that only a render
+ *        with the same settings resumes from them.
+ */
+static rt::sample_settings sample_settings(const rt::options &options);
+
+/**
+ * @brief Tests whether a pixel's estimate has converged enough to stop sampling it.
+ * @param[in] color_sum The sum of the colors of the pixel's samples.
+ * @param[in] luminance_square_sum The sum of the squared luminances of the pixel's samples.
+ * @param[in] sample_count The number of samples the pixel has taken.
+ * @param[in] threshold The largest acceptable error, relative to the pixel's mean luminance.
+ */
+static bool is_converged(accumulate_vec3 color_sum, accumulate_real luminance_square_sum, std::uint32_t sample_count, real threshold);
+
+/**
+ * @brief Writes the current estimate of every pixel of an accumulation buffer, and of its auxiliary outputs, in the
+ *        output format.
+ * @param[in] options The settings that choose the output file, its format and how it is tonemapped.
+ * @param[in] pool The pool that compresses the image in parallel. If null, it is compressed on the calling thread.
+ */
+static void write_image(const rt::options &options, const rt::accumulation_buffer &accumulation, rt::thread_pool *pool);
+
+/**
+ * @brief Writes everything a finished render outputs: the image, the final checkpoint and the heatmap.
+ * @param[in] pool The pool that compresses images in parallel. If null, they are compressed on the calling thread.
+ */
+static void write_outputs(const rt::options &options, const rt::accumulation_buffer &accumulation, rt::thread_pool *pool);
+
+/**
+ * @brief Creates a file and writes it with `write`.
+ * @throws std::runtime_error Thrown if the file cannot be created, or not every byte reaches it, such as when the disk
+ *                            is full.
+ */
+static void write_file(const std::string &filepath, const std::function<void(std::ostream &)> &write);
+
+/**
+ * @brief Derives the path of a file from the path of another by inserting a tag before its extension, such that
+ *        `output.pfm` becomes `output.albedo.pfm`.
+ */
+static std::string tagged_filepath(const std::string &filepath, std::string_view tag);
+
+/**
+ * @brief Writes a PNG image colored by the number of samples taken in each pixel, from dark blue for none to yellow
+ *        for `max_samples`.
+ */
+static void write_heatmap(
+    const std::string &filepath,
+    std::span<const std::uint32_t> samples_taken,
+    std::uint32_t width,
+    std::uint32_t height,
+    std::uint32_t max_samples,
+    rt::thread_pool *pool
+);
+
+/**
+ * @brief Queues the camera rays for a run of consecutive samples of a pixel onto an integrator.
+ * @param[in] first_sample The index of the first sample to take.
+ * @param[in] count The number of samples to take. Each adds its full radiance to the pixel.
+ * @param[in] total_count The number of samples the pixel takes across every call, which the sampler stratifies over.
+ * @param[in] pixel The index that the integrator accumulates the pixel's color into.
+ */
+static void sample_at(
     std::uint32_t x,
     std::uint32_t y,
     std::uint32_t width,
     std::uint32_t height,
+    std::uint32_t first_sample,
     std::uint32_t count,
+    std::uint32_t total_count,
     sample_method method,
     const rt::camera &camera,
-    const rt::world &world,
-    std::uint32_t max_depth
+    const rt::sampler &sampler,
+    rt::wavefront_integrator &integrator,
+    std::uint32_t pixel
 );
 
-static vec3 color_in_direction(const rt::ray &ray, const rt::world &world, std::uint32_t depth);
-
 /**
  * @brief Wraps run() in a try-catch to handle printing fatal errors.
  */
-int main()
+int main(int argc, char *argv[])
 {
     try
     {
-        run();
+        const std::span<const char *const> arguments(argv + 1, static_cast<std::size_t>(argc - 1));
+        const rt::options options = rt::parse_options(arguments);
+        if (options.show_help)
+        {
+            fmt::print("{}", rt::usage);
+            return EXIT_SUCCESS;
+        }
+
+        run(options);
     }
     catch (const std::exception &e)
     {
@@ -65,144 +243,1314 @@ int main()
     return EXIT_SUCCESS;
 }
 
-void run()
-{
-    constexpr std::uint32_t width = 1280;
-    constexpr std::uint32_t height = 720;
-    constexpr real aspect_ratio = static_cast<real>(width) / static_cast<real>(height);
-
-    constexpr std::uint32_t sample_count = 400;
-    constexpr std::uint32_t depth_max = 64;
-
-    constexpr real glass_refractive_index = real(1.52);
-
-    constexpr rt::lambertian matte_white  (vec3(real(1.0)));
-    constexpr rt::lambertian matte_grey   (vec3(real(0.5), real(0.5), real(0.5)));
-    constexpr rt::metal      metallic_gold(vec3(real(0.8), real(0.6), real(0.2)));
-    constexpr rt::dielectric glass        (glass_refractive_index);
-
-    std::vector<std::unique_ptr<rt::hittable>> objects;
-    objects.push_back(std::make_unique<rt::sphere>(vec3(real(-1.0), real(   0.0), real(1.0)), real(   0.5), glass));
-    objects.push_back(std::make_unique<rt::sphere>(vec3(real( 0.0), real(   0.0), real(1.0)), real(   0.5), metallic_gold));
-    objects.push_back(std::make_unique<rt::sphere>(vec3(real( 1.0), real(   0.0), real(1.0)), real(   0.5), matte_white));
-    objects.push_back(std::make_unique<rt::sphere>(vec3(real( 0.0), real(1000.5), real(1.0)), real(1000.0), matte_grey));
-    const rt::world world(std::move(objects));
-
-    constexpr vec3 camera_position(real(-3.0), real(-2.0), real(-3.0));
-    constexpr vec3 camera_target  (real( 0.0), real( 0.0), real( 1.0));
-    constexpr vec3 camera_up      (real( 0.0), real(-1.0), real( 0.0));
-    const rt::thin_lens_camera camera({
-        .origin       = camera_position,
-        .target       = camera_target,
-        .up           = camera_up,
-        .vertical_fov = glm::radians(real(47.0)),
-        .aspect_ratio = aspect_ratio,
-        .aperture     = real(0.1),
-        .focal_length = glm::distance(camera_target, camera_position),
+void run(const rt::options &options)
+{
+    // A worker renders whatever scene its coordinator sends.
+    if (!options.coordinator_host.empty())
+    {
+        run_worker(options);
+        return;
+    }
+
+    const rt::scene scene = options.scene_filepath.empty()
+        ? rt::scene(rt::default_scene())
+        : rt::scene::load(options.scene_filepath);
+
+    if (!options.compiled_scene_filepath.empty())
+    {
+        scene.compile(options.compiled_scene_filepath);
+        fmt::print("Compiled scene to '{}'\n", options.compiled_scene_filepath);
+        return;
+    }
+
+    if (options.listen_port != 0)
+    {
+        run_coordinator(options);
+        return;
+    }
+
+    rt::thread_pool pool(options.thread_count);
+    if (options.preview)
+    {
+        run_preview(options, scene, pool);
+        return;
+    }
+
+    if (options.frame_count != 0)
+    {
+        run_animation(options, scene, pool);
+        return;
+    }
+
+    const std::uint32_t width = options.width;
+    const std::uint32_t height = options.height;
+    rt::accumulation_buffer accumulation = options.resume_filepath.empty()
+        ? rt::accumulation_buffer(width, height, keeps_aovs(options))
+        : rt::accumulation_buffer::load(options.resume_filepath, sample_settings(options));
+    if (accumulation.width() != width || accumulation.height() != height)
+    {
+        throw std::runtime_error(fmt::format(
+            "checkpoint '{}' is {}x{}, but the image is {}x{}",
+            options.resume_filepath,
+            accumulation.width(),
+            accumulation.height(),
+            width,
+            height
+        ));
+    }
+
+    if (keeps_aovs(options) && !accumulation.has_aovs())
+    {
+        throw std::runtime_error(
+            fmt::format("checkpoint '{}' was rendered without auxiliary outputs", options.resume_filepath)
+        );
+    }
+
+    const auto render_start = std::chrono::steady_clock::now();
+    if (options.device == rt::render_device::cuda)
+    {
+        render_image_on_device(options, scene, accumulation, pool);
+    }
+    else
+    {
+        render_image(options, scene, scene.camera(), accumulation, pool, true);
+    }
+    report_stats(options, std::chrono::steady_clock::now() - render_start);
+
+    write_outputs(options, accumulation, &pool);
+}
+
+void render_image(
+    const rt::options &options,
+    const rt::scene &scene,
+    rt::camera::create_parameters camera_parameters,
+    rt::accumulation_buffer &accumulation,
+    rt::thread_pool &pool,
+    bool writes_previews
+)
+{
+    const std::uint32_t width = options.width;
+    const std::uint32_t height = options.height;
+    const real aspect_ratio = static_cast<real>(width) / static_cast<real>(height);
+
+    const std::uint32_t sample_count = options.sample_count;
+
+    const rt::world &world = scene.world();
+
+    camera_parameters.aspect_ratio = aspect_ratio;
+    const rt::thin_lens_camera camera(camera_parameters);
+
+    const std::vector<rt::tile> tiles = rt::make_tiles(width, height, options.tile_size);
+
+    const std::span<accumulate_vec3> color_sums = accumulation.color_sums();
+    const std::span<accumulate_real> luminance_squares = accumulation.luminance_squares();
+    const std::span<std::uint32_t> sample_counts = accumulation.sample_counts();
+    const rt::aov_accumulator aovs = {
+        .albedo_sums = accumulation.albedo_sums(),
+        .normal_sums = accumulation.normal_sums(),
+        .depths      = accumulation.depths(),
+    };
+
+    const std::unique_ptr<rt::sampler> sampler = rt::make_sampler(options.sampler, options.seed);
+
+    // A pixel keeps sampling until it has taken every sample or, with adaptive sampling, until its estimate has
+    // converged. Convergence is only tested between passes, so every pass samples a consistent set of pixels.
+    const bool is_adaptive = options.adaptive_threshold > real(0.0);
+    const auto needs_samples = [&](std::size_t pixel)
+    {
+        if (sample_counts[pixel] >= sample_count)
+        {
+            return false;
+        }
+
+        return !is_adaptive
+            || sample_counts[pixel] < options.adaptive_min_samples
+            || !is_converged(color_sums[pixel], luminance_squares[pixel], sample_counts[pixel], options.adaptive_threshold);
+    };
+
+    // The pixels that are still sampling, and the most samples they can take between them.
+    struct remaining_work
+    {
+        std::size_t   pixels = 0;
+        std::uint64_t samples = 0;
+    };
+
+    const auto count_remaining = [&]
+    {
+        remaining_work remaining;
+        for (std::size_t pixel = 0; pixel < sample_counts.size(); ++pixel)
+        {
+            if (needs_samples(pixel))
+            {
+                ++remaining.pixels;
+                remaining.samples += sample_count - sample_counts[pixel];
+            }
+        }
+
+        return remaining;
+    };
+
+    const std::uint64_t samples_before = accumulation.samples_done();
+    remaining_work remaining = count_remaining();
+
+    // Flush anything printed so far, since the reporter writes to its descriptor directly.
+    std::fflush(stdout);
+    rt::progress_reporter progress({
+        .format        = options.progress,
+        .fd            = options.progress_fd,
+        .interval      = std::chrono::milliseconds(static_cast<std::int64_t>(options.progress_interval * real(1000.0))),
+        .total_samples = remaining.samples,
     });
 
-    constexpr std::size_t size = png::image::uncompressed_size(width, height);
-    std::vector<std::uint8_t> raw_bytes;
-    raw_bytes.reserve(size);
-    for (std::uint32_t row = 0; row < height; ++row)
+    // The pass being rendered, which the statistics file each tile's timing under.
+    std::uint32_t pass = 0;
+    const auto render_tile = [&](std::size_t index)
     {
-        fmt::print("\rRemaining rows: {}", height - row);
+        const rt::tile &tile = tiles[index];
+        const rt::stats::tile_timer timer(pass, static_cast<std::uint32_t>(index));
+
+        // The integrator of the thread's previous tile is gone, so its path state can be reused for this one.
+        thread_local rt::scratch_arena scratch;
+        scratch.reset();
+
+        rt::wavefront_integrator integrator(world, scene.materials(), scene.lights(), *sampler, color_sums, {
+            .max_depth      = options.max_depth,
+            .roulette_depth = options.roulette_depth,
+            .tracing        = rt::trace_method::packet,
+            .memory         = scratch.resource(),
+        }, luminance_squares, aovs);
+
+        std::uint64_t samples_taken = 0;
+        for (std::uint32_t y = tile.y; y < tile.y + tile.height; ++y)
+        {
+            for (std::uint32_t x = tile.x; x < tile.x + tile.width; ++x)
+            {
+                const std::uint32_t pixel = y * width + x;
+                if (!needs_samples(pixel))
+                {
+                    continue;
+                }
+
+                const std::uint32_t count = std::min(options.pass_samples, sample_count - sample_counts[pixel]);
+                samples_taken += count;
+                sample_at(
+                    x,
+                    y,
+                    width,
+                    height,
+                    sample_counts[pixel],
+                    count,
+                    sample_count,
+                    sample_method::jittered,
+                    camera,
+                    *sampler,
+                    integrator,
+                    pixel
+                );
+                sample_counts[pixel] += count;
+            }
+        }
+
+        integrator.flush();
+        progress.complete_tile(samples_taken, integrator.ray_count());
+    };
+
+    auto last_checkpoint = std::chrono::steady_clock::now();
+    for (pass = 1; remaining.pixels > 0; ++pass)
+    {
+        progress.begin_pass(pass, tiles.size(), remaining.pixels);
+        pool.run(tiles.size(), render_tile);
+
+        // Pixels that converged will take no more samples, so they no longer count towards the total.
+        remaining = count_remaining();
+        progress.set_total_samples(accumulation.samples_done() - samples_before + remaining.samples);
+        if (!writes_previews || remaining.pixels == 0)
+        {
+            continue;
+        }
+
+        // Give a preview of the render so far, unless this was the last pass.
+        write_image(options, accumulation, &pool);
+
+        const auto now = std::chrono::steady_clock::now();
+        const bool is_checkpoint_due = now - last_checkpoint >= std::chrono::seconds(options.checkpoint_interval);
+        if (!options.checkpoint_filepath.empty() && is_checkpoint_due)
+        {
+            accumulation.save(options.checkpoint_filepath, sample_settings(options));
+            last_checkpoint = now;
+        }
+    }
+    progress.finish();
+}
+
+void render_image_on_device(
+    const rt::options &options,
+    const rt::scene &scene,
+    rt::accumulation_buffer &accumulation,
+    rt::thread_pool &pool
+)
+{
+    if constexpr (!rt::device::enabled)
+    {
+        throw std::runtime_error("this build has no CUDA backend");
+    }
+    else
+    {
+        const std::uint32_t width = options.width;
+        const std::uint32_t height = options.height;
+        const std::uint32_t sample_count = options.sample_count;
+
+        rt::camera::create_parameters camera_parameters = scene.camera();
+        camera_parameters.aspect_ratio = static_cast<real>(width) / static_cast<real>(height);
+
+        // The device traces in single precision whatever the build's, so rays leave surfaces by the single-precision
+        // distance.
+        const rt::device::pass_parameters parameters = {
+            .camera         = rt::flatten_for_device(camera_parameters),
+            .width          = width,
+            .height         = height,
+            .pass_samples   = options.pass_samples,
+            .total_samples  = sample_count,
+            .max_depth      = options.max_depth,
+            .roulette_depth = options.roulette_depth,
+            .seed           = options.seed,
+            .t_min          = rt::float_precision::t_min,
+        };
+
+        rt::device::renderer renderer(rt::flatten_for_device(scene), width * height);
+
+        const std::span<accumulate_vec3> color_sums = accumulation.color_sums();
+        const std::span<accumulate_real> luminance_squares = accumulation.luminance_squares();
+        const std::span<std::uint32_t> sample_counts = accumulation.sample_counts();
+        std::vector<float> pass_color_sums(std::size_t(3) * width * height);
+        std::vector<float> pass_luminance_squares(std::size_t(width) * height);
+
+        // The pixels that are still sampling, and the most samples they can take between them. Without adaptive
+        // sampling, those are the pixels short of the full sample count.
+        struct remaining_work
+        {
+            std::size_t   pixels = 0;
+            std::uint64_t samples = 0;
+        };
+
+        const auto count_remaining = [&]
+        {
+            remaining_work remaining;
+            for (const std::uint32_t count : sample_counts)
+            {
+                if (count < sample_count)
+                {
+                    ++remaining.pixels;
+                    remaining.samples += sample_count - count;
+                }
+            }
+
+            return remaining;
+        };
+
+        remaining_work remaining = count_remaining();
+
+        // Flush anything printed so far, since the reporter writes to its descriptor directly.
         std::fflush(stdout);
-        for (std::uint32_t column = 0; column < width; ++column)
+        rt::progress_reporter progress({
+            .format        = options.progress,
+            .fd            = options.progress_fd,
+            .interval      = std::chrono::milliseconds(static_cast<std::int64_t>(options.progress_interval * real(1000.0))),
+            .total_samples = remaining.samples,
+        });
+
+        // Each pass is reported as a single tile, since the device renders it all at once.
+        auto last_checkpoint = std::chrono::steady_clock::now();
+        for (std::uint32_t pass = 1; remaining.pixels > 0; ++pass)
         {
-            const std::uint32_t x = column;
-            const std::uint32_t y = row;
+            progress.begin_pass(pass, 1, remaining.pixels);
+            const std::uint64_t rays = renderer.render_pass(parameters, sample_counts, pass_color_sums, pass_luminance_squares);
+
+            std::uint64_t samples_taken = 0;
+            for (std::size_t pixel = 0; pixel < sample_counts.size(); ++pixel)
+            {
+                if (sample_counts[pixel] >= sample_count)
+                {
+                    continue;
+                }
+
+                const std::uint32_t count = std::min(options.pass_samples, sample_count - sample_counts[pixel]);
+                color_sums[pixel] += accumulate_vec3(
+                    pass_color_sums[3 * pixel + 0],
+                    pass_color_sums[3 * pixel + 1],
+                    pass_color_sums[3 * pixel + 2]
+                );
+                luminance_squares[pixel] += accumulate_real(pass_luminance_squares[pixel]);
+                sample_counts[pixel] += count;
+                samples_taken += count;
+            }
+
+            progress.complete_tile(samples_taken, rays);
+            remaining = count_remaining();
+            if (remaining.pixels == 0)
+            {
+                continue;
+            }
 
-            const vec3 color = sample_at(x, y, width, height, sample_count, sample_method::stratified, camera, world, depth_max);
-            const std::array rgba = to_rgba(color);
-            raw_bytes.insert(raw_bytes.end(), rgba.begin(), rgba.end());
+            // Give a preview of the render so far, unless this was the last pass.
+            write_image(options, accumulation, &pool);
+
+            const auto now = std::chrono::steady_clock::now();
+            const bool is_checkpoint_due = now - last_checkpoint >= std::chrono::seconds(options.checkpoint_interval);
+            if (!options.checkpoint_filepath.empty() && is_checkpoint_due)
+            {
+                accumulation.save(options.checkpoint_filepath, sample_settings(options));
+                last_checkpoint = now;
+            }
         }
+        progress.finish();
     }
+}
 
-    const png::image image = {
-        .raw_bytes = raw_bytes,
-        .width     = width,
-        .height    = height,
+void run_animation(const rt::options &options, const rt::scene &scene, rt::thread_pool &pool)
+{
+    if (scene.camera_path().empty())
+    {
+        throw std::runtime_error("option --frames needs a scene with keyframes for the camera to move along");
+    }
+
+    // The scene and pool live across frames, and each frame is written on a thread of its own while the render
+    // threads move on to the next. Only one frame is written at a time, so at most two frames are held in memory.
+    std::future<void> writing;
+    const auto render_start = std::chrono::steady_clock::now();
+    for (std::uint32_t frame = 0; frame < options.frame_count; ++frame)
+    {
+        rt::options frame_options = options;
+        const std::string tag = fmt::format("{:04}", frame);
+        frame_options.output_filepath = tagged_filepath(options.output_filepath, tag);
+        if (!options.heatmap_filepath.empty())
+        {
+            frame_options.heatmap_filepath = tagged_filepath(options.heatmap_filepath, tag);
+        }
+
+        if (options.progress == rt::progress_format::text)
+        {
+            fmt::print("Frame {} of {}: '{}'\n", frame + 1, options.frame_count, frame_options.output_filepath);
+        }
+
+        rt::accumulation_buffer accumulation(options.width, options.height, keeps_aovs(options));
+        render_image(options, scene, rt::camera_at(scene.camera_path(), static_cast<real>(frame)), accumulation, pool, false);
+
+        // Waiting rethrows anything that writing the previous frame threw.
+        if (writing.valid())
+        {
+            writing.get();
+        }
+
+        writing = std::async(
+            std::launch::async,
+            [frame_options = std::move(frame_options), accumulation = std::move(accumulation)]
+            {
+                write_outputs(frame_options, accumulation, nullptr);
+            }
+        );
+    }
+
+    report_stats(options, std::chrono::steady_clock::now() - render_start);
+    writing.get();
+}
+
+void run_preview(const rt::options &options, const rt::scene &scene, rt::thread_pool &pool)
+{
+    const std::uint32_t width = options.width;
+    const std::uint32_t height = options.height;
+    const std::uint32_t sample_count = options.sample_count;
+    const std::unique_ptr<rt::sampler> sampler = rt::make_sampler(options.sampler, options.seed);
+
+    // Each preview is written beside the output, then moved over it at once, so that a viewer watching the output
+    // never shows half an image.
+    rt::options preview_options = options;
+    preview_options.output_filepath = options.output_filepath + ".tmp";
+    preview_options.aovs = false;
+
+    // The coarse levels have no auxiliary outputs to guide the denoiser, and are gone too soon to need it.
+    rt::options coarse_options = preview_options;
+    coarse_options.denoise = false;
+
+    rt::command_reader commands(std::cin);
+    rt::camera::create_parameters camera_parameters = scene.camera();
+    camera_parameters.aspect_ratio = static_cast<real>(width) / static_cast<real>(height);
+
+    auto start = std::chrono::steady_clock::now();
+    const auto show = [&](const rt::accumulation_buffer &accumulation, std::uint32_t scale, std::uint32_t samples)
+    {
+        write_image(scale == 1 ? preview_options : coarse_options, accumulation, &pool);
+        std::filesystem::rename(preview_options.output_filepath, options.output_filepath);
+
+        if (options.progress == rt::progress_format::text)
+        {
+            const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            fmt::print("\rPreview at 1/{} resolution, {}/{} samples per pixel, {:.3f}s since the camera moved  ", scale, samples, sample_count, elapsed);
+            std::fflush(stdout);
+        }
+    };
+
+    const auto end_status_line = [&]
+    {
+        if (options.progress == rt::progress_format::text)
+        {
+            fmt::print("\n");
+        }
+    };
+
+    // Takes a run of samples of every pixel of an accumulation buffer, at whatever resolution it has, and returns
+    // whether they were all taken. Tiles are skipped once a command arrives, so the camera can move without waiting
+    // out the pass. Tiles marked in `finished_tiles` already have these samples, and the rest are marked as they are
+    // taken, so that a pass cut short can be finished later.
+    const auto render = [&](
+        rt::accumulation_buffer &accumulation,
+        const rt::camera &camera,
+        std::uint32_t first_sample,
+        std::uint32_t count,
+        sample_method method,
+        std::vector<std::uint8_t> &finished_tiles
+    )
+    {
+        const std::uint32_t level_width = accumulation.width();
+        const std::uint32_t level_height = accumulation.height();
+        const std::vector<rt::tile> tiles = rt::make_tiles(level_width, level_height, options.tile_size);
+        const std::span<std::uint32_t> sample_counts = accumulation.sample_counts();
+        finished_tiles.resize(tiles.size());
+
+        pool.run(tiles.size(), [&](std::size_t index)
+        {
+            if (finished_tiles[index] || commands.has_pending())
+            {
+                return;
+            }
+
+            const rt::tile &tile = tiles[index];
+            thread_local rt::scratch_arena scratch;
+            scratch.reset();
+
+            rt::wavefront_integrator integrator(scene.world(), scene.materials(), scene.lights(), *sampler, accumulation.color_sums(), {
+                .max_depth      = options.max_depth,
+                .roulette_depth = options.roulette_depth,
+                .tracing        = rt::trace_method::packet,
+                .memory         = scratch.resource(),
+            }, accumulation.luminance_squares(), {
+                .albedo_sums = accumulation.albedo_sums(),
+                .normal_sums = accumulation.normal_sums(),
+                .depths      = accumulation.depths(),
+            });
+
+            for (std::uint32_t y = tile.y; y < tile.y + tile.height; ++y)
+            {
+                for (std::uint32_t x = tile.x; x < tile.x + tile.width; ++x)
+                {
+                    const std::uint32_t pixel = y * level_width + x;
+                    sample_at(x, y, level_width, level_height, first_sample, count, sample_count, method, camera, *sampler, integrator, pixel);
+                    sample_counts[pixel] += count;
+                }
+            }
+
+            integrator.flush();
+            finished_tiles[index] = 1;
+        });
+
+        return !commands.has_pending();
+    };
+
+    // How far the current view has been refined, which commands that leave the camera where it is carry on from.
+    bool is_coarse_shown = false;
+    rt::accumulation_buffer full(width, height, options.denoise);
+    std::uint32_t taken = 0;
+    std::vector<std::uint8_t> finished_tiles;
+
+    // Refines the preview from the current camera, starting over if the camera has moved, and returns whether it
+    // reached every sample.
+    const auto refine = [&](bool is_new_view)
+    {
+        const rt::thin_lens_camera camera(camera_parameters);
+        if (is_new_view)
+        {
+            is_coarse_shown = false;
+            full = rt::accumulation_buffer(width, height, options.denoise);
+            taken = 0;
+            finished_tiles.clear();
+        }
+
+        // The coarse levels take one sample at the corner of each block of pixels, so the first image of a new view
+        // takes a small fraction of one full-resolution sample. They are cheap enough to redo if cut short.
+        if (!is_coarse_shown)
+        {
+            for (const std::uint32_t scale : { 8U, 4U })
+            {
+                rt::accumulation_buffer coarse((width + scale - 1) / scale, (height + scale - 1) / scale, false);
+                std::vector<std::uint8_t> coarse_tiles;
+                if (!render(coarse, camera, 0, 1, sample_method::single, coarse_tiles))
+                {
+                    return false;
+                }
+
+                show(upscale(coarse, width, height), scale, 1);
+            }
+
+            is_coarse_shown = true;
+        }
+
+        // Passes double in size up to --pass-samples, so the image sharpens quickly at first and is then written out
+        // rarely enough not to slow the render.
+        while (taken < sample_count)
+        {
+            const std::uint32_t count = std::min({ std::max(taken, 1U), options.pass_samples, sample_count - taken });
+            if (!render(full, camera, taken, count, sample_method::jittered, finished_tiles))
+            {
+                return false;
+            }
+
+            finished_tiles.clear();
+            taken += count;
+            show(full, 1, taken);
+        }
+
+        return true;
+    };
+
+    bool is_new_view = true;
+    bool is_refined = false;
+    while (true)
+    {
+        // Commands that were all rejected, or that set the camera to where it already is, leave the preview as it
+        // was, so it is only refined further if it had been cut short.
+        if (is_new_view || !is_refined)
+        {
+            if (is_new_view)
+            {
+                start = std::chrono::steady_clock::now();
+            }
+
+            is_refined = refine(is_new_view);
+        }
+
+        if (is_refined)
+        {
+            // The preview is as good as it gets, so wait for the camera to move, unless it never will.
+            if (commands.is_closed() && !commands.has_pending())
+            {
+                end_status_line();
+                return;
+            }
+
+            commands.wait();
+        }
+
+        const rt::camera::create_parameters previous_parameters = camera_parameters;
+        for (const std::string &line : commands.take())
+        {
+            if (line == "quit")
+            {
+                end_status_line();
+                return;
+            }
+
+            try
+            {
+                camera_parameters = rt::parse_camera_settings(line, "standard input", camera_parameters);
+            }
+            catch (const std::runtime_error &e)
+            {
+                fmt::print(stderr, "\n{}\n", e.what());
+            }
+        }
+
+        is_new_view = camera_parameters != previous_parameters;
+    }
+}
+
+rt::accumulation_buffer upscale(const rt::accumulation_buffer &coarse, std::uint32_t width, std::uint32_t height)
+{
+    const std::uint32_t scale_x = (width + coarse.width() - 1) / coarse.width();
+    const std::uint32_t scale_y = (height + coarse.height() - 1) / coarse.height();
+
+    rt::accumulation_buffer fine(width, height, false);
+    for (std::uint32_t y = 0; y < height; ++y)
+    {
+        for (std::uint32_t x = 0; x < width; ++x)
+        {
+            const std::size_t pixel = std::size_t(y) * width + x;
+            const std::size_t coarse_pixel = std::size_t(y / scale_y) * coarse.width() + x / scale_x;
+            fine.color_sums()[pixel] = coarse.color_sums()[coarse_pixel];
+            fine.sample_counts()[pixel] = coarse.sample_counts()[coarse_pixel];
+        }
+    }
+
+    return fine;
+}
+
+void report_stats(const rt::options &options, std::chrono::steady_clock::duration elapsed)
+{
+    if constexpr (rt::stats::enabled)
+    {
+        const rt::stats::counters stats = rt::stats::collect();
+        rt::stats::print_report(stats, elapsed);
+        if (!options.trace_filepath.empty())
+        {
+            rt::stats::write_trace(options.trace_filepath, stats);
+        }
+    }
+}
+
+void run_coordinator(const rt::options &options)
+{
+    namespace distributed = rt::distributed;
+    using clock = distributed::lease_table::clock;
+
+    const std::uint32_t width = options.width;
+    const std::uint32_t height = options.height;
+    const std::vector<rt::tile> tiles = rt::make_tiles(width, height, options.tile_size);
+
+    distributed::job job = {
+        .width          = width,
+        .height         = height,
+        .sample_count   = options.sample_count,
+        .max_depth      = options.max_depth,
+        .roulette_depth = options.roulette_depth,
+        .sampler        = options.sampler,
+        .seed           = options.seed,
+        .tile_size      = options.tile_size,
+        .aovs           = keeps_aovs(options),
+        .scene_filepath = options.scene_filepath,
+        .scene          = {},
+    };
+
+    // Workers are sent the file itself, so a compiled scene reaches them ready to use in place.
+    if (!options.scene_filepath.empty())
+    {
+        const rt::mapped_file file(options.scene_filepath);
+        job.scene.assign(file.bytes().begin(), file.bytes().end());
+    }
+
+    rt::accumulation_buffer accumulation(width, height, job.aovs);
+    distributed::lease_table leases(tiles.size(), options.sample_count, options.pass_samples);
+
+    // The leases of each pass that are not done yet, so that a preview is written as each pass completes.
+    const std::size_t pass_count = leases.size() / tiles.size();
+    std::vector<std::size_t> pass_remaining(pass_count, tiles.size());
+
+    struct connection
+    {
+        rt::socket                  socket;
+        distributed::message_buffer buffer;
+        std::uint64_t               id;
+        /// The number of leases the worker has asked for and not been given yet.
+        std::uint32_t               wanted = 0;
+    };
+
+    const rt::socket listener = rt::socket::listen(static_cast<std::uint16_t>(options.listen_port));
+    std::vector<connection> workers;
+    std::uint64_t next_worker_id = 1;
+    fmt::print("Listening for workers on port {}\n", options.listen_port);
+
+    std::fflush(stdout);
+    rt::progress_reporter progress({
+        .format        = options.progress,
+        .fd            = options.progress_fd,
+        .interval      = std::chrono::milliseconds(static_cast<std::int64_t>(options.progress_interval * real(1000.0))),
+        .total_samples = std::uint64_t(width) * height * options.sample_count,
+    });
+    progress.begin_pass(1, leases.size(), std::size_t(width) * height);
+
+    rt::thread_pool pool(options.thread_count);
+    const auto lease_timeout = std::chrono::seconds(options.lease_timeout);
+    auto last_checkpoint = clock::now();
+
+    // Previews are written outside the handling of any one worker's messages, so that a failure to write one ends
+    // the render rather than being blamed on the worker whose result completed the pass.
+    bool is_preview_due = false;
+
+    const auto merge_result = [&](distributed::message_reader reader)
+    {
+        const auto id = reader.read<std::uint32_t>();
+        const auto rays = reader.read<std::uint64_t>();
+        if (id >= leases.size())
+        {
+            throw std::runtime_error(fmt::format("a worker returned lease {}, which does not exist", id));
+        }
+
+        const distributed::lease &lease = leases[id];
+        const rt::tile &tile = tiles[lease.tile];
+        const std::size_t pixel_count = std::size_t(tile.width) * tile.height;
+
+        std::vector<accumulate_vec3> color_sums(pixel_count);
+        std::vector<accumulate_real> luminance_squares(pixel_count);
+        std::vector<vec3> albedo_sums(job.aovs ? pixel_count : 0);
+        std::vector<vec3> normal_sums(job.aovs ? pixel_count : 0);
+        std::vector<real> depths(job.aovs ? pixel_count : 0);
+        reader.read_span(std::span(color_sums));
+        reader.read_span(std::span(luminance_squares));
+        reader.read_span(std::span(albedo_sums));
+        reader.read_span(std::span(normal_sums));
+        reader.read_span(std::span(depths));
+
+        // A lease that expired may be returned by its first worker as well as by the one it was leased to next.
+        if (!leases.complete(id))
+        {
+            return;
+        }
+
+        for (std::uint32_t y = 0; y < tile.height; ++y)
+        {
+            for (std::uint32_t x = 0; x < tile.width; ++x)
+            {
+                const std::size_t local = std::size_t(y) * tile.width + x;
+                const std::size_t pixel = std::size_t(tile.y + y) * width + tile.x + x;
+                accumulation.color_sums()[pixel] += color_sums[local];
+                accumulation.luminance_squares()[pixel] += luminance_squares[local];
+                accumulation.sample_counts()[pixel] += lease.sample_count;
+                if (job.aovs)
+                {
+                    accumulation.albedo_sums()[pixel] += albedo_sums[local];
+                    accumulation.normal_sums()[pixel] += normal_sums[local];
+                    accumulation.depths()[pixel] = glm::min(accumulation.depths()[pixel], depths[local]);
+                }
+            }
+        }
+
+        progress.complete_tile(std::uint64_t(pixel_count) * lease.sample_count, rays);
+
+        // Give a preview once a pass is done, unless it was the last.
+        const std::size_t lease_pass = lease.first_sample / options.pass_samples;
+        if (--pass_remaining[lease_pass] == 0 && !leases.is_done())
+        {
+            is_preview_due = true;
+        }
+    };
+
+    const auto handle = [&](connection &worker, const distributed::message &message)
+    {
+        distributed::message_reader reader = message.reader();
+        switch (message.type)
+        {
+        case distributed::message_type::hello:
+        {
+            if (reader.read<std::uint32_t>() != distributed::protocol_version)
+            {
+                throw std::runtime_error("the worker speaks a different version of the protocol");
+            }
+
+            const auto thread_count = reader.read<std::uint32_t>();
+            fmt::print(stderr, "Worker {} connected with {} threads\n", worker.id, thread_count);
+            job.send(worker.socket);
+            break;
+        }
+        case distributed::message_type::request:
+            worker.wanted += reader.read<std::uint32_t>();
+            break;
+        case distributed::message_type::result:
+            merge_result(reader);
+            break;
+        default:
+            throw std::runtime_error(fmt::format("the worker sent an unexpected message of type {}", std::to_underlying(message.type)));
+        }
+    };
+
+    const auto disconnect = [&](std::size_t index, std::string_view reason)
+    {
+        const std::size_t released = leases.release(workers[index].id);
+        fmt::print(stderr, "Worker {} disconnected ({}), leasing its {} leases again\n", workers[index].id, reason, released);
+        workers.erase(workers.begin() + static_cast<std::ptrdiff_t>(index));
     };
 
-    constexpr const char output_filepath[] = "output.png";
-    std::ofstream output(output_filepath, std::ios::binary);
-    image.write_to(output);
+    while (!leases.is_done())
+    {
+        // Hand out leases to the workers that are waiting for them.
+        for (std::size_t i = 0; i < workers.size();)
+        {
+            connection &worker = workers[i];
+            std::vector<distributed::lease> batch;
+            const auto deadline = clock::now() + lease_timeout;
+            while (batch.size() < worker.wanted)
+            {
+                const std::optional<distributed::lease> lease = leases.take(worker.id, deadline);
+                if (!lease)
+                {
+                    break;
+                }
+
+                batch.push_back(*lease);
+            }
+
+            try
+            {
+                if (!batch.empty())
+                {
+                    distributed::message_writer writer;
+                    writer.write(static_cast<std::uint32_t>(batch.size())).write_span(std::span<const distributed::lease>(batch));
+                    writer.send(worker.socket, distributed::message_type::leases);
+                    worker.wanted = 0;
+                }
+
+                ++i;
+            }
+            catch (const std::runtime_error &e)
+            {
+                disconnect(i, e.what());
+            }
+        }
+
+        // Wake up at least once a second, and in time to free the first lease that expires.
+        auto timeout = std::chrono::milliseconds(1000);
+        if (const std::optional<clock::time_point> deadline = leases.next_deadline())
+        {
+            const auto until_deadline = std::chrono::ceil<std::chrono::milliseconds>(*deadline - clock::now());
+            timeout = std::clamp(until_deadline, std::chrono::milliseconds(0), timeout);
+        }
+
+        std::vector<const rt::socket *> sockets = { &listener };
+        for (const connection &worker : workers)
+        {
+            sockets.push_back(&worker.socket);
+        }
+
+        const std::vector<bool> is_ready = rt::socket::wait(sockets, timeout);
+
+        // Sockets are waited on in order, so the workers that connect now are waited on from the next round.
+        std::size_t index = 0;
+        for (std::size_t i = 1; i < is_ready.size(); ++i)
+        {
+            if (!is_ready[i])
+            {
+                ++index;
+                continue;
+            }
+
+            connection &worker = workers[index];
+            try
+            {
+                if (!worker.buffer.receive(worker.socket))
+                {
+                    disconnect(index, "the connection was closed");
+                    continue;
+                }
+
+                while (const std::optional<distributed::message> message = worker.buffer.next())
+                {
+                    handle(worker, *message);
+                }
+
+                ++index;
+            }
+            catch (const std::runtime_error &e)
+            {
+                disconnect(index, e.what());
+            }
+        }
+
+        if (is_preview_due && !leases.is_done())
+        {
+            write_image(options, accumulation, &pool);
+        }
+        is_preview_due = false;
+
+        if (is_ready[0])
+        {
+            if (std::optional<rt::socket> socket = listener.accept())
+            {
+                workers.push_back({ .socket = std::move(*socket), .buffer = {}, .id = next_worker_id++ });
+            }
+        }
+
+        const auto now = clock::now();
+        if (const std::size_t expired = leases.expire(now); expired > 0)
+        {
+            fmt::print(stderr, "{} leases expired, leasing them again\n", expired);
+        }
+
+        const bool is_checkpoint_due = now - last_checkpoint >= std::chrono::seconds(options.checkpoint_interval);
+        if (!options.checkpoint_filepath.empty() && is_checkpoint_due && !leases.is_done())
+        {
+            accumulation.save(options.checkpoint_filepath, sample_settings(options));
+            last_checkpoint = now;
+        }
+    }
+    progress.finish();
+
+    for (const connection &worker : workers)
+    {
+        try
+        {
+            distributed::message_writer().send(worker.socket, distributed::message_type::finish);
+        }
+        catch (const std::runtime_error &)
+        {
+            // The render is done, so a worker that has gone already is no loss.
+        }
+    }
+
+    write_outputs(options, accumulation, &pool);
 }
 
-vec3 sample_at(
-    std::uint32_t x,
-    std::uint32_t y,
-    std::uint32_t width,
-    std::uint32_t height,
-    std::uint32_t count,
-    sample_method method,
-    const rt::camera &camera,
-    const rt::world &world,
-    std::uint32_t max_depth
-)
+void run_worker(const rt::options &options)
 {
-    const real delta_u = real(1.0) / static_cast<real>(width);
-    const real delta_v = real(1.0) / static_cast<real>(height);
+    namespace distributed = rt::distributed;
 
-    const real u0 = static_cast<real>(x) * delta_u;
-    const real v0 = static_cast<real>(y) * delta_v;
+    const rt::socket coordinator = rt::socket::connect(options.coordinator_host, static_cast<std::uint16_t>(options.coordinator_port));
+    rt::thread_pool pool(options.thread_count);
+    distributed::message_writer()
+        .write(distributed::protocol_version)
+        .write(pool.thread_count())
+        .send(coordinator, distributed::message_type::hello);
 
-    if (method == sample_method::single)
+    const distributed::message job_message = distributed::receive_message(coordinator);
+    if (job_message.type != distributed::message_type::job)
     {
-        const rt::ray ray = camera.shoot_ray_at(u0, v0);
-        return color_in_direction(ray, world, max_depth);
+        throw std::runtime_error("the coordinator did not send a job");
     }
 
-    const std::uint32_t grid_size = static_cast<std::uint32_t>(std::ceil(std::sqrt(count)));
+    const distributed::job job = distributed::job::read(job_message.reader());
+    const rt::scene scene = job.scene_filepath.empty()
+        ? rt::scene(rt::default_scene())
+        : rt::scene::load(rt::mapped_file::copy_of(job.scene), job.scene_filepath);
+
+    rt::camera::create_parameters camera_parameters = scene.camera();
+    camera_parameters.aspect_ratio = static_cast<real>(job.width) / static_cast<real>(job.height);
+    const rt::thin_lens_camera camera(camera_parameters);
 
-    const real du = delta_u / static_cast<real>(grid_size);
-    const real dv = delta_v / static_cast<real>(grid_size);
+    const std::vector<rt::tile> tiles = rt::make_tiles(job.width, job.height, job.tile_size);
+    const std::unique_ptr<rt::sampler> sampler = rt::make_sampler(job.sampler, job.seed);
+    fmt::print(
+        "Rendering {}x{} at {} samples per pixel for {}:{} on {} threads\n",
+        job.width,
+        job.height,
+        job.sample_count,
+        options.coordinator_host,
+        options.coordinator_port,
+        pool.thread_count()
+    );
 
-    vec3 color(real(0.0));
-    for (std::uint32_t i = 0; i < grid_size; ++i)
+    std::vector<distributed::lease> batch;
+    std::vector<distributed::message_writer> results;
+    const auto render_lease = [&](std::size_t index)
     {
-        for (std::uint32_t j = 0; j < grid_size; ++j)
+        const distributed::lease &lease = batch[index];
+        const rt::tile &tile = tiles.at(lease.tile);
+        const std::size_t pixel_count = std::size_t(tile.width) * tile.height;
+
+        // Each lease is summed on its own, for the coordinator to add to its sums.
+        std::vector<accumulate_vec3> color_sums(pixel_count, accumulate_vec3(0.0));
+        std::vector<accumulate_real> luminance_squares(pixel_count, accumulate_real(0.0));
+        std::vector<vec3> albedo_sums(job.aovs ? pixel_count : 0, vec3(real(0.0)));
+        std::vector<vec3> normal_sums(job.aovs ? pixel_count : 0, vec3(real(0.0)));
+        std::vector<real> depths(job.aovs ? pixel_count : 0, std::numeric_limits<real>::infinity());
+
+        thread_local rt::scratch_arena scratch;
+        scratch.reset();
+
+        rt::wavefront_integrator integrator(scene.world(), scene.materials(), scene.lights(), *sampler, color_sums, {
+            .max_depth      = job.max_depth,
+            .roulette_depth = job.roulette_depth,
+            .tracing        = rt::trace_method::packet,
+            .memory         = scratch.resource(),
+        }, luminance_squares, {
+            .albedo_sums = albedo_sums,
+            .normal_sums = normal_sums,
+            .depths      = depths,
+        });
+
+        for (std::uint32_t y = 0; y < tile.height; ++y)
+        {
+            for (std::uint32_t x = 0; x < tile.width; ++x)
+            {
+                sample_at(
+                    tile.x + x,
+                    tile.y + y,
+                    job.width,
+                    job.height,
+                    lease.first_sample,
+                    lease.sample_count,
+                    job.sample_count,
+                    sample_method::jittered,
+                    camera,
+                    *sampler,
+                    integrator,
+                    y * tile.width + x
+                );
+            }
+        }
+
+        integrator.flush();
+        results[index]
+            .write(lease.id)
+            .write(integrator.ray_count())
+            .write_span(std::span<const accumulate_vec3>(color_sums))
+            .write_span(std::span<const accumulate_real>(luminance_squares))
+            .write_span(std::span<const vec3>(albedo_sums))
+            .write_span(std::span<const vec3>(normal_sums))
+            .write_span(std::span<const real>(depths));
+    };
+
+    // Two leases per thread keep every thread busy while the slowest tiles of a batch finish.
+    const std::uint32_t batch_size = 2 * pool.thread_count();
+    std::uint64_t leases_rendered = 0;
+    while (true)
+    {
+        distributed::message_writer().write(batch_size).send(coordinator, distributed::message_type::request);
+
+        const distributed::message reply = distributed::receive_message(coordinator);
+        if (reply.type == distributed::message_type::finish)
         {
-            const real u = u0 + (static_cast<real>(i) * du * random_real());
-            const real v = v0 + (static_cast<real>(j) * dv * random_real());
+            break;
+        }
 
-            const rt::ray ray = camera.shoot_ray_at(u, v);
-            color += color_in_direction(ray, world, max_depth) / static_cast<real>(count);
+        if (reply.type != distributed::message_type::leases)
+        {
+            throw std::runtime_error(fmt::format("the coordinator sent an unexpected message of type {}", std::to_underlying(reply.type)));
+        }
+
+        distributed::message_reader reader = reply.reader();
+        batch.resize(reader.read<std::uint32_t>());
+        reader.read_span(std::span(batch));
+
+        results.assign(batch.size(), distributed::message_writer());
+        pool.run(batch.size(), render_lease);
+        for (const distributed::message_writer &result : results)
+        {
+            result.send(coordinator, distributed::message_type::result);
         }
+
+        leases_rendered += batch.size();
+    }
+
+    fmt::print("Rendered {} leases\n", leases_rendered);
+}
+
+bool keeps_aovs(const rt::options &options)
+{
+    return options.aovs || options.denoise;
+}
+
+rt::sample_settings sample_settings(const rt::options &options)
+{
+    return rt::sample_settings {
+        .seed         = options.seed,
+        .sampler      = options.sampler,
+        .sample_count = options.sample_count,
+    };
+}
+
+bool is_converged(accumulate_vec3 color_sum, accumulate_real luminance_square_sum, std::uint32_t sample_count, real threshold)
+{
+    if (sample_count < 2)
+    {
+        return false;
     }
 
-    return color;
+    // The variance is a small difference of large sums, so it is found in the precision that they were summed in.
+    using T = accumulate_real;
+    const T n = static_cast<T>(sample_count);
+    const T mean = glm::dot(color_sum, accumulate_vec3(T(0.2126), T(0.7152), T(0.0722))) / n;
+    const T mean_square = luminance_square_sum / n;
+    const T variance = glm::max(mean_square - mean * mean, T(0.0)) * n / (n - T(1.0));
+
+    // 1.96 standard errors either side of the mean covers 95% of the distribution. Differences finer than one step
+    // of an 8-bit channel are invisible, which keeps near-black pixels from sampling forever.
+    constexpr T z_95 = T(1.96);
+    const T error = z_95 * glm::sqrt(variance / n);
+    return error <= static_cast<T>(threshold) * glm::max(mean, T(1.0) / T(256.0));
 }
 
-vec3 color_in_direction(const rt::ray &ray, const rt::world &world, std::uint32_t depth)
+void write_image(const rt::options &options, const rt::accumulation_buffer &accumulation, rt::thread_pool *pool)
 {
-    if (depth == 0)
+    rt::framebuffer image = rt::framebuffer::resolve(accumulation);
+    if (options.denoise)
+    {
+        rt::denoise(image, accumulation, { }, pool);
+    }
+
+    const std::uint32_t width = image.width();
+    const std::uint32_t height = image.height();
+
+    const auto *color = reinterpret_cast<const float *>(image.color().data());
+    const auto *albedo = reinterpret_cast<const float *>(image.albedo().data());
+    const auto *normal = reinterpret_cast<const float *>(image.normal().data());
+    const float *depth = image.depth().data();
+
+    switch (options.output_format)
+    {
+    case rt::image_format::png:
     {
-        return vec3(real(0.0));
+        const std::vector<std::uint8_t> raw_bytes = rt::tonemap(image, options.tonemap);
+        const png::image png_image = {
+            .raw_bytes = raw_bytes,
+            .width     = width,
+            .height    = height,
+        };
+        write_file(options.output_filepath, [&](std::ostream &output) { png_image.write_to(output, pool); });
+        break;
     }
+    case rt::image_format::exr:
+    {
+        std::vector<exr::channel> channels = {
+            { .name = "R", .values = color + 0, .stride = 4 },
+            { .name = "G", .values = color + 1, .stride = 4 },
+            { .name = "B", .values = color + 2, .stride = 4 },
+            { .name = "A", .values = color + 3, .stride = 4 },
+        };
+        if (options.aovs)
+        {
+            channels.push_back({ .name = "albedo.R", .values = albedo + 0, .stride = 3 });
+            channels.push_back({ .name = "albedo.G", .values = albedo + 1, .stride = 3 });
+            channels.push_back({ .name = "albedo.B", .values = albedo + 2, .stride = 3 });
+            channels.push_back({ .name = "normal.X", .values = normal + 0, .stride = 3 });
+            channels.push_back({ .name = "normal.Y", .values = normal + 1, .stride = 3 });
+            channels.push_back({ .name = "normal.Z", .values = normal + 2, .stride = 3 });
+            channels.push_back({ .name = "Z",        .values = depth,      .stride = 1 });
+        }
 
-    constexpr real t_max = std::numeric_limits<real>::infinity();
-    if (const std::optional maybe_hit = world.hit(ray, t_min, t_max))
+        const exr::image exr_image = {
+            .channels = std::move(channels),
+            .width    = width,
+            .height   = height,
+            .type     = options.exr_type,
+        };
+        write_file(options.output_filepath, [&](std::ostream &output) { exr_image.write_to(output, pool); });
+        break;
+    }
+    case rt::image_format::pfm:
     {
-        const rt::hit &hit = *maybe_hit;
+        const auto write_pfm = [&](const std::string &filepath, const float *values, std::size_t stride, std::uint32_t channels)
+        {
+            write_file(filepath, [&](std::ostream &output)
+            {
+                pfm::image { .values = values, .stride = stride, .channels = channels, .width = width, .height = height }.write_to(output);
+            });
+        };
 
-        if (const std::optional maybe_scattered = hit.material().scatter(ray, hit))
+        write_pfm(options.output_filepath, color, 4, 3);
+        if (options.aovs)
         {
-            const rt::scatter &scattered = *maybe_scattered;
-            return scattered.color * color_in_direction(scattered.ray, world, depth - 1);
+            write_pfm(tagged_filepath(options.output_filepath, "albedo"), albedo, 3, 3);
+            write_pfm(tagged_filepath(options.output_filepath, "normal"), normal, 3, 3);
+            write_pfm(tagged_filepath(options.output_filepath, "depth"), depth, 1, 1);
         }
+        break;
+    }
+    }
+}
+
+void write_outputs(const rt::options &options, const rt::accumulation_buffer &accumulation, rt::thread_pool *pool)
+{
+    write_image(options, accumulation, pool);
 
-        return vec3(real(0.0));
+    // The final checkpoint allows writing the finished render again later, such as denoised or in another format.
+    if (!options.checkpoint_filepath.empty())
+    {
+        accumulation.save(options.checkpoint_filepath, sample_settings(options));
     }
 
-    const vec3 direction = glm::normalize(ray.direction());
+    if (!options.heatmap_filepath.empty())
+    {
+        write_heatmap(
+            options.heatmap_filepath,
+            accumulation.sample_counts(),
+            accumulation.width(),
+            accumulation.height(),
+            options.sample_count,
+            pool
+        );
+    }
+}
 
-    const real t = real(0.5) * (direction.y + real(1.0));
+void write_file(const std::string &filepath, const std::function<void(std::ostream &)> &write)
+{
+    std::ofstream output(filepath, std::ios::binary | std::ios::trunc);
+    if (!output)
+    {
+        throw std::runtime_error(fmt::format("could not create '{}'", filepath));
+    }
 
-    constexpr vec3 blue (real(0.5), real(0.7), real(1.0));
-    constexpr vec3 white(real(1.0), real(1.0), real(1.0));
+    write(output);
+    output.close();
+    if (!output)
+    {
+        throw std::runtime_error(fmt::format("could not write '{}'", filepath));
+    }
+}
 
-    const vec3 color = lerp(blue, white, t);
-    return color;
+std::string tagged_filepath(const std::string &filepath, std::string_view tag)
+{
+    std::filesystem::path path(filepath);
+    const std::string extension = path.extension().string();
+    return path.replace_extension(fmt::format(".{}{}", tag, extension)).string();
+}
+
+void write_heatmap(
+    const std::string &filepath,
+    std::span<const std::uint32_t> samples_taken,
+    std::uint32_t width,
+    std::uint32_t height,
+    std::uint32_t max_samples,
+    rt::thread_pool *pool
+)
+{
+    constexpr vec3 cold(real(0.0), real(0.0), real(0.5));
+    constexpr vec3 warm(real(1.0), real(0.0), real(0.0));
+    constexpr vec3 hot (real(1.0), real(1.0), real(0.0));
+
+    std::vector<std::uint8_t> raw_bytes;
+    raw_bytes.reserve(png::image::uncompressed_size(width, height));
+    for (const std::uint32_t samples : samples_taken)
+    {
+        const real t = glm::min(static_cast<real>(samples) / static_cast<real>(max_samples), real(1.0));
+        const vec3 color = t < real(0.5) ? lerp(cold, warm, real(2.0) * t) : lerp(warm, hot, real(2.0) * t - real(1.0));
+
+        const std::array rgba = to_rgba(color);
+        raw_bytes.insert(raw_bytes.end(), rgba.begin(), rgba.end());
+    }
+
+    const png::image image = {
+        .raw_bytes = raw_bytes,
+        .width     = width,
+        .height    = height,
+    };
+
+    write_file(filepath, [&](std::ostream &output) { image.write_to(output, pool); });
+}
+
+void sample_at(
+    std::uint32_t x,
+    std::uint32_t y,
+    std::uint32_t width,
+    std::uint32_t height,
+    std::uint32_t first_sample,
+    std::uint32_t count,
+    std::uint32_t total_count,
+    sample_method method,
+    const rt::camera &camera,
+    const rt::sampler &sampler,
+    rt::wavefront_integrator &integrator,
+    std::uint32_t pixel
+)
+{
+    const real delta_u = real(1.0) / static_cast<real>(width);
+    const real delta_v = real(1.0) / static_cast<real>(height);
+
+    const real u0 = static_cast<real>(x) * delta_u;
+    const real v0 = static_cast<real>(y) * delta_v;
+
+    if (method == sample_method::single)
+    {
+        const rt::sample_id id = { .x = x, .y = y, .index = first_sample, .count = 1 };
+        const rt::ray ray = camera.shoot_ray_at(u0, v0, sampler.sample(id, rt::dimension::lens));
+        integrator.add(ray, pixel, real(1.0), id);
+        return;
+    }
+
+    for (std::uint32_t index = first_sample; index < first_sample + count; ++index)
+    {
+        const rt::sample_id id = { .x = x, .y = y, .index = index, .count = total_count };
+        const vec2 offset = sampler.sample(id, rt::dimension::pixel);
+
+        const real u = u0 + offset.x * delta_u;
+        const real v = v0 + offset.y * delta_v;
+
+        const rt::ray ray = camera.shoot_ray_at(u, v, sampler.sample(id, rt::dimension::lens));
+        integrator.add(ray, pixel, real(1.0), id);
+    }
 }
@@ -0,0 +1,451 @@
+/**
+ * @file sampler.hpp
+ * @brief Generating well-distributed sample points for pixels, lenses and scattering.
+ */
+
+#ifndef RAYTRACER_SAMPLER_HPP
+#define RAYTRACER_SAMPLER_HPP
+
+#include "isa.hpp"
+#include "math.hpp"
+#include "random.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+namespace rt
+{
+    /**
+     * @brief Identifies one sample of one pixel.
+     */
+    struct sample_id
+    {
+        /// The column of the pixel.
+        std::uint32_t x;
+        /// The row of the pixel.
+        std::uint32_t y;
+        /// The index of the sample within the pixel.
+        std::uint32_t index;
+        /// The number of samples the pixel is expected to take in total.
+        std::uint32_t count;
+    };
+
+    /**
+     * @brief The 2D sample dimensions consumed along a path.
+     *
+     * Bounce `n` of a path uses dimension `bounce + 3n` for its scattered direction, the two halves of dimension
+     * `bounce + 3n + 1` for discrete scattering choices and Russian roulette respectively, and dimension
+     * `bounce + 3n + 2` to pick a light and a point on it.
+     */
+    namespace dimension
+    {
+        /// The position of the sample within the pixel.
+        constexpr std::uint32_t pixel      = 0;
+        /// The position of the sample on the camera's lens.
+        constexpr std::uint32_t lens       = 1;
+        /// The first dimension used by scattering.
+        constexpr std::uint32_t bounce     = 2;
+        /// The number of dimensions that each bounce uses.
+        constexpr std::uint32_t per_bounce = 3;
+    }
+
+    /**
+     * @brief Maps samples to points in @f$[0, 1)^2@f$.
+     *
+     * A sampler is a pure function of its seed, the sample and the dimension being requested, so it can be shared by
+     * every thread and queried for any path at any time, in any order.
+     */
+    struct sampler
+    {
+        /**
+         * @param[in] seed Selects one of many equally good, decorrelated sets of points. Renders with different seeds
+         *                 have independent noise.
+         */
+        explicit sampler(std::uint32_t seed = 0)
+            : seed_(seed)
+        {
+        }
+
+        [[nodiscard]]
+        virtual vec2 sample(const rt::sample_id &id, std::uint32_t dimension) const = 0;
+
+        /**
+         * @brief Generates the same dimension for many samples at once.
+         * @param[in] ids The samples to generate.
+         * @param[in] dimension The dimension to generate for every sample.
+         * @param[out] samples The point for each of `ids`, in the same order.
+         */
+        virtual void sample_batch(std::span<const rt::sample_id> ids, std::uint32_t dimension, std::span<vec2> samples) const
+        {
+            for (std::size_t i = 0; i < ids.size(); ++i)
+            {
+                samples[i] = sample(ids[i], dimension);
+            }
+        }
+
+        virtual ~sampler() = default;
+
+        std::uint32_t seed() const
+        {
+            return seed_;
+        }
+
+    private:
+        std::uint32_t seed_;
+    };
+
+    namespace detail
+    {
+        constexpr std::uint32_t reverse_bits(std::uint32_t x)
+        {
+            x = ((x & 0x55555555U) << 1) | ((x >> 1) & 0x55555555U);
+            x = ((x & 0x33333333U) << 2) | ((x >> 2) & 0x33333333U);
+            x = ((x & 0x0F0F0F0FU) << 4) | ((x >> 4) & 0x0F0F0F0FU);
+            x = ((x & 0x00FF00FFU) << 8) | ((x >> 8) & 0x00FF00FFU);
+            return (x << 16) | (x >> 16);
+        }
+
+        /**
+         * @brief Randomly permutes `[0, length)` as selected by `seed`, without storing the permutation.
+         * @see A. Kensler, "Correlated Multi-Jittered Sampling", Pixar Technical Memo 13-01, 2013.
+         */
+        constexpr std::uint32_t permute(std::uint32_t index, std::uint32_t length, std::uint32_t seed)
+        {
+            std::uint32_t mask = length - 1;
+            mask |= mask >> 1;
+            mask |= mask >> 2;
+            mask |= mask >> 4;
+            mask |= mask >> 8;
+            mask |= mask >> 16;
+
+            do
+            {
+                index ^= seed;
+                index *= 0xE170893DU;
+                index ^= seed >> 16;
+                index ^= (index & mask) >> 4;
+                index ^= seed >> 8;
+                index *= 0x0929EB3FU;
+                index ^= seed >> 23;
+                index ^= (index & mask) >> 1;
+                index *= 1 | seed >> 27;
+                index *= 0x6935FA69U;
+                index ^= (index & mask) >> 11;
+                index *= 0x74DCB303U;
+                index ^= (index & mask) >> 2;
+                index *= 0x9E501CC3U;
+                index ^= (index & mask) >> 2;
+                index *= 0xC860A3DFU;
+                index &= mask;
+                index ^= index >> 5;
+            } while (index >= length);
+
+            return (index + seed) % length;
+        }
+
+        /**
+         * @brief Applies a hash-based Owen scramble to the bits of a fixed-point number in @f$[0, 1)@f$.
+         * @see B. Burley, "Practical Hash-based Owen Scrambling", Journal of Computer Graphics Techniques, 2020.
+         */
+        constexpr std::uint32_t owen_scramble(std::uint32_t x, std::uint32_t seed)
+        {
+            x = reverse_bits(x);
+            x += seed;
+            x ^= x * 0x6C50B47CU;
+            x ^= x * 0xB82F1E52U;
+            x ^= x * 0xC7AFE638U;
+            x ^= x * 0x8D22F6E6U;
+            return reverse_bits(x);
+        }
+
+        /**
+         * @brief Mirrors the base-`base` digits of `index` about the radix point, permuting each digit at random.
+         *
+         * The permutation of each digit depends on every digit before it (Owen scrambling), which keeps the
+         * stratification of the sequence while removing the correlation between dimensions with nearby bases.
+         */
+        constexpr real scrambled_radical_inverse(std::uint32_t base, std::uint32_t index, std::uint32_t seed)
+        {
+            const real inverse_base = real(1.0) / static_cast<real>(base);
+
+            real result = real(0.0);
+            real scale = inverse_base;
+
+            // Digits past the index's own are zero but still scrambled, until they are too small to matter.
+            while (scale >= std::numeric_limits<real>::epsilon())
+            {
+                const std::uint32_t digit = index % base;
+                result += static_cast<real>(permute(digit, base, seed)) * scale;
+                seed = hash(seed, digit);
+                index /= base;
+                scale *= inverse_base;
+            }
+
+            return glm::min(result, one_minus_epsilon);
+        }
+
+        /// An independent uniform random point, hashed from `seed`, the sample and the dimension.
+        constexpr vec2 sample_random(std::uint32_t seed, const rt::sample_id &id, std::uint32_t dimension)
+        {
+            const std::uint32_t hashed = hash(seed, id.x, id.y, id.index, dimension);
+            return { to_unit(hashed), to_unit(hash(hashed)) };
+        }
+
+        /**
+         * @brief Fills `samples` with sample_random() for each of `ids`.
+         *
+         * It is a free function so that it can be compiled for each instruction set, which rt::random_sampler's
+         * virtual rt::sampler::sample_batch could not be.
+         */
+        RAYTRACER_DISPATCH
+        inline void sample_random_batch(
+            std::uint32_t seed,
+            std::span<const rt::sample_id> ids,
+            std::uint32_t dimension,
+            std::span<vec2> samples
+        )
+        {
+            for (std::size_t i = 0; i < ids.size(); ++i)
+            {
+                samples[i] = sample_random(seed, ids[i], dimension);
+            }
+        }
+    }
+
+    /**
+     * @brief Independent uniform random points, hashed from the sample and dimension.
+     *
+     * Being counter-based rather than drawn from a generator's stream, each point is the same no matter which
+     * thread asks for it or when, so renders are reproducible for any number of threads.
+     */
+    class random_sampler : public sampler
+    {
+    public:
+        using sampler::sampler;
+
+        [[nodiscard]]
+        vec2 sample(const rt::sample_id &id, std::uint32_t dimension) const override
+        {
+            return detail::sample_random(seed(), id, dimension);
+        }
+
+        /// @copydoc rt::sampler::sample_batch
+        /// @note Each point depends only on its own sample, so the loop vectorizes.
+        void sample_batch(std::span<const rt::sample_id> ids, std::uint32_t dimension, std::span<vec2> samples) const override
+        {
+            detail::sample_random_batch(seed(), ids, dimension, samples);
+        }
+
+    };
+
+    /**
+     * @brief Jittered stratified sampling.
+     *
+     * Each dimension splits the unit square into a grid of just enough cells for the pixel's samples, visits the
+     * cells in a random order that differs per pixel and dimension, and jitters each sample uniformly within its cell.
+     * When the sample count is not a square, the unused cells are spread randomly across the grid.
+     */
+    class stratified_sampler : public sampler
+    {
+    public:
+        using sampler::sampler;
+
+        [[nodiscard]]
+        vec2 sample(const rt::sample_id &id, std::uint32_t dimension) const override
+        {
+            const auto grid_size = static_cast<std::uint32_t>(std::ceil(std::sqrt(static_cast<real>(glm::max(id.count, 1U)))));
+            const std::uint32_t cell_count = grid_size * grid_size;
+
+            // Samples beyond the expected count start another pass over the grid in a fresh order.
+            const std::uint32_t pass = id.index / cell_count;
+            const std::uint32_t seed = detail::hash(this->seed(), id.x, id.y, dimension, pass);
+            const std::uint32_t cell = detail::permute(id.index % cell_count, cell_count, seed);
+
+            const vec2 jitter(
+                detail::to_unit(detail::hash(seed, id.index, 0)),
+                detail::to_unit(detail::hash(seed, id.index, 1))
+            );
+
+            const vec2 corner(static_cast<real>(cell % grid_size), static_cast<real>(cell / grid_size));
+            return glm::min((corner + jitter) / static_cast<real>(grid_size), vec2(one_minus_epsilon));
+        }
+    };
+
+    /**
+     * @brief The Halton sequence, Owen-scrambled independently per pixel and dimension.
+     */
+    class halton_sampler : public sampler
+    {
+    public:
+        using sampler::sampler;
+
+        [[nodiscard]]
+        vec2 sample(const rt::sample_id &id, std::uint32_t dimension) const override
+        {
+            const std::uint32_t seed = detail::hash(this->seed(), id.x, id.y, dimension);
+
+            // Past the table, large prime bases need more samples than any pixel takes to stratify at all, so fall back
+            // to random points.
+            if (2 * dimension + 1 >= primes.size())
+            {
+                return {
+                    detail::to_unit(detail::hash(seed, id.index, 0)),
+                    detail::to_unit(detail::hash(seed, id.index, 1)),
+                };
+            }
+
+            return {
+                detail::scrambled_radical_inverse(primes[2 * dimension], id.index, detail::hash(seed, 0)),
+                detail::scrambled_radical_inverse(primes[2 * dimension + 1], id.index, detail::hash(seed, 1)),
+            };
+        }
+
+    private:
+        static constexpr std::array<std::uint32_t, 32> primes = {
+              2,   3,   5,   7,  11,  13,  17,  19,  23,  29,  31,  37,  41,  43,  47,  53,
+             59,  61,  67,  71,  73,  79,  83,  89,  97, 101, 103, 107, 109, 113, 127, 131,
+        };
+    };
+
+    /**
+     * @brief Owen-scrambled Sobol (0, 2)-sequence points, padded across dimensions by shuffling the sample index.
+     *
+     * The first two Sobol dimensions have excellent 2D stratification at every power-of-two sample count. Each
+     * dimension gets its own scramble and its own shuffled order of samples, so dimensions are not correlated.
+     */
+    class sobol_sampler : public sampler
+    {
+    public:
+        using sampler::sampler;
+
+        [[nodiscard]]
+        vec2 sample(const rt::sample_id &id, std::uint32_t dimension) const override
+        {
+            const std::uint32_t seed = detail::hash(this->seed(), id.x, id.y, dimension);
+            const std::uint32_t index = detail::owen_scramble(id.index, seed);
+
+            const std::uint32_t x = detail::owen_scramble(detail::reverse_bits(index), detail::hash(seed, 0));
+            const std::uint32_t y = detail::owen_scramble(sobol_second_dimension(index), detail::hash(seed, 1));
+
+            return { detail::to_unit(x), detail::to_unit(y) };
+        }
+
+    private:
+        static constexpr std::uint32_t sobol_second_dimension(std::uint32_t index)
+        {
+            std::uint32_t result = 0;
+            for (std::uint32_t direction = 1U << 31; index != 0; index >>= 1, direction ^= direction >> 1)
+            {
+                if ((index & 1) != 0)
+                {
+                    result ^= direction;
+                }
+            }
+
+            return result;
+        }
+    };
+
+    /**
+     * @brief A rank-1 lattice built on the R2 generator, shifted per pixel by blue noise.
+     *
+     * The generator @f$(1/\phi_2, 1/\phi_2^2)@f$, with @f$\phi_2@f$ the plastic number, gives near-optimal spacing at
+     * every sample count. Each pixel's lattice is shifted by interleaved gradient noise, so the error that remains is
+     * spread at high frequency across neighbouring pixels, where it is least visible. Every dimension visits the
+     * lattice's points in its own shuffled order, so that dimensions are not correlated.
+     */
+    class lattice_sampler : public sampler
+    {
+    public:
+        using sampler::sampler;
+
+        [[nodiscard]]
+        vec2 sample(const rt::sample_id &id, std::uint32_t dimension) const override
+        {
+            constexpr real plastic_number = real(1.32471795724474602596);
+            constexpr vec2 generator(real(1.0) / plastic_number, real(1.0) / (plastic_number * plastic_number));
+
+            const real x = static_cast<real>(id.x);
+            const real y = static_cast<real>(id.y);
+            const real noise = glm::fract(real(52.9829189) * glm::fract(real(0.06711056) * x + real(0.00583715) * y));
+
+            // The shuffle and the offset of the noise depend only on the dimension, as varying them per pixel would
+            // destroy the spatial structure of the noise.
+            const std::uint32_t count = glm::max(id.count, 1U);
+            const std::uint32_t pass = id.index / count;
+            const std::uint32_t seed = detail::hash(this->seed(), dimension, pass);
+            const std::uint32_t index = pass * count + detail::permute(id.index % count, count, seed);
+
+            const vec2 offset(detail::to_unit(detail::hash(seed, 0)), detail::to_unit(detail::hash(seed, 1)));
+            const vec2 shift = glm::fract(vec2(noise) + offset);
+
+            // Reduce the index first so that the product stays precise for large indices.
+            const vec2 point = glm::fract(generator * static_cast<real>(index % lattice_period)) + shift;
+            return glm::min(glm::fract(point), vec2(one_minus_epsilon));
+        }
+
+    private:
+        static constexpr std::uint32_t lattice_period = 1U << 20;
+    };
+
+    enum class sampler_type
+    {
+        random     = 0,
+        stratified = 1,
+        halton     = 2,
+        sobol      = 3,
+        lattice    = 4,
+    };
+
+    /// The name of a sampler, as given to --sampler.
+    [[nodiscard]]
+    constexpr std::string_view sampler_name(rt::sampler_type type)
+    {
+        switch (type)
+        {
+        case rt::sampler_type::random:
+            return "random";
+        case rt::sampler_type::stratified:
+            return "stratified";
+        case rt::sampler_type::halton:
+            return "halton";
+        case rt::sampler_type::sobol:
+            return "sobol";
+        case rt::sampler_type::lattice:
+            break;
+        }
+
+        return "lattice";
+    }
+
+    inline std::unique_ptr<rt::sampler> make_sampler(rt::sampler_type type, std::uint32_t seed = 0)
+    {
+        switch (type)
+        {
+        case rt::sampler_type::random:
+            return std::make_unique<rt::random_sampler>(seed);
+        case rt::sampler_type::stratified:
+            return std::make_unique<rt::stratified_sampler>(seed);
+        case rt::sampler_type::halton:
+            return std::make_unique<rt::halton_sampler>(seed);
+        case rt::sampler_type::sobol:
+            return std::make_unique<rt::sobol_sampler>(seed);
+        case rt::sampler_type::lattice:
+            return std::make_unique<rt::lattice_sampler>(seed);
+        }
+
+        throw std::invalid_argument("unknown sampler type");
+    }
+}
+
+#endif // !RAYTRACER_SAMPLER_HPP
@@ -0,0 +1,1080 @@
+/**
+ * @file scene.hpp
+ * @brief Loading scenes from text descriptions and from compiled, memory-mapped scene files.
+ *
+ * A scene description is a text file of one statement per line. Blank lines and everything after a `#` are ignored.
+ *
+ *     # A camera, given as any of: origin x y z, target x y z, up x y z, fov degrees, aperture a, focus distance.
+ *     camera origin -3 -2 -3 target 0 0 1 up 0 -1 0 fov 47 aperture 0.1
+ *
+ *     # A keyframe of the camera path that animations follow: the frame, then any camera settings, with the rest
+ *     # kept from the keyframe before, or from the camera for the first. Keyframes go in order of increasing frame.
+ *     keyframe 48 origin 3 -2 -3
+ *
+ *     # A named material: lambertian r g b, metal r g b, dielectric refractive_index, or emissive r g b.
+ *     material gold metal 0.8 0.6 0.2
+ *
+ *     # A sphere: center x y z, radius, then the name of a material declared earlier.
+ *     sphere 0 0 1 0.5 gold
+ *
+ *     # A triangle mesh read from an OBJ or PLY file, relative to the description, made of a declared material.
+ *     mesh models/bunny.ply gold
+ *
+ *     # A named mesh that is read once and placed any number of times by instances.
+ *     object bunny models/bunny.ply
+ *
+ *     # A copy of an object made of a declared material, then any of, applied in the order given:
+ *     # scale x y z, rotate axis_x axis_y axis_z degrees, translate x y z.
+ *     instance bunny gold scale 2 2 2 rotate 0 1 0 45 translate 0 0 1
+ *
+ *     # A point light: position x y z, then intensity r g b.
+ *     light point 0 -3 1 10 10 10
+ *
+ * Spheres of an emissive material are lights that every path samples directly. Meshes and instances of an emissive
+ * material glow too, but are only found by paths that happen to hit them.
+ *
+ * Parsing a description and building its hierarchy takes time proportional to the size of the scene, so a scene can
+ * also be compiled into a binary file that holds the spheres, already in hierarchy order, and the hierarchy itself.
+ * A compiled scene is mapped into memory and used in place, so loading it costs little more than validating it.
+ * Scenes with meshes or instances cannot be compiled yet.
+ */
+
+#ifndef RAYTRACER_SCENE_HPP
+#define RAYTRACER_SCENE_HPP
+
+#include "animation.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "instance.hpp"
+#include "light.hpp"
+#include "mapped_file.hpp"
+#include "material.hpp"
+#include "math.hpp"
+#include "obj.hpp"
+#include "ply.hpp"
+#include "scheduler.hpp"
+#include "shape.hpp"
+#include "sphere_bvh.hpp"
+#include "triangle_mesh.hpp"
+#include "world.hpp"
+
+#include <fmt/format.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace rt
+{
+    enum class material_type : std::uint32_t
+    {
+        lambertian = 0,
+        metal      = 1,
+        dielectric = 2,
+        emissive   = 3,
+    };
+
+    /**
+     * @brief The parameters of a material, in a form that can be written to and read from a file.
+     */
+    struct material_description
+    {
+        rt::material_type type;
+        /// The albedo of lambertian and metal materials, or the radiance of emissive ones.
+        vec3              albedo;
+        /// The refractive index of dielectric materials.
+        real              refractive_index;
+    };
+
+    /**
+     * @brief A triangle mesh in a scene, which is read from its file when the scene is built.
+     */
+    struct mesh_description
+    {
+        /// The OBJ or PLY file holding the mesh.
+        std::string   filepath;
+        /// The index of the material of every triangle.
+        std::uint32_t material;
+    };
+
+    /**
+     * @brief A triangle mesh that is read once and shared by every instance of it.
+     */
+    struct object_description
+    {
+        /// The OBJ or PLY file holding the mesh.
+        std::string filepath;
+    };
+
+    /**
+     * @brief A copy of an object placed in a scene.
+     */
+    struct instance_description
+    {
+        /// The index of the object in the scene's objects.
+        std::uint32_t object;
+        /// The index of the material of the whole copy.
+        std::uint32_t material;
+        mat4          object_to_world;
+    };
+
+    /**
+     * @brief Everything needed to build a scene.
+     */
+    struct scene_description
+    {
+        /// The camera, apart from its aspect ratio, which is set by the image being rendered.
+        rt::camera::create_parameters          camera;
+        /// The keyframes that the camera moves along when rendering an animation, if any.
+        std::vector<rt::camera_keyframe>       camera_path;
+        std::vector<rt::material_description>  materials;
+        /// The spheres, whose materials index into `materials`.
+        std::vector<rt::packed_sphere>         spheres;
+        /// The meshes, whose materials index into `materials`.
+        std::vector<rt::mesh_description>      meshes;
+        /// The objects that instances place copies of.
+        std::vector<rt::object_description>    objects;
+        /// The copies of objects, whose materials index into `materials`.
+        std::vector<rt::instance_description>  instances;
+        std::vector<rt::point_light>           point_lights;
+    };
+
+    /// The scene rendered when none is given: three spheres of glass, gold and white clay on a grey ground.
+    inline rt::scene_description default_scene()
+    {
+        constexpr vec3 camera_position(real(-3.0), real(-2.0), real(-3.0));
+        constexpr vec3 camera_target  (real( 0.0), real( 0.0), real( 1.0));
+        constexpr vec3 camera_up      (real( 0.0), real(-1.0), real( 0.0));
+
+        return rt::scene_description {
+            .camera = {
+                .origin       = camera_position,
+                .target       = camera_target,
+                .up           = camera_up,
+                .vertical_fov = glm::radians(real(47.0)),
+                .aspect_ratio = real(1.0),
+                .aperture     = real(0.1),
+                .focal_length = glm::distance(camera_target, camera_position),
+            },
+            .camera_path = { },
+            .materials = {
+                { .type = rt::material_type::dielectric, .albedo = vec3(real(1.0)),                      .refractive_index = real(1.52) },
+                { .type = rt::material_type::metal,      .albedo = vec3(real(0.8), real(0.6), real(0.2)), .refractive_index = real(1.0)  },
+                { .type = rt::material_type::lambertian, .albedo = vec3(real(1.0)),                      .refractive_index = real(1.0)  },
+                { .type = rt::material_type::lambertian, .albedo = vec3(real(0.5)),                      .refractive_index = real(1.0)  },
+            },
+            .spheres = {
+                { .center = vec3(real(-1.0), real(   0.0), real(1.0)), .radius = real(   0.5), .material = 0 },
+                { .center = vec3(real( 0.0), real(   0.0), real(1.0)), .radius = real(   0.5), .material = 1 },
+                { .center = vec3(real( 1.0), real(   0.0), real(1.0)), .radius = real(   0.5), .material = 2 },
+                { .center = vec3(real( 0.0), real(1000.5), real(1.0)), .radius = real(1000.0), .material = 3 },
+            },
+            .meshes       = { },
+            .objects      = { },
+            .instances    = { },
+            .point_lights = { },
+        };
+    }
+
+    namespace detail
+    {
+        /// Splits a line into whitespace-separated words, reporting errors against its position in a file.
+        class scene_tokenizer
+        {
+        public:
+            explicit scene_tokenizer(std::string_view line, std::string_view filepath, std::size_t line_number)
+                : rest_(line)
+                , filepath_(filepath)
+                , line_number_(line_number)
+            {
+            }
+
+            /// The next word, or an empty view at the end of the line.
+            std::string_view next()
+            {
+                constexpr std::string_view whitespace = " \t\r";
+                const std::size_t begin = std::min(rest_.find_first_not_of(whitespace), rest_.size());
+                rest_.remove_prefix(begin);
+                const std::size_t end = std::min(rest_.find_first_of(whitespace), rest_.size());
+                const std::string_view word = rest_.substr(0, end);
+                rest_.remove_prefix(end);
+                return word;
+            }
+
+            std::string_view next_word(std::string_view what)
+            {
+                const std::string_view word = next();
+                if (word.empty())
+                {
+                    throw error(fmt::format("expected {}", what));
+                }
+
+                return word;
+            }
+
+            real next_real(std::string_view what)
+            {
+                const std::string_view word = next_word(what);
+                real result = real(0.0);
+                const auto [end, status] = std::from_chars(word.data(), word.data() + word.size(), result);
+                if (status != std::errc() || end != word.data() + word.size())
+                {
+                    throw error(fmt::format("expected {}, but found '{}'", what, word));
+                }
+
+                return result;
+            }
+
+            vec3 next_vec3(std::string_view what)
+            {
+                const real x = next_real(what);
+                const real y = next_real(what);
+                const real z = next_real(what);
+                return vec3(x, y, z);
+            }
+
+            void expect_end()
+            {
+                if (const std::string_view word = next(); !word.empty())
+                {
+                    throw error(fmt::format("unexpected '{}'", word));
+                }
+            }
+
+            std::runtime_error error(std::string_view message) const
+            {
+                return std::runtime_error(fmt::format("{}:{}: {}", filepath_, line_number_, message));
+            }
+
+        private:
+            std::string_view rest_;
+            std::string_view filepath_;
+            std::size_t      line_number_;
+        };
+
+        /**
+         * @brief Reads the settings of a camera statement, through to the end of the line.
+         * @param[out] focal_length The focus distance, if one is given, since it otherwise depends on the origin and
+         *                          target that the camera ends up with.
+         */
+        inline void parse_camera_settings(
+            detail::scene_tokenizer &tokens,
+            rt::camera::create_parameters &camera,
+            std::optional<real> &focal_length
+        )
+        {
+            for (std::string_view key = tokens.next(); !key.empty(); key = tokens.next())
+            {
+                if (key == "origin")        camera.origin = tokens.next_vec3("an origin");
+                else if (key == "target")   camera.target = tokens.next_vec3("a target");
+                else if (key == "up")       camera.up = tokens.next_vec3("an up vector");
+                else if (key == "fov")      camera.vertical_fov = glm::radians(tokens.next_real("a field of view"));
+                else if (key == "aperture") camera.aperture = tokens.next_real("an aperture");
+                else if (key == "focus")    focal_length = tokens.next_real("a focus distance");
+                else throw tokens.error(fmt::format("unknown camera setting '{}'", key));
+            }
+        }
+    }
+
+    /**
+     * @brief Parses a scene description.
+     * @param[in] text The contents of the description.
+     * @param[in] filepath The name of the description, for error messages.
+     * @throws std::runtime_error Thrown if the description is invalid.
+     */
+    inline rt::scene_description parse_scene(std::string_view text, std::string_view filepath)
+    {
+        rt::scene_description scene;
+        scene.camera = {
+            .origin       = vec3(real(0.0)),
+            .target       = vec3(real(0.0), real( 0.0), real(1.0)),
+            .up           = vec3(real(0.0), real(-1.0), real(0.0)),
+            .vertical_fov = glm::radians(real(47.0)),
+            .aspect_ratio = real(1.0),
+            .aperture     = real(0.0),
+            .focal_length = real(0.0),
+        };
+
+        // The focus distances given, since each defaults to the distance to the target once that is known.
+        std::optional<real> focal_length;
+        std::vector<std::optional<real>> keyframe_focal_lengths;
+        std::vector<std::string_view> material_names;
+        std::vector<std::string_view> object_names;
+
+        std::size_t line_number = 0;
+        while (!text.empty())
+        {
+            ++line_number;
+            const std::size_t line_end = std::min(text.find('\n'), text.size());
+            std::string_view line = text.substr(0, line_end);
+            text.remove_prefix(std::min(line_end + 1, text.size()));
+
+            line = line.substr(0, std::min(line.find('#'), line.size()));
+            detail::scene_tokenizer tokens(line, filepath, line_number);
+
+            const std::string_view statement = tokens.next();
+            if (statement.empty())
+            {
+                continue;
+            }
+
+            if (statement == "camera")
+            {
+                detail::parse_camera_settings(tokens, scene.camera, focal_length);
+            }
+            else if (statement == "keyframe")
+            {
+                const real frame = tokens.next_real("a frame");
+                if (!std::isfinite(frame))
+                {
+                    throw tokens.error("expected a finite frame");
+                }
+
+                if (!scene.camera_path.empty() && frame <= scene.camera_path.back().frame)
+                {
+                    throw tokens.error(fmt::format("keyframe {} does not come after keyframe {}", frame, scene.camera_path.back().frame));
+                }
+
+                const bool is_first = scene.camera_path.empty();
+                rt::camera_keyframe keyframe = { .frame = frame, .camera = is_first ? scene.camera : scene.camera_path.back().camera };
+                std::optional<real> focus = is_first ? focal_length : keyframe_focal_lengths.back();
+                detail::parse_camera_settings(tokens, keyframe.camera, focus);
+                scene.camera_path.push_back(keyframe);
+                keyframe_focal_lengths.push_back(focus);
+            }
+            else if (statement == "material")
+            {
+                const std::string_view name = tokens.next_word("a material name");
+                if (std::ranges::find(material_names, name) != material_names.end())
+                {
+                    throw tokens.error(fmt::format("material '{}' is already declared", name));
+                }
+
+                const std::string_view type = tokens.next_word("a material type");
+                rt::material_description material = {
+                    .type             = rt::material_type::lambertian,
+                    .albedo           = vec3(real(1.0)),
+                    .refractive_index = real(1.0),
+                };
+                if (type == "lambertian" || type == "metal")
+                {
+                    material.type = type == "metal" ? rt::material_type::metal : rt::material_type::lambertian;
+                    material.albedo = tokens.next_vec3("an albedo");
+                }
+                else if (type == "emissive")
+                {
+                    material.type = rt::material_type::emissive;
+                    material.albedo = tokens.next_vec3("a radiance");
+                }
+                else if (type == "dielectric")
+                {
+                    material.type = rt::material_type::dielectric;
+                    material.refractive_index = tokens.next_real("a refractive index");
+                }
+                else
+                {
+                    throw tokens.error(fmt::format("unknown material type '{}'", type));
+                }
+
+                tokens.expect_end();
+                material_names.push_back(name);
+                scene.materials.push_back(material);
+            }
+            else if (statement == "sphere")
+            {
+                const vec3 center = tokens.next_vec3("a center");
+                const real radius = tokens.next_real("a radius");
+                const std::string_view name = tokens.next_word("a material name");
+                tokens.expect_end();
+
+                const auto found = std::ranges::find(material_names, name);
+                if (found == material_names.end())
+                {
+                    throw tokens.error(fmt::format("material '{}' is not declared", name));
+                }
+
+                const auto material = static_cast<std::uint32_t>(found - material_names.begin());
+                scene.spheres.push_back({ .center = center, .radius = radius, .material = material });
+            }
+            else if (statement == "mesh")
+            {
+                const std::string_view mesh_filepath = tokens.next_word("a mesh file");
+                const std::string_view name = tokens.next_word("a material name");
+                tokens.expect_end();
+
+                const auto found = std::ranges::find(material_names, name);
+                if (found == material_names.end())
+                {
+                    throw tokens.error(fmt::format("material '{}' is not declared", name));
+                }
+
+                scene.meshes.push_back({
+                    .filepath = (std::filesystem::path(filepath).parent_path() / mesh_filepath).string(),
+                    .material = static_cast<std::uint32_t>(found - material_names.begin()),
+                });
+            }
+            else if (statement == "object")
+            {
+                const std::string_view name = tokens.next_word("an object name");
+                if (std::ranges::find(object_names, name) != object_names.end())
+                {
+                    throw tokens.error(fmt::format("object '{}' is already declared", name));
+                }
+
+                const std::string_view mesh_filepath = tokens.next_word("a mesh file");
+                tokens.expect_end();
+
+                object_names.push_back(name);
+                scene.objects.push_back({
+                    .filepath = (std::filesystem::path(filepath).parent_path() / mesh_filepath).string(),
+                });
+            }
+            else if (statement == "instance")
+            {
+                const std::string_view object_name = tokens.next_word("an object name");
+                const auto object = std::ranges::find(object_names, object_name);
+                if (object == object_names.end())
+                {
+                    throw tokens.error(fmt::format("object '{}' is not declared", object_name));
+                }
+
+                const std::string_view material_name = tokens.next_word("a material name");
+                const auto material = std::ranges::find(material_names, material_name);
+                if (material == material_names.end())
+                {
+                    throw tokens.error(fmt::format("material '{}' is not declared", material_name));
+                }
+
+                // Each transform is applied after those before it, so it multiplies from the left.
+                mat4 object_to_world(real(1.0));
+                for (std::string_view transform = tokens.next(); !transform.empty(); transform = tokens.next())
+                {
+                    if (transform == "scale")
+                    {
+                        object_to_world = glm::scale(mat4(real(1.0)), tokens.next_vec3("a scale")) * object_to_world;
+                    }
+                    else if (transform == "rotate")
+                    {
+                        const vec3 axis = tokens.next_vec3("a rotation axis");
+                        const real angle = glm::radians(tokens.next_real("a rotation angle"));
+                        if (glm::length2(axis) == real(0.0))
+                        {
+                            throw tokens.error("a rotation axis must not be zero");
+                        }
+
+                        object_to_world = glm::rotate(mat4(real(1.0)), angle, axis) * object_to_world;
+                    }
+                    else if (transform == "translate")
+                    {
+                        object_to_world = glm::translate(mat4(real(1.0)), tokens.next_vec3("a translation")) * object_to_world;
+                    }
+                    else
+                    {
+                        throw tokens.error(fmt::format("unknown transform '{}'", transform));
+                    }
+                }
+
+                scene.instances.push_back({
+                    .object          = static_cast<std::uint32_t>(object - object_names.begin()),
+                    .material        = static_cast<std::uint32_t>(material - material_names.begin()),
+                    .object_to_world = object_to_world,
+                });
+            }
+            else if (statement == "light")
+            {
+                const std::string_view type = tokens.next_word("a light type");
+                if (type != "point")
+                {
+                    throw tokens.error(fmt::format("unknown light type '{}'", type));
+                }
+
+                const vec3 position = tokens.next_vec3("a position");
+                const vec3 intensity = tokens.next_vec3("an intensity");
+                tokens.expect_end();
+                scene.point_lights.push_back({ .position = position, .intensity = intensity });
+            }
+            else
+            {
+                throw tokens.error(fmt::format("unknown statement '{}'", statement));
+            }
+        }
+
+        scene.camera.focal_length = focal_length.value_or(glm::distance(scene.camera.target, scene.camera.origin));
+        for (std::size_t i = 0; i < scene.camera_path.size(); ++i)
+        {
+            rt::camera::create_parameters &camera = scene.camera_path[i].camera;
+            camera.focal_length = keyframe_focal_lengths[i].value_or(glm::distance(camera.target, camera.origin));
+        }
+
+        return scene;
+    }
+
+    /**
+     * @brief Changes the settings of a camera that a line names, in the syntax of the camera statement of a scene
+     *        description without the word `camera`, such as `origin 0 -2 -4 fov 40`.
+     *
+     * If the line moves the origin or target but gives no focus distance, the camera is focused on the target.
+     *
+     * @param[in] source The name of where the line came from, for error messages.
+     * @throws std::runtime_error Thrown if the line is invalid.
+     */
+    inline rt::camera::create_parameters parse_camera_settings(
+        std::string_view line,
+        std::string_view source,
+        rt::camera::create_parameters camera
+    )
+    {
+        const vec3 origin = camera.origin;
+        const vec3 target = camera.target;
+
+        detail::scene_tokenizer tokens(line, source, 1);
+        std::optional<real> focal_length;
+        detail::parse_camera_settings(tokens, camera, focal_length);
+
+        if (focal_length)
+        {
+            camera.focal_length = *focal_length;
+        }
+        else if (camera.origin != origin || camera.target != target)
+        {
+            camera.focal_length = glm::distance(camera.target, camera.origin);
+        }
+
+        return camera;
+    }
+
+    /**
+     * @brief The objects, materials and camera of a scene, ready to render.
+     *
+     * The materials, and the spheres, meshes and hierarchies of the world, are allocated from an arena that the scene
+     * owns, so they sit in a few large blocks rather than scattered across the heap, and a scene is freed all at once.
+     */
+    class scene
+    {
+    public:
+        /// Builds a scene, and the hierarchy over its spheres, from a description.
+        explicit scene(const rt::scene_description &description)
+            : camera_(description.camera)
+            , camera_path_(description.camera_path)
+            , material_descriptions_(description.materials)
+            , point_lights_(description.point_lights)
+        {
+            // Every emissive sphere gets a copy of its material, so that a hit on a light names the light it hit.
+            std::vector<rt::packed_sphere> spheres_in_order = description.spheres;
+            for (rt::packed_sphere &sphere : spheres_in_order)
+            {
+                if (sphere.material < material_descriptions_.size()
+                    && material_descriptions_[sphere.material].type == rt::material_type::emissive)
+                {
+                    material_descriptions_.push_back(material_descriptions_[sphere.material]);
+                    sphere.material = static_cast<std::uint32_t>(material_descriptions_.size() - 1);
+                }
+            }
+
+            make_materials();
+            auto spheres = std::make_unique<rt::sphere_bvh>(spheres_in_order, arena_.get());
+
+            std::vector<std::unique_ptr<rt::hittable>> objects;
+            if (!description.meshes.empty() || !description.objects.empty())
+            {
+                rt::thread_pool pool;
+                for (const rt::mesh_description &mesh : description.meshes)
+                {
+                    if (mesh.material >= materials_.size())
+                    {
+                        throw std::runtime_error(fmt::format("mesh '{}' refers to a material that does not exist", mesh.filepath));
+                    }
+
+                    objects.push_back(std::make_unique<rt::triangle_mesh>(load_mesh(mesh.filepath, pool), mesh.material, arena_.get()));
+                }
+
+                // Instances replace the material, so the one the shared mesh is built with never shows.
+                std::vector<std::shared_ptr<const rt::hittable>> shared_objects;
+                for (const rt::object_description &object : description.objects)
+                {
+                    shared_objects.push_back(
+                        std::make_shared<const rt::triangle_mesh>(load_mesh(object.filepath, pool), 0, arena_.get())
+                    );
+                }
+
+                for (const rt::instance_description &instance : description.instances)
+                {
+                    if (instance.object >= shared_objects.size() || instance.material >= materials_.size())
+                    {
+                        throw std::runtime_error("an instance refers to an object or material that does not exist");
+                    }
+
+                    objects.push_back(std::make_unique<rt::instance>(
+                        shared_objects[instance.object],
+                        instance.object_to_world,
+                        instance.material
+                    ));
+                }
+            }
+
+            make_world(std::move(spheres), std::move(objects));
+            make_lights();
+        }
+
+        scene(scene &&) = default;
+
+        // Assigning would free the arena before the objects that were allocated from it.
+        scene &operator=(scene &&) = delete;
+
+        /**
+         * @brief Loads a scene from a file, which may be a text description or a compiled scene.
+         * @throws std::runtime_error Thrown if the file cannot be read or is not a valid scene.
+         */
+        static scene load(const std::string &filepath)
+        {
+            return load(rt::mapped_file(filepath), filepath);
+        }
+
+        /**
+         * @brief Loads a scene from the contents of a file, which may be a text description or a compiled scene.
+         * @param[in] file The contents, which a compiled scene is used from in place.
+         * @param[in] filepath The path of the file, which errors name and relative paths are resolved against.
+         * @throws std::runtime_error Thrown if the contents are not a valid scene.
+         */
+        static scene load(rt::mapped_file file, const std::string &filepath)
+        {
+            const std::span<const std::byte> bytes = file.bytes();
+            if (bytes.size() >= sizeof(compiled_magic) && std::memcmp(bytes.data(), compiled_magic.data(), compiled_magic.size()) == 0)
+            {
+                return scene(std::move(file), filepath);
+            }
+
+            const std::string_view text(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+            return scene(rt::parse_scene(text, filepath));
+        }
+
+        /**
+         * @brief Writes the scene as a compiled scene file, replacing it atomically.
+         * @throws std::runtime_error Thrown if the scene has meshes or instances, or the file cannot be written.
+         */
+        void compile(const std::string &filepath) const
+        {
+            if (has_meshes_)
+            {
+                throw std::runtime_error("scenes with meshes or instances cannot be compiled yet");
+            }
+
+            const std::span<const rt::packed_sphere> spheres = spheres_->spheres();
+            const std::span<const rt::bvh_node> nodes = spheres_->nodes();
+
+            compiled_header header = {
+                .magic            = compiled_magic,
+                .version          = compiled_version,
+                .real_size        = sizeof(real),
+                .material_count   = static_cast<std::uint32_t>(material_descriptions_.size()),
+                .sphere_count     = spheres.size(),
+                .node_count       = nodes.size(),
+                .light_count      = point_lights_.size(),
+                .keyframe_count   = camera_path_.size(),
+                .materials_offset = 0,
+                .spheres_offset   = 0,
+                .nodes_offset     = 0,
+                .lights_offset    = 0,
+                .keyframes_offset = 0,
+                .camera           = camera_,
+            };
+            header.materials_offset = align_offset(sizeof(compiled_header));
+            header.spheres_offset = align_offset(header.materials_offset + std::span(material_descriptions_).size_bytes());
+            header.nodes_offset = align_offset(header.spheres_offset + spheres.size_bytes());
+            header.lights_offset = align_offset(header.nodes_offset + nodes.size_bytes());
+            header.keyframes_offset = align_offset(header.lights_offset + std::span(point_lights_).size_bytes());
+
+            const std::string temporary_filepath = filepath + ".tmp";
+            {
+                std::ofstream output(temporary_filepath, std::ios::binary | std::ios::trunc);
+                const auto write_at = [&](std::uint64_t offset, const void *data, std::size_t size)
+                {
+                    static constexpr std::array<char, section_alignment> padding = { };
+                    output.write(padding.data(), static_cast<std::streamsize>(offset - static_cast<std::uint64_t>(output.tellp())));
+                    output.write(static_cast<const char *>(data), static_cast<std::streamsize>(size));
+                };
+
+                write_at(0, &header, sizeof(header));
+                write_at(header.materials_offset, material_descriptions_.data(), std::span(material_descriptions_).size_bytes());
+                write_at(header.spheres_offset, spheres.data(), spheres.size_bytes());
+                write_at(header.nodes_offset, nodes.data(), nodes.size_bytes());
+                write_at(header.lights_offset, point_lights_.data(), std::span(point_lights_).size_bytes());
+                write_at(header.keyframes_offset, camera_path_.data(), std::span(camera_path_).size_bytes());
+                if (!output.flush())
+                {
+                    throw std::runtime_error(fmt::format("could not write compiled scene '{}'", temporary_filepath));
+                }
+            }
+
+            std::filesystem::rename(temporary_filepath, filepath);
+        }
+
+        const rt::world &world() const
+        {
+            return *world_;
+        }
+
+        /// The material table that the surfaces of the world index into.
+        std::span<const rt::material> materials() const
+        {
+            return materials_;
+        }
+
+        /// The point lights and emissive spheres, which the emissive materials refer to.
+        const rt::light_set &lights() const
+        {
+            return lights_;
+        }
+
+        /// The camera, apart from its aspect ratio, which is left for the renderer to set.
+        const rt::camera::create_parameters &camera() const
+        {
+            return camera_;
+        }
+
+        /// The keyframes that the camera moves along when rendering an animation, in order, which may be none.
+        std::span<const rt::camera_keyframe> camera_path() const
+        {
+            return camera_path_;
+        }
+
+        /// The spheres of the world and the hierarchy over them.
+        const rt::sphere_bvh &spheres() const
+        {
+            return *spheres_;
+        }
+
+        /// Whether the world also has meshes or instances, which only world() can intersect.
+        bool has_meshes() const
+        {
+            return has_meshes_;
+        }
+
+        /// The parameters that the material table was made from, in the same order.
+        std::span<const rt::material_description> material_descriptions() const
+        {
+            return material_descriptions_;
+        }
+
+        std::span<const rt::point_light> point_lights() const
+        {
+            return point_lights_;
+        }
+
+    private:
+        /**
+         * @brief The fixed-size start of a compiled scene file.
+         *
+         * It is followed by an array of rt::material_description, an array of rt::packed_sphere in the order of the
+         * hierarchy's leaves, an array of rt::bvh_node, an array of rt::point_light, then an array of
+         * rt::camera_keyframe, each starting at its offset from the start of the file.
+         * Everything is in native byte order and in the precision of rt::real, so files are only portable between
+         * builds that agree on both.
+         */
+        struct compiled_header
+        {
+            std::array<char, 4>           magic;
+            std::uint32_t                 version;
+            std::uint32_t                 real_size;
+            std::uint32_t                 material_count;
+            std::uint64_t                 sphere_count;
+            std::uint64_t                 node_count;
+            std::uint64_t                 light_count;
+            std::uint64_t                 keyframe_count;
+            std::uint64_t                 materials_offset;
+            std::uint64_t                 spheres_offset;
+            std::uint64_t                 nodes_offset;
+            std::uint64_t                 lights_offset;
+            std::uint64_t                 keyframes_offset;
+            rt::camera::create_parameters camera;
+        };
+
+        static_assert(std::is_trivially_copyable_v<rt::material_description>);
+        static_assert(std::is_trivially_copyable_v<rt::packed_sphere>);
+        static_assert(std::is_trivially_copyable_v<rt::bvh_node>);
+        static_assert(std::is_trivially_copyable_v<rt::point_light>);
+        static_assert(std::is_trivially_copyable_v<rt::camera_keyframe>);
+
+        static constexpr std::array<char, 4> compiled_magic = { 'R', 'T', 'S', 'C' };
+        static constexpr std::uint32_t compiled_version = 3;
+        static constexpr std::size_t section_alignment = 64;
+
+        /// Uses a compiled scene in place.
+        explicit scene(rt::mapped_file file, const std::string &filepath)
+            : file_(std::move(file))
+        {
+            const std::span<const std::byte> bytes = file_->bytes();
+            const auto invalid = [&](std::string_view reason)
+            {
+                return std::runtime_error(fmt::format("'{}' is not a valid compiled scene: {}", filepath, reason));
+            };
+
+            compiled_header header;
+            if (bytes.size() < sizeof(header))
+            {
+                throw invalid("the header is truncated");
+            }
+
+            std::memcpy(&header, bytes.data(), sizeof(header));
+            if (header.version != compiled_version)
+            {
+                throw invalid(fmt::format("it has version {}, but this build reads version {}", header.version, compiled_version));
+            }
+
+            if (header.real_size != sizeof(real))
+            {
+                throw invalid(fmt::format("it holds {}-byte reals, but this build uses {}-byte reals", header.real_size, sizeof(real)));
+            }
+
+            // The sections are reinterpreted in place. Each is an array of trivially-copyable objects at an offset
+            // aligned for its type, within a mapping that starts on a page boundary.
+            const auto section = [&]<typename T>(std::uint64_t offset, std::uint64_t count, std::string_view name)
+            {
+                if (offset % alignof(T) != 0 || offset > bytes.size() || count > (bytes.size() - offset) / sizeof(T))
+                {
+                    throw invalid(fmt::format("the {} are out of bounds", name));
+                }
+
+                return std::span(reinterpret_cast<const T *>(bytes.data() + offset), static_cast<std::size_t>(count));
+            };
+
+            const std::span materials = section.template operator()<rt::material_description>(header.materials_offset, header.material_count, "materials");
+            const std::span spheres = section.template operator()<rt::packed_sphere>(header.spheres_offset, header.sphere_count, "spheres");
+            const std::span nodes = section.template operator()<rt::bvh_node>(header.nodes_offset, header.node_count, "nodes");
+            const std::span lights = section.template operator()<rt::point_light>(header.lights_offset, header.light_count, "lights");
+            const std::span keyframes = section.template operator()<rt::camera_keyframe>(header.keyframes_offset, header.keyframe_count, "keyframes");
+
+            for (const rt::material_description &material : materials)
+            {
+                if (material.type > rt::material_type::emissive)
+                {
+                    throw invalid("a material has an unknown type");
+                }
+            }
+
+            for (const rt::packed_sphere &sphere : spheres)
+            {
+                if (sphere.material >= materials.size())
+                {
+                    throw invalid("a sphere refers to a material that does not exist");
+                }
+            }
+
+            if (!is_valid_hierarchy(nodes, spheres.size()))
+            {
+                throw invalid("the hierarchy is malformed");
+            }
+
+            for (std::size_t i = 0; i < keyframes.size(); ++i)
+            {
+                if (!std::isfinite(keyframes[i].frame) || (i > 0 && keyframes[i].frame <= keyframes[i - 1].frame))
+                {
+                    throw invalid("the keyframes are out of order");
+                }
+            }
+
+            camera_ = header.camera;
+            camera_path_.assign(keyframes.begin(), keyframes.end());
+            material_descriptions_.assign(materials.begin(), materials.end());
+            point_lights_.assign(lights.begin(), lights.end());
+            make_materials();
+            make_world(std::make_unique<rt::sphere_bvh>(spheres, nodes, arena_.get()), { });
+            make_lights();
+        }
+
+        /**
+         * @brief Tests that a hierarchy read from a file can be traversed safely: every node is visited at most once,
+         *        every index is in range, and it is no deeper than traversal allows.
+         */
+        static bool is_valid_hierarchy(std::span<const rt::bvh_node> nodes, std::size_t primitive_count)
+        {
+            if (nodes.empty())
+            {
+                return primitive_count == 0;
+            }
+
+            struct entry
+            {
+                std::uint64_t node;
+                std::size_t   depth;
+            };
+
+            std::vector<entry> stack = { { .node = 0, .depth = 1 } };
+            std::size_t visited = 0;
+            while (!stack.empty())
+            {
+                const auto [index, depth] = stack.back();
+                stack.pop_back();
+
+                const rt::bvh_node &node = nodes[index];
+                if (++visited > nodes.size() || depth > rt::bvh_builder::max_depth)
+                {
+                    return false;
+                }
+
+                if (node.is_leaf())
+                {
+                    if (static_cast<std::uint64_t>(node.index) + node.count > primitive_count)
+                    {
+                        return false;
+                    }
+
+                    continue;
+                }
+
+                // Children always follow their parent, which also rules out cycles.
+                if (node.axis > 2 || index + 1 >= nodes.size() || node.index <= index + 1 || node.index >= nodes.size())
+                {
+                    return false;
+                }
+
+                stack.push_back({ .node = index + 1, .depth = depth + 1 });
+                stack.push_back({ .node = node.index, .depth = depth + 1 });
+            }
+
+            return true;
+        }
+
+        static std::uint64_t align_offset(std::uint64_t offset)
+        {
+            return (offset + section_alignment - 1) / section_alignment * section_alignment;
+        }
+
+        void make_materials()
+        {
+            materials_.clear();
+            materials_.reserve(material_descriptions_.size());
+            for (const rt::material_description &description : material_descriptions_)
+            {
+                switch (description.type)
+                {
+                case rt::material_type::lambertian:
+                    materials_.push_back(rt::lambertian(description.albedo));
+                    break;
+                case rt::material_type::metal:
+                    materials_.push_back(rt::metal(description.albedo));
+                    break;
+                case rt::material_type::dielectric:
+                    materials_.push_back(rt::dielectric(description.refractive_index));
+                    break;
+                case rt::material_type::emissive:
+                    materials_.push_back(rt::emissive(description.albedo));
+                    break;
+                }
+            }
+        }
+
+        /**
+         * @brief Gathers the point lights and the emissive spheres into the light set, and points each emissive
+         *        sphere's material at its light.
+         *
+         * A light must be the only surface of its material, or hits on the others would be mistaken for hits on it.
+         * Emissive spheres that share a material are therefore left out of the set, and only glow when hit, as do
+         * spheres turned inside out by a negative radius, whose light never leaves them.
+         */
+        void make_lights()
+        {
+            std::vector<rt::light> lights(point_lights_.begin(), point_lights_.end());
+
+            const std::span<const rt::packed_sphere> spheres = spheres_->spheres();
+            std::vector<std::uint32_t> sphere_counts(materials_.size(), 0);
+            for (const rt::packed_sphere &sphere : spheres)
+            {
+                ++sphere_counts[sphere.material];
+            }
+
+            for (const rt::packed_sphere &sphere : spheres)
+            {
+                if (!std::holds_alternative<rt::emissive>(materials_[sphere.material])
+                    || sphere_counts[sphere.material] != 1
+                    || sphere.radius <= real(0.0))
+                {
+                    continue;
+                }
+
+                const vec3 radiance = std::get<rt::emissive>(materials_[sphere.material]).radiance();
+                materials_[sphere.material] = rt::emissive(radiance, static_cast<std::uint32_t>(lights.size()));
+                lights.push_back(rt::sphere_light { .center = sphere.center, .radius = sphere.radius, .radiance = radiance });
+            }
+
+            lights_ = rt::light_set(std::move(lights));
+        }
+
+        /**
+         * @brief Reads a mesh from an OBJ or PLY file, going by its extension.
+         * @throws std::runtime_error Thrown if the file cannot be read, is invalid, or is in neither format.
+         */
+        static rt::mesh_data load_mesh(const std::string &filepath, rt::thread_pool &pool)
+        {
+            const std::string extension = std::filesystem::path(filepath).extension().string();
+            if (extension != ".obj" && extension != ".ply")
+            {
+                throw std::runtime_error(fmt::format("cannot tell the format of mesh '{}': expected a .obj or .ply file", filepath));
+            }
+
+            const rt::mapped_file file(filepath);
+            const std::span<const std::byte> bytes = file.bytes();
+            if (extension == ".ply")
+            {
+                return ply::load(bytes, filepath, &pool);
+            }
+
+            return obj::load(std::string_view(reinterpret_cast<const char *>(bytes.data()), bytes.size()), filepath, &pool);
+        }
+
+        /// Builds the world from the spheres and every mesh and instance, over which it builds the top-level hierarchy.
+        void make_world(std::unique_ptr<rt::sphere_bvh> spheres, std::vector<std::unique_ptr<rt::hittable>> objects)
+        {
+            spheres_ = spheres.get();
+            has_meshes_ = !objects.empty();
+
+            objects.push_back(std::move(spheres));
+            world_ = std::make_unique<rt::world>(std::move(objects), arena_.get());
+        }
+
+    private:
+        /// The size of the first block of the arena. Later blocks grow geometrically, and an allocation larger than
+        /// the next block, such as the vertices of a big mesh, gets a block of its own.
+        static constexpr std::size_t arena_block_size = std::size_t(1) << 16;
+
+        /// The arena is declared first so that it is destroyed last, after everything allocated from it. It is
+        /// allocated separately so that it stays in place when the scene is moved.
+        std::unique_ptr<std::pmr::monotonic_buffer_resource> arena_ =
+            std::make_unique<std::pmr::monotonic_buffer_resource>(arena_block_size);
+        rt::camera::create_parameters         camera_;
+        std::vector<rt::camera_keyframe>      camera_path_;
+        std::vector<rt::material_description> material_descriptions_;
+        std::pmr::vector<rt::material>        materials_ { arena_.get() };
+        std::vector<rt::point_light>          point_lights_;
+        rt::light_set                         lights_;
+        /// The compiled scene file that the spheres and hierarchy are borrowed from, if any.
+        std::optional<rt::mapped_file>        file_;
+        std::unique_ptr<rt::world>            world_;
+        const rt::sphere_bvh                 *spheres_ = nullptr;
+        bool                                  has_meshes_ = false;
+    };
+}
+
+#endif // !RAYTRACER_SCENE_HPP
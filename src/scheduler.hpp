@@ -0,0 +1,258 @@
+/**
+ * @file scheduler.hpp
+ * @brief Splitting an image into tiles and rendering them on a pool of worker threads.
+ */
+
+#ifndef RAYTRACER_SCHEDULER_HPP
+#define RAYTRACER_SCHEDULER_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief A rectangular region of the image, in pixels.
+     */
+    struct tile
+    {
+        /// The column of the left-most pixel in the tile.
+        std::uint32_t x;
+        /// The row of the top-most pixel in the tile.
+        std::uint32_t y;
+        /// The width of the tile in pixels.
+        std::uint32_t width;
+        /// The height of the tile in pixels.
+        std::uint32_t height;
+    };
+
+    /**
+     * @brief Splits an image into row-major tiles of at most `tile_size` by `tile_size` pixels.
+     * @param[in] width The width of the image.
+     * @param[in] height The height of the image.
+     * @param[in] tile_size The maximum width and height of a tile. Tiles along the right and bottom edges are cropped
+     *                      to the image.
+     */
+    inline std::vector<rt::tile> make_tiles(std::uint32_t width, std::uint32_t height, std::uint32_t tile_size)
+    {
+        std::vector<rt::tile> tiles;
+        for (std::uint32_t y = 0; y < height; y += tile_size)
+        {
+            for (std::uint32_t x = 0; x < width; x += tile_size)
+            {
+                tiles.push_back({
+                    .x      = x,
+                    .y      = y,
+                    .width  = std::min(tile_size, width - x),
+                    .height = std::min(tile_size, height - y),
+                });
+            }
+        }
+
+        return tiles;
+    }
+
+    /**
+     * @brief A persistent pool of worker threads that execute batches of independent tasks with work stealing.
+     *
+     * Each worker owns a queue of task indices. A batch is dealt out to the queues in contiguous runs so that
+     * neighbouring tiles stay on the same thread; a worker that drains its own queue steals from the back of the
+     * others, so a few expensive tasks never leave the remaining threads idle.
+     */
+    class thread_pool
+    {
+    public:
+        /// A function that executes the task with the given index.
+        using task_type = std::function<void(std::size_t)>;
+        /// A function that is called on the submitting thread with the number of completed tasks.
+        using progress_type = std::function<void(std::size_t)>;
+
+        /**
+         * @brief Starts a new pool of worker threads.
+         * @param[in] thread_count The number of worker threads. If 0, one thread per hardware thread is started.
+         */
+        explicit thread_pool(std::uint32_t thread_count = 0)
+        {
+            if (thread_count == 0)
+            {
+                thread_count = std::max(std::thread::hardware_concurrency(), 1U);
+            }
+
+            queues_.reserve(thread_count);
+            for (std::uint32_t i = 0; i < thread_count; ++i)
+            {
+                queues_.push_back(std::make_unique<worker_queue>());
+            }
+
+            workers_.reserve(thread_count);
+            for (std::uint32_t i = 0; i < thread_count; ++i)
+            {
+                workers_.emplace_back([this, i] { work(i); });
+            }
+        }
+
+        thread_pool(const thread_pool &) = delete;
+        thread_pool &operator=(const thread_pool &) = delete;
+
+        ~thread_pool()
+        {
+            {
+                const std::scoped_lock lock(mutex_);
+                stopping_ = true;
+            }
+
+            batch_started_.notify_all();
+            for (std::thread &worker : workers_)
+            {
+                worker.join();
+            }
+        }
+
+        /// The number of worker threads in the pool.
+        std::uint32_t thread_count() const
+        {
+            return static_cast<std::uint32_t>(workers_.size());
+        }
+
+        /**
+         * @brief Executes tasks `[0, task_count)` on the worker threads and blocks until all of them are complete.
+         * @param[in] task_count The number of tasks in the batch.
+         * @param[in] task The function executing a single task. It must be safe to call concurrently.
+         * @param[in] progress An optional function called on the calling thread whenever tasks have completed.
+         * @note Tasks must not throw. Only one batch may be in flight at a time.
+         */
+        void run(std::size_t task_count, const task_type &task, const progress_type &progress = nullptr)
+        {
+            std::unique_lock lock(mutex_);
+
+            const std::size_t queue_count = queues_.size();
+            for (std::size_t i = 0; i < queue_count; ++i)
+            {
+                const std::size_t begin = (task_count * i) / queue_count;
+                const std::size_t end = (task_count * (i + 1)) / queue_count;
+
+                worker_queue &queue = *queues_[i];
+                const std::scoped_lock queue_lock(queue.mutex);
+                for (std::size_t index = begin; index < end; ++index)
+                {
+                    queue.tasks.push_back(index);
+                }
+            }
+
+            task_ = &task;
+            completed_ = 0;
+            ++generation_;
+            batch_started_.notify_all();
+
+            std::size_t reported = 0;
+            while (reported < task_count)
+            {
+                task_completed_.wait(lock, [&] { return completed_ != reported; });
+                reported = completed_;
+                if (progress)
+                {
+                    lock.unlock();
+                    progress(reported);
+                    lock.lock();
+                }
+            }
+
+            // Wait for every worker to leave the batch before the task can go out of scope.
+            task_completed_.wait(lock, [&] { return busy_ == 0; });
+            task_ = nullptr;
+        }
+
+    private:
+        struct worker_queue
+        {
+            std::mutex              mutex;
+            std::deque<std::size_t> tasks;
+        };
+
+        void work(std::size_t index)
+        {
+            std::uint64_t generation = 0;
+            while (true)
+            {
+                const task_type *task = nullptr;
+                {
+                    std::unique_lock lock(mutex_);
+                    batch_started_.wait(lock, [&] { return stopping_ || (task_ != nullptr && generation_ != generation); });
+                    if (stopping_)
+                    {
+                        return;
+                    }
+
+                    generation = generation_;
+                    task = task_;
+                    ++busy_;
+                }
+
+                while (const std::optional index_to_run = next_task(index))
+                {
+                    (*task)(*index_to_run);
+
+                    const std::scoped_lock lock(mutex_);
+                    ++completed_;
+                    task_completed_.notify_all();
+                }
+
+                const std::scoped_lock lock(mutex_);
+                --busy_;
+                task_completed_.notify_all();
+            }
+        }
+
+        std::optional<std::size_t> next_task(std::size_t index)
+        {
+            {
+                worker_queue &own = *queues_[index];
+                const std::scoped_lock lock(own.mutex);
+                if (!own.tasks.empty())
+                {
+                    const std::size_t task = own.tasks.front();
+                    own.tasks.pop_front();
+                    return task;
+                }
+            }
+
+            for (std::size_t offset = 1; offset < queues_.size(); ++offset)
+            {
+                worker_queue &victim = *queues_[(index + offset) % queues_.size()];
+                const std::scoped_lock lock(victim.mutex);
+                if (!victim.tasks.empty())
+                {
+                    const std::size_t task = victim.tasks.back();
+                    victim.tasks.pop_back();
+                    return task;
+                }
+            }
+
+            return std::nullopt;
+        }
+
+    private:
+        std::vector<std::unique_ptr<worker_queue>> queues_;
+        std::vector<std::thread>                   workers_;
+
+        std::mutex              mutex_;
+        std::condition_variable batch_started_;
+        std::condition_variable task_completed_;
+        const task_type        *task_ = nullptr;
+        std::uint64_t           generation_ = 0;
+        std::size_t             completed_ = 0;
+        std::size_t             busy_ = 0;
+        bool                    stopping_ = false;
+    };
+}
+
+#endif // !RAYTRACER_SCHEDULER_HPP
@@ -1,22 +1,21 @@
 #ifndef RAYTRACER_SHAPE_HPP
 #define RAYTRACER_SHAPE_HPP
 
+#include "aabb.hpp"
 #include "camera.hpp"
 #include "math.hpp"
+#include "packet.hpp"
+#include "stats.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtx/norm.hpp>
 
 #include <algorithm>
-#include <memory>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <optional>
-#include <utility>
-#include <vector>
-
-namespace rt
-{
-    struct material;
-}
 
 namespace rt
 {
@@ -26,12 +25,12 @@ namespace rt
         explicit hit(
             vec3 point,
             vec3 outward_normal,
-            const rt::material &material,
+            std::uint32_t material,
             const rt::ray &ray,
             real t
         )
             : point_(point)
-            , material_(&material)
+            , material_(material)
             , t_(t)
         {
             front_face_ = glm::dot(ray.direction(), outward_normal) < real(0.0);
@@ -48,9 +47,10 @@ namespace rt
             return normal_;
         }
 
-        const rt::material &material() const
+        /// The index of the surface's material in the scene's material table.
+        std::uint32_t material() const
         {
-            return *material_;
+            return material_;
         }
 
         real t() const
@@ -66,31 +66,140 @@ namespace rt
     private:
         vec3 point_;
         vec3 normal_;
-        const rt::material *material_;
+        std::uint32_t material_;
         real t_;
         bool front_face_;
     };
 
+    struct hittable;
+
+    /**
+     * @brief The minimal record of an intersection, kept while searching for the nearest one.
+     *
+     * Traversal only compares distances, so everything else about a hit is worked out once, by
+     * rt::hittable::resolve, for the nearest record alone.
+     */
+    struct hit_record
+    {
+        real                t;
+        /// The index of the primitive within the object that found the hit, such as a triangle of a mesh.
+        std::uint32_t       primitive;
+        /// The weights of the second and third vertices of a triangle at the hit point. Unused by other shapes.
+        vec2                barycentrics;
+        /// The object that found the hit and can resolve it.
+        const rt::hittable *object;
+        /// The instance that `object` was reached through, if any, which resolves the hit in its own space.
+        const rt::hittable *instance = nullptr;
+    };
+
+    /**
+     * @brief The nearest hits found so far for each ray of an rt::ray_packet.
+     */
+    struct packet_hits
+    {
+        /// The upper bound of the interval of interest for each ray, which shrinks to the nearest hit found.
+        std::array<real, rt::packet_size>                          t_max;
+        /// The nearest hit found for each ray.
+        std::array<std::optional<rt::hit_record>, rt::packet_size> hits;
+
+        /**
+         * @brief Prepares to trace `packet`.
+         * @param[in] packet The packet about to be traced.
+         * @param[in] t_max The upper bound of the interval of interest for every ray.
+         * @note Unused slots of the packet are given an empty interval, so they never record a hit.
+         */
+        explicit packet_hits(const rt::ray_packet &packet, real t_max)
+        {
+            const real empty = -std::numeric_limits<real>::infinity();
+            for (std::size_t i = 0; i < rt::packet_size; ++i)
+            {
+                this->t_max[i] = i < packet.count ? t_max : empty;
+            }
+        }
+    };
+
     struct hittable
     {
+        /// Finds the nearest intersection within `[t_min, t_max]`, recording no more than where it is.
         [[nodiscard]]
-        virtual std::optional<rt::hit> hit(const rt::ray &ray, real t_min, real t_max) const = 0;
+        virtual std::optional<rt::hit_record> intersect(const rt::ray &ray, real t_min, real t_max) const = 0;
+
+        /**
+         * @brief Intersects every ray of a packet with the object, keeping only hits nearer than those already found.
+         * @param[in] packet The rays to intersect.
+         * @param[in] t_min The lower bound of the interval of interest.
+         * @param[in,out] hits The nearest hits found so far, which are replaced by any nearer hits on this object.
+         * @note The default implementation traces each ray on its own. Shapes that can share work across coherent
+         *       rays should override it.
+         */
+        virtual void intersect_packet(const rt::ray_packet &packet, real t_min, rt::packet_hits &hits) const
+        {
+            for (std::size_t i = 0; i < packet.count; ++i)
+            {
+                if (const std::optional record = intersect(packet[i], t_min, hits.t_max[i]))
+                {
+                    hits.hits[i] = record;
+                    hits.t_max[i] = record->t;
+                }
+            }
+        }
+
+        /**
+         * @brief Whether anything blocks the ray within `[t_min, t_max]`, as for a shadow ray.
+         * @note The default implementation searches for the nearest hit. Objects that can stop at the first hit they
+         *       find should override it.
+         */
+        [[nodiscard]]
+        virtual bool occluded(const rt::ray &ray, real t_min, real t_max) const
+        {
+            return intersect(ray, t_min, t_max).has_value();
+        }
+
+        /**
+         * @brief Works out the point, normal and material of a hit found by intersecting `ray` with this object.
+         * @note Objects made of other objects never record hits of their own, so the default implementation hands the
+         *       record to the instance or object that found it. Every object that records hits must override it.
+         */
+        [[nodiscard]]
+        virtual rt::hit resolve(const rt::ray &ray, const rt::hit_record &record) const
+        {
+            return (record.instance != nullptr ? record.instance : record.object)->resolve(ray, record);
+        }
+
+        /// The smallest axis-aligned box enclosing the object.
+        [[nodiscard]]
+        virtual rt::aabb bounding_box() const = 0;
+
+        /// Finds the nearest intersection within `[t_min, t_max]` and resolves it.
+        [[nodiscard]]
+        std::optional<rt::hit> hit(const rt::ray &ray, real t_min, real t_max) const
+        {
+            const std::optional record = intersect(ray, t_min, t_max);
+            if (!record)
+            {
+                return std::nullopt;
+            }
+
+            return resolve(ray, *record);
+        }
+
         virtual ~hittable() = default;
     };
 
     class sphere : public hittable
     {
     public:
-        constexpr explicit sphere(vec3 center, real radius, const rt::material &material)
-            : material_(&material)
+        constexpr explicit sphere(vec3 center, real radius, std::uint32_t material)
+            : material_(material)
             , center_(center)
             , radius_(radius)
         {
         }
 
         [[nodiscard]]
-        std::optional<rt::hit> hit(const rt::ray &ray, real t_min, real t_max) const override
+        std::optional<rt::hit_record> intersect(const rt::ray &ray, real t_min, real t_max) const override
         {
+            rt::stats::add(&rt::stats::counters::primitive_tests);
             const vec3 oc = ray.origin() - center_;
 
             const real a = glm::length2(ray.direction());
@@ -121,48 +230,32 @@ namespace rt
                 return std::nullopt;
             }
 
-            const real t = *candidate;
-            const vec3 point = ray.at(t);
-            const vec3 outward_normal = (point - center_) / radius_;
-
-            const rt::hit hit(point, outward_normal, *material_, ray, t);
-            return hit;
+            return rt::hit_record { .t = *candidate, .primitive = 0, .barycentrics = vec2(), .object = this };
         }
 
-    private:
-        const rt::material *material_;
-        vec3 center_;
-        real radius_;
-    };
-
-    class world : public hittable
-    {
-    public:
-        explicit world(std::vector<std::unique_ptr<hittable>> objects)
-            : objects_(std::move(objects))
+        [[nodiscard]]
+        rt::hit resolve(const rt::ray &ray, const rt::hit_record &record) const override
         {
+            const vec3 point = ray.at(record.t);
+            const vec3 outward_normal = (point - center_) / radius_;
+
+            return rt::hit(point, outward_normal, material_, ray, record.t);
         }
 
         [[nodiscard]]
-        std::optional<rt::hit> hit(const rt::ray &ray, real t_min, real t_max) const override
+        rt::aabb bounding_box() const override
         {
-            std::optional<rt::hit> hit;
-
-            real t_nearest = t_max;
-            for (const auto &object : objects_)
-            {
-                if (const std::optional maybe_hit = object->hit(ray, t_min, t_nearest))
-                {
-                    hit = maybe_hit;
-                    t_nearest = hit->t();
-                }
-            }
-
-            return hit;
+            const vec3 half_extent(glm::abs(radius_));
+            return rt::aabb {
+                .min = center_ - half_extent,
+                .max = center_ + half_extent,
+            };
         }
 
     private:
-        std::vector<std::unique_ptr<hittable>> objects_;
+        std::uint32_t material_;
+        vec3 center_;
+        real radius_;
     };
 }
 
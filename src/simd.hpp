@@ -0,0 +1,108 @@
+/**
+ * @file simd.hpp
+ * @brief A thin portability layer over native SIMD vectors of reals.
+ */
+
+#ifndef RAYTRACER_SIMD_HPP
+#define RAYTRACER_SIMD_HPP
+
+#include "math.hpp"
+
+#include <cstddef>
+
+#if __has_include(<experimental/simd>)
+#include <experimental/simd>
+#define RAYTRACER_HAS_SIMD
+#endif
+
+namespace rt::simd
+{
+#ifdef RAYTRACER_HAS_SIMD
+    /// A vector of reals as wide as the target's native SIMD registers.
+    using real_lanes = std::experimental::native_simd<real>;
+    /// The result of comparing two rt::simd::real_lanes.
+    using mask_lanes = real_lanes::mask_type;
+
+    inline real_lanes load(const real *source)
+    {
+        return real_lanes(source, std::experimental::element_aligned);
+    }
+
+    inline void store(real_lanes lanes, real *destination)
+    {
+        lanes.copy_to(destination, std::experimental::element_aligned);
+    }
+
+    inline real_lanes select(mask_lanes mask, real_lanes if_true, real_lanes if_false)
+    {
+        std::experimental::where(mask, if_false) = if_true;
+        return if_false;
+    }
+
+    inline bool any_of(mask_lanes mask)
+    {
+        return std::experimental::any_of(mask);
+    }
+
+    inline real lane_of(const real_lanes &lanes, std::size_t lane)
+    {
+        return lanes[lane];
+    }
+
+    inline bool lane_of(const mask_lanes &mask, std::size_t lane)
+    {
+        return mask[lane];
+    }
+
+    /// A mask of the first `count` lanes.
+    inline mask_lanes first_lanes(std::size_t count)
+    {
+        const real_lanes indices([](auto lane) { return static_cast<real>(lane); });
+        return indices < real_lanes(static_cast<real>(count));
+    }
+#else
+    /// Without SIMD support, each "vector" holds a single real.
+    using real_lanes = real;
+    using mask_lanes = bool;
+
+    inline real_lanes load(const real *source)
+    {
+        return *source;
+    }
+
+    inline void store(real_lanes lanes, real *destination)
+    {
+        *destination = lanes;
+    }
+
+    inline real_lanes select(mask_lanes mask, real_lanes if_true, real_lanes if_false)
+    {
+        return mask ? if_true : if_false;
+    }
+
+    inline bool any_of(mask_lanes mask)
+    {
+        return mask;
+    }
+
+    inline real lane_of(real_lanes lanes, [[maybe_unused]] std::size_t lane)
+    {
+        return lanes;
+    }
+
+    inline bool lane_of(mask_lanes mask, [[maybe_unused]] std::size_t lane)
+    {
+        return mask;
+    }
+
+    inline mask_lanes first_lanes(std::size_t count)
+    {
+        return count > 0;
+    }
+#endif
+
+    /// The number of reals in an rt::simd::real_lanes.
+    constexpr std::size_t lane_count = sizeof(real_lanes) / sizeof(real);
+}
+
+#endif // !RAYTRACER_SIMD_HPP
@@ -0,0 +1,302 @@
+/**
+ * @file socket.hpp
+ * @brief Connecting over TCP to exchange streams of bytes.
+ */
+
+#ifndef RAYTRACER_SOCKET_HPP
+#define RAYTRACER_SOCKET_HPP
+
+#include <fmt/format.h>
+
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/types.h>
+    #include <unistd.h>
+#endif
+
+namespace rt
+{
+    /**
+     * @brief An open TCP socket, either listening for connections or connected to a peer.
+     * @note Only POSIX systems are supported for now. Elsewhere, opening a socket throws.
+     */
+    class socket
+    {
+    public:
+        socket(const socket &) = delete;
+        socket &operator=(const socket &) = delete;
+
+        socket(socket &&other) noexcept
+            : fd_(std::exchange(other.fd_, -1))
+        {
+        }
+
+        socket &operator=(socket &&other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                fd_ = std::exchange(other.fd_, -1);
+            }
+
+            return *this;
+        }
+
+        ~socket()
+        {
+            close();
+        }
+
+        /**
+         * @brief Connects to a listening socket.
+         * @param[in] host The name or address of the host.
+         * @throws std::runtime_error Thrown if the host cannot be resolved or no address of it accepts the connection.
+         */
+        [[nodiscard]]
+        static socket connect(const std::string &host, std::uint16_t port)
+        {
+#ifdef _WIN32
+            throw std::runtime_error(fmt::format("could not connect to {}:{}: sockets are not supported on Windows yet", host, port));
+#else
+            addrinfo hints = { };
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+
+            addrinfo *addresses = nullptr;
+            const std::string service = std::to_string(port);
+            if (const int error = ::getaddrinfo(host.c_str(), service.c_str(), &hints, &addresses); error != 0)
+            {
+                throw std::runtime_error(fmt::format("could not resolve '{}': {}", host, ::gai_strerror(error)));
+            }
+
+            std::optional<socket> connected;
+            int error = 0;
+            for (const addrinfo *address = addresses; address != nullptr && !connected; address = address->ai_next)
+            {
+                socket candidate(::socket(address->ai_family, address->ai_socktype, address->ai_protocol));
+                if (candidate.fd_ >= 0 && ::connect(candidate.fd_, address->ai_addr, address->ai_addrlen) == 0)
+                {
+                    connected = std::move(candidate);
+                }
+                else
+                {
+                    error = errno;
+                }
+            }
+            ::freeaddrinfo(addresses);
+
+            if (!connected)
+            {
+                throw std::runtime_error(fmt::format("could not connect to {}:{}: {}", host, port, std::strerror(error)));
+            }
+
+            connected->disable_delay();
+            return std::move(*connected);
+#endif
+        }
+
+        /**
+         * @brief Listens for connections on every interface.
+         * @throws std::runtime_error Thrown if the port cannot be bound.
+         */
+        [[nodiscard]]
+        static socket listen(std::uint16_t port)
+        {
+#ifdef _WIN32
+            throw std::runtime_error(fmt::format("could not listen on port {}: sockets are not supported on Windows yet", port));
+#else
+            socket listener(::socket(AF_INET6, SOCK_STREAM, 0));
+            if (listener.fd_ < 0)
+            {
+                throw std::runtime_error(fmt::format("could not create a socket: {}", std::strerror(errno)));
+            }
+
+            // Accept IPv4 connections too, and allow restarting on the same port at once.
+            const int no = 0;
+            const int yes = 1;
+            ::setsockopt(listener.fd_, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+            ::setsockopt(listener.fd_, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+
+            sockaddr_in6 address = { };
+            address.sin6_family = AF_INET6;
+            address.sin6_addr = in6addr_any;
+            address.sin6_port = htons(port);
+            if (::bind(listener.fd_, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0
+                || ::listen(listener.fd_, SOMAXCONN) != 0)
+            {
+                throw std::runtime_error(fmt::format("could not listen on port {}: {}", port, std::strerror(errno)));
+            }
+
+            return listener;
+#endif
+        }
+
+        /**
+         * @brief Accepts a pending connection on a listening socket, blocking until there is one.
+         * @return The connection, or std::nullopt if the peer gave up before it was accepted.
+         */
+        [[nodiscard]]
+        std::optional<socket> accept() const
+        {
+#ifndef _WIN32
+            socket connection(::accept(fd_, nullptr, nullptr));
+            if (connection.fd_ >= 0)
+            {
+                connection.disable_delay();
+                return connection;
+            }
+#endif
+            return std::nullopt;
+        }
+
+        /**
+         * @brief Sends every byte of `bytes`, blocking until they are all sent.
+         * @throws std::runtime_error Thrown if the connection fails.
+         */
+        void send(std::span<const std::byte> bytes) const
+        {
+#ifndef _WIN32
+            while (!bytes.empty())
+            {
+                const ssize_t sent = ::send(fd_, bytes.data(), bytes.size(), MSG_NOSIGNAL);
+                if (sent < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (sent <= 0)
+                {
+                    throw std::runtime_error(fmt::format("could not send: {}", std::strerror(errno)));
+                }
+
+                bytes = bytes.subspan(static_cast<std::size_t>(sent));
+            }
+#endif
+        }
+
+        /**
+         * @brief Receives whatever bytes have arrived, blocking until at least one has.
+         * @return The number of bytes received into the start of `buffer`, or 0 if the peer closed the connection.
+         * @throws std::runtime_error Thrown if the connection fails.
+         */
+        std::size_t receive_some(std::span<std::byte> buffer) const
+        {
+#ifndef _WIN32
+            while (true)
+            {
+                const ssize_t received = ::recv(fd_, buffer.data(), buffer.size(), 0);
+                if (received < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+
+                if (received < 0)
+                {
+                    throw std::runtime_error(fmt::format("could not receive: {}", std::strerror(errno)));
+                }
+
+                return static_cast<std::size_t>(received);
+            }
+#else
+            return 0;
+#endif
+        }
+
+        /**
+         * @brief Receives exactly enough bytes to fill `buffer`.
+         * @throws std::runtime_error Thrown if the connection fails or is closed first.
+         */
+        void receive(std::span<std::byte> buffer) const
+        {
+            while (!buffer.empty())
+            {
+                const std::size_t received = receive_some(buffer);
+                if (received == 0)
+                {
+                    throw std::runtime_error("the connection was closed");
+                }
+
+                buffer = buffer.subspan(received);
+            }
+        }
+
+        /**
+         * @brief Waits until any of `sockets` has bytes to receive, a connection to accept, or has been closed, or
+         *        until the timeout passes.
+         * @return Whether each of `sockets` is ready, in the same order.
+         * @throws std::runtime_error Thrown if waiting fails.
+         */
+        [[nodiscard]]
+        static std::vector<bool> wait(std::span<const socket *const> sockets, std::chrono::milliseconds timeout)
+        {
+            std::vector<bool> is_ready(sockets.size(), false);
+#ifndef _WIN32
+            std::vector<pollfd> descriptors;
+            descriptors.reserve(sockets.size());
+            for (const socket *socket : sockets)
+            {
+                descriptors.push_back({ .fd = socket->fd_, .events = POLLIN, .revents = 0 });
+            }
+
+            const int ready = ::poll(descriptors.data(), descriptors.size(), static_cast<int>(timeout.count()));
+            if (ready < 0 && errno != EINTR)
+            {
+                throw std::runtime_error(fmt::format("could not wait for sockets: {}", std::strerror(errno)));
+            }
+
+            for (std::size_t i = 0; i < descriptors.size() && ready > 0; ++i)
+            {
+                is_ready[i] = descriptors[i].revents != 0;
+            }
+#endif
+            return is_ready;
+        }
+
+    private:
+        explicit socket(int fd)
+            : fd_(fd)
+        {
+        }
+
+        /// Sends small messages at once, rather than waiting to coalesce them, since each one is a request.
+        void disable_delay() const
+        {
+#ifndef _WIN32
+            const int yes = 1;
+            ::setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+#endif
+        }
+
+        void close()
+        {
+#ifndef _WIN32
+            if (fd_ >= 0)
+            {
+                ::close(fd_);
+            }
+#endif
+            fd_ = -1;
+        }
+
+    private:
+        int fd_ = -1;
+    };
+}
+
+#endif // !RAYTRACER_SOCKET_HPP
@@ -0,0 +1,426 @@
+/**
+ * @file sphere_bvh.hpp
+ * @brief Intersecting large numbers of spheres stored in flat arrays.
+ */
+
+#ifndef RAYTRACER_SPHERE_BVH_HPP
+#define RAYTRACER_SPHERE_BVH_HPP
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "math.hpp"
+#include "packet.hpp"
+#include "shape.hpp"
+#include "simd.hpp"
+
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+    /**
+     * @brief Finds the nearest root within `[lower, inf)` of the ray-sphere equation for each lane, where each lane
+     *        holds a ray and the offset `oc` from the sphere's center to the ray's origin.
+     * @return The root for each lane, or infinity for lanes that miss.
+     */
+    inline simd::real_lanes intersect_sphere_lanes(
+        simd::real_lanes oc_x,
+        simd::real_lanes oc_y,
+        simd::real_lanes oc_z,
+        simd::real_lanes direction_x,
+        simd::real_lanes direction_y,
+        simd::real_lanes direction_z,
+        simd::real_lanes a,
+        simd::real_lanes inverse_a,
+        simd::real_lanes radius_squared,
+        simd::real_lanes lower
+    )
+    {
+        using simd::real_lanes;
+        using std::max;
+        using std::sqrt;
+
+        const real_lanes zero(real(0.0));
+        const real_lanes no_hit(std::numeric_limits<real>::infinity());
+
+        const real_lanes half_b = direction_x * oc_x + direction_y * oc_y + direction_z * oc_z;
+        const real_lanes c = oc_x * oc_x + oc_y * oc_y + oc_z * oc_z - radius_squared;
+        const real_lanes discriminant = half_b * half_b - a * c;
+        const real_lanes sqrt_discriminant = sqrt(max(discriminant, zero));
+
+        const real_lanes near_root = (-half_b - sqrt_discriminant) * inverse_a;
+        const real_lanes far_root = (-half_b + sqrt_discriminant) * inverse_a;
+        const real_lanes root = simd::select(near_root >= lower, near_root, far_root);
+
+        return simd::select(discriminant > zero && root >= lower, root, no_hit);
+    }
+
+    /**
+     * @brief A sphere in a form that can be written to, and read in place from, a file.
+     */
+    struct packed_sphere
+    {
+        vec3          center;
+        /// The radius of the sphere. A negative radius flips the surface normal.
+        real          radius;
+        /// The index of the sphere's material.
+        std::uint32_t material;
+
+        rt::aabb bounding_box() const
+        {
+            const vec3 half_extent(glm::abs(radius));
+            return rt::aabb {
+                .min = center - half_extent,
+                .max = center + half_extent,
+            };
+        }
+    };
+
+    /**
+     * @brief Spheres in a flat array, intersected through a bounding volume hierarchy over them.
+     *
+     * Unlike an rt::bvh over separate rt::sphere objects, the spheres and the nodes are plain arrays that index each
+     * other, so they can be built once and then borrowed directly from a memory-mapped file.
+     *
+     * The centers and squared radii are also kept as separate arrays in the same order, so that a single ray is
+     * tested against every sphere of a leaf at once, a block of SIMD lanes at a time.
+     */
+    class sphere_bvh : public hittable
+    {
+    public:
+        /**
+         * @brief Builds a hierarchy over spheres, reordering them to match its leaves.
+         * @param[in] spheres The spheres, whose materials index into the scene's material table.
+         * @param[in] memory The memory that the spheres and hierarchy are copied into, such as the arena of the scene,
+         *                   which must outlive the set.
+         */
+        explicit sphere_bvh(
+            std::span<const rt::packed_sphere> spheres,
+            std::pmr::memory_resource *memory = std::pmr::get_default_resource()
+        )
+            : owned_spheres_(memory)
+            , owned_nodes_(memory)
+            , center_x_(memory)
+            , center_y_(memory)
+            , center_z_(memory)
+            , radius_squared_(memory)
+        {
+            std::vector<rt::aabb> bounds;
+            bounds.reserve(spheres.size());
+            for (const rt::packed_sphere &sphere : spheres)
+            {
+                bounds.push_back(sphere.bounding_box());
+            }
+
+            const rt::bvh_builder::result built = rt::bvh_builder::build(bounds);
+            owned_nodes_.assign(built.nodes.begin(), built.nodes.end());
+
+            owned_spheres_.reserve(spheres.size());
+            for (const std::uint32_t index : built.order)
+            {
+                owned_spheres_.push_back(spheres[index]);
+            }
+
+            spheres_ = owned_spheres_;
+            nodes_ = owned_nodes_;
+            make_lanes();
+        }
+
+        /**
+         * @brief Borrows spheres already ordered to match the leaves of a hierarchy, such as from a scene file.
+         * @param[in] memory The memory that the arrays of centers and radii are derived into, which must outlive the
+         *                   set.
+         * @note Every span must outlive the set, and the hierarchy must be valid for the spheres.
+         */
+        explicit sphere_bvh(
+            std::span<const rt::packed_sphere> spheres,
+            std::span<const rt::bvh_node> nodes,
+            std::pmr::memory_resource *memory = std::pmr::get_default_resource()
+        )
+            : owned_spheres_(memory)
+            , owned_nodes_(memory)
+            , spheres_(spheres)
+            , nodes_(nodes)
+            , center_x_(memory)
+            , center_y_(memory)
+            , center_z_(memory)
+            , radius_squared_(memory)
+        {
+            make_lanes();
+        }
+
+        // Copies would point into the storage of the original.
+        sphere_bvh(const sphere_bvh &) = delete;
+        sphere_bvh &operator=(const sphere_bvh &) = delete;
+
+        [[nodiscard]]
+        std::optional<rt::hit_record> intersect(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            const ray_lanes lanes(ray, t_min);
+            std::size_t nearest = spheres_.size();
+            rt::traverse_bvh(nodes_, ray, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, real &t_nearest)
+            {
+                for (std::size_t block = first; block < first + count; block += simd::lane_count)
+                {
+                    const simd::real_lanes t = intersect_block(lanes, block, first + count - block);
+                    if (!simd::any_of(t < simd::real_lanes(t_nearest)))
+                    {
+                        continue;
+                    }
+
+                    for (std::size_t lane = 0; lane < simd::lane_count; ++lane)
+                    {
+                        if (const real candidate = simd::lane_of(t, lane); candidate < t_nearest)
+                        {
+                            t_nearest = candidate;
+                            nearest = block + lane;
+                        }
+                    }
+                }
+            });
+
+            if (nearest == spheres_.size())
+            {
+                return std::nullopt;
+            }
+
+            return make_record(t_max, nearest);
+        }
+
+        /**
+         * @copydoc rt::hittable::intersect_packet
+         * @note Each leaf is tested against several rays of the packet at a time.
+         */
+        void intersect_packet(const rt::ray_packet &packet, real t_min, rt::packet_hits &hits) const override
+        {
+            using simd::real_lanes;
+            using simd::mask_lanes;
+
+            constexpr std::size_t block_count = rt::packet_size / simd::lane_count;
+
+            std::array<real_lanes, block_count> a;
+            std::array<real_lanes, block_count> inverse_a;
+            for (std::size_t block = 0; block < block_count; ++block)
+            {
+                const std::size_t first = block * simd::lane_count;
+                const real_lanes direction_x = simd::load(&packet.direction_x[first]);
+                const real_lanes direction_y = simd::load(&packet.direction_y[first]);
+                const real_lanes direction_z = simd::load(&packet.direction_z[first]);
+                a[block] = direction_x * direction_x + direction_y * direction_y + direction_z * direction_z;
+                inverse_a[block] = real_lanes(real(1.0)) / a[block];
+            }
+
+            std::array<std::size_t, rt::packet_size> nearest;
+            nearest.fill(spheres_.size());
+
+            rt::traverse_bvh_packet(nodes_, packet, t_min, hits, [&](std::uint32_t first_sphere, std::uint32_t count)
+            {
+                for (std::size_t block = 0; block < block_count; ++block)
+                {
+                    const std::size_t first = block * simd::lane_count;
+                    const real_lanes origin_x = simd::load(&packet.origin_x[first]);
+                    const real_lanes origin_y = simd::load(&packet.origin_y[first]);
+                    const real_lanes origin_z = simd::load(&packet.origin_z[first]);
+                    const real_lanes direction_x = simd::load(&packet.direction_x[first]);
+                    const real_lanes direction_y = simd::load(&packet.direction_y[first]);
+                    const real_lanes direction_z = simd::load(&packet.direction_z[first]);
+
+                    real_lanes t_nearest = simd::load(&hits.t_max[first]);
+                    for (std::uint32_t i = first_sphere; i < first_sphere + count; ++i)
+                    {
+                        const rt::packed_sphere &sphere = spheres_[i];
+                        const real_lanes t = rt::intersect_sphere_lanes(
+                            origin_x - real_lanes(sphere.center.x),
+                            origin_y - real_lanes(sphere.center.y),
+                            origin_z - real_lanes(sphere.center.z),
+                            direction_x,
+                            direction_y,
+                            direction_z,
+                            a[block],
+                            inverse_a[block],
+                            real_lanes(sphere.radius * sphere.radius),
+                            real_lanes(t_min)
+                        );
+
+                        const mask_lanes is_nearer = t < t_nearest;
+                        if (!simd::any_of(is_nearer))
+                        {
+                            continue;
+                        }
+
+                        t_nearest = simd::select(is_nearer, t, t_nearest);
+                        for (std::size_t lane = 0; lane < simd::lane_count; ++lane)
+                        {
+                            if (simd::lane_of(is_nearer, lane))
+                            {
+                                nearest[first + lane] = i;
+                            }
+                        }
+                    }
+
+                    simd::store(t_nearest, &hits.t_max[first]);
+                }
+            });
+
+            for (std::size_t ray = 0; ray < packet.count; ++ray)
+            {
+                if (nearest[ray] != spheres_.size())
+                {
+                    hits.hits[ray] = make_record(hits.t_max[ray], nearest[ray]);
+                }
+            }
+        }
+
+        [[nodiscard]]
+        bool occluded(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            const ray_lanes lanes(ray, t_min);
+            bool is_occluded = false;
+            rt::traverse_bvh(nodes_, ray, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, real &t_nearest)
+            {
+                for (std::size_t block = first; block < first + count && !is_occluded; block += simd::lane_count)
+                {
+                    const simd::real_lanes t = intersect_block(lanes, block, first + count - block);
+                    is_occluded = simd::any_of(t < simd::real_lanes(t_nearest));
+                }
+
+                return is_occluded;
+            });
+
+            return is_occluded;
+        }
+
+        [[nodiscard]]
+        rt::hit resolve(const rt::ray &ray, const rt::hit_record &record) const override
+        {
+            const rt::packed_sphere &sphere = spheres_[record.primitive];
+            const vec3 point = ray.at(record.t);
+            const vec3 outward_normal = (point - sphere.center) / sphere.radius;
+
+            return rt::hit(point, outward_normal, sphere.material, ray, record.t);
+        }
+
+        [[nodiscard]]
+        rt::aabb bounding_box() const override
+        {
+            return nodes_.empty() ? rt::aabb() : nodes_.front().bounds;
+        }
+
+        /// The spheres, in the order the leaves of the hierarchy refer to them.
+        std::span<const rt::packed_sphere> spheres() const
+        {
+            return spheres_;
+        }
+
+        /// The flattened nodes of the hierarchy, root first.
+        std::span<const rt::bvh_node> nodes() const
+        {
+            return nodes_;
+        }
+
+    private:
+        /// A single ray, broadcast to every lane.
+        struct ray_lanes
+        {
+            ray_lanes(const rt::ray &ray, real t_min)
+                : origin_x(ray.origin().x)
+                , origin_y(ray.origin().y)
+                , origin_z(ray.origin().z)
+                , direction_x(ray.direction().x)
+                , direction_y(ray.direction().y)
+                , direction_z(ray.direction().z)
+                , a(glm::length2(ray.direction()))
+                , inverse_a(real(1.0) / glm::length2(ray.direction()))
+                , lower(t_min)
+            {
+            }
+
+            simd::real_lanes origin_x;
+            simd::real_lanes origin_y;
+            simd::real_lanes origin_z;
+            simd::real_lanes direction_x;
+            simd::real_lanes direction_y;
+            simd::real_lanes direction_z;
+            simd::real_lanes a;
+            simd::real_lanes inverse_a;
+            simd::real_lanes lower;
+        };
+
+        /**
+         * @brief Tests a ray against the block of spheres starting at `first`, of which only the first `count` belong
+         *        to the leaf being visited.
+         * @return The root for each lane, or infinity for lanes that miss or lie past the leaf.
+         */
+        simd::real_lanes intersect_block(const ray_lanes &ray, std::size_t first, std::size_t count) const
+        {
+            const simd::real_lanes t = rt::intersect_sphere_lanes(
+                ray.origin_x - simd::load(&center_x_[first]),
+                ray.origin_y - simd::load(&center_y_[first]),
+                ray.origin_z - simd::load(&center_z_[first]),
+                ray.direction_x,
+                ray.direction_y,
+                ray.direction_z,
+                ray.a,
+                ray.inverse_a,
+                simd::load(&radius_squared_[first]),
+                ray.lower
+            );
+
+            return simd::select(simd::first_lanes(count), t, simd::real_lanes(std::numeric_limits<real>::infinity()));
+        }
+
+        /// Copies the centers and squared radii into their own arrays, padded with spheres that can never be hit so
+        /// that a whole block of lanes can be loaded from the start of any leaf.
+        void make_lanes()
+        {
+            const std::size_t padded_size = spheres_.size() + simd::lane_count;
+            center_x_.assign(padded_size, real(0.0));
+            center_y_.assign(padded_size, real(0.0));
+            center_z_.assign(padded_size, real(0.0));
+            radius_squared_.assign(padded_size, -std::numeric_limits<real>::infinity());
+
+            for (std::size_t i = 0; i < spheres_.size(); ++i)
+            {
+                center_x_[i] = spheres_[i].center.x;
+                center_y_[i] = spheres_[i].center.y;
+                center_z_[i] = spheres_[i].center.z;
+                radius_squared_[i] = spheres_[i].radius * spheres_[i].radius;
+            }
+        }
+
+        rt::hit_record make_record(real t, std::size_t index) const
+        {
+            return rt::hit_record {
+                .t            = t,
+                .primitive    = static_cast<std::uint32_t>(index),
+                .barycentrics = vec2(),
+                .object       = this,
+            };
+        }
+
+    private:
+        std::pmr::vector<rt::packed_sphere> owned_spheres_;
+        std::pmr::vector<rt::bvh_node>      owned_nodes_;
+        std::span<const rt::packed_sphere>  spheres_;
+        std::span<const rt::bvh_node>       nodes_;
+        std::pmr::vector<real>              center_x_;
+        std::pmr::vector<real>              center_y_;
+        std::pmr::vector<real>              center_z_;
+        std::pmr::vector<real>              radius_squared_;
+    };
+}
+
+#endif // !RAYTRACER_SPHERE_BVH_HPP
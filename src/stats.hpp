@@ -0,0 +1,374 @@
+/**
+ * @file stats.hpp
+ * @brief Counters and timings of the hot paths of a render, for finding out where its time goes.
+ *
+ * Every thread counts into its own rt::stats::counters, so counting needs no synchronization, and the counters of
+ * every thread are merged once the render is done. Statistics are only gathered in builds that define
+ * `RAYTRACER_ENABLE_STATS`; in every other build, each counting function has an empty body and compiles to nothing.
+ */
+
+#ifndef RAYTRACER_STATS_HPP
+#define RAYTRACER_STATS_HPP
+
+#include "isa.hpp"
+#include "math.hpp"
+#include "simd.hpp"
+
+#include <fmt/core.h>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace rt::stats
+{
+#ifdef RAYTRACER_ENABLE_STATS
+    inline constexpr bool enabled = true;
+#else
+    inline constexpr bool enabled = false;
+#endif
+
+    using clock = std::chrono::steady_clock;
+
+    /// The number of depths that paths are counted at. Paths that reach any deeper are counted at the deepest one.
+    inline constexpr std::size_t depth_count = 65;
+
+    /// The names of the alternatives of rt::material, in order, for the report.
+    inline constexpr std::array<std::string_view, 4> material_names = { "lambertian", "metal", "dielectric", "emissive" };
+
+    /**
+     * @brief How long one tile of one pass took to render, and on which thread.
+     */
+    struct tile_timing
+    {
+        std::uint32_t     pass;
+        std::uint32_t     tile;
+        /// The order in which the thread first counted anything, which names it in the trace.
+        std::uint32_t     thread;
+        clock::time_point start;
+        clock::time_point end;
+    };
+
+    /**
+     * @brief Everything counted by one thread, or by every thread once merged.
+     */
+    struct counters
+    {
+        /// Rays leaving the camera.
+        std::uint64_t primary_rays = 0;
+        /// Rays leaving a surface after scattering.
+        std::uint64_t secondary_rays = 0;
+        /// Rays towards a sampled light.
+        std::uint64_t shadow_rays = 0;
+        /// Tests of a ray, or of a packet of rays, against the bounds of a node of a hierarchy.
+        std::uint64_t node_tests = 0;
+        /// Tests of a single ray against a single primitive.
+        std::uint64_t primitive_tests = 0;
+        /// The number of paths that were traced to at least each depth.
+        std::array<std::uint64_t, depth_count> paths_at_depth = { };
+        /// The number of hits on each material that scattered.
+        std::array<std::uint64_t, material_names.size()> scattered = { };
+        /// The number of hits on each material that ended their path.
+        std::array<std::uint64_t, material_names.size()> absorbed = { };
+        std::vector<rt::stats::tile_timing> tiles;
+
+        /// Adds everything counted in `other` to these counters.
+        void merge(const counters &other)
+        {
+            primary_rays    += other.primary_rays;
+            secondary_rays  += other.secondary_rays;
+            shadow_rays     += other.shadow_rays;
+            node_tests      += other.node_tests;
+            primitive_tests += other.primitive_tests;
+            for (std::size_t depth = 0; depth < depth_count; ++depth)
+            {
+                paths_at_depth[depth] += other.paths_at_depth[depth];
+            }
+
+            for (std::size_t material = 0; material < material_names.size(); ++material)
+            {
+                scattered[material] += other.scattered[material];
+                absorbed[material] += other.absorbed[material];
+            }
+
+            tiles.insert(tiles.end(), other.tiles.begin(), other.tiles.end());
+        }
+    };
+
+    namespace detail
+    {
+        /// The counters of every thread that has counted anything, which outlive the threads themselves.
+        struct registry
+        {
+            std::mutex                                         mutex;
+            std::vector<std::unique_ptr<rt::stats::counters>> threads;
+        };
+
+        inline registry &global_registry()
+        {
+            static registry instance;
+            return instance;
+        }
+
+        struct thread_counters
+        {
+            rt::stats::counters *counters;
+            std::uint32_t        thread;
+        };
+
+        inline thread_counters &local()
+        {
+            thread_local thread_counters instance = []
+            {
+                registry &registry = global_registry();
+                const std::scoped_lock lock(registry.mutex);
+                registry.threads.push_back(std::make_unique<rt::stats::counters>());
+                return thread_counters {
+                    .counters = registry.threads.back().get(),
+                    .thread   = static_cast<std::uint32_t>(registry.threads.size() - 1),
+                };
+            }();
+
+            return instance;
+        }
+    }
+
+    /// Adds `count` to one of the counters of the calling thread.
+    inline void add([[maybe_unused]] std::uint64_t counters::*counter, [[maybe_unused]] std::uint64_t count = 1)
+    {
+        if constexpr (enabled)
+        {
+            detail::local().counters->*counter += count;
+        }
+    }
+
+    /// Counts `count` paths as having been traced to `depth`.
+    inline void add_paths_at_depth([[maybe_unused]] std::uint32_t depth, [[maybe_unused]] std::uint64_t count)
+    {
+        if constexpr (enabled)
+        {
+            detail::local().counters->paths_at_depth[std::min<std::size_t>(depth, depth_count - 1)] += count;
+        }
+    }
+
+    /// Counts the outcome of scattering a run of hits on the material with index `material` in rt::material.
+    inline void add_scatter(
+        [[maybe_unused]] std::size_t material,
+        [[maybe_unused]] std::uint64_t scattered,
+        [[maybe_unused]] std::uint64_t absorbed
+    )
+    {
+        if constexpr (enabled)
+        {
+            rt::stats::counters &counters = *detail::local().counters;
+            counters.scattered[material] += scattered;
+            counters.absorbed[material] += absorbed;
+        }
+    }
+
+    /// Records how long a tile took, on the calling thread.
+    inline void add_tile(
+        [[maybe_unused]] std::uint32_t pass,
+        [[maybe_unused]] std::uint32_t tile,
+        [[maybe_unused]] clock::time_point start,
+        [[maybe_unused]] clock::time_point end
+    )
+    {
+        if constexpr (enabled)
+        {
+            detail::thread_counters &local = detail::local();
+            local.counters->tiles.push_back({ .pass = pass, .tile = tile, .thread = local.thread, .start = start, .end = end });
+        }
+    }
+
+    /**
+     * @brief Times a tile from its construction to its destruction, on the calling thread.
+     */
+    class tile_timer
+    {
+    public:
+        tile_timer([[maybe_unused]] std::uint32_t pass, [[maybe_unused]] std::uint32_t tile)
+        {
+            if constexpr (enabled)
+            {
+                pass_ = pass;
+                tile_ = tile;
+                start_ = clock::now();
+            }
+        }
+
+        tile_timer(const tile_timer &) = delete;
+        tile_timer &operator=(const tile_timer &) = delete;
+
+        ~tile_timer()
+        {
+            if constexpr (enabled)
+            {
+                add_tile(pass_, tile_, start_, clock::now());
+            }
+        }
+
+    private:
+        std::uint32_t     pass_ = 0;
+        std::uint32_t     tile_ = 0;
+        clock::time_point start_;
+    };
+
+    /**
+     * @brief Merges the counters of every thread.
+     * @note No thread may be counting while they are merged. Threads of an rt::thread_pool are done with a batch as
+     *       soon as rt::thread_pool::run() returns.
+     */
+    [[nodiscard]]
+    inline counters collect()
+    {
+        counters merged;
+        if constexpr (enabled)
+        {
+            detail::registry &registry = detail::global_registry();
+            const std::scoped_lock lock(registry.mutex);
+            for (const std::unique_ptr<counters> &thread : registry.threads)
+            {
+                merged.merge(*thread);
+            }
+        }
+
+        return merged;
+    }
+
+    /**
+     * @brief Prints a summary of the counters.
+     * @param[in] stats The merged counters.
+     * @param[in] elapsed The wall-clock time of the whole render, for the rates.
+     */
+    inline void print_report(const counters &stats, clock::duration elapsed)
+    {
+        const double seconds = std::max(std::chrono::duration<double>(elapsed).count(), 1.0e-9);
+        const std::uint64_t rays = stats.primary_rays + stats.secondary_rays + stats.shadow_rays;
+        const double per_ray = rays > 0 ? 1.0 / static_cast<double>(rays) : 0.0;
+
+        fmt::print("Statistics:\n");
+        fmt::print(
+            "  Build: {} loops, {}-lane intersection, {}-bit tracing, {}-bit accumulation\n",
+            rt::isa_name(rt::dispatched_isa()),
+            rt::simd::lane_count,
+            sizeof(real) * 8,
+            sizeof(accumulate_real) * 8
+        );
+        fmt::print("  Rays: {} ({:.2f} Mrays/s)\n", rays, static_cast<double>(rays) * 1.0e-6 / seconds);
+        fmt::print("    primary:   {}\n", stats.primary_rays);
+        fmt::print("    secondary: {}\n", stats.secondary_rays);
+        fmt::print("    shadow:    {}\n", stats.shadow_rays);
+        fmt::print("  Node tests: {} ({:.1f} per ray)\n", stats.node_tests, static_cast<double>(stats.node_tests) * per_ray);
+        fmt::print("  Primitive tests: {} ({:.1f} per ray)\n", stats.primitive_tests, static_cast<double>(stats.primitive_tests) * per_ray);
+
+        fmt::print("  Paths reaching each depth:\n");
+        const std::uint64_t paths = stats.paths_at_depth.front();
+        for (std::size_t depth = 0; depth < depth_count && stats.paths_at_depth[depth] > 0; ++depth)
+        {
+            fmt::print(
+                "    {:>2}{} {:>12} ({:6.2f}%)\n",
+                depth,
+                depth + 1 == depth_count ? "+" : ":",
+                stats.paths_at_depth[depth],
+                100.0 * static_cast<double>(stats.paths_at_depth[depth]) / static_cast<double>(paths)
+            );
+        }
+
+        fmt::print("  Scattering:\n");
+        std::uint64_t hits = 0;
+        for (std::size_t material = 0; material < material_names.size(); ++material)
+        {
+            hits += stats.scattered[material] + stats.absorbed[material];
+        }
+
+        for (std::size_t material = 0; material < material_names.size(); ++material)
+        {
+            const std::uint64_t material_hits = stats.scattered[material] + stats.absorbed[material];
+            if (material_hits == 0)
+            {
+                continue;
+            }
+
+            fmt::print(
+                "    {:<10} {:>12} hits ({:6.2f}%), {} scattered, {} absorbed\n",
+                material_names[material],
+                material_hits,
+                100.0 * static_cast<double>(material_hits) / static_cast<double>(hits),
+                stats.scattered[material],
+                stats.absorbed[material]
+            );
+        }
+
+        if (!stats.tiles.empty())
+        {
+            const auto duration = [](const tile_timing &timing) { return timing.end - timing.start; };
+            const auto milliseconds = [](clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); };
+
+            clock::duration total = clock::duration::zero();
+            for (const tile_timing &timing : stats.tiles)
+            {
+                total += duration(timing);
+            }
+
+            const auto [fastest, slowest] = std::ranges::minmax_element(stats.tiles, { }, duration);
+            fmt::print("  Tiles: {} rendered, {:.2f} ms on average\n", stats.tiles.size(), milliseconds(total) / static_cast<double>(stats.tiles.size()));
+            fmt::print("    fastest: tile {} of pass {}, {:.2f} ms\n", fastest->tile, fastest->pass, milliseconds(duration(*fastest)));
+            fmt::print("    slowest: tile {} of pass {}, {:.2f} ms\n", slowest->tile, slowest->pass, milliseconds(duration(*slowest)));
+        }
+    }
+
+    /**
+     * @brief Writes the tile timings as a trace in the Chrome trace event format, which Perfetto and
+     *        `chrome://tracing` can open.
+     *
+     * Every tile is one complete event on the track of the thread that rendered it, timed from the start of the first
+     * tile.
+     *
+     * @throws std::runtime_error Thrown if the file cannot be opened.
+     */
+    inline void write_trace(const std::string &filepath, const counters &stats)
+    {
+        const clock::time_point origin = stats.tiles.empty()
+            ? clock::time_point()
+            : std::ranges::min(stats.tiles, { }, &tile_timing::start).start;
+        const auto microseconds = [](clock::duration duration) { return std::chrono::duration<double, std::micro>(duration).count(); };
+
+        std::ofstream output(filepath);
+        if (!output)
+        {
+            throw std::runtime_error(fmt::format("could not open trace file '{}'", filepath));
+        }
+
+        output << "{\"traceEvents\":[\n";
+        for (std::size_t i = 0; i < stats.tiles.size(); ++i)
+        {
+            const tile_timing &timing = stats.tiles[i];
+            output << fmt::format(
+                "{{\"name\":\"tile {}\",\"cat\":\"pass {}\",\"ph\":\"X\",\"ts\":{:.3f},\"dur\":{:.3f},\"pid\":0,\"tid\":{},"
+                "\"args\":{{\"tile\":{},\"pass\":{}}}}}{}\n",
+                timing.tile,
+                timing.pass,
+                microseconds(timing.start - origin),
+                microseconds(timing.end - timing.start),
+                timing.thread,
+                timing.tile,
+                timing.pass,
+                i + 1 == stats.tiles.size() ? "" : ","
+            );
+        }
+        output << "],\"displayTimeUnit\":\"ms\"}\n";
+    }
+}
+
+#endif // !RAYTRACER_STATS_HPP
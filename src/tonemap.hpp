@@ -0,0 +1,91 @@
+/**
+ * @file tonemap.hpp
+ * @brief Mapping high dynamic range images to displayable 8-bit colors.
+ */
+
+#ifndef RAYTRACER_TONEMAP_HPP
+#define RAYTRACER_TONEMAP_HPP
+
+#include "color.hpp"
+#include "framebuffer.hpp"
+#include "math.hpp"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace rt
+{
+    enum class tonemap_operator
+    {
+        /// Clips every channel to @f$[0, 1]@f$.
+        clamp    = 0,
+        /// Compresses every channel with @f$x / (1 + x)@f$, which never clips.
+        reinhard = 1,
+        /// Krzysztof Narkowicz's fit of the ACES filmic curve, which rolls off highlights and adds contrast.
+        aces     = 2,
+    };
+
+    struct tonemap_parameters
+    {
+        /// The curve that maps linear values into @f$[0, 1]@f$.
+        rt::tonemap_operator op = rt::tonemap_operator::clamp;
+        /// The number of stops that linear values are scaled by before the curve.
+        real                 exposure = real(0.0);
+        /// The gamma that values are encoded with after the curve. 1 leaves them linear.
+        real                 gamma = real(1.0);
+    };
+
+    /// Applies a tonemapping curve to a single linear color.
+    inline vec3 tonemap(vec3 color, rt::tonemap_operator op)
+    {
+        switch (op)
+        {
+        case rt::tonemap_operator::clamp:
+            return glm::clamp(color, vec3(real(0.0)), vec3(real(1.0)));
+        case rt::tonemap_operator::reinhard:
+            color = glm::max(color, vec3(real(0.0)));
+            return color / (vec3(real(1.0)) + color);
+        case rt::tonemap_operator::aces:
+            color = glm::max(color, vec3(real(0.0)));
+            return glm::clamp(
+                (color * (real(2.51) * color + real(0.03))) / (color * (real(2.43) * color + real(0.59)) + real(0.14)),
+                vec3(real(0.0)),
+                vec3(real(1.0))
+            );
+        }
+
+        return color;
+    }
+
+    /**
+     * @brief Converts the color of an image to 8-bit RGBA, as a post-process separate from rendering.
+     * @return The bytes of every pixel, in row-major order from the top-left.
+     */
+    inline std::vector<std::uint8_t> tonemap(const rt::framebuffer &image, const rt::tonemap_parameters &parameters)
+    {
+        const real scale = std::exp2(parameters.exposure);
+        const real inverse_gamma = real(1.0) / parameters.gamma;
+
+        std::vector<std::uint8_t> bytes;
+        bytes.reserve(image.color().size() * 4);
+        for (const glm::vec4 &pixel : image.color())
+        {
+            vec3 color = rt::tonemap(scale * vec3(pixel), parameters.op);
+            if (parameters.gamma != real(1.0))
+            {
+                color = glm::pow(color, vec3(inverse_gamma));
+            }
+
+            const std::array rgba = to_rgba(color);
+            bytes.insert(bytes.end(), rgba.begin(), rgba.end());
+        }
+
+        return bytes;
+    }
+}
+
+#endif // !RAYTRACER_TONEMAP_HPP
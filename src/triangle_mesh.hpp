@@ -0,0 +1,379 @@
+/**
+ * @file triangle_mesh.hpp
+ * @brief Intersecting meshes of triangles that share indexed vertex buffers.
+ */
+
+#ifndef RAYTRACER_TRIANGLE_MESH_HPP
+#define RAYTRACER_TRIANGLE_MESH_HPP
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "math.hpp"
+#include "packet.hpp"
+#include "shape.hpp"
+#include "simd.hpp"
+
+#include <fmt/format.h>
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+    /// The indices of the three vertices of a triangle, in counter-clockwise order seen from its front.
+    using triangle_indices = std::array<std::uint32_t, 3>;
+
+    /**
+     * @brief The vertex buffers and triangles of a mesh, as read from a file.
+     */
+    struct mesh_data
+    {
+        std::vector<vec3>                  positions;
+        /// The shading normals, if the mesh has any. They need not be normalized.
+        std::vector<vec3>                  normals;
+        /// The triangles, as indices into `positions`.
+        std::vector<rt::triangle_indices>  triangles;
+        /// If not empty, the triangles again as indices into `normals`, one for each triangle in `triangles`.
+        std::vector<rt::triangle_indices>  normal_triangles;
+    };
+
+    /**
+     * @brief A mesh of triangles intersected through its own bounding volume hierarchy.
+     *
+     * Vertices are stored once and shared between triangles by index, so a closed mesh costs about 12 bytes of indices
+     * per triangle, half a vertex, and its share of the hierarchy. Triangles are intersected with the watertight
+     * algorithm of Woop, Benthin and Wald, which never lets a ray slip through the shared edge of two triangles, and
+     * every leaf is tested against a ray several triangles at a time.
+     */
+    class triangle_mesh : public hittable
+    {
+    public:
+        /**
+         * @brief Builds a hierarchy over the triangles of a mesh, reordering them to match its leaves.
+         * @param[in] mesh The mesh.
+         * @param[in] material The index of the material of every triangle.
+         * @param[in] memory The memory that the vertices, triangles and hierarchy are copied into, such as the arena of
+         *                   the scene, which must outlive the mesh.
+         * @throws std::runtime_error Thrown if a triangle refers to a vertex that does not exist.
+         */
+        explicit triangle_mesh(
+            const rt::mesh_data &mesh,
+            std::uint32_t material,
+            std::pmr::memory_resource *memory = std::pmr::get_default_resource()
+        )
+            : positions_(memory)
+            , normals_(memory)
+            , triangles_(memory)
+            , normal_triangles_(memory)
+            , nodes_(memory)
+            , material_(material)
+        {
+            validate(mesh.triangles, mesh.positions.size(), "vertex");
+            if (!mesh.normal_triangles.empty())
+            {
+                if (mesh.normal_triangles.size() != mesh.triangles.size())
+                {
+                    throw std::runtime_error("a mesh must give normals for every triangle or for none");
+                }
+
+                validate(mesh.normal_triangles, mesh.normals.size(), "normal");
+                normals_.assign(mesh.normals.begin(), mesh.normals.end());
+            }
+
+            positions_.assign(mesh.positions.begin(), mesh.positions.end());
+
+            std::vector<rt::aabb> bounds;
+            bounds.reserve(mesh.triangles.size());
+            for (const rt::triangle_indices &triangle : mesh.triangles)
+            {
+                rt::aabb triangle_bounds;
+                for (const std::uint32_t vertex : triangle)
+                {
+                    triangle_bounds.expand(positions_[vertex]);
+                }
+
+                bounds.push_back(triangle_bounds);
+            }
+
+            const rt::bvh_builder::result built = rt::bvh_builder::build(bounds);
+            nodes_.assign(built.nodes.begin(), built.nodes.end());
+
+            triangles_.reserve(mesh.triangles.size());
+            normal_triangles_.reserve(mesh.normal_triangles.size());
+            for (const std::uint32_t index : built.order)
+            {
+                triangles_.push_back(mesh.triangles[index]);
+                if (!mesh.normal_triangles.empty())
+                {
+                    normal_triangles_.push_back(mesh.normal_triangles[index]);
+                }
+            }
+        }
+
+        [[nodiscard]]
+        std::optional<rt::hit_record> intersect(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            const sheared_ray sheared(ray);
+
+            std::optional<rt::hit_record> nearest;
+            rt::traverse_bvh(nodes_, ray, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, real &t_nearest)
+            {
+                intersect_leaf(sheared, first, count, t_min, t_nearest, nearest);
+            });
+
+            return nearest;
+        }
+
+        /**
+         * @copydoc rt::hittable::intersect_packet
+         * @note The packet shares one traversal, and each leaf it reaches is tested against every ray in turn.
+         */
+        void intersect_packet(const rt::ray_packet &packet, real t_min, rt::packet_hits &hits) const override
+        {
+            std::array<sheared_ray, rt::packet_size> rays;
+            for (std::size_t ray = 0; ray < packet.count; ++ray)
+            {
+                rays[ray] = sheared_ray(packet[ray]);
+            }
+
+            rt::traverse_bvh_packet(nodes_, packet, t_min, hits, [&](std::uint32_t first, std::uint32_t count)
+            {
+                for (std::size_t ray = 0; ray < packet.count; ++ray)
+                {
+                    intersect_leaf(rays[ray], first, count, t_min, hits.t_max[ray], hits.hits[ray]);
+                }
+            });
+        }
+
+        [[nodiscard]]
+        bool occluded(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            const sheared_ray sheared(ray);
+
+            std::optional<rt::hit_record> found;
+            rt::traverse_bvh(nodes_, ray, t_min, t_max, [&](std::uint32_t first, std::uint32_t count, real &t_nearest)
+            {
+                intersect_leaf(sheared, first, count, t_min, t_nearest, found);
+                return found.has_value();
+            });
+
+            return found.has_value();
+        }
+
+        [[nodiscard]]
+        rt::hit resolve(const rt::ray &ray, const rt::hit_record &record) const override
+        {
+            const rt::triangle_indices &triangle = triangles_[record.primitive];
+            const vec3 p0 = positions_[triangle[0]];
+            const vec3 p1 = positions_[triangle[1]];
+            const vec3 p2 = positions_[triangle[2]];
+            const vec3 geometric_normal = glm::cross(p1 - p0, p2 - p0);
+
+            vec3 normal = glm::normalize(geometric_normal);
+            if (!normal_triangles_.empty())
+            {
+                const rt::triangle_indices &normal_triangle = normal_triangles_[record.primitive];
+                const vec2 weights = record.barycentrics;
+                const vec3 shading_normal = (real(1.0) - weights.x - weights.y) * normals_[normal_triangle[0]]
+                    + weights.x * normals_[normal_triangle[1]]
+                    + weights.y * normals_[normal_triangle[2]];
+
+                // Keep the shading normal on the side that the winding of the triangle faces.
+                if (glm::length2(shading_normal) > real(0.0))
+                {
+                    normal = glm::normalize(shading_normal);
+                    if (glm::dot(normal, geometric_normal) < real(0.0))
+                    {
+                        normal = -normal;
+                    }
+                }
+            }
+
+            return rt::hit(ray.at(record.t), normal, material_, ray, record.t);
+        }
+
+        [[nodiscard]]
+        rt::aabb bounding_box() const override
+        {
+            return nodes_.empty() ? rt::aabb() : nodes_.front().bounds;
+        }
+
+        /// The number of triangles in the mesh.
+        std::size_t triangle_count() const
+        {
+            return triangles_.size();
+        }
+
+        /// The flattened nodes of the hierarchy, root first.
+        std::span<const rt::bvh_node> nodes() const
+        {
+            return nodes_;
+        }
+
+        /// The number of bytes of geometry and hierarchy the mesh holds.
+        std::size_t memory_size() const
+        {
+            return std::span(positions_).size_bytes()
+                + std::span(normals_).size_bytes()
+                + std::span(triangles_).size_bytes()
+                + std::span(normal_triangles_).size_bytes()
+                + std::span(nodes_).size_bytes();
+        }
+
+    private:
+        /**
+         * @brief A ray transformed so that it points along +z, which reduces every triangle test to a 2D edge test.
+         *
+         * The axis along which the direction is largest becomes z, and the other two are sheared so that the direction
+         * becomes (0, 0, 1). Swapping x and y when that direction is negative preserves the winding of triangles.
+         */
+        struct sheared_ray
+        {
+            vec3               origin;
+            std::array<int, 3> axes;
+            vec3               shear;
+
+            sheared_ray() = default;
+
+            explicit sheared_ray(const rt::ray &ray)
+                : origin(ray.origin())
+            {
+                const vec3 direction = ray.direction();
+                const vec3 magnitude = glm::abs(direction);
+                const int z = magnitude.x > magnitude.y
+                    ? (magnitude.x > magnitude.z ? 0 : 2)
+                    : (magnitude.y > magnitude.z ? 1 : 2);
+                int x = (z + 1) % 3;
+                int y = (x + 1) % 3;
+                if (direction[z] < real(0.0))
+                {
+                    std::swap(x, y);
+                }
+
+                axes = { x, y, z };
+                shear = vec3(direction[x] / direction[z], direction[y] / direction[z], real(1.0) / direction[z]);
+            }
+        };
+
+        /**
+         * @brief Intersects a ray with the triangles of a leaf, keeping the nearest hit within `[t_min, t_nearest]`.
+         * @param[in,out] t_nearest The upper bound of the interval, lowered to the distance of any nearer hit.
+         * @param[in,out] nearest The nearest hit found so far, replaced by any nearer hit in the leaf.
+         */
+        void intersect_leaf(
+            const sheared_ray &ray,
+            std::uint32_t first,
+            std::uint32_t count,
+            real t_min,
+            real &t_nearest,
+            std::optional<rt::hit_record> &nearest
+        ) const
+        {
+            using simd::real_lanes;
+            using simd::mask_lanes;
+
+            constexpr std::size_t lane_count = simd::lane_count;
+            const auto [kx, ky, kz] = ray.axes;
+
+            for (std::uint32_t block = first; block < first + count; block += lane_count)
+            {
+                // Unused lanes keep every vertex at the origin, whose zero determinant never counts as a hit.
+                std::array<std::array<real, lane_count>, 9> vertices = { };
+                const std::size_t lanes = std::min<std::size_t>(lane_count, first + count - block);
+                for (std::size_t lane = 0; lane < lanes; ++lane)
+                {
+                    const rt::triangle_indices &triangle = triangles_[block + lane];
+                    for (std::size_t corner = 0; corner < 3; ++corner)
+                    {
+                        const vec3 position = positions_[triangle[corner]] - ray.origin;
+                        vertices[3 * corner + 0][lane] = position[kx];
+                        vertices[3 * corner + 1][lane] = position[ky];
+                        vertices[3 * corner + 2][lane] = position[kz];
+                    }
+                }
+
+                const real_lanes shear_x(ray.shear.x);
+                const real_lanes shear_y(ray.shear.y);
+                const real_lanes shear_z(ray.shear.z);
+
+                const real_lanes a_z = simd::load(vertices[2].data());
+                const real_lanes b_z = simd::load(vertices[5].data());
+                const real_lanes c_z = simd::load(vertices[8].data());
+                const real_lanes a_x = simd::load(vertices[0].data()) - shear_x * a_z;
+                const real_lanes a_y = simd::load(vertices[1].data()) - shear_y * a_z;
+                const real_lanes b_x = simd::load(vertices[3].data()) - shear_x * b_z;
+                const real_lanes b_y = simd::load(vertices[4].data()) - shear_y * b_z;
+                const real_lanes c_x = simd::load(vertices[6].data()) - shear_x * c_z;
+                const real_lanes c_y = simd::load(vertices[7].data()) - shear_y * c_z;
+
+                // Scaled barycentric coordinates, each the signed area opposite one vertex in the sheared plane.
+                const real_lanes u = c_x * b_y - c_y * b_x;
+                const real_lanes v = a_x * c_y - a_y * c_x;
+                const real_lanes w = b_x * a_y - b_y * a_x;
+
+                const real_lanes zero(real(0.0));
+                const mask_lanes is_inside = (u >= zero && v >= zero && w >= zero) || (u <= zero && v <= zero && w <= zero);
+                const real_lanes determinant = u + v + w;
+                const real_lanes t = (u * (shear_z * a_z) + v * (shear_z * b_z) + w * (shear_z * c_z)) / determinant;
+                const mask_lanes is_hit = is_inside && determinant != zero && t >= real_lanes(t_min) && t <= real_lanes(t_nearest);
+                if (!simd::any_of(is_hit))
+                {
+                    continue;
+                }
+
+                for (std::size_t lane = 0; lane < lanes; ++lane)
+                {
+                    const real lane_t = simd::lane_of(t, lane);
+                    if (simd::lane_of(is_hit, lane) && lane_t <= t_nearest)
+                    {
+                        t_nearest = lane_t;
+                        const real inverse_determinant = real(1.0) / simd::lane_of(determinant, lane);
+                        nearest = rt::hit_record {
+                            .t            = lane_t,
+                            .primitive    = static_cast<std::uint32_t>(block + lane),
+                            .barycentrics = vec2(simd::lane_of(v, lane), simd::lane_of(w, lane)) * inverse_determinant,
+                            .object       = this,
+                        };
+                    }
+                }
+            }
+        }
+
+        static void validate(std::span<const rt::triangle_indices> triangles, std::size_t vertex_count, const char *what)
+        {
+            for (const rt::triangle_indices &triangle : triangles)
+            {
+                for (const std::uint32_t vertex : triangle)
+                {
+                    if (vertex >= vertex_count)
+                    {
+                        throw std::runtime_error(fmt::format(
+                            "a triangle refers to {} {}, but the mesh only has {}", what, vertex, vertex_count
+                        ));
+                    }
+                }
+            }
+        }
+
+    private:
+        std::pmr::vector<vec3>                 positions_;
+        std::pmr::vector<vec3>                 normals_;
+        std::pmr::vector<rt::triangle_indices> triangles_;
+        std::pmr::vector<rt::triangle_indices> normal_triangles_;
+        std::pmr::vector<rt::bvh_node>         nodes_;
+        std::uint32_t                          material_;
+    };
+}
+
+#endif // !RAYTRACER_TRIANGLE_MESH_HPP
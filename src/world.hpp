@@ -0,0 +1,103 @@
+/**
+ * @file world.hpp
+ * @brief The collection of every object in a scene.
+ */
+
+#ifndef RAYTRACER_WORLD_HPP
+#define RAYTRACER_WORLD_HPP
+
+#include "aabb.hpp"
+#include "bvh.hpp"
+#include "camera.hpp"
+#include "math.hpp"
+#include "packet.hpp"
+#include "shape.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace rt
+{
+    class world : public hittable
+    {
+    public:
+        /// The number of objects at which the world starts building an rt::bvh over them instead of testing each one.
+        static constexpr std::size_t bvh_threshold = 8;
+
+        /**
+         * @param[in] objects Every object in the scene.
+         * @param[in] memory The memory that the hierarchy over the objects is allocated from, which must outlive the
+         *                   world.
+         */
+        explicit world(
+            std::vector<std::unique_ptr<hittable>> objects,
+            std::pmr::memory_resource *memory = std::pmr::get_default_resource()
+        )
+        {
+            if (objects.size() >= bvh_threshold)
+            {
+                objects_.push_back(std::make_unique<rt::bvh>(std::move(objects), memory));
+            }
+            else
+            {
+                objects_ = std::move(objects);
+            }
+        }
+
+        [[nodiscard]]
+        std::optional<rt::hit_record> intersect(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            std::optional<rt::hit_record> nearest;
+
+            real t_nearest = t_max;
+            for (const auto &object : objects_)
+            {
+                if (const std::optional record = object->intersect(ray, t_min, t_nearest))
+                {
+                    nearest = record;
+                    t_nearest = record->t;
+                }
+            }
+
+            return nearest;
+        }
+
+        void intersect_packet(const rt::ray_packet &packet, real t_min, rt::packet_hits &hits) const override
+        {
+            for (const auto &object : objects_)
+            {
+                object->intersect_packet(packet, t_min, hits);
+            }
+        }
+
+        [[nodiscard]]
+        bool occluded(const rt::ray &ray, real t_min, real t_max) const override
+        {
+            return std::ranges::any_of(objects_, [&](const auto &object)
+            {
+                return object->occluded(ray, t_min, t_max);
+            });
+        }
+
+        [[nodiscard]]
+        rt::aabb bounding_box() const override
+        {
+            rt::aabb bounds;
+            for (const auto &object : objects_)
+            {
+                bounds.expand(object->bounding_box());
+            }
+
+            return bounds;
+        }
+
+    private:
+        std::vector<std::unique_ptr<hittable>> objects_;
+    };
+}
+
+#endif // !RAYTRACER_WORLD_HPP